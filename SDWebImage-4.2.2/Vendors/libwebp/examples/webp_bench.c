@@ -0,0 +1,1578 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the COPYING file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS. All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+// -----------------------------------------------------------------------------
+//
+//  Benchmark harness for the codec and the dsp kernels.
+//
+//  A deterministic synthetic corpus (photo-like, graphic, alpha and animated
+//  content) is generated in memory, so that runs are comparable across
+//  machines and commits without any input file. Two sets of measurements are
+//  reported:
+//   * codec: throughput (MP/s) and peak memory of WebPEncode() (methods 0-6,
+//     lossy and lossless), WebPDecode(), WebPAnimEncoder and WebPAnimDecoder.
+//   * dsp: the cost of each dispatched function pointer of dsp.h and
+//     lossless.h, once per CPU feature level available on this machine, and
+//     the cost of a -m 6 lossy encoding at each of these levels, together
+//     with a check that they all produce the same bitstream. Levels that do
+//     not change any dispatched function (e.g. not compiled in) are skipped,
+//     and so are the kernels that a level leaves unchanged.
+//
+//  Usage: webp_bench [options]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <sys/resource.h>
+#include <sys/time.h>
+#endif
+
+#include "webp/decode.h"
+#include "webp/demux.h"
+#include "webp/encode.h"
+#include "webp/mux.h"
+#include "../src/dsp/dsp.h"
+#include "../src/dsp/lossless.h"
+#include "../src/enc/cost_enc.h"
+#include "../src/enc/histogram_enc.h"
+#include "../src/enc/vp8i_enc.h"
+#include "../src/utils/rescaler_utils.h"
+#include "../src/utils/utils.h"
+
+//------------------------------------------------------------------------------
+// Timing and memory
+
+static double GetTime(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / freq.QuadPart;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+
+#if defined(__linux__)
+// Returns the value of the 'key' entry of /proc/self/status, in bytes.
+static size_t ReadProcStatus(const char* const key) {
+  const size_t len = strlen(key);
+  size_t kb = 0;
+  char line[256];
+  FILE* const file = fopen("/proc/self/status", "r");
+  if (file == NULL) return 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (!strncmp(line, key, len)) {
+      kb = (size_t)strtoul(line + len, NULL, 10);
+      break;
+    }
+  }
+  fclose(file);
+  return kb * 1024;
+}
+#endif
+
+static size_t peak_memory_base = 0;
+
+// Starts a new peak-memory measurement. On Linux the high-water mark of the
+// resident set size is reset, so that only the memory used from now on is
+// accounted. Elsewhere, the peak of the whole process is used.
+static void ResetPeakMemory(void) {
+#if defined(__linux__)
+  FILE* file;
+#if defined(__GLIBC__)
+  malloc_trim(0);   // so that memory freed by the previous test is not reused
+#endif
+  file = fopen("/proc/self/clear_refs", "w");
+  if (file != NULL) {
+    fputs("5", file);
+    fclose(file);
+  }
+  peak_memory_base = ReadProcStatus("VmRSS:");
+#else
+  peak_memory_base = 0;
+#endif
+}
+
+// Returns the peak memory used since the last call to ResetPeakMemory(), in
+// bytes, or 0 if unknown (Windows).
+static size_t GetPeakMemory(void) {
+  size_t peak = 0;
+#if defined(__linux__)
+  peak = ReadProcStatus("VmHWM:");
+#elif !defined(_WIN32)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+    peak = (size_t)usage.ru_maxrss;           // in bytes
+#else
+    peak = (size_t)usage.ru_maxrss * 1024;    // in kilobytes
+#endif
+  }
+#endif
+  return (peak > peak_memory_base) ? peak - peak_memory_base : 0;
+}
+
+//------------------------------------------------------------------------------
+// Synthetic corpus
+
+typedef enum {
+  CONTENT_PHOTO = 0,   // smooth gradients, textures and noise, opaque
+  CONTENT_GRAPHIC,     // flat areas, sharp edges and few colors, opaque
+  CONTENT_ALPHA        // photo with a soft-edged and partly transparent alpha
+} ContentType;
+
+static uint32_t bench_seed = 0;
+
+static void SetSeed(uint32_t seed) { bench_seed = seed; }
+
+static uint32_t Rand(void) {
+  bench_seed = bench_seed * 1103515245u + 12345u;
+  return (bench_seed >> 8) & 0xffffff;
+}
+
+static int Clip8(int v) { return (v < 0) ? 0 : (v > 255) ? 255 : v; }
+
+#define NOISE_CELL 32    // spacing of the value-noise lattice, in pixels
+
+// Smooth value noise in [0, 255], bilinearly interpolated from a random
+// lattice of 'lattice_w' x 'lattice_h' nodes.
+static int ValueNoise(const uint8_t* const lattice, int lattice_w,
+                      int x, int y, int cell) {
+  const int cx = x / cell, cy = y / cell;
+  const int fx = x % cell, fy = y % cell;
+  const uint8_t* const l0 = lattice + cy * lattice_w + cx;
+  const uint8_t* const l1 = l0 + lattice_w;
+  const int top = l0[0] * (cell - fx) + l0[1] * fx;
+  const int bottom = l1[0] * (cell - fx) + l1[1] * fx;
+  return (top * (cell - fy) + bottom * fy) / (cell * cell);
+}
+
+static void MakePhoto(int width, int height, int with_alpha, uint8_t* rgba) {
+  const int lattice_w = width / (NOISE_CELL / 4) + 2;
+  const int lattice_h = height / (NOISE_CELL / 4) + 2;
+  uint8_t* const lattice =
+      (uint8_t*)malloc(3 * lattice_w * lattice_h * sizeof(*lattice));
+  const int cx = width / 2, cy = height / 2;
+  const int r2 = (cx * cx + cy * cy) * 2 / 5 + 1;
+  int x, y, i;
+  if (lattice == NULL) return;
+  for (i = 0; i < 3 * lattice_w * lattice_h; ++i) lattice[i] = Rand() & 0xff;
+  for (y = 0; y < height; ++y) {
+    for (x = 0; x < width; ++x) {
+      uint8_t* const dst = rgba + 4 * (y * width + x);
+      // two octaves of noise per channel, on top of a diagonal gradient
+      for (i = 0; i < 3; ++i) {
+        const uint8_t* const l = lattice + i * lattice_w * lattice_h;
+        const int coarse = ValueNoise(l, lattice_w, x, y, NOISE_CELL);
+        const int fine = ValueNoise(l, lattice_w, x, y, NOISE_CELL / 4);
+        const int ramp = (x + y) * 64 / (width + height);
+        const int grain = (int)(Rand() & 7) - 4;
+        dst[i] = Clip8((coarse * 3 + fine) / 4 + ramp - 32 + grain);
+      }
+      if (with_alpha) {
+        const int dx = x - cx, dy = y - cy;
+        dst[3] = Clip8(255 * 2 - (dx * dx + dy * dy) * 255 * 2 / r2);
+      } else {
+        dst[3] = 0xff;
+      }
+    }
+  }
+  free(lattice);
+}
+
+static void FillRect(uint8_t* rgba, int width, int height,
+                     int x0, int y0, int w, int h, uint32_t color) {
+  int x, y;
+  if (x0 < 0) { w += x0; x0 = 0; }
+  if (y0 < 0) { h += y0; y0 = 0; }
+  if (x0 + w > width) w = width - x0;
+  if (y0 + h > height) h = height - y0;
+  for (y = y0; y < y0 + h; ++y) {
+    for (x = x0; x < x0 + w; ++x) {
+      uint8_t* const dst = rgba + 4 * (y * width + x);
+      dst[0] = (color >> 16) & 0xff;
+      dst[1] = (color >>  8) & 0xff;
+      dst[2] = (color >>  0) & 0xff;
+      dst[3] = 0xff;
+    }
+  }
+}
+
+#define GRAPHIC_COLORS 24
+
+static void MakeGraphic(int width, int height, uint8_t* rgba) {
+  uint32_t palette[GRAPHIC_COLORS];
+  int i, x, y;
+  for (i = 0; i < GRAPHIC_COLORS; ++i) palette[i] = Rand();
+  FillRect(rgba, width, height, 0, 0, width, height, 0xf4f4f0u);
+  // panels
+  for (i = 0; i < 12; ++i) {
+    const int w = 16 + Rand() % (width / 3 + 1);
+    const int h = 16 + Rand() % (height / 3 + 1);
+    FillRect(rgba, width, height, Rand() % width, Rand() % height, w, h,
+             palette[Rand() % GRAPHIC_COLORS]);
+  }
+  // lines of 'text': small glyph-like strokes on a regular baseline grid
+  for (y = 8; y + 10 < height; y += 14) {
+    const uint32_t ink = palette[Rand() % 4];
+    for (x = 8; x + 8 < width; x += 7) {
+      const uint32_t bits = Rand();
+      if ((bits & 15) == 0) { x += 7; continue; }   // word break
+      FillRect(rgba, width, height, x, y + (bits >> 4) % 3, 1 + (bits >> 6) % 4,
+               2 + (bits >> 8) % 7, ink);
+      FillRect(rgba, width, height, x + (bits >> 11) % 3, y + 8, 4, 1, ink);
+    }
+  }
+}
+
+static uint8_t* NewPicture(ContentType type, int width, int height) {
+  uint8_t* const rgba = (uint8_t*)malloc(4 * width * height);
+  if (rgba == NULL) return NULL;
+  SetSeed(0x57454250u + (uint32_t)type);
+  if (type == CONTENT_GRAPHIC) {
+    MakeGraphic(width, height, rgba);
+  } else {
+    MakePhoto(width, height, (type == CONTENT_ALPHA), rgba);
+  }
+  return rgba;
+}
+
+// Animation: a graphic background with a photo-like sprite moving across it,
+// and a blinking status area.
+static uint8_t* NewAnimation(int width, int height, int num_frames) {
+  const size_t frame_size = 4 * (size_t)width * height;
+  const int sprite_w = width / 4 + 1, sprite_h = height / 4 + 1;
+  uint8_t* frames = (uint8_t*)malloc(num_frames * frame_size);
+  uint8_t* const background = NewPicture(CONTENT_GRAPHIC, width, height);
+  uint8_t* const sprite = NewPicture(CONTENT_PHOTO, sprite_w, sprite_h);
+  int n, y;
+  if (frames == NULL || background == NULL || sprite == NULL) {
+    free(frames);
+    frames = NULL;
+  } else {
+    for (n = 0; n < num_frames; ++n) {
+      uint8_t* const frame = frames + n * frame_size;
+      const int x0 = n * (width - sprite_w) / (num_frames > 1 ? num_frames - 1
+                                                                : 1);
+      const int y0 = (height - sprite_h) / 2 + ((n & 1) ? 4 : -4);
+      memcpy(frame, background, frame_size);
+      for (y = 0; y < sprite_h; ++y) {
+        memcpy(frame + 4 * ((y0 + y) * width + x0),
+               sprite + 4 * y * sprite_w, 4 * sprite_w);
+      }
+      if (n & 2) {
+        FillRect(frame, width, height, 4, 4, width / 8, 6, 0xd02020u);
+      }
+    }
+  }
+  free(background);
+  free(sprite);
+  return frames;
+}
+
+//------------------------------------------------------------------------------
+// Codec benchmarks
+
+typedef int (*BenchFunc)(void* arg);
+
+typedef struct {
+  double time;        // average time per call, in seconds
+  size_t peak_mem;    // peak memory during the calls, in bytes
+} BenchResult;
+
+// Calls 'func' repeatedly for at least 'min_time' seconds.
+// Returns false if any call failed.
+static int RunBench(BenchFunc func, void* arg, double min_time,
+                    BenchResult* const result) {
+  int count = 0;
+  double start, elapsed;
+  ResetPeakMemory();
+  start = GetTime();
+  do {
+    if (!func(arg)) return 0;
+    ++count;
+    elapsed = GetTime() - start;
+  } while (elapsed < min_time);
+  result->time = elapsed / count;
+  result->peak_mem = GetPeakMemory();
+  return 1;
+}
+
+static void PrintResult(const char* const name, double mpixels,
+                        const BenchResult* const result, size_t size) {
+  printf("%-34s %8.2f %9.2f", name, mpixels / result->time,
+         1000. * result->time);
+  if (size > 0) {
+    printf(" %9d %6.3f", (int)size, 8. * size / (mpixels * 1e6));
+  } else {
+    printf(" %9s %6s", "-", "-");
+  }
+#if defined(_WIN32)
+  printf(" %8s\n", "n/a");
+#else
+  printf(" %8.2f\n", result->peak_mem / (1024. * 1024.));
+#endif
+}
+
+typedef struct {
+  const uint8_t* rgba;
+  int width, height;
+  WebPConfig config;
+  WebPMemoryWriter writer;    // output of the last call
+} EncodeArgs;
+
+static int Encode(void* arg) {
+  EncodeArgs* const args = (EncodeArgs*)arg;
+  WebPPicture pic;
+  int ok;
+  if (!WebPPictureInit(&pic)) return 0;
+  WebPMemoryWriterClear(&args->writer);
+  pic.width = args->width;
+  pic.height = args->height;
+  pic.use_argb = args->config.lossless;
+  pic.writer = WebPMemoryWrite;
+  pic.custom_ptr = &args->writer;
+  ok = WebPPictureImportRGBA(&pic, args->rgba, 4 * args->width) &&
+       WebPEncode(&args->config, &pic);
+  WebPPictureFree(&pic);
+  return ok;
+}
+
+typedef struct {
+  const uint8_t* data;
+  size_t data_size;
+  int use_threads;
+} DecodeArgs;
+
+static int Decode(void* arg) {
+  const DecodeArgs* const args = (const DecodeArgs*)arg;
+  WebPDecoderConfig config;
+  int ok;
+  if (!WebPInitDecoderConfig(&config)) return 0;
+  config.output.colorspace = MODE_RGBA;
+  config.options.use_threads = args->use_threads;
+  ok = (WebPDecode(args->data, args->data_size, &config) == VP8_STATUS_OK);
+  WebPFreeDecBuffer(&config.output);
+  return ok;
+}
+
+typedef struct {
+  const uint8_t* frames;
+  int width, height, num_frames;
+  WebPConfig config;
+  WebPData webp;              // output of the last call
+} AnimEncodeArgs;
+
+static int AnimEncode(void* arg) {
+  AnimEncodeArgs* const args = (AnimEncodeArgs*)arg;
+  const size_t frame_size = 4 * (size_t)args->width * args->height;
+  WebPAnimEncoderOptions options;
+  WebPAnimEncoder* enc = NULL;
+  WebPPicture pic;
+  int ok, n, timestamp = 0;
+  if (!WebPAnimEncoderOptionsInit(&options) || !WebPPictureInit(&pic)) {
+    return 0;
+  }
+  WebPDataClear(&args->webp);
+  pic.width = args->width;
+  pic.height = args->height;
+  pic.use_argb = 1;
+  enc = WebPAnimEncoderNew(args->width, args->height, &options);
+  ok = (enc != NULL);
+  for (n = 0; ok && n < args->num_frames; ++n) {
+    ok = WebPPictureImportRGBA(&pic, args->frames + n * frame_size,
+                               4 * args->width) &&
+         WebPAnimEncoderAdd(enc, &pic, timestamp, &args->config);
+    timestamp += 100;
+  }
+  ok = ok && WebPAnimEncoderAdd(enc, NULL, timestamp, NULL) &&
+       WebPAnimEncoderAssemble(enc, &args->webp);
+  WebPPictureFree(&pic);
+  WebPAnimEncoderDelete(enc);
+  return ok;
+}
+
+typedef struct {
+  const WebPData* webp;
+  int use_threads;
+  int lookahead_frames;
+} AnimDecodeArgs;
+
+static int AnimDecode(void* arg) {
+  const AnimDecodeArgs* const args = (const AnimDecodeArgs*)arg;
+  WebPAnimDecoderOptions options;
+  WebPAnimDecoder* dec;
+  int ok = 1;
+  if (!WebPAnimDecoderOptionsInit(&options)) return 0;
+  options.color_mode = MODE_RGBA;
+  options.use_threads = args->use_threads;
+  options.lookahead_frames = args->lookahead_frames;
+  dec = WebPAnimDecoderNew(args->webp, &options);
+  if (dec == NULL) return 0;
+  while (ok && WebPAnimDecoderHasMoreFrames(dec)) {
+    uint8_t* buf;
+    int timestamp;
+    ok = WebPAnimDecoderGetNext(dec, &buf, &timestamp);
+  }
+  WebPAnimDecoderDelete(dec);
+  return ok;
+}
+
+typedef struct {
+  int width, height;
+  int num_frames;
+  float quality;
+  int use_threads;
+  double min_time;
+} BenchParams;
+
+static int InitConfig(WebPConfig* const config, const BenchParams* const params,
+                      int lossless, int method) {
+  if (!WebPConfigInit(config)) return 0;
+  config->quality = params->quality;
+  config->lossless = lossless;
+  config->method = method;
+  config->thread_level = params->use_threads;
+  return WebPValidateConfig(config);
+}
+
+static int BenchCodec(const BenchParams* const params) {
+  static const struct {
+    ContentType type;
+    int lossless;
+    const char* name;
+  } kPictures[] = {
+    { CONTENT_PHOTO,   0, "photo lossy" },
+    { CONTENT_ALPHA,   0, "alpha lossy" },
+    { CONTENT_GRAPHIC, 1, "graphic lossless" },
+    { CONTENT_ALPHA,   1, "alpha lossless" }
+  };
+  const int num_pictures = (int)(sizeof(kPictures) / sizeof(kPictures[0]));
+  const double mpixels = 1e-6 * params->width * params->height;
+  BenchResult result;
+  char name[64];
+  int ok = 1;
+  int i, method;
+
+  printf("== codec: %dx%d, %d frames, q=%.0f, threads=%d, min %.2fs/test ==\n",
+         params->width, params->height, params->num_frames, params->quality,
+         params->use_threads, params->min_time);
+  printf("%-34s %8s %9s %9s %6s %8s\n",
+         "test", "MP/s", "ms/call", "bytes", "bpp", "peak MB");
+
+  for (i = 0; ok && i < num_pictures; ++i) {
+    EncodeArgs enc_args;
+    DecodeArgs dec_args;
+    const int lossless = kPictures[i].lossless;
+    uint8_t* const rgba =
+        NewPicture(kPictures[i].type, params->width, params->height);
+    if (rgba == NULL) return 0;
+    enc_args.rgba = rgba;
+    enc_args.width = params->width;
+    enc_args.height = params->height;
+    WebPMemoryWriterInit(&enc_args.writer);
+    // Full method sweep for the opaque pictures, default method otherwise.
+    for (method = 0; ok && method <= 6; ++method) {
+      const int sweep = (kPictures[i].type != CONTENT_ALPHA);
+      if (!sweep && method != 4) continue;
+      ok = InitConfig(&enc_args.config, params, lossless, method) &&
+           RunBench(Encode, &enc_args, params->min_time, &result);
+      snprintf(name, sizeof(name), "encode %s -m %d",
+               kPictures[i].name, method);
+      if (ok) PrintResult(name, mpixels, &result, enc_args.writer.size);
+    }
+    // Decode the output of the default method.
+    ok = ok && InitConfig(&enc_args.config, params, lossless, 4) &&
+         Encode(&enc_args);
+    if (ok) {
+      dec_args.data = enc_args.writer.mem;
+      dec_args.data_size = enc_args.writer.size;
+      dec_args.use_threads = params->use_threads;
+      snprintf(name, sizeof(name), "decode %s", kPictures[i].name);
+      ok = RunBench(Decode, &dec_args, params->min_time, &result);
+      if (ok) PrintResult(name, mpixels, &result, dec_args.data_size);
+    }
+    WebPMemoryWriterClear(&enc_args.writer);
+    free(rgba);
+  }
+
+  if (ok && params->num_frames > 0) {
+    AnimEncodeArgs enc_args;
+    AnimDecodeArgs dec_args;
+    const double anim_mpixels = mpixels * params->num_frames;
+    int lossless;
+    enc_args.frames =
+        NewAnimation(params->width, params->height, params->num_frames);
+    if (enc_args.frames == NULL) return 0;
+    enc_args.width = params->width;
+    enc_args.height = params->height;
+    enc_args.num_frames = params->num_frames;
+    WebPDataInit(&enc_args.webp);
+    for (lossless = 0; ok && lossless <= 1; ++lossless) {
+      const char* const mode = lossless ? "lossless" : "lossy";
+      ok = InitConfig(&enc_args.config, params, lossless, 4) &&
+           RunBench(AnimEncode, &enc_args, params->min_time, &result);
+      snprintf(name, sizeof(name), "anim encode %s", mode);
+      if (ok) PrintResult(name, anim_mpixels, &result, enc_args.webp.size);
+
+      dec_args.webp = &enc_args.webp;
+      dec_args.use_threads = params->use_threads;
+      dec_args.lookahead_frames = 0;
+      ok = ok && RunBench(AnimDecode, &dec_args, params->min_time, &result);
+      snprintf(name, sizeof(name), "anim decode %s", mode);
+      if (ok) PrintResult(name, anim_mpixels, &result, enc_args.webp.size);
+      if (ok && params->use_threads) {
+        dec_args.lookahead_frames = 2;
+        ok = RunBench(AnimDecode, &dec_args, params->min_time, &result);
+        snprintf(name, sizeof(name), "anim decode %s lookahead=2", mode);
+        if (ok) PrintResult(name, anim_mpixels, &result, enc_args.webp.size);
+      }
+    }
+    WebPDataClear(&enc_args.webp);
+    free((void*)enc_args.frames);
+  }
+  if (!ok) fprintf(stderr, "Error: codec benchmark failed.\n");
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+// DSP kernels
+//
+// Each kernel runs one call of a dispatched function pointer (or of the whole
+// family, for the predictor arrays) on fixed buffers. The function pointers
+// are re-initialized for each CPU feature level by handing a masked
+// VP8GetCPUInfo to the Init functions.
+
+#define KW 256                  // row length, in pixels
+#define KH 32                   // number of rows for plane kernels
+#define KN (KW * KH)            // number of pixels for plane kernels
+
+static volatile uint32_t sink;  // keeps the results alive
+
+#define WORK_SIZE (BPS * 48)
+#define EDGES_SIZE 96
+
+// BPS-strided work areas, aligned like the codec's own.
+static uint8_t k_mem[2 * WORK_SIZE + PRED_SIZE_ENC + EDGES_SIZE +
+                     WEBP_ALIGN_CST];
+static uint8_t* k_yuv;
+static uint8_t* k_ref;
+static uint8_t* k_pred;
+static uint8_t* k_edges;              // encoder top/left samples
+static uint8_t k_luma[64 * 64];       // loop-filter areas, stride 64
+static uint8_t k_chroma_u[32 * 32], k_chroma_v[32 * 32];
+static int16_t k_coeffs[256 + 64];
+static int16_t k_out16[256 + 64];
+static uint8_t k_y[KN], k_u[KN], k_v[KN];
+static uint8_t k_rgba[4 * KN + 32], k_rgba2[4 * KN + 32];  // padded for
+                                                          // +3 offsets
+static uint8_t k_alpha[KN];
+static uint16_t k_rgba16[4 * KW];
+static uint16_t k_sharp_a[2 * KW + 16], k_sharp_b[2 * KW + 16];
+static uint16_t k_sharp_out[2 * KW + 16];
+static int16_t k_sharp_c[2 * KW + 16], k_sharp_d[2 * KW + 16];
+static int16_t k_sharp_e[2 * KW + 16];
+static uint32_t k_argb[KN + 2 * KW], k_argb2[KN + 2 * KW];
+static uint32_t k_argb3[KN + 2 * KW];
+static uint32_t k_color_map[256];
+static rescaler_t k_rescaler_work[2 * 4 * 2 * KW];
+static uint8_t k_rescaled[4 * 4 * KN];
+static uint32_t k_population_x[NUM_LITERAL_CODES + NUM_LENGTH_CODES];
+static uint32_t k_population_y[NUM_LITERAL_CODES + NUM_LENGTH_CODES];
+static int k_histo_x[256], k_histo_y[256];
+static int k_histo[256];
+static VP8Matrix k_matrix;
+static VP8EncProba k_proba;
+static VP8LHistogram* k_histograms[3];
+static const uint16_t kWeights[16] = {
+  38, 32, 20, 9, 32, 28, 17, 7, 20, 17, 10, 4, 9, 7, 4, 2
+};
+
+static int InitKernelData(void) {
+  int i;
+  SetSeed(0x6b65726eu);
+  k_yuv = (uint8_t*)WEBP_ALIGN(k_mem);
+  k_ref = k_yuv + WORK_SIZE;
+  k_pred = k_ref + WORK_SIZE;
+  k_edges = k_pred + PRED_SIZE_ENC;
+  for (i = 0; i < WORK_SIZE; ++i) k_yuv[i] = Rand() & 0xff;
+  for (i = 0; i < WORK_SIZE; ++i) k_ref[i] = Rand() & 0xff;
+  for (i = 0; i < EDGES_SIZE; ++i) k_edges[i] = Rand() & 0xff;
+  // smooth content, so that the loop filters actually filter
+  for (i = 0; i < (int)sizeof(k_luma); ++i) k_luma[i] = 96 + Rand() % 12;
+  for (i = 0; i < (int)sizeof(k_chroma_u); ++i) {
+    k_chroma_u[i] = 120 + Rand() % 8;
+    k_chroma_v[i] = 130 + Rand() % 8;
+  }
+  for (i = 0; i < 256 + 64; ++i) k_coeffs[i] = (int16_t)(Rand() % 512) - 256;
+  for (i = 0; i < KN; ++i) {
+    k_y[i] = Rand() & 0xff;
+    k_u[i] = Rand() & 0xff;
+    k_v[i] = Rand() & 0xff;
+    k_alpha[i] = (i & 7) ? 0xff : Rand() & 0xff;
+  }
+  for (i = 0; i < 4 * KN; ++i) {
+    k_rgba[i] = Rand() & 0xff;
+    k_rgba2[i] = Rand() & 0xff;
+  }
+  for (i = 0; i < 4 * KW; ++i) k_rgba16[i] = Rand() & 0x3ff;
+  for (i = 0; i < 2 * KW + 16; ++i) {
+    k_sharp_a[i] = Rand() & 0x3ff;
+    k_sharp_b[i] = Rand() & 0x3ff;
+    k_sharp_c[i] = (int16_t)(Rand() % 256) - 128;
+    k_sharp_d[i] = (int16_t)(Rand() % 256) - 128;
+    k_sharp_e[i] = (int16_t)(Rand() % 256) - 128;
+  }
+  for (i = 0; i < KN + 2 * KW; ++i) {
+    // locally correlated ARGB values, as in real lossless content
+    const uint32_t prev = (i > 0) ? k_argb[i - 1] : 0xff808080u;
+    k_argb[i] = (Rand() & 3) ? prev : (0xff000000u | Rand());
+    k_argb2[i] = k_argb[i];
+    k_argb3[i] = 0xff000000u | Rand();
+  }
+  for (i = 0; i < 256; ++i) {
+    k_color_map[i] = 0xff000000u | Rand();
+    k_histo_x[i] = Rand() % 1000;
+    k_histo_y[i] = Rand() % 1000;
+  }
+  for (i = 0; i < NUM_LITERAL_CODES + NUM_LENGTH_CODES; ++i) {
+    k_population_x[i] = (i & 3) ? Rand() % 100 : 0;
+    k_population_y[i] = (i & 5) ? Rand() % 100 : 0;
+  }
+  // quantization matrix, as ExpandMatrix() would set it up for q ~= 75
+  for (i = 0; i < 16; ++i) {
+    const int q = (i == 0) ? 12 : 16;
+    const int bias = (i == 0) ? 96 : 110;
+    k_matrix.q_[i] = q;
+    k_matrix.iq_[i] = (1 << QFIX) / q;
+    k_matrix.bias_[i] = BIAS(bias);
+    k_matrix.zthresh_[i] =
+        ((1 << QFIX) - 1 - k_matrix.bias_[i]) / k_matrix.iq_[i];
+    k_matrix.sharpen_[i] = 0;
+  }
+  memcpy(k_proba.coeffs_, VP8CoeffsProba0, sizeof(k_proba.coeffs_));
+  k_proba.dirty_ = 1;
+  VP8CalculateLevelCosts(&k_proba);
+  for (i = 0; i < 3; ++i) {
+    int j;
+    k_histograms[i] = VP8LAllocateHistogram(0);
+    if (k_histograms[i] == NULL) return 0;
+    for (j = 0; j < VP8LHistogramNumCodes(0); ++j) {
+      k_histograms[i]->literal_[j] = Rand() % 64;
+    }
+    for (j = 0; j < NUM_LITERAL_CODES; ++j) {
+      k_histograms[i]->red_[j] = Rand() % 64;
+      k_histograms[i]->blue_[j] = Rand() % 64;
+      k_histograms[i]->alpha_[j] = Rand() % 64;
+    }
+    for (j = 0; j < NUM_DISTANCE_CODES; ++j) {
+      k_histograms[i]->distance_[j] = Rand() % 64;
+    }
+  }
+  return 1;
+}
+
+static void FreeKernelData(void) {
+  int i;
+  for (i = 0; i < 3; ++i) VP8LFreeHistogram(k_histograms[i]);
+}
+
+// Decoding
+
+#define DEC_DST (k_yuv + 4 * BPS + 8)
+#define FILTER_Y (k_luma + 16 * 64 + 16)
+#define FILTER_U (k_chroma_u + 8 * 32 + 8)
+#define FILTER_V (k_chroma_v + 8 * 32 + 8)
+
+static void RunTransform(void) { VP8Transform(k_coeffs, DEC_DST, 1); }
+static void RunTransformAC3(void) { VP8TransformAC3(k_coeffs, DEC_DST); }
+static void RunTransformUV(void) { VP8TransformUV(k_coeffs, DEC_DST); }
+static void RunTransformDC(void) { VP8TransformDC(k_coeffs, DEC_DST); }
+static void RunTransformDCUV(void) { VP8TransformDCUV(k_coeffs, DEC_DST); }
+static void RunTransformWHT(void) { VP8TransformWHT(k_coeffs, k_out16); }
+
+static void RunSimpleVFilter16(void) { VP8SimpleVFilter16(FILTER_Y, 64, 40); }
+static void RunSimpleHFilter16(void) { VP8SimpleHFilter16(FILTER_Y, 64, 40); }
+static void RunSimpleVFilter16i(void) {
+  VP8SimpleVFilter16i(FILTER_Y, 64, 40);
+}
+static void RunSimpleHFilter16i(void) {
+  VP8SimpleHFilter16i(FILTER_Y, 64, 40);
+}
+static void RunVFilter16(void) { VP8VFilter16(FILTER_Y, 64, 60, 30, 2); }
+static void RunHFilter16(void) { VP8HFilter16(FILTER_Y, 64, 60, 30, 2); }
+static void RunVFilter16i(void) { VP8VFilter16i(FILTER_Y, 64, 60, 30, 2); }
+static void RunHFilter16i(void) { VP8HFilter16i(FILTER_Y, 64, 60, 30, 2); }
+static void RunVFilter8(void) {
+  VP8VFilter8(FILTER_U, FILTER_V, 32, 60, 30, 2);
+}
+static void RunHFilter8(void) {
+  VP8HFilter8(FILTER_U, FILTER_V, 32, 60, 30, 2);
+}
+static void RunVFilter8i(void) {
+  VP8VFilter8i(FILTER_U, FILTER_V, 32, 60, 30, 2);
+}
+static void RunHFilter8i(void) {
+  VP8HFilter8i(FILTER_U, FILTER_V, 32, 60, 30, 2);
+}
+
+static void RunPredLuma4(void) {
+  int mode;
+  for (mode = 0; mode < NUM_BMODES; ++mode) VP8PredLuma4[mode](DEC_DST);
+}
+static void RunPredLuma16(void) {
+  int mode;
+  for (mode = 0; mode < NUM_B_DC_MODES; ++mode) VP8PredLuma16[mode](DEC_DST);
+}
+static void RunPredChroma8(void) {
+  int mode;
+  for (mode = 0; mode < NUM_B_DC_MODES; ++mode) VP8PredChroma8[mode](DEC_DST);
+}
+static void RunDitherCombine8x8(void) {
+  VP8DitherCombine8x8(k_ref, DEC_DST, BPS);
+}
+
+// Encoding
+
+static void RunFTransform(void) { VP8FTransform(k_yuv, k_ref, k_out16); }
+static void RunFTransform2(void) { VP8FTransform2(k_yuv, k_ref, k_out16); }
+static void RunFTransformWHT(void) { VP8FTransformWHT(k_coeffs, k_out16); }
+static void RunITransform(void) { VP8ITransform(k_ref, k_coeffs, k_yuv, 1); }
+static void RunEncPredLuma4(void) { VP8EncPredLuma4(k_pred, k_edges + 8); }
+static void RunEncPredLuma16(void) {
+  VP8EncPredLuma16(k_pred, k_edges + 16, k_edges + 48);
+}
+static void RunEncPredChroma8(void) {
+  VP8EncPredChroma8(k_pred, k_edges + 16, k_edges + 48);
+}
+static void RunSSE16x16(void) { sink += VP8SSE16x16(k_yuv, k_ref); }
+static void RunSSE16x8(void) { sink += VP8SSE16x8(k_yuv, k_ref); }
+static void RunSSE8x8(void) { sink += VP8SSE8x8(k_yuv, k_ref); }
+static void RunSSE4x4(void) { sink += VP8SSE4x4(k_yuv, k_ref); }
+static void RunTDisto4x4(void) {
+  sink += VP8TDisto4x4(k_yuv, k_ref, kWeights);
+}
+static void RunTDisto16x16(void) {
+  sink += VP8TDisto16x16(k_yuv, k_ref, kWeights);
+}
+static void RunMean16x4(void) {
+  uint32_t dc[4];
+  VP8Mean16x4(k_yuv, dc);
+  sink += dc[0];
+}
+static void RunCopy4x4(void) { VP8Copy4x4(k_ref, k_pred); }
+static void RunCopy16x8(void) { VP8Copy16x8(k_ref, k_pred); }
+
+static void RunQuantizeBlock(void) {
+  memcpy(k_out16, k_coeffs, 16 * sizeof(*k_out16));
+  sink += VP8EncQuantizeBlock(k_out16, k_out16 + 32, &k_matrix);
+}
+static void RunQuantize2Blocks(void) {
+  memcpy(k_out16, k_coeffs, 32 * sizeof(*k_out16));
+  sink += VP8EncQuantize2Blocks(k_out16, k_out16 + 32, &k_matrix);
+}
+static void RunQuantizeBlockWHT(void) {
+  memcpy(k_out16, k_coeffs, 16 * sizeof(*k_out16));
+  sink += VP8EncQuantizeBlockWHT(k_out16, k_out16 + 32, &k_matrix);
+}
+static void RunTrellisPrepare(void) {
+  VP8TrellisCoeffs tc;
+  sink += VP8EncTrellisPrepare(k_coeffs, 0, &k_matrix, kWeights, &tc);
+  sink += tc.error[0][5];
+}
+static void RunCollectHistogram(void) {
+  VP8Histogram histo;
+  VP8CollectHistogram(k_yuv, k_ref, 0, 16, &histo);
+  sink += histo.max_value;
+}
+static void RunResidualCost(void) {
+  VP8Residual res;
+  res.first = 0;
+  res.coeff_type = 3;
+  res.prob = k_proba.coeffs_[3];
+  res.stats = k_proba.stats_[3];
+  res.costs = k_proba.remapped_costs_[3];
+  VP8SetResidualCoeffs(k_coeffs + 64, &res);
+  sink += VP8GetResidualCost(0, &res);
+}
+static void RunSSIMGet(void) {
+  sink += (uint32_t)(1000. * VP8SSIMGet(k_y, KW, k_u, KW));
+}
+static void RunSSIMGetClipped(void) {
+  sink += (uint32_t)(1000. * VP8SSIMGetClipped(k_y, KW, k_u, KW, 2, 2, KW, KH));
+}
+static void RunAccumulateSSE(void) { sink += VP8AccumulateSSE(k_y, k_u, KN); }
+
+// I/O, colorspace conversions and rescaling
+
+static void RunUpsamplersRGBA(void) {
+  WebPUpsamplers[MODE_RGBA](k_y, k_y + KW, k_u, k_v, k_u + KW, k_v + KW,
+                            k_rgba, k_rgba + 4 * KW, KW);
+}
+static void RunUpsamplersRGB565(void) {
+  WebPUpsamplers[MODE_RGB_565](k_y, k_y + KW, k_u, k_v, k_u + KW, k_v + KW,
+                               k_rgba, k_rgba + 4 * KW, KW);
+}
+static void RunSamplersRGBA(void) {
+  WebPSamplers[MODE_RGBA](k_y, k_u, k_v, k_rgba, KW);
+}
+static void RunYUV444ToRGBA(void) {
+  WebPYUV444Converters[MODE_RGBA](k_y, k_u, k_v, k_rgba, KW);
+}
+static void RunConvertARGBToY(void) {
+  WebPConvertARGBToY(k_argb3, k_y + KW, KW);
+}
+static void RunConvertARGBToUV(void) {
+  WebPConvertARGBToUV(k_argb3, k_u + KW, k_v + KW, KW, 1);
+}
+static void RunConvertRGBA32ToUV(void) {
+  WebPConvertRGBA32ToUV(k_rgba16, k_u + KW, k_v + KW, KW / 2);
+}
+static void RunConvertRGB24ToY(void) {
+  WebPConvertRGB24ToY(k_rgba2, k_y + KW, KW);
+}
+static void RunConvertBGR24ToY(void) {
+  WebPConvertBGR24ToY(k_rgba2, k_y + KW, KW);
+}
+static void RunSharpYUVUpdateY(void) {
+  sink += (uint32_t)WebPSharpYUVUpdateY(k_sharp_a, k_sharp_b, k_sharp_out, KW);
+}
+static void RunSharpYUVUpdateRGB(void) {
+  WebPSharpYUVUpdateRGB(k_sharp_c, k_sharp_d, k_sharp_e, KW);
+}
+static void RunSharpYUVFilterRow(void) {
+  WebPSharpYUVFilterRow(k_sharp_c, k_sharp_d, KW / 2, k_sharp_a, k_sharp_out);
+}
+
+// Rescales the k_rgba2 plane (KW x KH) to 'dst_width' x 'dst_height'.
+static void Rescale(int dst_width, int dst_height) {
+  WebPRescaler rescaler;
+  int y = 0;
+  WebPRescalerInit(&rescaler, KW, KH, k_rescaled, dst_width, dst_height,
+                   4 * dst_width, 4, k_rescaler_work);
+  while (y < KH) {
+    y += WebPRescalerImport(&rescaler, KH - y, k_rgba2 + 4 * KW * y, 4 * KW);
+    WebPRescalerExport(&rescaler);
+  }
+}
+static void RunRescalerShrink(void) { Rescale(KW / 2, KH / 2); }
+static void RunRescalerExpand(void) { Rescale(2 * KW, 2 * KH); }
+
+// Alpha
+
+static void RunApplyAlphaMultiply(void) {
+  WebPApplyAlphaMultiply(k_rgba, 0, KW, KH, 4 * KW);
+}
+static void RunApplyAlphaMultiply4444(void) {
+  WebPApplyAlphaMultiply4444(k_rgba, KW, KH, 2 * KW);
+}
+static void RunDispatchAlpha(void) {
+  sink += WebPDispatchAlpha(k_alpha, KW, KW, KH, k_rgba + 3, 4 * KW);
+}
+static void RunDispatchAlphaToGreen(void) {
+  WebPDispatchAlphaToGreen(k_alpha, KW, KW, KH, k_argb3, KW);
+}
+static void RunExtractAlpha(void) {
+  sink += WebPExtractAlpha(k_rgba2 + 3, 4 * KW, KW, KH, k_y, KW);
+}
+static void RunExtractGreen(void) { WebPExtractGreen(k_argb, k_y, KN); }
+static void RunMultARGBRow(void) {
+  WebPMultARGBRow(k_argb3, KW, 0);
+  WebPMultARGBRow(k_argb3, KW, 1);
+}
+static void RunMultRow(void) {
+  WebPMultRow(k_y, k_alpha, KW, 0);
+  WebPMultRow(k_y, k_alpha, KW, 1);
+}
+static void RunPackARGB(void) {
+  VP8PackARGB(k_rgba2 + 3, k_rgba2, k_rgba2 + 1, k_rgba2 + 2, KN, k_argb3);
+}
+static void RunPackRGB(void) {
+  VP8PackRGB(k_rgba2, k_rgba2 + 1, k_rgba2 + 2, KN, 4, k_argb3);
+}
+
+// Alpha plane filters
+
+static void RunFilters(void) {
+  int f;
+  for (f = WEBP_FILTER_HORIZONTAL; f <= WEBP_FILTER_GRADIENT; ++f) {
+    WebPFilters[f](k_alpha, KW, KH, KW, k_y);
+  }
+}
+static void RunUnfilters(void) {
+  int f, y;
+  for (f = WEBP_FILTER_HORIZONTAL; f <= WEBP_FILTER_GRADIENT; ++f) {
+    for (y = 0; y < KH; ++y) {
+      const uint8_t* const prev = (y == 0) ? NULL : k_u + (y - 1) * KW;
+      WebPUnfilters[f](prev, k_alpha + y * KW, k_u + y * KW, KW);
+    }
+  }
+}
+
+// Lossless decoding
+
+static void RunPredictorsAdd(void) {
+  int mode;
+  for (mode = 0; mode < 14; ++mode) {
+    VP8LPredictorsAdd[mode](k_argb + KW + 1, k_argb + 1, KW, k_argb3 + 1);
+  }
+}
+static void RunAddGreenToBlueAndRed(void) {
+  VP8LAddGreenToBlueAndRed(k_argb, KN, k_argb3);
+}
+static void RunTransformColorInverse(void) {
+  static const VP8LMultipliers m = { 23, 255 - 12, 7 };
+  VP8LTransformColorInverse(&m, k_argb, KN, k_argb3);
+}
+static void RunConvertBGRAToRGB(void) {
+  VP8LConvertBGRAToRGB(k_argb, KN, k_rgba);
+}
+static void RunConvertBGRAToRGBA(void) {
+  VP8LConvertBGRAToRGBA(k_argb, KN, k_rgba);
+}
+static void RunConvertBGRAToRGBA4444(void) {
+  VP8LConvertBGRAToRGBA4444(k_argb, KN, k_rgba);
+}
+static void RunConvertBGRAToRGB565(void) {
+  VP8LConvertBGRAToRGB565(k_argb, KN, k_rgba);
+}
+static void RunConvertBGRAToBGR(void) {
+  VP8LConvertBGRAToBGR(k_argb, KN, k_rgba);
+}
+static void RunMapColor32b(void) {
+  VP8LMapColor32b(k_argb, k_color_map, k_argb3, 0, KH, KW);
+}
+static void RunMapColor8b(void) {
+  VP8LMapColor8b(k_y, k_color_map, k_u, 0, KH, KW);
+}
+
+// Lossless encoding
+
+static void RunSubtractGreen(void) {
+  VP8LSubtractGreenFromBlueAndRed(k_argb2, KN);
+}
+static void RunTransformColor(void) {
+  static const VP8LMultipliers m = { 23, 255 - 12, 7 };
+  VP8LTransformColor(&m, k_argb2, KN);
+}
+static void RunCollectColorBlueTransforms(void) {
+  memset(k_histo, 0, sizeof(k_histo));
+  VP8LCollectColorBlueTransforms(k_argb, KW, 32, KH, 5, -3, k_histo);
+}
+static void RunCollectColorRedTransforms(void) {
+  memset(k_histo, 0, sizeof(k_histo));
+  VP8LCollectColorRedTransforms(k_argb, KW, 32, KH, 5, k_histo);
+}
+static void RunPredictorsSub(void) {
+  int mode;
+  for (mode = 0; mode < 14; ++mode) {
+    VP8LPredictorsSub[mode](k_argb + KW + 1, k_argb + 1, KW, k_argb3 + 1);
+  }
+}
+static void RunExtraCost(void) {
+  sink += (uint32_t)VP8LExtraCost(k_population_x + NUM_LITERAL_CODES,
+                                  NUM_LENGTH_CODES);
+}
+static void RunExtraCostCombined(void) {
+  sink += (uint32_t)VP8LExtraCostCombined(k_population_x, k_population_y,
+                                          NUM_DISTANCE_CODES);
+}
+static void RunCombinedShannonEntropy(void) {
+  sink += (uint32_t)VP8LCombinedShannonEntropy(k_histo_x, k_histo_y);
+}
+static void RunGetEntropyUnrefined(void) {
+  VP8LBitEntropy entropy;
+  VP8LStreaks stats;
+  VP8LGetEntropyUnrefined(k_population_x, NUM_LITERAL_CODES + NUM_LENGTH_CODES,
+                          &entropy, &stats);
+  sink += entropy.sum;
+}
+static void RunGetCombinedEntropyUnrefined(void) {
+  VP8LBitEntropy entropy;
+  VP8LStreaks stats;
+  VP8LGetCombinedEntropyUnrefined(k_population_x, k_population_y,
+                                  NUM_LITERAL_CODES + NUM_LENGTH_CODES,
+                                  &entropy, &stats);
+  sink += entropy.sum;
+}
+static void RunHistogramAdd(void) {
+  VP8LHistogramAdd(k_histograms[0], k_histograms[1], k_histograms[2]);
+}
+static void RunVectorMismatch(void) {
+  sink += VP8LVectorMismatch(k_argb + 1, k_argb, KW);
+}
+static void RunBundleColorMap(void) {
+  VP8LBundleColorMap(k_y, KW, 1, k_argb3);
+}
+
+typedef void (*KernelFunc)(void);
+
+// Dispatched function pointer, or array of pointers, called by a kernel.
+typedef struct {
+  const void* ptr;
+  size_t size;
+} DspPointer;
+#define DSP_PTR(P) { (const void*)&(P), sizeof(P) }
+#define DSP_ARRAY(P, N) { (const void*)(P), (N) * sizeof((P)[0]) }
+
+typedef struct {
+  const char* name;
+  KernelFunc run;
+  DspPointer dispatch[2];   // the pointers 'run' goes through
+} Kernel;
+
+static const Kernel kKernels[] = {
+  { "VP8Transform (x2)", RunTransform, { DSP_PTR(VP8Transform) } },
+  { "VP8TransformAC3", RunTransformAC3, { DSP_PTR(VP8TransformAC3) } },
+  { "VP8TransformUV", RunTransformUV, { DSP_PTR(VP8TransformUV) } },
+  { "VP8TransformDC", RunTransformDC, { DSP_PTR(VP8TransformDC) } },
+  { "VP8TransformDCUV", RunTransformDCUV, { DSP_PTR(VP8TransformDCUV) } },
+  { "VP8TransformWHT", RunTransformWHT, { DSP_PTR(VP8TransformWHT) } },
+  { "VP8SimpleVFilter16", RunSimpleVFilter16, { DSP_PTR(VP8SimpleVFilter16) } },
+  { "VP8SimpleHFilter16", RunSimpleHFilter16, { DSP_PTR(VP8SimpleHFilter16) } },
+  { "VP8SimpleVFilter16i", RunSimpleVFilter16i,
+    { DSP_PTR(VP8SimpleVFilter16i) } },
+  { "VP8SimpleHFilter16i", RunSimpleHFilter16i,
+    { DSP_PTR(VP8SimpleHFilter16i) } },
+  { "VP8VFilter16", RunVFilter16, { DSP_PTR(VP8VFilter16) } },
+  { "VP8HFilter16", RunHFilter16, { DSP_PTR(VP8HFilter16) } },
+  { "VP8VFilter16i", RunVFilter16i, { DSP_PTR(VP8VFilter16i) } },
+  { "VP8HFilter16i", RunHFilter16i, { DSP_PTR(VP8HFilter16i) } },
+  { "VP8VFilter8", RunVFilter8, { DSP_PTR(VP8VFilter8) } },
+  { "VP8HFilter8", RunHFilter8, { DSP_PTR(VP8HFilter8) } },
+  { "VP8VFilter8i", RunVFilter8i, { DSP_PTR(VP8VFilter8i) } },
+  { "VP8HFilter8i", RunHFilter8i, { DSP_PTR(VP8HFilter8i) } },
+  { "VP8PredLuma4[all]", RunPredLuma4,
+    { DSP_ARRAY(VP8PredLuma4, NUM_BMODES) } },
+  { "VP8PredLuma16[all]", RunPredLuma16,
+    { DSP_ARRAY(VP8PredLuma16, NUM_B_DC_MODES) } },
+  { "VP8PredChroma8[all]", RunPredChroma8,
+    { DSP_ARRAY(VP8PredChroma8, NUM_B_DC_MODES) } },
+  { "VP8DitherCombine8x8", RunDitherCombine8x8,
+    { DSP_PTR(VP8DitherCombine8x8) } },
+  { "VP8FTransform", RunFTransform, { DSP_PTR(VP8FTransform) } },
+  { "VP8FTransform2", RunFTransform2, { DSP_PTR(VP8FTransform2) } },
+  { "VP8FTransformWHT", RunFTransformWHT, { DSP_PTR(VP8FTransformWHT) } },
+  { "VP8ITransform (x2)", RunITransform, { DSP_PTR(VP8ITransform) } },
+  { "VP8EncPredLuma4", RunEncPredLuma4, { DSP_PTR(VP8EncPredLuma4) } },
+  { "VP8EncPredLuma16", RunEncPredLuma16, { DSP_PTR(VP8EncPredLuma16) } },
+  { "VP8EncPredChroma8", RunEncPredChroma8, { DSP_PTR(VP8EncPredChroma8) } },
+  { "VP8SSE16x16", RunSSE16x16, { DSP_PTR(VP8SSE16x16) } },
+  { "VP8SSE16x8", RunSSE16x8, { DSP_PTR(VP8SSE16x8) } },
+  { "VP8SSE8x8", RunSSE8x8, { DSP_PTR(VP8SSE8x8) } },
+  { "VP8SSE4x4", RunSSE4x4, { DSP_PTR(VP8SSE4x4) } },
+  { "VP8TDisto4x4", RunTDisto4x4, { DSP_PTR(VP8TDisto4x4) } },
+  { "VP8TDisto16x16", RunTDisto16x16, { DSP_PTR(VP8TDisto16x16) } },
+  { "VP8Mean16x4", RunMean16x4, { DSP_PTR(VP8Mean16x4) } },
+  { "VP8Copy4x4", RunCopy4x4, { DSP_PTR(VP8Copy4x4) } },
+  { "VP8Copy16x8", RunCopy16x8, { DSP_PTR(VP8Copy16x8) } },
+  { "VP8EncQuantizeBlock", RunQuantizeBlock, { DSP_PTR(VP8EncQuantizeBlock) } },
+  { "VP8EncQuantize2Blocks", RunQuantize2Blocks,
+    { DSP_PTR(VP8EncQuantize2Blocks) } },
+  { "VP8EncQuantizeBlockWHT", RunQuantizeBlockWHT,
+    { DSP_PTR(VP8EncQuantizeBlockWHT) } },
+  { "VP8EncTrellisPrepare", RunTrellisPrepare,
+    { DSP_PTR(VP8EncTrellisPrepare) } },
+  { "VP8CollectHistogram", RunCollectHistogram,
+    { DSP_PTR(VP8CollectHistogram) } },
+  { "VP8GetResidualCost", RunResidualCost,
+    { DSP_PTR(VP8SetResidualCoeffs), DSP_PTR(VP8GetResidualCost) } },
+  { "VP8SSIMGet", RunSSIMGet, { DSP_PTR(VP8SSIMGet) } },
+  { "VP8SSIMGetClipped", RunSSIMGetClipped, { DSP_PTR(VP8SSIMGetClipped) } },
+  { "VP8AccumulateSSE", RunAccumulateSSE, { DSP_PTR(VP8AccumulateSSE) } },
+  { "WebPUpsamplers[RGBA]", RunUpsamplersRGBA,
+    { DSP_PTR(WebPUpsamplers[MODE_RGBA]) } },
+  { "WebPUpsamplers[RGB_565]", RunUpsamplersRGB565,
+    { DSP_PTR(WebPUpsamplers[MODE_RGB_565]) } },
+  { "WebPSamplers[RGBA]", RunSamplersRGBA,
+    { DSP_PTR(WebPSamplers[MODE_RGBA]) } },
+  { "WebPYUV444Converters[RGBA]", RunYUV444ToRGBA,
+    { DSP_PTR(WebPYUV444Converters[MODE_RGBA]) } },
+  { "WebPConvertARGBToY", RunConvertARGBToY, { DSP_PTR(WebPConvertARGBToY) } },
+  { "WebPConvertARGBToUV", RunConvertARGBToUV,
+    { DSP_PTR(WebPConvertARGBToUV) } },
+  { "WebPConvertRGBA32ToUV", RunConvertRGBA32ToUV,
+    { DSP_PTR(WebPConvertRGBA32ToUV) } },
+  { "WebPConvertRGB24ToY", RunConvertRGB24ToY,
+    { DSP_PTR(WebPConvertRGB24ToY) } },
+  { "WebPConvertBGR24ToY", RunConvertBGR24ToY,
+    { DSP_PTR(WebPConvertBGR24ToY) } },
+  { "WebPSharpYUVUpdateY", RunSharpYUVUpdateY,
+    { DSP_PTR(WebPSharpYUVUpdateY) } },
+  { "WebPSharpYUVUpdateRGB", RunSharpYUVUpdateRGB,
+    { DSP_PTR(WebPSharpYUVUpdateRGB) } },
+  { "WebPSharpYUVFilterRow", RunSharpYUVFilterRow,
+    { DSP_PTR(WebPSharpYUVFilterRow) } },
+  { "WebPRescaler (shrink plane)", RunRescalerShrink,
+    { DSP_PTR(WebPRescalerImportRowShrink),
+      DSP_PTR(WebPRescalerExportRowShrink) } },
+  { "WebPRescaler (expand plane)", RunRescalerExpand,
+    { DSP_PTR(WebPRescalerImportRowExpand),
+      DSP_PTR(WebPRescalerExportRowExpand) } },
+  { "WebPApplyAlphaMultiply", RunApplyAlphaMultiply,
+    { DSP_PTR(WebPApplyAlphaMultiply) } },
+  { "WebPApplyAlphaMultiply4444", RunApplyAlphaMultiply4444,
+    { DSP_PTR(WebPApplyAlphaMultiply4444) } },
+  { "WebPDispatchAlpha", RunDispatchAlpha, { DSP_PTR(WebPDispatchAlpha) } },
+  { "WebPDispatchAlphaToGreen", RunDispatchAlphaToGreen,
+    { DSP_PTR(WebPDispatchAlphaToGreen) } },
+  { "WebPExtractAlpha", RunExtractAlpha, { DSP_PTR(WebPExtractAlpha) } },
+  { "WebPExtractGreen", RunExtractGreen, { DSP_PTR(WebPExtractGreen) } },
+  { "WebPMultARGBRow (+inverse)", RunMultARGBRow,
+    { DSP_PTR(WebPMultARGBRow) } },
+  { "WebPMultRow (+inverse)", RunMultRow, { DSP_PTR(WebPMultRow) } },
+  { "VP8PackARGB", RunPackARGB, { DSP_PTR(VP8PackARGB) } },
+  { "VP8PackRGB", RunPackRGB, { DSP_PTR(VP8PackRGB) } },
+  { "WebPFilters[all]", RunFilters, { DSP_PTR(WebPFilters) } },
+  { "WebPUnfilters[all]", RunUnfilters, { DSP_PTR(WebPUnfilters) } },
+  { "VP8LPredictorsAdd[all]", RunPredictorsAdd,
+    { DSP_PTR(VP8LPredictorsAdd) } },
+  { "VP8LAddGreenToBlueAndRed", RunAddGreenToBlueAndRed,
+    { DSP_PTR(VP8LAddGreenToBlueAndRed) } },
+  { "VP8LTransformColorInverse", RunTransformColorInverse,
+    { DSP_PTR(VP8LTransformColorInverse) } },
+  { "VP8LConvertBGRAToRGB", RunConvertBGRAToRGB,
+    { DSP_PTR(VP8LConvertBGRAToRGB) } },
+  { "VP8LConvertBGRAToRGBA", RunConvertBGRAToRGBA,
+    { DSP_PTR(VP8LConvertBGRAToRGBA) } },
+  { "VP8LConvertBGRAToRGBA4444", RunConvertBGRAToRGBA4444,
+    { DSP_PTR(VP8LConvertBGRAToRGBA4444) } },
+  { "VP8LConvertBGRAToRGB565", RunConvertBGRAToRGB565,
+    { DSP_PTR(VP8LConvertBGRAToRGB565) } },
+  { "VP8LConvertBGRAToBGR", RunConvertBGRAToBGR,
+    { DSP_PTR(VP8LConvertBGRAToBGR) } },
+  { "VP8LMapColor32b", RunMapColor32b, { DSP_PTR(VP8LMapColor32b) } },
+  { "VP8LMapColor8b", RunMapColor8b, { DSP_PTR(VP8LMapColor8b) } },
+  { "VP8LSubtractGreenFromBlueAndRed", RunSubtractGreen,
+    { DSP_PTR(VP8LSubtractGreenFromBlueAndRed) } },
+  { "VP8LTransformColor", RunTransformColor, { DSP_PTR(VP8LTransformColor) } },
+  { "VP8LCollectColorBlueTransforms", RunCollectColorBlueTransforms,
+    { DSP_PTR(VP8LCollectColorBlueTransforms) } },
+  { "VP8LCollectColorRedTransforms", RunCollectColorRedTransforms,
+    { DSP_PTR(VP8LCollectColorRedTransforms) } },
+  { "VP8LPredictorsSub[all]", RunPredictorsSub,
+    { DSP_PTR(VP8LPredictorsSub) } },
+  { "VP8LExtraCost", RunExtraCost, { DSP_PTR(VP8LExtraCost) } },
+  { "VP8LExtraCostCombined", RunExtraCostCombined,
+    { DSP_PTR(VP8LExtraCostCombined) } },
+  { "VP8LCombinedShannonEntropy", RunCombinedShannonEntropy,
+    { DSP_PTR(VP8LCombinedShannonEntropy) } },
+  { "VP8LGetEntropyUnrefined", RunGetEntropyUnrefined,
+    { DSP_PTR(VP8LGetEntropyUnrefined) } },
+  { "VP8LGetCombinedEntropyUnrefined", RunGetCombinedEntropyUnrefined,
+    { DSP_PTR(VP8LGetCombinedEntropyUnrefined) } },
+  { "VP8LHistogramAdd", RunHistogramAdd, { DSP_PTR(VP8LHistogramAdd) } },
+  { "VP8LVectorMismatch", RunVectorMismatch, { DSP_PTR(VP8LVectorMismatch) } },
+  { "VP8LBundleColorMap", RunBundleColorMap, { DSP_PTR(VP8LBundleColorMap) } }
+};
+#define NUM_KERNELS ((int)(sizeof(kKernels) / sizeof(kKernels[0])))
+
+// CPU feature levels. Each level needs its own VP8CPUInfo function: the Init
+// functions only re-run when VP8GetCPUInfo changes value.
+
+static VP8CPUInfo real_cpu_info = NULL;
+
+#define FEATURE_BIT(f) (1 << (f))
+#define X86_BASE (FEATURE_BIT(kSSE2) | FEATURE_BIT(kSSE3) | \
+                  FEATURE_BIT(kSlowSSSE3))
+
+static int MaskedCPUInfo(CPUFeature feature, int mask) {
+  return (mask & FEATURE_BIT(feature)) && real_cpu_info(feature);
+}
+
+#define CPU_LEVEL_INFO(NAME, MASK)                                             \
+static int NAME(CPUFeature feature) { return MaskedCPUInfo(feature, (MASK)); }
+
+CPU_LEVEL_INFO(CPUInfoSSE2, X86_BASE)
+CPU_LEVEL_INFO(CPUInfoSSE41, X86_BASE | FEATURE_BIT(kSSE4_1))
+CPU_LEVEL_INFO(CPUInfoAVX2, X86_BASE | FEATURE_BIT(kSSE4_1) |
+                            FEATURE_BIT(kAVX) | FEATURE_BIT(kAVX2))
+CPU_LEVEL_INFO(CPUInfoNEON, FEATURE_BIT(kNEON))
+CPU_LEVEL_INFO(CPUInfoMIPS32, FEATURE_BIT(kMIPS32))
+CPU_LEVEL_INFO(CPUInfoMIPSdspR2, FEATURE_BIT(kMIPS32) |
+                                 FEATURE_BIT(kMIPSdspR2))
+CPU_LEVEL_INFO(CPUInfoMSA, FEATURE_BIT(kMSA))
+
+#undef CPU_LEVEL_INFO
+
+typedef struct {
+  const char* name;
+  CPUFeature top_feature;   // the level is available if this one is
+  VP8CPUInfo info;          // NULL for plain-C
+} CPULevel;
+
+static const CPULevel kCPULevels[] = {
+  { "c",        kSSE2,      NULL },
+  { "sse2",     kSSE2,      CPUInfoSSE2 },
+  { "sse4.1",   kSSE4_1,    CPUInfoSSE41 },
+  { "avx2",     kAVX2,      CPUInfoAVX2 },
+  { "neon",     kNEON,      CPUInfoNEON },
+  { "mips32",   kMIPS32,    CPUInfoMIPS32 },
+  { "mipsdspr2", kMIPSdspR2, CPUInfoMIPSdspR2 },
+  { "msa",      kMSA,       CPUInfoMSA }
+};
+#define NUM_CPU_LEVELS ((int)(sizeof(kCPULevels) / sizeof(kCPULevels[0])))
+
+static void InitDsp(void) {
+  VP8DspInit();
+  VP8EncDspInit();
+  VP8EncDspCostInit();
+  VP8SSIMDspInit();
+  VP8LDspInit();
+  VP8LEncDspInit();
+  WebPInitAlphaProcessing();
+  VP8EncDspARGBInit();
+  VP8FiltersInit();
+  WebPRescalerDspInit();
+  WebPInitSamplers();
+  WebPInitUpsamplers();
+  WebPInitYUV444Converters();
+  WebPInitConvertARGBToYUV();
+}
+
+// Returns the number of calls to 'run' lasting at least 'min_time'.
+static int CalibrateKernel(KernelFunc run, double min_time) {
+  int count = 1;
+  for (;;) {
+    const double start = GetTime();
+    double elapsed;
+    int i;
+    for (i = 0; i < count; ++i) run();
+    elapsed = GetTime() - start;
+    if (elapsed >= min_time || count >= (1 << 28)) return count;
+    // aim slightly above 'min_time', growing at most 16x per round
+    count = (elapsed * 16 < min_time * 1.2) ? count * 16
+          : (int)(count * min_time * 1.2 / elapsed) + 1;
+  }
+}
+
+// Returns the average duration of 'count' calls to 'run', in nanoseconds.
+static double TimeKernel(KernelFunc run, int count) {
+  const double start = GetTime();
+  int i;
+  for (i = 0; i < count; ++i) run();
+  return 1e9 * (GetTime() - start) / count;
+}
+
+static void SetCPULevel(int level) {
+  VP8GetCPUInfo = kCPULevels[level].info;
+  InitDsp();
+}
+
+// A level can be detected at run-time but have no (or no new) kernels
+// compiled in: its dispatch is then the one of the level below, and timing
+// it would only measure noise.
+static void PrintCompiledCPULevels(void) {
+  printf("CPU levels compiled in: c");
+#if defined(WEBP_USE_SSE2)
+  printf(" sse2");
+#endif
+#if defined(WEBP_USE_SSE41)
+  printf(" sse4.1");
+#endif
+#if defined(WEBP_USE_AVX2)
+  printf(" avx2");
+#endif
+#if defined(WEBP_USE_NEON)
+  printf(" neon");
+#endif
+#if defined(WEBP_USE_MIPS32)
+  printf(" mips32");
+#endif
+#if defined(WEBP_USE_MIPS_DSP_R2)
+  printf(" mipsdspr2");
+#endif
+#if defined(WEBP_USE_MSA)
+  printf(" msa");
+#endif
+  printf("\n");
+}
+
+#define MAX_DISPATCH_SIZE 256   // bytes, for the largest pointer array
+
+// Returns true if the pointers of kernel 'k' differ from the ones seen at the
+// previous call, which are then updated.
+static int DispatchChanged(int k) {
+  static uint8_t prev[NUM_KERNELS][MAX_DISPATCH_SIZE];
+  uint8_t cur[MAX_DISPATCH_SIZE];
+  size_t size = 0;
+  int changed, j;
+  memset(cur, 0, sizeof(cur));
+  for (j = 0; j < 2 && kKernels[k].dispatch[j].ptr != NULL; ++j) {
+    const DspPointer* const d = &kKernels[k].dispatch[j];
+    if (size + d->size > sizeof(cur)) break;
+    memcpy(cur + size, d->ptr, d->size);
+    size += d->size;
+  }
+  changed = memcmp(cur, prev[k], sizeof(cur)) != 0;
+  memcpy(prev[k], cur, sizeof(cur));
+  return changed;
+}
+
+// Stores in 'levels' the CPU levels that are available on this machine and
+// change at least one dispatched kernel, and returns their number. If not
+// NULL, 'same[k * NUM_CPU_LEVELS + i]' is set when kernel 'k' dispatches to
+// the same functions at 'levels[i]' as at 'levels[i - 1]'. Skipped levels are
+// reported if 'verbose' is true. Leaves the plain-C level set.
+static int SelectCPULevels(int levels[], uint8_t* const same, int verbose) {
+  int changed[NUM_KERNELS];
+  int num_levels = 0;
+  int i, k;
+  if (verbose) {
+    PrintCompiledCPULevels();
+    printf("CPU levels available:");
+  }
+  for (i = 0; i < NUM_CPU_LEVELS; ++i) {
+    const int available = (kCPULevels[i].info == NULL) ||
+        (real_cpu_info != NULL && real_cpu_info(kCPULevels[i].top_feature));
+    int any_change = (num_levels == 0);
+    if (!available) continue;
+    SetCPULevel(i);
+    for (k = 0; k < NUM_KERNELS; ++k) {
+      changed[k] = DispatchChanged(k) || (num_levels == 0);
+      any_change |= changed[k];
+    }
+    if (verbose) {
+      printf(" %s%s", kCPULevels[i].name,
+             any_change ? "" : " (skipped: same kernels as the level below)");
+    }
+    if (!any_change) continue;
+    if (same != NULL) {
+      for (k = 0; k < NUM_KERNELS; ++k) {
+        same[k * NUM_CPU_LEVELS + num_levels] = !changed[k];
+      }
+    }
+    levels[num_levels++] = i;
+  }
+  if (verbose) printf("\n");
+  SetCPULevel(0);
+  return num_levels;
+}
+
+// Each kernel is timed DSP_REPEATS times per CPU level, the levels being
+// interleaved (in alternating order) so that frequency changes and other
+// machine noise affect them alike. The best time is reported.
+#define DSP_REPEATS 7
+
+static int BenchDsp(double min_time) {
+  double* const times =
+      (double*)malloc(NUM_KERNELS * NUM_CPU_LEVELS * sizeof(*times));
+  uint8_t same[NUM_KERNELS * NUM_CPU_LEVELS];
+  int levels[NUM_CPU_LEVELS];
+  int counts[NUM_CPU_LEVELS];
+  int num_levels;
+  int i, k, r;
+
+  if (times == NULL || !InitKernelData()) {
+    free(times);
+    FreeKernelData();
+    return 0;
+  }
+  real_cpu_info = VP8GetCPUInfo;
+  num_levels = SelectCPULevels(levels, same, 1);
+  for (k = 0; k < NUM_KERNELS; ++k) {
+    double* const t = times + k * NUM_CPU_LEVELS;
+    const uint8_t* const s = same + k * NUM_CPU_LEVELS;
+    for (i = 0; i < num_levels; ++i) {
+      t[i] = -1.;
+      if (s[i]) continue;
+      SetCPULevel(levels[i]);
+      counts[i] = CalibrateKernel(kKernels[k].run, min_time);
+    }
+    for (r = 0; r < DSP_REPEATS; ++r) {
+      for (i = 0; i < num_levels; ++i) {
+        const int l = (r & 1) ? num_levels - 1 - i : i;
+        double time;
+        if (s[l]) continue;
+        SetCPULevel(levels[l]);
+        time = TimeKernel(kKernels[k].run, counts[l]);
+        if (t[l] < 0. || time < t[l]) t[l] = time;
+      }
+    }
+  }
+  VP8GetCPUInfo = real_cpu_info;
+  InitDsp();
+
+  printf("== dsp kernels: ns/call, best of %d runs of %.3fs/kernel, %dx%d "
+         "pixels for row/plane kernels ==\n", DSP_REPEATS, min_time, KW, KH);
+  printf("('=': same function as the level on the left, not timed)\n");
+  printf("%-34s", "kernel");
+  for (i = 0; i < num_levels; ++i) printf(" %9s", kCPULevels[levels[i]].name);
+  if (num_levels > 1) printf(" %8s", "speedup");
+  printf("\n");
+  for (k = 0; k < NUM_KERNELS; ++k) {
+    const double* const t = times + k * NUM_CPU_LEVELS;
+    const uint8_t* const s = same + k * NUM_CPU_LEVELS;
+    double last = t[0];
+    printf("%-34s", kKernels[k].name);
+    for (i = 0; i < num_levels; ++i) {
+      if (s[i]) {
+        printf(" %9s", "=");
+      } else {
+        printf(" %9.1f", t[i]);
+        last = t[i];
+      }
+    }
+    if (num_levels > 1) printf(" %7.2fx", t[0] / last);
+    printf("\n");
+  }
+  free(times);
+  FreeKernelData();
+  return 1;
+}
+
+// Lossy encoding at -m 6 (trellis quantization of every block) for each CPU
+// level. The dispatched functions must not change the bitstream, so the
+// output of each level is checked against the plain-C one.
+static int BenchTrellis(const BenchParams* const params) {
+  const double mpixels = 1e-6 * params->width * params->height;
+  uint8_t* const rgba =
+      NewPicture(CONTENT_PHOTO, params->width, params->height);
+  WebPMemoryWriter ref;
+  EncodeArgs args;
+  BenchResult result;
+  int levels[NUM_CPU_LEVELS];
+  int num_levels;
+  int ok = (rgba != NULL);
+  int l;
+
+  WebPMemoryWriterInit(&ref);
+  WebPMemoryWriterInit(&args.writer);
+  args.rgba = rgba;
+  args.width = params->width;
+  args.height = params->height;
+  ok = ok && InitConfig(&args.config, params, 0, 6);
+  if (ok) {
+    printf("== encode photo lossy -m 6 per CPU level: %dx%d, q=%.0f ==\n",
+           params->width, params->height, params->quality);
+    printf("%-34s %8s %9s %9s %s\n",
+           "level", "MP/s", "ms/call", "bytes", "bitstream");
+  }
+  real_cpu_info = VP8GetCPUInfo;
+  num_levels = SelectCPULevels(levels, NULL, 0);
+  for (l = 0; ok && l < num_levels; ++l) {
+    const int i = levels[l];
+    SetCPULevel(i);
+    ok = RunBench(Encode, &args, params->min_time, &result);
+    if (ok) {
+      const int is_ref = (ref.mem == NULL);
+      const int same = !is_ref && args.writer.size == ref.size &&
+                       !memcmp(args.writer.mem, ref.mem, ref.size);
+      printf("%-34s %8.2f %9.2f %9d %s\n", kCPULevels[i].name,
+             mpixels / result.time, 1000. * result.time,
+             (int)args.writer.size,
+             is_ref ? "reference" : same ? "identical" : "MISMATCH");
+      ok = is_ref || same;
+      if (is_ref) {   // keep the plain-C output
+        ref = args.writer;
+        WebPMemoryWriterInit(&args.writer);
+      }
+    }
+  }
+  VP8GetCPUInfo = real_cpu_info;
+  InitDsp();
+  WebPMemoryWriterClear(&args.writer);
+  WebPMemoryWriterClear(&ref);
+  free(rgba);
+  if (!ok) fprintf(stderr, "Error: trellis benchmark failed.\n");
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+
+static void Help(void) {
+  printf("Usage: webp_bench [options]\n\n");
+  printf("Encodes and decodes a synthetic corpus and times the dsp kernels.\n");
+  printf("Options:\n");
+  printf("  -h / -help ............. this help\n");
+  printf("  -size <int>x<int> ...... picture size (default: 512x384)\n");
+  printf("  -frames <int> .......... number of animation frames (default: 8,"
+         "\n                           0 disables the animation tests)\n");
+  printf("  -q <float> ............. encoding quality (default: 75)\n");
+  printf("  -time <float> .......... minimum duration of each codec test, "
+         "in seconds\n                           (default: 0.5)\n");
+  printf("  -dsp_time <float> ...... minimum duration of each dsp kernel "
+         "run, in seconds\n                           (default: 0.005, best of "
+         "%d runs)\n", DSP_REPEATS);
+  printf("  -mt .................... use multi-threading\n");
+  printf("  -codec ................. only run the codec tests\n");
+  printf("  -dsp ................... only run the dsp kernel tests (and the "
+         "-m 6\n                           encoding per CPU level)\n");
+}
+
+int main(int argc, const char* argv[]) {
+  BenchParams params;
+  double dsp_time = 0.005;
+  int run_codec = 1, run_dsp = 1;
+  int ok = 1;
+  int c;
+
+  params.width = 512;
+  params.height = 384;
+  params.num_frames = 8;
+  params.quality = 75.f;
+  params.use_threads = 0;
+  params.min_time = 0.5;
+
+  for (c = 1; c < argc; ++c) {
+    int parse_error = 0;
+    if (!strcmp(argv[c], "-h") || !strcmp(argv[c], "-help")) {
+      Help();
+      return 0;
+    } else if (!strcmp(argv[c], "-size") && c < argc - 1) {
+      parse_error = (sscanf(argv[++c], "%dx%d",
+                            &params.width, &params.height) != 2 ||
+                     params.width < 16 || params.height < 16 ||
+                     params.width > 8192 || params.height > 8192);
+    } else if (!strcmp(argv[c], "-frames") && c < argc - 1) {
+      params.num_frames = atoi(argv[++c]);
+      parse_error = (params.num_frames < 0 || params.num_frames > 256);
+    } else if (!strcmp(argv[c], "-q") && c < argc - 1) {
+      params.quality = (float)atof(argv[++c]);
+      parse_error = (params.quality < 0.f || params.quality > 100.f);
+    } else if (!strcmp(argv[c], "-time") && c < argc - 1) {
+      params.min_time = atof(argv[++c]);
+      parse_error = (params.min_time < 0.);
+    } else if (!strcmp(argv[c], "-dsp_time") && c < argc - 1) {
+      dsp_time = atof(argv[++c]);
+      parse_error = (dsp_time < 0.);
+    } else if (!strcmp(argv[c], "-mt")) {
+      params.use_threads = 1;
+    } else if (!strcmp(argv[c], "-codec")) {
+      run_dsp = 0;
+    } else if (!strcmp(argv[c], "-dsp")) {
+      run_codec = 0;
+    } else {
+      fprintf(stderr, "Unknown option '%s'\n", argv[c]);
+      Help();
+      return -1;
+    }
+    if (parse_error) {
+      fprintf(stderr, "Invalid value for option '%s'\n", argv[c - 1]);
+      return -1;
+    }
+  }
+
+  if (run_codec) ok = BenchCodec(&params);
+  if (ok && run_codec && run_dsp) printf("\n");
+  if (ok && run_dsp) ok = BenchDsp(dsp_time);
+  if (ok && run_dsp) {
+    printf("\n");
+    ok = BenchTrellis(&params);
+  }
+  return ok ? 0 : 1;
+}
@@ -151,11 +151,16 @@ static int AllocateAlphaPlane(VP8Decoder* const dec, const VP8Io* const io) {
   const int stride = io->width;
   const int height = io->crop_bottom;
   const uint64_t alpha_size = (uint64_t)stride * height;
-  assert(dec->alpha_plane_mem_ == NULL);
-  dec->alpha_plane_mem_ =
-      (uint8_t*)WebPSafeMalloc(alpha_size, sizeof(*dec->alpha_plane_));
-  if (dec->alpha_plane_mem_ == NULL) {
-    return 0;
+  // The plane kept by VP8Reset() is reused if it is large enough.
+  if (alpha_size > dec->alpha_plane_mem_size_) {
+    WebPSafeFree(dec->alpha_plane_mem_);
+    dec->alpha_plane_mem_size_ = 0;
+    dec->alpha_plane_mem_ =
+        (uint8_t*)WebPSafeMalloc(alpha_size, sizeof(*dec->alpha_plane_));
+    if (dec->alpha_plane_mem_ == NULL) {
+      return 0;
+    }
+    dec->alpha_plane_mem_size_ = (size_t)alpha_size;
   }
   dec->alpha_plane_ = dec->alpha_plane_mem_;
   dec->alpha_prev_line_ = NULL;
@@ -166,6 +171,14 @@ void WebPDeallocateAlphaMemory(VP8Decoder* const dec) {
   assert(dec != NULL);
   WebPSafeFree(dec->alpha_plane_mem_);
   dec->alpha_plane_mem_ = NULL;
+  dec->alpha_plane_mem_size_ = 0;
+  dec->alpha_plane_ = NULL;
+  ALPHDelete(dec->alph_dec_);
+  dec->alph_dec_ = NULL;
+}
+
+void WebPResetAlphaMemory(VP8Decoder* const dec) {
+  assert(dec != NULL);
   dec->alpha_plane_ = NULL;
   ALPHDelete(dec->alph_dec_);
   dec->alph_dec_ = NULL;
@@ -45,6 +45,9 @@ struct ALPHDecoder {
 // Deallocate memory associated to dec->alpha_plane_ decoding
 void WebPDeallocateAlphaMemory(VP8Decoder* const dec);
 
+// Same, but keeps the memory of dec->alpha_plane_ for the next picture.
+void WebPResetAlphaMemory(VP8Decoder* const dec);
+
 //------------------------------------------------------------------------------
 
 #ifdef __cplusplus
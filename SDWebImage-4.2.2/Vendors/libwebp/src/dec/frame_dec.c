@@ -496,6 +496,28 @@ static int FinishRow(VP8Decoder* const dec, VP8Io* const io) {
 
 #undef MACROBLOCK_VPOS
 
+// Reconstruct, filter and transmit the group of rows described by the thread
+// context (mt_method_=3). Return false in case of user-abort.
+static int FinishRows(VP8Decoder* const dec, VP8Io* const io) {
+  int ok = 1;
+  int n;
+  VP8ThreadContext* const ctx = &dec->thread_ctx_;
+  const int first_row = ctx->mb_y_;
+  VP8MBData* const mb_data = ctx->mb_data_;
+  VP8FInfo* const f_info = ctx->f_info_;
+  for (n = 0; ok && n < ctx->num_rows_; ++n) {
+    const int mb_y = first_row + n;
+    ctx->mb_y_ = mb_y;
+    ctx->filter_row_ = (dec->filter_type_ > 0) &&
+                       (mb_y >= dec->tl_mb_y_) && (mb_y <= dec->br_mb_y_);
+    ctx->mb_data_ = mb_data + n * dec->mb_w_;
+    ctx->f_info_ = (f_info != NULL) ? f_info + n * dec->mb_w_ : NULL;
+    ReconstructRow(dec, ctx);
+    ok = FinishRow(dec, io);
+  }
+  return ok;
+}
+
 //------------------------------------------------------------------------------
 
 int VP8ProcessRow(VP8Decoder* const dec, VP8Io* const io) {
@@ -543,6 +565,26 @@ int VP8ProcessRow(VP8Decoder* const dec, VP8Io* const io) {
   return ok;
 }
 
+int VP8ProcessRows(VP8Decoder* const dec, VP8Io* const io,
+                   int mb_y, int num_rows,
+                   VP8MBData* const mb_data, VP8FInfo* const f_info) {
+  WebPWorker* const worker = &dec->worker_;
+  VP8ThreadContext* const ctx = &dec->thread_ctx_;
+  // Finish previous job *before* updating context
+  const int ok = WebPGetWorkerInterface()->Sync(worker);
+  assert(dec->mt_method_ == 3);
+  if (ok) {
+    ctx->io_ = *io;
+    ctx->id_ = 0;
+    ctx->mb_y_ = mb_y;
+    ctx->num_rows_ = num_rows;
+    ctx->mb_data_ = mb_data;
+    ctx->f_info_ = f_info;
+    WebPGetWorkerInterface()->Launch(worker);
+  }
+  return ok;
+}
+
 //------------------------------------------------------------------------------
 // Finish setting up the decoding parameter once user's setup() is called.
 
@@ -651,9 +693,16 @@ static int InitThreadContext(VP8Decoder* const dec) {
     }
     worker->data1 = dec;
     worker->data2 = (void*)&dec->thread_ctx_.io_;
-    worker->hook = (WebPWorkerHook)FinishRow;
-    dec->num_caches_ =
-      (dec->filter_type_ > 0) ? MT_CACHE_LINES : MT_CACHE_LINES - 1;
+    if (dec->mt_method_ == 3) {
+      // Reconstruction, filtering and output all happen in the worker, one
+      // row after the other: no need for extra cache lines.
+      worker->hook = (WebPWorkerHook)FinishRows;
+      dec->num_caches_ = ST_CACHE_LINES;
+    } else {
+      worker->hook = (WebPWorkerHook)FinishRow;
+      dec->num_caches_ =
+        (dec->filter_type_ > 0) ? MT_CACHE_LINES : MT_CACHE_LINES - 1;
+    }
   } else {
     dec->num_caches_ = ST_CACHE_LINES;
   }
@@ -669,9 +718,10 @@ int VP8GetThreadMethod(const WebPDecoderOptions* const options,
   (void)headers;
   (void)width;
   (void)height;
-  assert(headers == NULL || !headers->is_lossless);
 #if defined(WEBP_USE_THREAD)
   if (width < MIN_WIDTH_FOR_THREADS) return 0;
+  // Lossless only has one method: [entropy decoding][transforms+output]
+  if (headers != NULL && headers->is_lossless) return 1;
   // TODO(skal): tune the heuristic further
 #if 0
   if (height < 2 * width) return 2;
@@ -691,17 +741,21 @@ int VP8GetThreadMethod(const WebPDecoderOptions* const options,
 static int AllocateMemory(VP8Decoder* const dec) {
   const int num_caches = dec->num_caches_;
   const int mb_w = dec->mb_w_;
+  // Number of rows of parsed data: 2 groups of one row per partition for
+  // mt_method_=3, otherwise one row (plus the one being reconstructed).
+  const int num_parsed_rows =
+      (dec->mt_method_ == 3) ? 2 * (dec->num_parts_minus_one_ + 1) :
+      (dec->mt_method_ > 0) ? 2 : 1;
   // Note: we use 'size_t' when there's no overflow risk, uint64_t otherwise.
   const size_t intra_pred_mode_size = 4 * mb_w * sizeof(uint8_t);
   const size_t top_size = sizeof(VP8TopSamples) * mb_w;
   const size_t mb_info_size = (mb_w + 1) * sizeof(VP8MB);
   const size_t f_info_size =
-      (dec->filter_type_ > 0) ?
-          mb_w * (dec->mt_method_ > 0 ? 2 : 1) * sizeof(VP8FInfo)
-        : 0;
+      (dec->filter_type_ > 0) ? mb_w * num_parsed_rows * sizeof(VP8FInfo) : 0;
   const size_t yuv_size = YUV_SIZE * sizeof(*dec->yuv_b_);
   const size_t mb_data_size =
-      (dec->mt_method_ == 2 ? 2 : 1) * mb_w * sizeof(*dec->mb_data_);
+      (dec->mt_method_ == 1 ? 1 : num_parsed_rows) * mb_w *
+      sizeof(*dec->mb_data_);
   const size_t cache_height = (16 * num_caches
                             + kFilterExtraRows[dec->filter_type_]) * 3 / 2;
   const size_t cache_size = top_size * cache_height;
@@ -741,7 +795,8 @@ static int AllocateMemory(VP8Decoder* const dec) {
   mem += f_info_size;
   dec->thread_ctx_.id_ = 0;
   dec->thread_ctx_.f_info_ = dec->f_info_;
-  if (dec->mt_method_ > 0) {
+  dec->parsed_f_info_ = dec->f_info_;
+  if (dec->mt_method_ == 1 || dec->mt_method_ == 2) {
     // secondary cache line. The deblocking process need to make use of the
     // filtering strength from previous macroblock row, while the new ones
     // are being decoded in parallel. We'll just swap the pointers.
@@ -755,6 +810,7 @@ static int AllocateMemory(VP8Decoder* const dec) {
 
   dec->mb_data_ = (VP8MBData*)mem;
   dec->thread_ctx_.mb_data_ = (VP8MBData*)mem;
+  dec->parsed_mb_data_ = (VP8MBData*)mem;
   if (dec->mt_method_ == 2) {
     dec->thread_ctx_.mb_data_ += mb_w;
   }
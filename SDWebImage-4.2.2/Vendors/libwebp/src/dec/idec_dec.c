@@ -47,9 +47,17 @@ typedef enum {
 typedef enum {
   MEM_MODE_NONE = 0,
   MEM_MODE_APPEND,
-  MEM_MODE_MAP
+  MEM_MODE_MAP,
+  MEM_MODE_CHUNKS   // chain of caller's buffers, read in place
 } MemBufferMode;
 
+// Caller's buffer, in MEM_MODE_CHUNKS.
+typedef struct {
+  VP8InputSegment seg_;   // must be first: seg_.next_ links the chunks
+  WebPIReleaseChunkFunc release_;
+  void* user_data_;
+} MemChunk;
+
 // storage for partition #0 and partial data (in a rolling fashion)
 typedef struct {
   MemBufferMode mode_;  // Operation mode
@@ -60,6 +68,13 @@ typedef struct {
 
   size_t part0_size_;         // size of partition #0
   const uint8_t* part0_buf_;  // buffer to store partition #0
+
+  // MEM_MODE_CHUNKS only. start_ and end_ are positions in the whole input,
+  // buf_ is only used to gather the headers if they span several chunks, and
+  // part0_buf_ to gather partition #0 (else it's read in place).
+  MemChunk* first_chunk_;     // oldest chunk not released yet
+  MemChunk* last_chunk_;
+  size_t part0_pos_;          // position of partition #0
 } MemBuffer;
 
 struct WebPIDecoder {
@@ -217,20 +232,80 @@ static int RemapMemBuffer(WebPIDecoder* const idec,
   return 1;
 }
 
+// Links a new chunk at the end of the input, without copying it.
+static int AppendChunk(MemBuffer* const mem,
+                       const uint8_t* const data, size_t data_size,
+                       WebPIReleaseChunkFunc release, void* user_data) {
+  MemChunk* const chunk = (MemChunk*)WebPSafeMalloc(1ULL, sizeof(*chunk));
+  assert(mem->mode_ == MEM_MODE_CHUNKS);
+  assert(data_size > 0);
+  if (chunk == NULL) return 0;
+  chunk->seg_.data_ = data;
+  chunk->seg_.size_ = data_size;
+  chunk->seg_.offset_ = mem->end_;
+  chunk->seg_.next_ = NULL;
+  chunk->release_ = release;
+  chunk->user_data_ = user_data;
+  if (mem->last_chunk_ != NULL) {
+    mem->last_chunk_->seg_.next_ = &chunk->seg_;
+  } else {
+    mem->first_chunk_ = chunk;
+  }
+  mem->last_chunk_ = chunk;
+  mem->end_ += data_size;
+  return 1;
+}
+
+// Releases the chunks ending before position 'keep_pos'. The last chunk is
+// kept unless 'all' is true, as the bit-readers need it to reach the chunks
+// appended later.
+static void ReleaseChunks(MemBuffer* const mem, size_t keep_pos, int all) {
+  while (mem->first_chunk_ != NULL &&
+         (all || mem->first_chunk_ != mem->last_chunk_)) {
+    MemChunk* const chunk = mem->first_chunk_;
+    if (!all && chunk->seg_.offset_ + chunk->seg_.size_ >= keep_pos) break;
+    mem->first_chunk_ = (MemChunk*)chunk->seg_.next_;
+    if (chunk->release_ != NULL) {
+      chunk->release_(chunk->seg_.data_, chunk->seg_.size_, chunk->user_data_);
+    }
+    WebPSafeFree(chunk);
+  }
+  if (mem->first_chunk_ == NULL) mem->last_chunk_ = NULL;
+}
+
+static const VP8InputSegment* FindChunk(const MemBuffer* const mem,
+                                        size_t pos) {
+  assert(mem->first_chunk_ != NULL);
+  return VP8FindSegment(&mem->first_chunk_->seg_, pos);
+}
+
+// Returns a pointer to the 'size' bytes at position 'pos' if they are all in
+// the same chunk, NULL otherwise.
+static const uint8_t* GetChunkData(const MemBuffer* const mem,
+                                   size_t pos, size_t size) {
+  const VP8InputSegment* const seg = FindChunk(mem, pos);
+  if (pos + size > seg->offset_ + seg->size_) return NULL;
+  return seg->data_ + (pos - seg->offset_);
+}
+
 static void InitMemBuffer(MemBuffer* const mem) {
   mem->mode_       = MEM_MODE_NONE;
   mem->buf_        = NULL;
   mem->buf_size_   = 0;
   mem->part0_buf_  = NULL;
   mem->part0_size_ = 0;
+  mem->first_chunk_ = NULL;
+  mem->last_chunk_  = NULL;
+  mem->part0_pos_   = 0;
 }
 
 static void ClearMemBuffer(MemBuffer* const mem) {
   assert(mem);
-  if (mem->mode_ == MEM_MODE_APPEND) {
+  if (mem->mode_ == MEM_MODE_APPEND || mem->mode_ == MEM_MODE_CHUNKS) {
     WebPSafeFree(mem->buf_);
     WebPSafeFree((void*)mem->part0_buf_);
   }
+  ReleaseChunks(mem, 0, 1);
 }
 
 static int CheckMemBufferMode(MemBuffer* const mem, MemBufferMode expected) {
@@ -279,6 +354,17 @@ static void RestoreContext(const MBContext* context, VP8Decoder* const dec,
   *token_br = context->token_br_;
 }
 
+// Position in the input of the next byte read by segment bit-readers.
+static size_t BitReaderPos(const VP8BitReader* const br) {
+  assert(br->seg_ != NULL);
+  return br->seg_->offset_ + (size_t)(br->buf_ - br->seg_->data_);
+}
+
+static size_t LBitReaderPos(const VP8LBitReader* const br) {
+  assert(br->seg_ != NULL);
+  return br->seg_->offset_ + br->pos_;
+}
+
 //------------------------------------------------------------------------------
 
 static VP8StatusCode IDecError(WebPIDecoder* const idec, VP8StatusCode error) {
@@ -298,22 +384,60 @@ static void ChangeState(WebPIDecoder* const idec, DecState new_state,
   idec->state_ = new_state;
   mem->start_ += consumed_bytes;
   assert(mem->start_ <= mem->end_);
-  idec->io_.data = mem->buf_ + mem->start_;
-  idec->io_.data_size = MemDataSize(mem);
+  if (mem->mode_ != MEM_MODE_CHUNKS) {
+    idec->io_.data = mem->buf_ + mem->start_;
+    idec->io_.data_size = MemDataSize(mem);
+  }
+}
+
+// Parses the headers in MEM_MODE_CHUNKS. They're read in place from the chunk
+// at 'mem->start_' if possible. Otherwise, the data is gathered in mem->buf_,
+// doubling its size until the headers are complete.
+static VP8StatusCode ParseChunkHeaders(MemBuffer* const mem,
+                                       WebPHeaderStructure* const headers) {
+  const size_t avail = MemDataSize(mem);
+  const VP8InputSegment* const seg = FindChunk(mem, mem->start_);
+  size_t size = seg->offset_ + seg->size_ - mem->start_;
+  VP8StatusCode status;
+
+  headers->data = seg->data_ + (mem->start_ - seg->offset_);
+  headers->data_size = size;
+  headers->have_all_data = 0;
+  status = WebPParseHeaders(headers);
+  while (status == VP8_STATUS_NOT_ENOUGH_DATA && size < avail) {
+    size = (2 * size < avail) ? 2 * size : avail;
+    if (size > mem->buf_size_) {
+      WebPSafeFree(mem->buf_);
+      mem->buf_size_ = 0;
+      mem->buf_ = (uint8_t*)WebPSafeMalloc(1ULL, size);
+      if (mem->buf_ == NULL) return VP8_STATUS_OUT_OF_MEMORY;
+      mem->buf_size_ = size;
+    }
+    if (!VP8CopySegmentBytes(seg, mem->start_, mem->buf_, size)) {
+      return VP8_STATUS_BITSTREAM_ERROR;   // Not reached.
+    }
+    headers->data = mem->buf_;
+    headers->data_size = size;
+    headers->have_all_data = 0;
+    status = WebPParseHeaders(headers);
+  }
+  return status;
 }
 
 // Headers
 static VP8StatusCode DecodeWebPHeaders(WebPIDecoder* const idec) {
   MemBuffer* const mem = &idec->mem_;
-  const uint8_t* data = mem->buf_ + mem->start_;
-  size_t curr_size = MemDataSize(mem);
   VP8StatusCode status;
   WebPHeaderStructure headers;
 
-  headers.data = data;
-  headers.data_size = curr_size;
-  headers.have_all_data = 0;
-  status = WebPParseHeaders(&headers);
+  if (mem->mode_ == MEM_MODE_CHUNKS) {
+    status = ParseChunkHeaders(mem, &headers);
+  } else {
+    headers.data = mem->buf_ + mem->start_;
+    headers.data_size = MemDataSize(mem);
+    headers.have_all_data = 0;
+    status = WebPParseHeaders(&headers);
+  }
   if (status == VP8_STATUS_NOT_ENOUGH_DATA) {
     return VP8_STATUS_SUSPENDED;  // We haven't found a VP8 chunk yet.
   } else if (status != VP8_STATUS_OK) {
@@ -343,8 +467,10 @@ static VP8StatusCode DecodeWebPHeaders(WebPIDecoder* const idec) {
 }
 
 static VP8StatusCode DecodeVP8FrameHeader(WebPIDecoder* const idec) {
-  const uint8_t* data = idec->mem_.buf_ + idec->mem_.start_;
-  const size_t curr_size = MemDataSize(&idec->mem_);
+  MemBuffer* const mem = &idec->mem_;
+  const uint8_t* data = NULL;
+  size_t curr_size = MemDataSize(mem);
+  uint8_t tmp[VP8_FRAME_HEADER_SIZE];
   int width, height;
   uint32_t bits;
 
@@ -352,15 +478,28 @@ static VP8StatusCode DecodeVP8FrameHeader(WebPIDecoder* const idec) {
     // Not enough data bytes to extract VP8 Frame Header.
     return VP8_STATUS_SUSPENDED;
   }
+  if (mem->mode_ == MEM_MODE_CHUNKS) {
+    data = GetChunkData(mem, mem->start_, VP8_FRAME_HEADER_SIZE);
+    if (data == NULL) {
+      VP8CopySegmentBytes(FindChunk(mem, mem->start_), mem->start_,
+                          tmp, VP8_FRAME_HEADER_SIZE);
+      data = tmp;
+    }
+    curr_size = VP8_FRAME_HEADER_SIZE;
+  } else {
+    data = mem->buf_ + mem->start_;
+  }
   if (!VP8GetInfo(data, curr_size, idec->chunk_size_, &width, &height)) {
     return IDecError(idec, VP8_STATUS_BITSTREAM_ERROR);
   }
 
   bits = data[0] | (data[1] << 8) | (data[2] << 16);
-  idec->mem_.part0_size_ = (bits >> 5) + VP8_FRAME_HEADER_SIZE;
+  mem->part0_size_ = (bits >> 5) + VP8_FRAME_HEADER_SIZE;
 
-  idec->io_.data = data;
-  idec->io_.data_size = curr_size;
+  if (mem->mode_ != MEM_MODE_CHUNKS) {
+    idec->io_.data = data;
+    idec->io_.data_size = curr_size;
+  }
   idec->state_ = STATE_VP8_PARTS0;
   return VP8_STATUS_OK;
 }
@@ -372,7 +511,6 @@ static VP8StatusCode CopyParts0Data(WebPIDecoder* const idec) {
   const size_t part_size = br->buf_end_ - br->buf_;
   MemBuffer* const mem = &idec->mem_;
   assert(!idec->is_lossless_);
-  assert(mem->part0_buf_ == NULL);
   // the following is a format limitation, no need for runtime check:
   assert(part_size <= mem->part0_size_);
   if (part_size == 0) {   // can't have zero-size partition #0
@@ -380,7 +518,9 @@ static VP8StatusCode CopyParts0Data(WebPIDecoder* const idec) {
   }
   if (mem->mode_ == MEM_MODE_APPEND) {
     // We copy and grab ownership of the partition #0 data.
-    uint8_t* const part0_buf = (uint8_t*)WebPSafeMalloc(1ULL, part_size);
+    uint8_t* part0_buf;
+    assert(mem->part0_buf_ == NULL);
+    part0_buf = (uint8_t*)WebPSafeMalloc(1ULL, part_size);
     if (part0_buf == NULL) {
       return VP8_STATUS_OUT_OF_MEMORY;
     }
@@ -388,12 +528,41 @@ static VP8StatusCode CopyParts0Data(WebPIDecoder* const idec) {
     mem->part0_buf_ = part0_buf;
     VP8BitReaderSetBuffer(br, part0_buf, part_size);
   } else {
-    // Else: just keep pointers to the partition #0's data in dec_->br_.
+    // Else: just keep pointers to the partition #0's data in dec_->br_. In
+    // MEM_MODE_CHUNKS, it was already gathered by SetupChunkParts0() if
+    // needed.
   }
   mem->start_ += part_size;
   return VP8_STATUS_OK;
 }
 
+// In MEM_MODE_CHUNKS, points io->data to the frame header and partition #0.
+// They're read in place if they're in a single chunk, and gathered in
+// mem->part0_buf_ otherwise. The other partitions are read from the chunks.
+static int SetupChunkParts0(WebPIDecoder* const idec) {
+  VP8Decoder* const dec = (VP8Decoder*)idec->dec_;
+  MemBuffer* const mem = &idec->mem_;
+  const size_t size = mem->part0_size_;
+  const uint8_t* data = GetChunkData(mem, mem->start_, size);
+  assert(mem->mode_ == MEM_MODE_CHUNKS);
+  if (data == NULL) {
+    if (mem->part0_buf_ == NULL) {  // else: already gathered by a previous call
+      uint8_t* const part0_buf = (uint8_t*)WebPSafeMalloc(1ULL, size);
+      if (part0_buf == NULL) return 0;
+      VP8CopySegmentBytes(FindChunk(mem, mem->start_), mem->start_,
+                          part0_buf, size);
+      mem->part0_buf_ = part0_buf;
+    }
+    data = mem->part0_buf_;
+  }
+  mem->part0_pos_ = mem->start_;
+  dec->input_ = FindChunk(mem, mem->start_);
+  dec->input_pos_ = mem->start_;
+  idec->io_.data = data;
+  idec->io_.data_size = size;
+  return 1;
+}
+
 static VP8StatusCode DecodePartition0(WebPIDecoder* const idec) {
   VP8Decoder* const dec = (VP8Decoder*)idec->dec_;
   VP8Io* const io = &idec->io_;
@@ -404,6 +573,9 @@ static VP8StatusCode DecodePartition0(WebPIDecoder* const idec) {
   if (MemDataSize(&idec->mem_) < idec->mem_.part0_size_) {
     return VP8_STATUS_SUSPENDED;
   }
+  if (idec->mem_.mode_ == MEM_MODE_CHUNKS && !SetupChunkParts0(idec)) {
+    return IDecError(idec, VP8_STATUS_OUT_OF_MEMORY);
+  }
 
   if (!VP8GetHeaders(dec, io)) {
     const VP8StatusCode status = dec->status_;
@@ -478,7 +650,9 @@ static VP8StatusCode DecodeRemaining(WebPIDecoder* const idec) {
       }
       // Release buffer only if there is only one partition
       if (dec->num_parts_minus_one_ == 0) {
-        idec->mem_.start_ = token_br->buf_ - idec->mem_.buf_;
+        idec->mem_.start_ =
+            (idec->mem_.mode_ == MEM_MODE_CHUNKS) ? BitReaderPos(token_br)
+                : (size_t)(token_br->buf_ - idec->mem_.buf_);
         assert(idec->mem_.start_ <= idec->mem_.end_);
       }
     }
@@ -518,6 +692,10 @@ static VP8StatusCode DecodeVP8LHeader(WebPIDecoder* const idec) {
     dec->status_ = VP8_STATUS_SUSPENDED;
     return ErrorStatusLossless(idec, dec->status_);
   }
+  if (idec->mem_.mode_ == MEM_MODE_CHUNKS) {
+    dec->input_ = FindChunk(&idec->mem_, idec->mem_.start_);
+    dec->input_pos_ = idec->mem_.start_;
+  }
 
   if (!VP8LDecodeHeader(dec, io)) {
     if (dec->status_ == VP8_STATUS_BITSTREAM_ERROR &&
@@ -582,6 +760,33 @@ static VP8StatusCode IDecode(WebPIDecoder* idec) {
   return status;
 }
 
+// In MEM_MODE_CHUNKS, releases the chunks that won't be read anymore.
+static void ReleaseUsedChunks(WebPIDecoder* const idec) {
+  MemBuffer* const mem = &idec->mem_;
+  size_t keep_pos = mem->start_;
+  assert(mem->mode_ == MEM_MODE_CHUNKS);
+  if (idec->state_ == STATE_DONE) {
+    ReleaseChunks(mem, 0, 1);
+    return;
+  } else if (idec->state_ == STATE_ERROR) {
+    return;   // Released by WebPIDelete().
+  } else if (idec->state_ == STATE_VP8_DATA) {
+    const VP8Decoder* const dec = (VP8Decoder*)idec->dec_;
+    uint32_t p;
+    // Compressed alpha data, if not gathered, is read in place from a chunk.
+    if (NeedCompressedAlpha(idec)) return;
+    if (mem->part0_buf_ == NULL) keep_pos = mem->part0_pos_;
+    for (p = 0; p <= dec->num_parts_minus_one_; ++p) {
+      const size_t pos = BitReaderPos(&dec->parts_[p]);
+      if (pos < keep_pos) keep_pos = pos;
+    }
+  } else if (idec->state_ == STATE_VP8L_DATA) {
+    // Note: the bit-reader is rewound to its last saved state when suspended.
+    keep_pos = LBitReaderPos(&((VP8LDecoder*)idec->dec_)->br_);
+  }
+  ReleaseChunks(mem, keep_pos, 0);
+}
+
 //------------------------------------------------------------------------------
 // Internal constructor
 
@@ -804,6 +1009,40 @@ VP8StatusCode WebPIUpdate(WebPIDecoder* idec,
   return IDecode(idec);
 }
 
+VP8StatusCode WebPIAppendChunk(WebPIDecoder* idec,
+                               const uint8_t* data, size_t data_size,
+                               WebPIReleaseChunkFunc release,
+                               void* user_data) {
+  VP8StatusCode status;
+  if (idec == NULL || data == NULL) {
+    status = VP8_STATUS_INVALID_PARAM;
+    goto NotAppended;
+  }
+  status = IDecCheckStatus(idec);
+  if (status != VP8_STATUS_SUSPENDED) {
+    goto NotAppended;
+  }
+  // Check mixed calls with AppendToMemBuffer and RemapMemBuffer.
+  if (!CheckMemBufferMode(&idec->mem_, MEM_MODE_CHUNKS)) {
+    status = VP8_STATUS_INVALID_PARAM;
+    goto NotAppended;
+  }
+  if (data_size == 0) {
+    goto NotAppended;    // Nothing new to decode.
+  }
+  if (!AppendChunk(&idec->mem_, data, data_size, release, user_data)) {
+    status = VP8_STATUS_OUT_OF_MEMORY;
+    goto NotAppended;
+  }
+  status = IDecode(idec);
+  ReleaseUsedChunks(idec);
+  return status;
+
+ NotAppended:
+  if (release != NULL && data != NULL) release(data, data_size, user_data);
+  return status;
+}
+
 //------------------------------------------------------------------------------
 
 static const WebPDecBuffer* GetOutputBuffer(const WebPIDecoder* const idec) {
@@ -57,8 +57,12 @@ int VP8InitIoInternal(VP8Io* const io, int version) {
 VP8Decoder* VP8New(void) {
   VP8Decoder* const dec = (VP8Decoder*)WebPSafeCalloc(1ULL, sizeof(*dec));
   if (dec != NULL) {
+    int n;
     SetOk(dec);
     WebPGetWorkerInterface()->Init(&dec->worker_);
+    for (n = 0; n < MAX_NUM_PARTITIONS; ++n) {
+      WebPGetWorkerInterface()->Init(&dec->parse_workers_[n]);
+    }
     dec->ready_ = 0;
     dec->num_parts_minus_one_ = 0;
     InitGetCoeffs();
@@ -226,6 +230,39 @@ static VP8StatusCode ParsePartitions(VP8Decoder* const dec,
            VP8_STATUS_SUSPENDED;   // Init is ok, but there's not enough data
 }
 
+// Same as ParsePartitions(), for partitions starting at position 'pos' of the
+// segmented input.
+static VP8StatusCode ParseSegmentPartitions(VP8Decoder* const dec,
+                                            size_t pos) {
+  VP8BitReader* const br = &dec->br_;
+  const VP8InputSegment* const input = dec->input_;
+  const VP8InputSegment* last_seg;
+  uint8_t sz[3 * (MAX_NUM_PARTITIONS - 1)];
+  size_t input_end;
+  size_t last_part;
+  size_t p;
+
+  dec->num_parts_minus_one_ = (1 << VP8GetValue(br, 2)) - 1;
+  last_part = dec->num_parts_minus_one_;
+  if (!VP8CopySegmentBytes(input, pos, sz, 3 * last_part)) {
+    return VP8_STATUS_NOT_ENOUGH_DATA;
+  }
+  pos += last_part * 3;
+  for (p = 0; p < last_part; ++p) {
+    const size_t psize =
+        sz[3 * p + 0] | (sz[3 * p + 1] << 8) | (sz[3 * p + 2] << 16);
+    // Unlike with a flat buffer, partitions are not truncated to the data
+    // available yet: the readers will pick up segments appended later.
+    VP8InitSegmentBitReader(dec->parts_ + p, input, pos, pos + psize);
+    pos += psize;
+  }
+  VP8InitSegmentBitReader(dec->parts_ + last_part, input, pos, (size_t)-1);
+  last_seg = VP8FindSegment(input, pos);
+  input_end = last_seg->offset_ + last_seg->size_;
+  return (pos < input_end) ? VP8_STATUS_OK :
+           VP8_STATUS_SUSPENDED;   // Init is ok, but there's not enough data
+}
+
 // Paragraph 9.4
 static int ParseFilterHeader(VP8BitReader* br, VP8Decoder* const dec) {
   VP8FilterHeader* const hdr = &dec->filter_hdr_;
@@ -364,7 +401,9 @@ int VP8GetHeaders(VP8Decoder* const dec, VP8Io* const io) {
     return VP8SetError(dec, VP8_STATUS_BITSTREAM_ERROR,
                        "cannot parse filter header");
   }
-  status = ParsePartitions(dec, buf, buf_size);
+  status = (dec->input_ != NULL) ?
+      ParseSegmentPartitions(dec, dec->input_pos_ + (buf - io->data)) :
+      ParsePartitions(dec, buf, buf_size);
   if (status != VP8_STATUS_OK) {
     return VP8SetError(dec, status, "cannot parse partitions");
   }
@@ -507,14 +546,14 @@ static WEBP_INLINE uint32_t NzCodeBits(uint32_t nz_coeffs, int nz, int dc_nz) {
   return nz_coeffs;
 }
 
-static int ParseResiduals(VP8Decoder* const dec,
-                          VP8MB* const mb, VP8BitReader* const token_br) {
-  const VP8BandProbas* (* const bands)[16 + 1] = dec->proba_.bands_ptr_;
+static int ParseResiduals(const VP8Decoder* const dec,
+                          VP8MB* const mb, VP8MB* const left_mb,
+                          VP8MBData* const block,
+                          VP8BitReader* const token_br) {
+  const VP8BandProbas* const (* const bands)[16 + 1] = dec->proba_.bands_ptr_;
   const VP8BandProbas* const * ac_proba;
-  VP8MBData* const block = dec->mb_data_ + dec->mb_x_;
   const VP8QuantMatrix* const q = &dec->dqm_[block->segment_];
   int16_t* dst = block->coeffs_;
-  VP8MB* const left_mb = dec->mb_info_ - 1;
   uint8_t tnz, lnz;
   uint32_t non_zero_y = 0;
   uint32_t non_zero_uv = 0;
@@ -601,14 +640,17 @@ static int ParseResiduals(VP8Decoder* const dec,
 //------------------------------------------------------------------------------
 // Main loop
 
-int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
-  VP8MB* const left = dec->mb_info_ - 1;
-  VP8MB* const mb = dec->mb_info_ + dec->mb_x_;
-  VP8MBData* const block = dec->mb_data_ + dec->mb_x_;
+// Decodes the macroblock at position 'mb_x' of the row whose parsed data is
+// 'mb_data' (and filter strengths 'f_info'), given its left context.
+static int DecodeMB(const VP8Decoder* const dec, int mb_x,
+                    VP8MB* const left, VP8MBData* const mb_data,
+                    VP8FInfo* const f_info, VP8BitReader* const token_br) {
+  VP8MB* const mb = dec->mb_info_ + mb_x;
+  VP8MBData* const block = mb_data + mb_x;
   int skip = dec->use_skip_proba_ ? block->skip_ : 0;
 
   if (!skip) {
-    skip = ParseResiduals(dec, mb, token_br);
+    skip = ParseResiduals(dec, mb, left, block, token_br);
   } else {
     left->nz_ = mb->nz_ = 0;
     if (!block->is_i4x4_) {
@@ -620,7 +662,7 @@ int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
   }
 
   if (dec->filter_type_ > 0) {  // store filter info
-    VP8FInfo* const finfo = dec->f_info_ + dec->mb_x_;
+    VP8FInfo* const finfo = f_info + mb_x;
     *finfo = dec->fstrengths_[block->segment_][block->is_i4x4_];
     finfo->f_inner_ |= !skip;
   }
@@ -628,6 +670,11 @@ int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
   return !token_br->eof_;
 }
 
+int VP8DecodeMB(VP8Decoder* const dec, VP8BitReader* const token_br) {
+  return DecodeMB(dec, dec->mb_x_, dec->mb_info_ - 1, dec->mb_data_,
+                  dec->f_info_, token_br);
+}
+
 void VP8InitScanline(VP8Decoder* const dec) {
   VP8MB* const left = dec->mb_info_ - 1;
   left->nz_ = 0;
@@ -636,7 +683,127 @@ void VP8InitScanline(VP8Decoder* const dec) {
   dec->mb_x_ = 0;
 }
 
+//------------------------------------------------------------------------------
+// Partition-parallel parsing (mt_method_=3)
+//
+// Token partitions can be parsed independently, except for the top context
+// (dec->mb_info_) which makes the macroblock at (x, y) depend on (x, y - 1).
+// Rows are hence parsed by groups of one row per partition, as a wavefront:
+// the picture is split vertically into chunks of PARSE_CHUNK_SIZE macroblocks
+// and, at each step, row #n of the group parses the chunk on the left of the
+// one just parsed by row #n-1. Rows don't share any other state: the left
+// context is part of the VP8ParseJob. Meanwhile, the previous group of rows is
+// reconstructed, filtered and emitted by dec->worker_.
+
+#define PARSE_CHUNK_SIZE 16   // in macroblocks
+
+// Worker hook: parses the tokens of the macroblocks in [first_mb_x_,
+// last_mb_x_). Returns false if there is not enough data.
+static int ParseTokens(const VP8Decoder* const dec, VP8ParseJob* const job) {
+  int mb_x;
+  if (job->first_mb_x_ == 0) {   // start of the row
+    job->left_.nz_ = 0;
+    job->left_.nz_dc_ = 0;
+  }
+  for (mb_x = job->first_mb_x_; mb_x < job->last_mb_x_; ++mb_x) {
+    if (!DecodeMB(dec, mb_x, &job->left_, job->mb_data_, job->f_info_,
+                  job->br_)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int InitParseWorkers(VP8Decoder* const dec) {
+  int n;
+  for (n = 1; n <= (int)dec->num_parts_minus_one_; ++n) {
+    WebPWorker* const worker = &dec->parse_workers_[n];
+    if (!WebPGetWorkerInterface()->Reset(worker)) {
+      return VP8SetError(dec, VP8_STATUS_OUT_OF_MEMORY,
+                         "thread initialization failed.");
+    }
+    worker->data1 = dec;
+    worker->data2 = &dec->parse_jobs_[n];
+    worker->hook = (WebPWorkerHook)ParseTokens;
+  }
+  return 1;
+}
+
+static int ParseFrameMT(VP8Decoder* const dec, VP8Io* io) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const int mb_w = dec->mb_w_;
+  const int max_rows = dec->num_parts_minus_one_ + 1;
+  const int num_chunks = (mb_w + PARSE_CHUNK_SIZE - 1) / PARSE_CHUNK_SIZE;
+  int num_rows;
+  int set = 0;   // which of the two sets of rows is being parsed
+
+  if (!InitParseWorkers(dec)) return 0;
+  for (dec->mb_y_ = 0; dec->mb_y_ < dec->br_mb_y_;
+       dec->mb_y_ += num_rows, set ^= 1) {
+    VP8MBData* const mb_data = dec->parsed_mb_data_ + set * max_rows * mb_w;
+    VP8FInfo* const f_info = (dec->filter_type_ > 0) ?
+        dec->parsed_f_info_ + set * max_rows * mb_w : NULL;
+    int n, step;
+    num_rows = dec->br_mb_y_ - dec->mb_y_;
+    if (num_rows > max_rows) num_rows = max_rows;
+
+    // Intra modes, from partition #0: must be parsed sequentially.
+    for (n = 0; n < num_rows; ++n) {
+      VP8ParseJob* const job = &dec->parse_jobs_[n];
+      VP8InitScanline(dec);
+      dec->mb_data_ = mb_data + n * mb_w;
+      if (!VP8ParseIntraModeRow(&dec->br_, dec)) {
+        return VP8SetError(dec, VP8_STATUS_NOT_ENOUGH_DATA,
+                           "Premature end-of-partition0 encountered.");
+      }
+      job->br_ = &dec->parts_[(dec->mb_y_ + n) & dec->num_parts_minus_one_];
+      job->mb_data_ = dec->mb_data_;
+      job->f_info_ = (f_info != NULL) ? f_info + n * mb_w : NULL;
+    }
+
+    // Tokens, as a wavefront.
+    for (step = 0; step < num_chunks + num_rows - 1; ++step) {
+      int ok = 1;
+      for (n = num_rows - 1; n >= 0; --n) {
+        VP8ParseJob* const job = &dec->parse_jobs_[n];
+        const int chunk = step - n;
+        if (chunk < 0 || chunk >= num_chunks) continue;
+        job->first_mb_x_ = chunk * PARSE_CHUNK_SIZE;
+        job->last_mb_x_ = job->first_mb_x_ + PARSE_CHUNK_SIZE;
+        if (job->last_mb_x_ > mb_w) job->last_mb_x_ = mb_w;
+        if (n > 0) {
+          winterface->Launch(&dec->parse_workers_[n]);
+        } else {
+          ok = ParseTokens(dec, job);
+        }
+      }
+      for (n = 1; n < num_rows; ++n) {
+        ok &= winterface->Sync(&dec->parse_workers_[n]);
+      }
+      if (!ok) {
+        return VP8SetError(dec, VP8_STATUS_NOT_ENOUGH_DATA,
+                           "Premature end-of-file encountered.");
+      }
+    }
+
+    // Reconstruct, filter and emit the rows, in the background.
+    if (!VP8ProcessRows(dec, io, dec->mb_y_, num_rows, mb_data, f_info)) {
+      return VP8SetError(dec, VP8_STATUS_USER_ABORT, "Output aborted.");
+    }
+  }
+  if (!winterface->Sync(&dec->worker_)) return 0;
+
+  return 1;
+}
+
+#undef PARSE_CHUNK_SIZE
+
+//------------------------------------------------------------------------------
+
 static int ParseFrame(VP8Decoder* const dec, VP8Io* io) {
+  if (dec->mt_method_ == 3) {
+    return ParseFrameMT(dec, io);
+  }
   for (dec->mb_y_ = 0; dec->mb_y_ < dec->br_mb_y_; ++dec->mb_y_) {
     // Parse bitstream for this row.
     VP8BitReader* const token_br =
@@ -686,6 +853,11 @@ int VP8Decode(VP8Decoder* const dec, VP8Io* const io) {
   // Finish setting up the decoding parameter. Will call io->setup().
   ok = (VP8EnterCritical(dec, io) == VP8_STATUS_OK);
   if (ok) {   // good to go.
+    // When several token partitions are present, parse them in parallel.
+    // Note: this is only possible when decoding the whole frame at once.
+    if (dec->mt_method_ > 0 && dec->num_parts_minus_one_ > 0) {
+      dec->mt_method_ = 3;
+    }
     // Will allocate memory and prepare everything.
     if (ok) ok = VP8InitFrame(dec, io);
 
@@ -706,9 +878,13 @@ int VP8Decode(VP8Decoder* const dec, VP8Io* const io) {
 }
 
 void VP8Clear(VP8Decoder* const dec) {
+  int n;
   if (dec == NULL) {
     return;
   }
+  for (n = 0; n < MAX_NUM_PARTITIONS; ++n) {
+    WebPGetWorkerInterface()->End(&dec->parse_workers_[n]);
+  }
   WebPGetWorkerInterface()->End(&dec->worker_);
   WebPDeallocateAlphaMemory(dec);
   WebPSafeFree(dec->mem_);
@@ -718,4 +894,26 @@ void VP8Clear(VP8Decoder* const dec) {
   dec->ready_ = 0;
 }
 
+void VP8Reset(VP8Decoder* const dec) {
+  if (dec == NULL) {
+    return;
+  }
+  // 'mem_' and the alpha plane are kept, and grown if needed by the next
+  // picture. The alpha decoder itself is specific to each picture.
+  WebPResetAlphaMemory(dec);
+  SetOk(dec);
+  memset(&dec->br_, 0, sizeof(dec->br_));
+  dec->ready_ = 0;
+  dec->mt_method_ = 0;
+  dec->num_parts_minus_one_ = 0;
+  dec->input_ = NULL;
+  dec->input_pos_ = 0;
+  dec->dither_ = 0;
+  dec->alpha_data_ = NULL;
+  dec->alpha_data_size_ = 0;
+  dec->is_alpha_decoded_ = 0;
+  dec->alpha_prev_line_ = NULL;
+  dec->alpha_dithering_ = 0;
+}
+
 //------------------------------------------------------------------------------
@@ -150,6 +150,10 @@ const char* VP8StatusMessage(VP8Decoder* const dec);
 // Not a mandatory call between calls to VP8Decode().
 void VP8Clear(VP8Decoder* const dec);
 
+// Prepares the decoder for a new picture, like VP8Clear(), but keeps its
+// memory and worker threads around so they can be reused.
+void VP8Reset(VP8Decoder* const dec);
+
 // Destroy the decoder object.
 void VP8Delete(VP8Decoder* const dec);
 
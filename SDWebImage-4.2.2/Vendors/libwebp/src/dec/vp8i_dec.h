@@ -62,7 +62,7 @@ extern "C" {
 #define U_OFF    (Y_OFF + BPS * 16 + BPS)
 #define V_OFF    (U_OFF + 16)
 
-// minimal width under which lossy multi-threading is always disabled
+// minimal width under which multi-threading is always disabled
 #define MIN_WIDTH_FOR_THREADS 512
 
 //------------------------------------------------------------------------------
@@ -166,12 +166,23 @@ typedef struct {
 typedef struct {
   int id_;              // cache row to process (in [0..2])
   int mb_y_;            // macroblock position of the row
+  int num_rows_;        // number of rows to process, from mb_y_ (mt_method_=3)
   int filter_row_;      // true if row-filtering is needed
   VP8FInfo* f_info_;    // filter strengths (swapped with dec->f_info_)
   VP8MBData* mb_data_;  // reconstruction data (swapped with dec->mb_data_)
   VP8Io io_;            // copy of the VP8Io to pass to put()
 } VP8ThreadContext;
 
+// Token-parsing job for one row of macroblocks (mt_method_=3)
+typedef struct {
+  VP8BitReader* br_;     // token partition the row belongs to
+  VP8MBData* mb_data_;   // parsed data for the row
+  VP8FInfo* f_info_;     // filter strengths for the row (or NULL)
+  VP8MB left_;           // left context
+  int first_mb_x_;       // macroblocks to parse: [first_mb_x_, last_mb_x_)
+  int last_mb_x_;
+} VP8ParseJob;
+
 // Saved top samples, per macroblock. Fits into a cache-line.
 typedef struct {
   uint8_t y[16], u[8], v[8];
@@ -198,10 +209,20 @@ struct VP8Decoder {
   WebPWorker worker_;
   int mt_method_;      // multi-thread method: 0=off, 1=[parse+recon][filter]
                        // 2=[parse][recon+filter]
+                       // 3=[parse partition #0..N][recon+filter]
   int cache_id_;       // current cache row
   int num_caches_;     // number of cached rows of 16 pixels (1, 2 or 3)
   VP8ThreadContext thread_ctx_;  // Thread context
 
+  // Partition-parallel parsing (mt_method_=3). Rows are parsed by groups of
+  // one row per token partition, each on its own worker (the first one is run
+  // in the main thread). Reconstruction of the previous group is done in
+  // parallel by 'worker_', hence the two sets of rows.
+  WebPWorker parse_workers_[MAX_NUM_PARTITIONS];
+  VP8ParseJob parse_jobs_[MAX_NUM_PARTITIONS];
+  VP8MBData* parsed_mb_data_;  // 2 x (num_parts_minus_one_ + 1) rows
+  VP8FInfo* parsed_f_info_;    // ditto, for the filter strengths
+
   // dimension, in macroblock units.
   int mb_w_, mb_h_;
 
@@ -213,6 +234,10 @@ struct VP8Decoder {
   uint32_t num_parts_minus_one_;
   // per-partition boolean decoders.
   VP8BitReader parts_[MAX_NUM_PARTITIONS];
+  // Segmented input (incremental decoding): if not NULL, the partitions are
+  // read from this chain of segments, where io->data is at 'input_pos_'.
+  const VP8InputSegment* input_;
+  size_t input_pos_;
 
   // Dithering strength, deduced from decoding options
   int dither_;                // whether to use dithering or not
@@ -260,6 +285,7 @@ struct VP8Decoder {
   size_t alpha_data_size_;
   int is_alpha_decoded_;      // true if alpha_data_ is decoded in alpha_plane_
   uint8_t* alpha_plane_mem_;  // memory allocated for alpha_plane_
+  size_t alpha_plane_mem_size_;  // allocated size of alpha_plane_mem_
   uint8_t* alpha_plane_;      // output. Persistent, contains the whole data.
   const uint8_t* alpha_prev_line_;  // last decoded alpha row (or NULL)
   int alpha_dithering_;       // derived from decoding options (0=off, 100=full)
@@ -292,7 +318,7 @@ VP8StatusCode VP8EnterCritical(VP8Decoder* const dec, VP8Io* const io);
 // Returns false in case of error.
 int VP8ExitCritical(VP8Decoder* const dec, VP8Io* const io);
 // Return the multi-threading method to use (0=off), depending
-// on options and bitstream size. Only for lossy decoding.
+// on options and bitstream size. For lossless decoding, the only method is 1.
 int VP8GetThreadMethod(const WebPDecoderOptions* const options,
                        const WebPHeaderStructure* const headers,
                        int width, int height);
@@ -301,6 +327,12 @@ void VP8InitDithering(const WebPDecoderOptions* const options,
                       VP8Decoder* const dec);
 // Process the last decoded row (filtering + output).
 int VP8ProcessRow(VP8Decoder* const dec, VP8Io* const io);
+// Reconstruct, filter and output 'num_rows' rows starting at 'mb_y', whose
+// parsed data are stored contiguously in 'mb_data' and 'f_info'. The work is
+// done in the background by dec->worker_ (mt_method_=3 only).
+int VP8ProcessRows(VP8Decoder* const dec, VP8Io* const io,
+                   int mb_y, int num_rows,
+                   VP8MBData* const mb_data, VP8FInfo* const f_info);
 // To be called at the start of a new scanline, to initialize predictors.
 void VP8InitScanline(VP8Decoder* const dec);
 // Decode one macroblock. Returns false if there is not enough data.
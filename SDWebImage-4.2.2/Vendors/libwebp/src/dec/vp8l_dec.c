@@ -368,6 +368,7 @@ static int ReadHuffmanCodes(VP8LDecoder* const dec, int xsize, int ysize,
   int max_alphabet_size = 0;
   int* code_lengths = NULL;
   const int table_size = kTableSize[color_cache_bits];
+  size_t tables_size = 0;
 
   if (allow_recursion && VP8LReadBits(br, 1)) {
     // use meta Huffman codes.
@@ -403,8 +404,17 @@ static int ReadHuffmanCodes(VP8LDecoder* const dec, int xsize, int ysize,
     }
   }
 
-  huffman_tables = (HuffmanCode*)WebPSafeMalloc(num_htree_groups * table_size,
-                                                sizeof(*huffman_tables));
+  tables_size = (size_t)num_htree_groups * table_size;
+  if (allow_recursion && tables_size <= dec->spare_tables_size_) {
+    // Reuse the main tables of the previous picture (see VP8LReset()).
+    huffman_tables = dec->spare_tables_;
+    tables_size = dec->spare_tables_size_;
+    dec->spare_tables_ = NULL;
+    dec->spare_tables_size_ = 0;
+  } else {
+    huffman_tables = (HuffmanCode*)WebPSafeMalloc(tables_size,
+                                                  sizeof(*huffman_tables));
+  }
   htree_groups = VP8LHtreeGroupsNew(num_htree_groups);
   code_lengths = (int*)WebPSafeCalloc((uint64_t)max_alphabet_size,
                                       sizeof(*code_lengths));
@@ -472,6 +482,7 @@ static int ReadHuffmanCodes(VP8LDecoder* const dec, int xsize, int ysize,
   hdr->num_htree_groups_ = num_htree_groups;
   hdr->htree_groups_ = htree_groups;
   hdr->huffman_tables_ = huffman_tables;
+  hdr->huffman_tables_size_ = tables_size;
   return 1;
 
  Error:
@@ -702,11 +713,11 @@ static WEBP_INLINE HTreeGroup* GetHtreeGroupForPos(VP8LMetadata* const hdr,
 
 typedef void (*ProcessRowsFunc)(VP8LDecoder* const dec, int row);
 
-static void ApplyInverseTransforms(VP8LDecoder* const dec, int num_rows,
+static void ApplyInverseTransforms(VP8LDecoder* const dec,
+                                   int start_row, int num_rows,
                                    const uint32_t* const rows) {
   int n = dec->next_transform_;
   const int cache_pixs = dec->width_ * num_rows;
-  const int start_row = dec->last_row_;
   const int end_row = start_row + num_rows;
   const uint32_t* rows_in = rows;
   uint32_t* const rows_out = dec->argb_cache_;
@@ -723,11 +734,10 @@ static void ApplyInverseTransforms(VP8LDecoder* const dec, int num_rows,
   }
 }
 
-// Processes (transforms, scales & color-converts) the rows decoded after the
-// last call.
-static void ProcessRows(VP8LDecoder* const dec, int row) {
-  const uint32_t* const rows = dec->pixels_ + dec->width_ * dec->last_row_;
-  const int num_rows = row - dec->last_row_;
+// Processes (transforms, scales & color-converts) the rows [first_row, row).
+static void EmitProcessedRows(VP8LDecoder* const dec, int first_row, int row) {
+  const uint32_t* const rows = dec->pixels_ + dec->width_ * first_row;
+  const int num_rows = row - first_row;
 
   assert(row <= dec->io_->crop_bottom);
   // We can't process more than NUM_ARGB_CACHE_ROWS at a time (that's the size
@@ -738,8 +748,8 @@ static void ProcessRows(VP8LDecoder* const dec, int row) {
     uint8_t* rows_data = (uint8_t*)dec->argb_cache_;
     const int in_stride = io->width * sizeof(uint32_t);  // in unit of RGBA
 
-    ApplyInverseTransforms(dec, num_rows, rows);
-    if (!SetCropWindow(io, dec->last_row_, row, &rows_data, in_stride)) {
+    ApplyInverseTransforms(dec, first_row, num_rows, rows);
+    if (!SetCropWindow(io, first_row, row, &rows_data, in_stride)) {
       // Nothing to output (this time).
     } else {
       const WebPDecBuffer* const output = dec->output_;
@@ -761,12 +771,50 @@ static void ProcessRows(VP8LDecoder* const dec, int row) {
       assert(dec->last_out_row_ <= output->height);
     }
   }
+}
+
+// Worker hook: post-processes the batch of rows handed over by ProcessRows().
+static int ProcessRowsHook(void* arg1, void* arg2) {
+  VP8LDecoder* const dec = (VP8LDecoder*)arg1;
+  (void)arg2;
+  EmitProcessedRows(dec, dec->mt_first_row_, dec->mt_last_row_);
+  return 1;
+}
+
+// Processes the rows decoded after the last call. In multi-threaded mode, the
+// work is handed over to the worker while the main thread keeps on entropy
+// decoding. Batches are still processed in order (they share argb_cache_ and
+// the top-row of the predictor), hence the Sync() before each new Launch().
+// Note that the rows being processed in dec->pixels_ are never written to by
+// the entropy decoder anymore.
+static void ProcessRows(VP8LDecoder* const dec, int row) {
+  if (dec->mt_method_ > 0) {
+    if (row > dec->last_row_) {
+      const WebPWorkerInterface* const worker_interface =
+          WebPGetWorkerInterface();
+      WebPWorker* const worker = &dec->worker_;
+      worker_interface->Sync(worker);
+      dec->mt_first_row_ = dec->last_row_;
+      dec->mt_last_row_ = row;
+      worker_interface->Launch(worker);
+    }
+  } else {
+    EmitProcessedRows(dec, dec->last_row_, row);
+  }
 
   // Update 'last_row_'.
   dec->last_row_ = row;
   assert(dec->last_row_ <= dec->height_);
 }
 
+// Waits for the worker to be done with the rows in flight, if any.
+static int SyncProcessRows(VP8LDecoder* const dec) {
+  if (dec->mt_method_ > 0) {
+    return WebPGetWorkerInterface()->Sync(&dec->worker_);
+  }
+  return 1;
+}
+
 // Row-processing for the special case when alpha data contains only one
 // transform (color indexing), and trivial non-green literals.
 static int Is8bOptimizable(const VP8LMetadata* const hdr) {
@@ -1308,6 +1356,7 @@ VP8LDecoder* VP8LNew(void) {
   if (dec == NULL) return NULL;
   dec->status_ = VP8_STATUS_OK;
   dec->state_ = READ_DIM;
+  WebPGetWorkerInterface()->Init(&dec->worker_);
 
   VP8LDspInit();  // Init critical function pointers.
 
@@ -1317,10 +1366,12 @@ VP8LDecoder* VP8LNew(void) {
 void VP8LClear(VP8LDecoder* const dec) {
   int i;
   if (dec == NULL) return;
+  SyncProcessRows(dec);   // the worker might still be using the buffers
   ClearMetadata(&dec->hdr_);
 
   WebPSafeFree(dec->pixels_);
   dec->pixels_ = NULL;
+  dec->pixels_size_ = 0;
   for (i = 0; i < dec->next_transform_; ++i) {
     ClearTransform(&dec->transforms_[i]);
   }
@@ -1333,9 +1384,44 @@ void VP8LClear(VP8LDecoder* const dec) {
   dec->output_ = NULL;   // leave no trace behind
 }
 
+void VP8LReset(VP8LDecoder* const dec) {
+  VP8LMetadata* hdr;
+  if (dec == NULL) return;
+  SyncProcessRows(dec);
+  hdr = &dec->hdr_;
+  // Keep the largest buffers around, VP8LClear() releases the rest.
+  if (dec->pixels_ != NULL && dec->pixels_size_ > dec->spare_pixels_size_) {
+    WebPSafeFree(dec->spare_pixels_);
+    dec->spare_pixels_ = dec->pixels_;
+    dec->spare_pixels_size_ = dec->pixels_size_;
+    dec->pixels_ = NULL;
+  }
+  if (hdr->huffman_tables_ != NULL &&
+      hdr->huffman_tables_size_ > dec->spare_tables_size_) {
+    WebPSafeFree(dec->spare_tables_);
+    dec->spare_tables_ = hdr->huffman_tables_;
+    dec->spare_tables_size_ = hdr->huffman_tables_size_;
+    hdr->huffman_tables_ = NULL;
+  }
+  VP8LClear(dec);
+  dec->status_ = VP8_STATUS_OK;
+  dec->state_ = READ_DIM;
+  dec->io_ = NULL;
+  dec->input_ = NULL;
+  dec->input_pos_ = 0;
+  dec->incremental_ = 0;
+  dec->last_row_ = 0;
+  dec->last_pixel_ = 0;
+  dec->last_out_row_ = 0;
+  dec->mt_method_ = 0;
+}
+
 void VP8LDelete(VP8LDecoder* const dec) {
   if (dec != NULL) {
     VP8LClear(dec);
+    WebPSafeFree(dec->spare_pixels_);
+    WebPSafeFree(dec->spare_tables_);
+    WebPGetWorkerInterface()->End(&dec->worker_);
     WebPSafeFree(dec);
   }
 }
@@ -1441,6 +1527,22 @@ static int DecodeImageStream(int xsize, int ysize,
 
 //------------------------------------------------------------------------------
 // Allocate internal buffers dec->pixels_ and dec->argb_cache_.
+
+// Sets dec->pixels_ to a buffer of at least 'size' bytes, reusing the one kept
+// by VP8LReset() if it is large enough.
+static void AllocatePixels(VP8LDecoder* const dec, uint64_t size) {
+  assert(dec->pixels_ == NULL);
+  if (size <= dec->spare_pixels_size_) {
+    dec->pixels_ = dec->spare_pixels_;
+    dec->pixels_size_ = dec->spare_pixels_size_;
+    dec->spare_pixels_ = NULL;
+    dec->spare_pixels_size_ = 0;
+  } else {
+    dec->pixels_ = (uint32_t*)WebPSafeMalloc(size, sizeof(uint8_t));
+    dec->pixels_size_ = (dec->pixels_ != NULL) ? (size_t)size : 0;
+  }
+}
+
 static int AllocateInternalBuffers32b(VP8LDecoder* const dec, int final_width) {
   const uint64_t num_pixels = (uint64_t)dec->width_ * dec->height_;
   // Scratch buffer corresponding to top-prediction row for transforming the
@@ -1452,7 +1554,7 @@ static int AllocateInternalBuffers32b(VP8LDecoder* const dec, int final_width) {
       num_pixels + cache_top_pixels + cache_pixels;
 
   assert(dec->width_ <= final_width);
-  dec->pixels_ = (uint32_t*)WebPSafeMalloc(total_num_pixels, sizeof(uint32_t));
+  AllocatePixels(dec, total_num_pixels * sizeof(uint32_t));
   if (dec->pixels_ == NULL) {
     dec->argb_cache_ = NULL;    // for sanity check
     dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
@@ -1465,7 +1567,7 @@ static int AllocateInternalBuffers32b(VP8LDecoder* const dec, int final_width) {
 static int AllocateInternalBuffers8b(VP8LDecoder* const dec) {
   const uint64_t total_num_pixels = (uint64_t)dec->width_ * dec->height_;
   dec->argb_cache_ = NULL;    // for sanity check
-  dec->pixels_ = (uint32_t*)WebPSafeMalloc(total_num_pixels, sizeof(uint8_t));
+  AllocatePixels(dec, total_num_pixels * sizeof(uint8_t));
   if (dec->pixels_ == NULL) {
     dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
     return 0;
@@ -1492,7 +1594,7 @@ static void ExtractAlphaRows(VP8LDecoder* const dec, int last_row) {
     const int cache_pixs = width * num_rows_to_process;
     uint8_t* const dst = output + width * cur_row;
     const uint32_t* const src = dec->argb_cache_;
-    ApplyInverseTransforms(dec, num_rows_to_process, in);
+    ApplyInverseTransforms(dec, cur_row, num_rows_to_process, in);
     WebPExtractGreen(src, dst, cache_pixs);
     AlphaApplyFilter(alph_dec,
                      cur_row, cur_row + num_rows_to_process, dst, width);
@@ -1584,7 +1686,11 @@ int VP8LDecodeHeader(VP8LDecoder* const dec, VP8Io* const io) {
 
   dec->io_ = io;
   dec->status_ = VP8_STATUS_OK;
-  VP8LInitBitReader(&dec->br_, io->data, io->data_size);
+  if (dec->input_ != NULL) {
+    VP8LInitSegmentBitReader(&dec->br_, dec->input_, dec->input_pos_);
+  } else {
+    VP8LInitBitReader(&dec->br_, io->data, io->data_size);
+  }
   if (!ReadImageInfo(&dec->br_, &width, &height, &has_alpha)) {
     dec->status_ = VP8_STATUS_BITSTREAM_ERROR;
     goto Error;
@@ -1640,6 +1746,16 @@ int VP8LDecodeImage(VP8LDecoder* const dec) {
       WebPInitConvertARGBToYUV();
       if (dec->output_->u.YUVA.a != NULL) WebPInitAlphaProcessing();
     }
+    if (dec->mt_method_ > 0) {
+      WebPWorker* const worker = &dec->worker_;
+      if (!WebPGetWorkerInterface()->Reset(worker)) {
+        dec->status_ = VP8_STATUS_OUT_OF_MEMORY;
+        goto Err;
+      }
+      worker->data1 = dec;
+      worker->data2 = NULL;
+      worker->hook = ProcessRowsHook;
+    }
     if (dec->incremental_) {
       if (dec->hdr_.color_cache_size_ > 0 &&
           dec->hdr_.saved_color_cache_.colors_ == NULL) {
@@ -1658,6 +1774,10 @@ int VP8LDecodeImage(VP8LDecoder* const dec) {
                        io->crop_bottom, ProcessRows)) {
     goto Err;
   }
+  if (!SyncProcessRows(dec)) {
+    dec->status_ = VP8_STATUS_BITSTREAM_ERROR;
+    goto Err;
+  }
 
   params->last_y = dec->last_out_row_;
   return 1;
@@ -20,6 +20,7 @@
 #include "../utils/bit_reader_utils.h"
 #include "../utils/color_cache_utils.h"
 #include "../utils/huffman_utils.h"
+#include "../utils/thread_utils.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -52,6 +53,7 @@ typedef struct {
   int             num_htree_groups_;
   HTreeGroup     *htree_groups_;
   HuffmanCode    *huffman_tables_;
+  size_t          huffman_tables_size_;  // allocated number of entries
 } VP8LMetadata;
 
 typedef struct VP8LDecoder VP8LDecoder;
@@ -65,8 +67,12 @@ struct VP8LDecoder {
   uint32_t        *pixels_;        // Internal data: either uint8_t* for alpha
                                    // or uint32_t* for BGRA.
   uint32_t        *argb_cache_;    // Scratch buffer for temporary BGRA storage.
+  size_t           pixels_size_;   // allocated size of pixels_, in bytes
 
   VP8LBitReader    br_;
+  const VP8InputSegment* input_;   // if not NULL, the bitstream is read from
+  size_t           input_pos_;     // this chain of segments, from position
+                                   // 'input_pos_' on, instead of io->data.
   int              incremental_;   // if true, incremental decoding is expected
   VP8LBitReader    saved_br_;      // note: could be local variables too
   int              saved_last_pixel_;
@@ -88,6 +94,19 @@ struct VP8LDecoder {
 
   uint8_t         *rescaler_memory;  // Working memory for rescaling work.
   WebPRescaler    *rescaler;         // Common rescaler for all channels.
+
+  // Worker
+  WebPWorker       worker_;
+  int              mt_method_;     // multi-thread method: 0=off,
+                                   // 1=[entropy decoding][transforms+output]
+  int              mt_first_row_;  // rows [mt_first_row_, mt_last_row_) are
+  int              mt_last_row_;   // being processed by the worker.
+
+  // Buffers kept by VP8LReset() for the next picture, and their size.
+  uint32_t        *spare_pixels_;
+  size_t           spare_pixels_size_;      // in bytes
+  HuffmanCode     *spare_tables_;
+  size_t           spare_tables_size_;      // in number of entries
 };
 
 //------------------------------------------------------------------------------
@@ -123,6 +142,10 @@ int VP8LDecodeImage(VP8LDecoder* const dec);
 // Preserves the dec->status_ value.
 void VP8LClear(VP8LDecoder* const dec);
 
+// Prepares the decoder for a new picture, like VP8LClear(), but keeps the
+// pixel buffer, the main Huffman tables and the worker thread for reuse.
+void VP8LReset(VP8LDecoder* const dec);
+
 // Clears and deallocate a lossless decoder instance.
 void VP8LDelete(VP8LDecoder* const dec);
 
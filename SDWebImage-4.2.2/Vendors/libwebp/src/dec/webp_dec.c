@@ -442,8 +442,46 @@ void WebPResetDecParams(WebPDecParams* const params) {
 // "Into" decoding variants
 
 // Main flow
+struct WebPDecoderContext {
+  VP8Decoder* vp8_;     // lossy decoder, created on first use
+  VP8LDecoder* vp8l_;   // lossless decoder, created on first use
+};
+
+// Returns the lossy decoder of 'ctx', or a new one if 'ctx' is NULL.
+static VP8Decoder* GetVP8Decoder(WebPDecoderContext* const ctx) {
+  if (ctx == NULL) return VP8New();
+  if (ctx->vp8_ == NULL) ctx->vp8_ = VP8New();
+  return ctx->vp8_;
+}
+
+static void ReleaseVP8Decoder(WebPDecoderContext* const ctx,
+                              VP8Decoder* const dec) {
+  if (ctx == NULL) {
+    VP8Delete(dec);
+  } else {
+    VP8Reset(dec);
+  }
+}
+
+static VP8LDecoder* GetVP8LDecoder(WebPDecoderContext* const ctx) {
+  if (ctx == NULL) return VP8LNew();
+  if (ctx->vp8l_ == NULL) ctx->vp8l_ = VP8LNew();
+  return ctx->vp8l_;
+}
+
+static void ReleaseVP8LDecoder(WebPDecoderContext* const ctx,
+                               VP8LDecoder* const dec) {
+  if (ctx == NULL) {
+    VP8LDelete(dec);
+  } else {
+    VP8LReset(dec);
+  }
+}
+
+// 'ctx' can be NULL, in which case temporary decoders are used.
 static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
-                                WebPDecParams* const params) {
+                                WebPDecParams* const params,
+                                WebPDecoderContext* const ctx) {
   VP8StatusCode status;
   VP8Io io;
   WebPHeaderStructure headers;
@@ -463,7 +501,7 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
   WebPInitCustomIo(params, &io);  // Plug the I/O functions.
 
   if (!headers.is_lossless) {
-    VP8Decoder* const dec = VP8New();
+    VP8Decoder* const dec = GetVP8Decoder(ctx);
     if (dec == NULL) {
       return VP8_STATUS_OUT_OF_MEMORY;
     }
@@ -487,9 +525,9 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
         }
       }
     }
-    VP8Delete(dec);
+    ReleaseVP8Decoder(ctx, dec);
   } else {
-    VP8LDecoder* const dec = VP8LNew();
+    VP8LDecoder* const dec = GetVP8LDecoder(ctx);
     if (dec == NULL) {
       return VP8_STATUS_OUT_OF_MEMORY;
     }
@@ -500,12 +538,14 @@ static VP8StatusCode DecodeInto(const uint8_t* const data, size_t data_size,
       status = WebPAllocateDecBuffer(io.width, io.height, params->options,
                                      params->output);
       if (status == VP8_STATUS_OK) {  // Decode
+        dec->mt_method_ = VP8GetThreadMethod(params->options, &headers,
+                                             io.width, io.height);
         if (!VP8LDecodeImage(dec)) {
           status = dec->status_;
         }
       }
     }
-    VP8LDelete(dec);
+    ReleaseVP8LDecoder(ctx, dec);
   }
 
   if (status != VP8_STATUS_OK) {
@@ -539,7 +579,7 @@ static uint8_t* DecodeIntoRGBABuffer(WEBP_CSP_MODE colorspace,
   buf.u.RGBA.stride = stride;
   buf.u.RGBA.size   = size;
   buf.is_external_memory = 1;
-  if (DecodeInto(data, data_size, &params) != VP8_STATUS_OK) {
+  if (DecodeInto(data, data_size, &params, NULL) != VP8_STATUS_OK) {
     return NULL;
   }
   return rgba;
@@ -591,7 +631,7 @@ uint8_t* WebPDecodeYUVInto(const uint8_t* data, size_t data_size,
   output.u.YUVA.v_stride = v_stride;
   output.u.YUVA.v_size   = v_size;
   output.is_external_memory = 1;
-  if (DecodeInto(data, data_size, &params) != VP8_STATUS_OK) {
+  if (DecodeInto(data, data_size, &params, NULL) != VP8_STATUS_OK) {
     return NULL;
   }
   return luma;
@@ -618,7 +658,7 @@ static uint8_t* Decode(WEBP_CSP_MODE mode, const uint8_t* const data,
   if (height != NULL) *height = output.height;
 
   // Decode
-  if (DecodeInto(data, data_size, &params) != VP8_STATUS_OK) {
+  if (DecodeInto(data, data_size, &params, NULL) != VP8_STATUS_OK) {
     return NULL;
   }
   if (keep_info != NULL) {    // keep track of the side-info
@@ -740,8 +780,26 @@ VP8StatusCode WebPGetFeaturesInternal(const uint8_t* data, size_t data_size,
   return GetFeatures(data, data_size, features);
 }
 
+WebPDecoderContext* WebPDecoderNew(void) {
+  return (WebPDecoderContext*)WebPSafeCalloc(1ULL, sizeof(WebPDecoderContext));
+}
+
+void WebPDecoderDelete(WebPDecoderContext* ctx) {
+  if (ctx != NULL) {
+    VP8Delete(ctx->vp8_);
+    VP8LDelete(ctx->vp8l_);
+    WebPSafeFree(ctx);
+  }
+}
+
 VP8StatusCode WebPDecode(const uint8_t* data, size_t data_size,
                          WebPDecoderConfig* config) {
+  return WebPDecodeWith(NULL, data, data_size, config);
+}
+
+VP8StatusCode WebPDecodeWith(WebPDecoderContext* ctx,
+                             const uint8_t* data, size_t data_size,
+                             WebPDecoderConfig* config) {
   WebPDecParams params;
   VP8StatusCode status;
 
@@ -768,13 +826,13 @@ VP8StatusCode WebPDecode(const uint8_t* data, size_t data_size,
     in_mem_buffer.width = config->input.width;
     in_mem_buffer.height = config->input.height;
     params.output = &in_mem_buffer;
-    status = DecodeInto(data, data_size, &params);
+    status = DecodeInto(data, data_size, &params, ctx);
     if (status == VP8_STATUS_OK) {  // do the slow-copy
       status = WebPCopyDecBufferPixels(&in_mem_buffer, &config->output);
     }
     WebPFreeDecBuffer(&in_mem_buffer);
   } else {
-    status = DecodeInto(data, data_size, &params);
+    status = DecodeInto(data, data_size, &params, ctx);
   }
 
   return status;
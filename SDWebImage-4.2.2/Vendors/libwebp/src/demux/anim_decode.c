@@ -17,11 +17,22 @@
 #include <assert.h>
 #include <string.h>
 
+#include "../utils/thread_utils.h"
 #include "../utils/utils.h"
 #include "../webp/decode.h"
 #include "../webp/demux.h"
 
 #define NUM_CHANNELS 4
+#define MAX_LOOKAHEAD_FRAMES 16
+
+// A frame payload decoded (or being decoded) ahead of time by a worker.
+typedef struct {
+  WebPWorker worker_;
+  WebPDecoderConfig config_;       // Copy of the decoder config for this slot.
+  WebPIterator iter_;              // Frame being decoded.
+  uint8_t* buf_;                   // Decoded frame (iter_.width x iter_.height).
+  int frame_num_;                  // Frame held by this slot (0 if none).
+} LookaheadSlot;
 
 typedef void (*BlendRowFunc)(uint32_t* const, const uint32_t* const, int);
 static void BlendPixelRowNonPremult(uint32_t* const src,
@@ -43,11 +54,16 @@ struct WebPAnimDecoder {
   int prev_frame_was_keyframe_;    // True if previous frame was a keyframe.
   int next_frame_;                 // Index of the next frame to be decoded
                                    // (starting from 1).
+  LookaheadSlot* slots_;           // Ring of pre-decoded frames; frame 'n' is
+                                   // held by slots_[(n - 1) % num_slots_].
+  int num_slots_;                  // 0 if look-ahead decoding is disabled.
+  int next_launch_;                // Index of the next frame to pre-decode.
 };
 
 static void DefaultDecoderOptions(WebPAnimDecoderOptions* const dec_options) {
   dec_options->color_mode = MODE_RGBA;
   dec_options->use_threads = 0;
+  dec_options->lookahead_frames = 0;
 }
 
 int WebPAnimDecoderOptionsInitInternal(WebPAnimDecoderOptions* dec_options,
@@ -71,6 +87,10 @@ static int ApplyDecoderOptions(const WebPAnimDecoderOptions* const dec_options,
       mode != MODE_rgbA && mode != MODE_bgrA) {
     return 0;
   }
+  if (dec_options->lookahead_frames < 0 ||
+      dec_options->lookahead_frames > MAX_LOOKAHEAD_FRAMES) {
+    return 0;
+  }
   dec->blend_func_ = (mode == MODE_RGBA || mode == MODE_BGRA)
                          ? &BlendPixelRowNonPremult
                          : &BlendPixelRowPremult;
@@ -82,6 +102,118 @@ static int ApplyDecoderOptions(const WebPAnimDecoderOptions* const dec_options,
   return 1;
 }
 
+//------------------------------------------------------------------------------
+// Look-ahead decoding
+
+// Decodes the payload of slot->iter_ into slot->buf_. The payload of a frame
+// does not depend on the previous canvas, only the blending does.
+static int DecodeFrameHook(void* arg1, void* arg2) {
+  LookaheadSlot* const slot = (LookaheadSlot*)arg1;
+  const WebPIterator* const iter = &slot->iter_;
+  (void)arg2;
+  return (WebPDecode(iter->fragment.bytes, iter->fragment.size,
+                     &slot->config_) == VP8_STATUS_OK);
+}
+
+static int AllocateLookahead(WebPAnimDecoder* const dec, int num_frames) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const uint64_t canvas_size =
+      (uint64_t)dec->info_.canvas_width * dec->info_.canvas_height;
+  int i;
+  if (num_frames > (int)dec->info_.frame_count) {
+    num_frames = (int)dec->info_.frame_count;
+  }
+  if (num_frames <= 0) return 1;
+  dec->slots_ =
+      (LookaheadSlot*)WebPSafeCalloc(num_frames, sizeof(*dec->slots_));
+  if (dec->slots_ == NULL) return 0;
+  dec->num_slots_ = num_frames;
+  for (i = 0; i < num_frames; ++i) {
+    LookaheadSlot* const slot = &dec->slots_[i];
+    winterface->Init(&slot->worker_);
+    slot->worker_.hook = DecodeFrameHook;
+    slot->worker_.data1 = slot;
+  }
+  for (i = 0; i < num_frames; ++i) {
+    LookaheadSlot* const slot = &dec->slots_[i];
+    slot->buf_ = (uint8_t*)WebPSafeMalloc(canvas_size, NUM_CHANNELS);
+    if (slot->buf_ == NULL) return 0;
+    if (!winterface->Reset(&slot->worker_)) return 0;
+  }
+  return 1;
+}
+
+// Waits for all pending look-ahead decodes and discards their results.
+static void ClearLookahead(WebPAnimDecoder* const dec) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  int i;
+  for (i = 0; i < dec->num_slots_; ++i) {
+    LookaheadSlot* const slot = &dec->slots_[i];
+    winterface->Sync(&slot->worker_);
+    winterface->Reset(&slot->worker_);   // Clears any decoding error.
+    WebPDemuxReleaseIterator(&slot->iter_);
+    slot->frame_num_ = 0;
+  }
+  dec->next_launch_ = dec->next_frame_;
+}
+
+// Starts decoding the frames following 'dec->next_frame_' into the free slots
+// of the ring.
+static int LaunchLookahead(WebPAnimDecoder* const dec) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  while (dec->next_launch_ < dec->next_frame_ + dec->num_slots_ &&
+         dec->next_launch_ <= (int)dec->info_.frame_count) {
+    const int frame_num = dec->next_launch_;
+    LookaheadSlot* const slot =
+        &dec->slots_[(frame_num - 1) % dec->num_slots_];
+    WebPRGBABuffer* const buf = &slot->config_.output.u.RGBA;
+    assert(slot->frame_num_ == 0);
+    if (!WebPDemuxGetFrame(dec->demux_, frame_num, &slot->iter_)) return 0;
+    slot->config_ = dec->config_;
+    buf->stride = NUM_CHANNELS * slot->iter_.width;
+    buf->size = buf->stride * slot->iter_.height;
+    buf->rgba = slot->buf_;
+    slot->frame_num_ = frame_num;
+    winterface->Launch(&slot->worker_);
+    ++dec->next_launch_;
+  }
+  return 1;
+}
+
+// Waits for the pre-decoded frame 'iter->frame_num' and copies it into the
+// frame rectangle of 'canvas'.
+static int GetLookaheadFrame(WebPAnimDecoder* const dec,
+                             const WebPIterator* const iter,
+                             uint8_t* const canvas) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  LookaheadSlot* const slot =
+      &dec->slots_[(iter->frame_num - 1) % dec->num_slots_];
+  const size_t src_stride = (size_t)iter->width * NUM_CHANNELS;
+  const size_t dst_stride = (size_t)dec->info_.canvas_width * NUM_CHANNELS;
+  uint8_t* dst = canvas + iter->y_offset * dst_stride +
+                 iter->x_offset * NUM_CHANNELS;
+  const uint8_t* src = slot->buf_;
+  int ok, y;
+  if (!LaunchLookahead(dec)) return 0;
+  assert(slot->frame_num_ == iter->frame_num);
+  ok = winterface->Sync(&slot->worker_);
+  if (!ok) {
+    // Start over from this frame if the caller tries again.
+    ClearLookahead(dec);
+    return 0;
+  }
+  for (y = 0; y < iter->height; ++y) {
+    memcpy(dst, src, src_stride);
+    dst += dst_stride;
+    src += src_stride;
+  }
+  WebPDemuxReleaseIterator(&slot->iter_);
+  slot->frame_num_ = 0;
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+
 WebPAnimDecoder* WebPAnimDecoderNewInternal(
     const WebPData* webp_data, const WebPAnimDecoderOptions* dec_options,
     int abi_version) {
@@ -120,6 +252,8 @@ WebPAnimDecoder* WebPAnimDecoderNewInternal(
       dec->info_.canvas_width * NUM_CHANNELS, dec->info_.canvas_height);
   if (dec->prev_frame_disposed_ == NULL) goto Error;
 
+  if (!AllocateLookahead(dec, options.lookahead_frames)) goto Error;
+
   WebPAnimDecoderReset(dec);
   return dec;
 
@@ -343,7 +477,9 @@ int WebPAnimDecoderGetNext(WebPAnimDecoder* dec,
   }
 
   // Decode.
-  {
+  if (dec->num_slots_ > 0) {
+    if (!GetLookaheadFrame(dec, &iter, dec->curr_frame_)) goto Error;
+  } else {
     const uint8_t* in = iter.fragment.bytes;
     const size_t in_size = iter.fragment.size;
     const size_t out_offset =
@@ -412,6 +548,11 @@ int WebPAnimDecoderGetNext(WebPAnimDecoder* dec,
                       dec->prev_iter_.width, dec->prev_iter_.height);
   }
   ++dec->next_frame_;
+  if (dec->num_slots_ > 0) {
+    // Keep the workers busy while the caller consumes this frame. A failure
+    // is reported by the next call.
+    (void)LaunchLookahead(dec);
+  }
 
   // All OK, fill in the values.
   *buf_ptr = dec->curr_frame_;
@@ -435,6 +576,7 @@ void WebPAnimDecoderReset(WebPAnimDecoder* dec) {
     memset(&dec->prev_iter_, 0, sizeof(dec->prev_iter_));
     dec->prev_frame_was_keyframe_ = 0;
     dec->next_frame_ = 1;
+    ClearLookahead(dec);
   }
 }
 
@@ -445,6 +587,13 @@ const WebPDemuxer* WebPAnimDecoderGetDemuxer(const WebPAnimDecoder* dec) {
 
 void WebPAnimDecoderDelete(WebPAnimDecoder* dec) {
   if (dec != NULL) {
+    int i;
+    for (i = 0; i < dec->num_slots_; ++i) {
+      WebPGetWorkerInterface()->End(&dec->slots_[i].worker_);
+      WebPDemuxReleaseIterator(&dec->slots_[i].iter_);
+      WebPSafeFree(dec->slots_[i].buf_);
+    }
+    WebPSafeFree(dec->slots_);
     WebPDemuxReleaseIterator(&dec->prev_iter_);
     WebPDemuxDelete(dec->demux_);
     WebPSafeFree(dec->curr_frame_);
@@ -696,6 +696,7 @@ void (*VP8DitherCombine8x8)(const uint8_t* dither, uint8_t* dst,
 
 extern void VP8DspInitSSE2(void);
 extern void VP8DspInitSSE41(void);
+extern void VP8DspInitAVX2(void);
 extern void VP8DspInitNEON(void);
 extern void VP8DspInitMIPS32(void);
 extern void VP8DspInitMIPSdspR2(void);
@@ -767,6 +768,11 @@ WEBP_TSAN_IGNORE_FUNCTION void VP8DspInit(void) {
       if (VP8GetCPUInfo(kSSE4_1)) {
         VP8DspInitSSE41();
       }
+#endif
+#if defined(WEBP_USE_AVX2)
+      if (VP8GetCPUInfo(kAVX2)) {
+        VP8DspInitAVX2();
+      }
 #endif
     }
 #endif
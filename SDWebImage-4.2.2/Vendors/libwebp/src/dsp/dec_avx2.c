@@ -0,0 +1,358 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the COPYING file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS. All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+// -----------------------------------------------------------------------------
+//
+// AVX2 version of some decoding functions (idct, DC predictors).
+
+#include "./dsp.h"
+
+#if defined(WEBP_USE_AVX2)
+
+#include <immintrin.h>
+#include "../dec/vp8i_dec.h"
+#include "../utils/utils.h"
+
+//------------------------------------------------------------------------------
+// Transforms (Paragraph 14.4)
+
+// Same as VP8Transpose_2_4x4_16b(), on each 128-bit lane.
+static WEBP_INLINE void Transpose_4_4x4_16b(
+    const __m256i* const in0, const __m256i* const in1,
+    const __m256i* const in2, const __m256i* const in3, __m256i* const out0,
+    __m256i* const out1, __m256i* const out2, __m256i* const out3) {
+  const __m256i transpose0_0 = _mm256_unpacklo_epi16(*in0, *in1);
+  const __m256i transpose0_1 = _mm256_unpacklo_epi16(*in2, *in3);
+  const __m256i transpose0_2 = _mm256_unpackhi_epi16(*in0, *in1);
+  const __m256i transpose0_3 = _mm256_unpackhi_epi16(*in2, *in3);
+  const __m256i transpose1_0 =
+      _mm256_unpacklo_epi32(transpose0_0, transpose0_1);
+  const __m256i transpose1_1 =
+      _mm256_unpacklo_epi32(transpose0_2, transpose0_3);
+  const __m256i transpose1_2 =
+      _mm256_unpackhi_epi32(transpose0_0, transpose0_1);
+  const __m256i transpose1_3 =
+      _mm256_unpackhi_epi32(transpose0_2, transpose0_3);
+  *out0 = _mm256_unpacklo_epi64(transpose1_0, transpose1_1);
+  *out1 = _mm256_unpackhi_epi64(transpose1_0, transpose1_1);
+  *out2 = _mm256_unpacklo_epi64(transpose1_2, transpose1_3);
+  *out3 = _mm256_unpackhi_epi64(transpose1_2, transpose1_3);
+}
+
+// One pass of the transform, on the rows in0..in3 (see dec_sse2.c for the
+// explanation of the k1/k2 constants). 'dc_bias' is added to in0.
+static WEBP_INLINE void TransformPass(const __m256i* const in0,
+                                      const __m256i* const in1,
+                                      const __m256i* const in2,
+                                      const __m256i* const in3,
+                                      const __m256i* const dc_bias,
+                                      __m256i* const out0, __m256i* const out1,
+                                      __m256i* const out2,
+                                      __m256i* const out3) {
+  const __m256i k1 = _mm256_set1_epi16(20091);
+  const __m256i k2 = _mm256_set1_epi16(-30068);
+  const __m256i dc = _mm256_add_epi16(*in0, *dc_bias);
+  const __m256i a = _mm256_add_epi16(dc, *in2);
+  const __m256i b = _mm256_sub_epi16(dc, *in2);
+  // c = MUL(in1, K2) - MUL(in3, K1) = MUL(in1, k2) - MUL(in3, k1) + in1 - in3
+  const __m256i c1 = _mm256_mulhi_epi16(*in1, k2);
+  const __m256i c2 = _mm256_mulhi_epi16(*in3, k1);
+  const __m256i c3 = _mm256_sub_epi16(*in1, *in3);
+  const __m256i c4 = _mm256_sub_epi16(c1, c2);
+  const __m256i c = _mm256_add_epi16(c3, c4);
+  // d = MUL(in1, K1) + MUL(in3, K2) = MUL(in1, k1) + MUL(in3, k2) + in1 + in3
+  const __m256i d1 = _mm256_mulhi_epi16(*in1, k1);
+  const __m256i d2 = _mm256_mulhi_epi16(*in3, k2);
+  const __m256i d3 = _mm256_add_epi16(*in1, *in3);
+  const __m256i d4 = _mm256_add_epi16(d1, d2);
+  const __m256i d = _mm256_add_epi16(d3, d4);
+  *out0 = _mm256_add_epi16(a, d);
+  *out1 = _mm256_add_epi16(b, c);
+  *out2 = _mm256_sub_epi16(b, c);
+  *out3 = _mm256_sub_epi16(a, d);
+}
+
+// Loads row 'i' of the two consecutive 4x4 coefficient blocks at 'in'.
+static WEBP_INLINE __m128i LoadRowPair(const int16_t* const in, int i) {
+  const __m128i A = _mm_loadl_epi64((const __m128i*)&in[4 * i]);
+  const __m128i B = _mm_loadl_epi64((const __m128i*)&in[16 + 4 * i]);
+  return _mm_unpacklo_epi64(A, B);
+}
+
+// Inverse-transforms the rows in0..in3 of up to four 4x4 blocks (two per
+// 128-bit lane, each lane doing the same work as the SSE2 version), and
+// returns the (transposed back) residual rows.
+static WEBP_INLINE void TransformCore(__m256i* const in0, __m256i* const in1,
+                                      __m256i* const in2, __m256i* const in3) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i four = _mm256_set1_epi16(4);
+  __m256i T0, T1, T2, T3;
+  __m256i tmp0, tmp1, tmp2, tmp3;
+
+  // Vertical pass and subsequent transpose.
+  TransformPass(in0, in1, in2, in3, &zero, &tmp0, &tmp1, &tmp2, &tmp3);
+  Transpose_4_4x4_16b(&tmp0, &tmp1, &tmp2, &tmp3, &T0, &T1, &T2, &T3);
+
+  // Horizontal pass and subsequent transpose.
+  TransformPass(&T0, &T1, &T2, &T3, &four, &tmp0, &tmp1, &tmp2, &tmp3);
+  tmp0 = _mm256_srai_epi16(tmp0, 3);
+  tmp1 = _mm256_srai_epi16(tmp1, 3);
+  tmp2 = _mm256_srai_epi16(tmp2, 3);
+  tmp3 = _mm256_srai_epi16(tmp3, 3);
+  Transpose_4_4x4_16b(&tmp0, &tmp1, &tmp2, &tmp3, in0, in1, in2, in3);
+}
+
+// Adds the 8-pixel wide residual rows to 'dst' and stores them.
+static WEBP_INLINE void AddStore8x4(const __m128i* const T, uint8_t* dst) {
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = 0; i < 4; ++i, dst += BPS) {
+    const __m128i ref = _mm_loadl_epi64((const __m128i*)dst);
+    const __m128i res = _mm_add_epi16(_mm_unpacklo_epi8(ref, zero), T[i]);
+    _mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(res, res));
+  }
+}
+
+// Same, for 4 pixels only.
+static WEBP_INLINE void AddStore4x4(const __m128i* const T, uint8_t* dst) {
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = 0; i < 4; ++i, dst += BPS) {
+    const __m128i ref = _mm_cvtsi32_si128(WebPMemToUint32(dst));
+    const __m128i res = _mm_add_epi16(_mm_unpacklo_epi8(ref, zero), T[i]);
+    WebPUint32ToMem(dst, _mm_cvtsi128_si32(_mm_packus_epi16(res, res)));
+  }
+}
+
+// One pass of the transform on a whole 4x4 block per 128-bit lane: 'r01'
+// holds the rows [r0 r1] of the block and 'r23' the rows [r2 r3]. The result
+// rows are returned in the same layout. 'dc_bias' is added to r0.
+static WEBP_INLINE void TransformPassBlock(__m256i* const r01,
+                                           __m256i* const r23,
+                                           const __m256i* const dc_bias) {
+  // The constants only apply to r1 and r3 (the high halves), so that the
+  // low halves of the products vanish and the same sums give [a d] and [b c].
+  const __m256i k1 = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(20091, 20091, 20091, 20091, 0, 0, 0, 0));
+  const __m256i k2 = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(-30068, -30068, -30068, -30068, 0, 0, 0, 0));
+  const __m256i U = _mm256_add_epi16(*r01, *dc_bias);
+  const __m256i V = *r23;
+  // [a | d3] and [b | c3], see TransformPass()
+  const __m256i S = _mm256_add_epi16(U, V);
+  const __m256i D = _mm256_sub_epi16(U, V);
+  const __m256i c4 = _mm256_sub_epi16(_mm256_mulhi_epi16(U, k2),
+                                      _mm256_mulhi_epi16(V, k1));
+  const __m256i d4 = _mm256_add_epi16(_mm256_mulhi_epi16(U, k1),
+                                      _mm256_mulhi_epi16(V, k2));
+  const __m256i ad = _mm256_add_epi16(S, d4);   // [a | d]
+  const __m256i bc = _mm256_add_epi16(D, c4);   // [b | c]
+  const __m256i da = _mm256_shuffle_epi32(ad, _MM_SHUFFLE(1, 0, 3, 2));
+  const __m256i cb = _mm256_shuffle_epi32(bc, _MM_SHUFFLE(1, 0, 3, 2));
+  const __m256i out0 = _mm256_add_epi16(ad, da);   // [a + d | ...]
+  const __m256i out1 = _mm256_add_epi16(bc, cb);   // [b + c | ...]
+  const __m256i out2 = _mm256_sub_epi16(bc, cb);   // [b - c | ...]
+  const __m256i out3 = _mm256_sub_epi16(ad, da);   // [a - d | ...]
+  *r01 = _mm256_unpacklo_epi64(out0, out1);
+  *r23 = _mm256_unpacklo_epi64(out2, out3);
+}
+
+// Transposes the 4x4 block held in each lane of [r0 r1] / [r2 r3].
+static WEBP_INLINE void TransposeBlock(__m256i* const r01, __m256i* const r23) {
+  // r00 r20 r01 r21 r02 r22 r03 r23
+  const __m256i t0 = _mm256_unpacklo_epi16(*r01, *r23);
+  // r10 r30 r11 r31 r12 r32 r13 r33
+  const __m256i t1 = _mm256_unpackhi_epi16(*r01, *r23);
+  *r01 = _mm256_unpacklo_epi16(t0, t1);
+  *r23 = _mm256_unpackhi_epi16(t0, t1);
+}
+
+static void Transform(const int16_t* in, uint8_t* dst, int do_two) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i four = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(0, 0, 0, 0, 4, 4, 4, 4));
+  __m256i r01, r23;
+  // The first block goes in the low lane and the second one, if any, in the
+  // high lane: each lane then does a whole transform.
+  if (do_two) {
+    r01 = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&in[0])),
+        _mm_loadu_si128((const __m128i*)&in[16]), 1);
+    r23 = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&in[8])),
+        _mm_loadu_si128((const __m128i*)&in[24]), 1);
+  } else {
+    r01 = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&in[0]));
+    r23 = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&in[8]));
+  }
+
+  // Vertical pass and subsequent transpose.
+  TransformPassBlock(&r01, &r23, &zero);
+  TransposeBlock(&r01, &r23);
+
+  // Horizontal pass and subsequent transpose.
+  TransformPassBlock(&r01, &r23, &four);
+  r01 = _mm256_srai_epi16(r01, 3);
+  r23 = _mm256_srai_epi16(r23, 3);
+  TransposeBlock(&r01, &r23);
+
+  if (do_two) {
+    // The reference rows are loaded in the same [A0 A1 | B0 B1] layout.
+    const __m128i ref0 = _mm_loadl_epi64((const __m128i*)&dst[0 * BPS]);
+    const __m128i ref1 = _mm_loadl_epi64((const __m128i*)&dst[1 * BPS]);
+    const __m128i ref2 = _mm_loadl_epi64((const __m128i*)&dst[2 * BPS]);
+    const __m128i ref3 = _mm_loadl_epi64((const __m128i*)&dst[3 * BPS]);
+    const __m256i sum01 = _mm256_add_epi16(
+        _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(ref0, ref1)), r01);
+    const __m256i sum23 = _mm256_add_epi16(
+        _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(ref2, ref3)), r23);
+    // A0 A1 A2 A3 | B0 B1 B2 B3
+    const __m256i packed = _mm256_packus_epi16(sum01, sum23);
+    const __m128i lo = _mm256_castsi256_si128(packed);
+    const __m128i hi = _mm256_extracti128_si256(packed, 1);
+    const __m128i AB01 = _mm_unpacklo_epi32(lo, hi);
+    const __m128i AB23 = _mm_unpackhi_epi32(lo, hi);
+    _mm_storel_epi64((__m128i*)&dst[0 * BPS], AB01);
+    _mm_storel_epi64((__m128i*)&dst[1 * BPS], _mm_srli_si128(AB01, 8));
+    _mm_storel_epi64((__m128i*)&dst[2 * BPS], AB23);
+    _mm_storel_epi64((__m128i*)&dst[3 * BPS], _mm_srli_si128(AB23, 8));
+  } else {
+    __m128i T[4];
+    T[0] = _mm256_castsi256_si128(r01);
+    T[1] = _mm_srli_si128(T[0], 8);
+    T[2] = _mm256_castsi256_si128(r23);
+    T[3] = _mm_srli_si128(T[2], 8);
+    AddStore4x4(T, dst);
+  }
+}
+
+// The four chroma blocks of one plane, in a single pass: blocks 0 and 1 in the
+// low lane, 2 and 3 (the next four rows) in the high lane.
+static void TransformUV(const int16_t* in, uint8_t* dst) {
+  __m256i in0, in1, in2, in3;
+  __m128i T[4];
+  in0 = _mm256_inserti128_si256(_mm256_castsi128_si256(LoadRowPair(in, 0)),
+                                LoadRowPair(in + 32, 0), 1);
+  in1 = _mm256_inserti128_si256(_mm256_castsi128_si256(LoadRowPair(in, 1)),
+                                LoadRowPair(in + 32, 1), 1);
+  in2 = _mm256_inserti128_si256(_mm256_castsi128_si256(LoadRowPair(in, 2)),
+                                LoadRowPair(in + 32, 2), 1);
+  in3 = _mm256_inserti128_si256(_mm256_castsi128_si256(LoadRowPair(in, 3)),
+                                LoadRowPair(in + 32, 3), 1);
+  TransformCore(&in0, &in1, &in2, &in3);
+  T[0] = _mm256_castsi256_si128(in0);
+  T[1] = _mm256_castsi256_si128(in1);
+  T[2] = _mm256_castsi256_si128(in2);
+  T[3] = _mm256_castsi256_si128(in3);
+  AddStore8x4(T, dst);
+  T[0] = _mm256_extracti128_si256(in0, 1);
+  T[1] = _mm256_extracti128_si256(in1, 1);
+  T[2] = _mm256_extracti128_si256(in2, 1);
+  T[3] = _mm256_extracti128_si256(in3, 1);
+  AddStore8x4(T, dst + 4 * BPS);
+}
+
+//------------------------------------------------------------------------------
+// Luma 16x16 and chroma 8x8 DC predictions.
+//
+// The left column is gathered in one go: each 32-bit word read at
+// 'dst - 4 + j * BPS' has the left sample dst[-1 + j * BPS] in its top byte.
+
+static WEBP_INLINE __m256i LoadLeft8(const uint8_t* const dst) {
+  const __m256i kOffsets =
+      _mm256_setr_epi32(0 * BPS, 1 * BPS, 2 * BPS, 3 * BPS,
+                        4 * BPS, 5 * BPS, 6 * BPS, 7 * BPS);
+  const __m256i words =
+      _mm256_i32gather_epi32((const int*)(dst - 4), kOffsets, 1);
+  return _mm256_srli_epi32(words, 24);   // 8 x int32 left samples
+}
+
+static WEBP_INLINE int HorizontalSum32(const __m256i v) {
+  const __m128i s0 = _mm_add_epi32(_mm256_castsi256_si128(v),
+                                   _mm256_extracti128_si256(v, 1));
+  const __m128i s1 = _mm_add_epi32(s0, _mm_shuffle_epi32(s0, 0x4e));
+  const __m128i s2 = _mm_add_epi32(s1, _mm_shuffle_epi32(s1, 0xb1));
+  return _mm_cvtsi128_si32(s2);
+}
+
+static WEBP_INLINE int SumLeft16(const uint8_t* const dst) {
+  return HorizontalSum32(_mm256_add_epi32(LoadLeft8(dst),
+                                          LoadLeft8(dst + 8 * BPS)));
+}
+
+static WEBP_INLINE int SumLeft8(const uint8_t* const dst) {
+  return HorizontalSum32(LoadLeft8(dst));
+}
+
+static WEBP_INLINE int SumTop(const uint8_t* const dst, int size) {
+  const __m128i zero = _mm_setzero_si128();
+  if (size == 16) {
+    const __m128i top = _mm_loadu_si128((const __m128i*)(dst - BPS));
+    const __m128i sad8x2 = _mm_sad_epu8(top, zero);
+    return _mm_cvtsi128_si32(_mm_add_epi32(sad8x2,
+                                           _mm_shuffle_epi32(sad8x2, 2)));
+  } else {
+    const __m128i top = _mm_loadl_epi64((const __m128i*)(dst - BPS));
+    return _mm_cvtsi128_si32(_mm_sad_epu8(top, zero));
+  }
+}
+
+static WEBP_INLINE void Put16(uint8_t v, uint8_t* dst) {
+  int j;
+  const __m128i values = _mm_set1_epi8(v);
+  for (j = 0; j < 16; ++j) {
+    _mm_storeu_si128((__m128i*)(dst + j * BPS), values);
+  }
+}
+
+static WEBP_INLINE void Put8x8uv(uint8_t v, uint8_t* dst) {
+  int j;
+  const __m128i values = _mm_set1_epi8(v);
+  for (j = 0; j < 8; ++j) {
+    _mm_storel_epi64((__m128i*)(dst + j * BPS), values);
+  }
+}
+
+static void DC16(uint8_t* dst) {    // DC
+  Put16((SumTop(dst, 16) + SumLeft16(dst) + 16) >> 5, dst);
+}
+
+static void DC16NoTop(uint8_t* dst) {   // DC with top samples not available
+  Put16((SumLeft16(dst) + 8) >> 4, dst);
+}
+
+static void DC8uv(uint8_t* dst) {     // DC
+  Put8x8uv((SumTop(dst, 8) + SumLeft8(dst) + 8) >> 4, dst);
+}
+
+static void DC8uvNoTop(uint8_t* dst) {  // DC with no top samples
+  Put8x8uv((SumLeft8(dst) + 4) >> 3, dst);
+}
+
+//------------------------------------------------------------------------------
+// Entry point
+
+extern void VP8DspInitAVX2(void);
+
+WEBP_TSAN_IGNORE_FUNCTION void VP8DspInitAVX2(void) {
+  // Only the functions measured to be faster than their SSE2 / SSE4.1
+  // counterparts are installed (see 'webp_bench -dsp').
+  VP8Transform = Transform;
+  VP8TransformUV = TransformUV;
+
+  VP8PredLuma16[0] = DC16;
+  VP8PredLuma16[4] = DC16NoTop;
+
+  VP8PredChroma8[0] = DC8uv;
+  VP8PredChroma8[4] = DC8uvNoTop;
+}
+
+#else  // !WEBP_USE_AVX2
+
+WEBP_DSP_INIT_STUB(VP8DspInitAVX2)
+
+#endif  // WEBP_USE_AVX2
@@ -209,6 +209,25 @@ typedef int (*VP8QuantizeBlockWHT)(int16_t in[16], int16_t out[16],
                                    const struct VP8Matrix* const mtx);
 extern VP8QuantizeBlockWHT VP8EncQuantizeBlockWHT;
 
+// Per-coefficient terms of the trellis quantization, in natural order:
+// the levels quantized with a neutral bias and with a 0x80 bias (above which
+// a level is not worth trying), and the weighted distortion delta of coding
+// 'level' or 'level + 1' instead of zero.
+typedef struct {
+  int16_t level[16];
+  int16_t max_level[16];
+  int32_t error[2][16];
+} VP8TrellisCoeffs;
+// Returns the zigzag position 'last' of the last coefficient at or after
+// 'first' whose square exceeds q_[1]^2 / 4, or first - 1 if there is none.
+// 'tc' only needs to be filled for zigzag positions 'first' to
+// min(last + 1, 15), which is as far as the trellis looks.
+typedef int (*VP8TrellisPrepareFunc)(const int16_t in[16], int first,
+                                     const struct VP8Matrix* const mtx,
+                                     const uint16_t weights[16],
+                                     VP8TrellisCoeffs* const tc);
+extern VP8TrellisPrepareFunc VP8EncTrellisPrepare;
+
 extern const int VP8DspScan[16 + 4 + 4];
 
 // Collect histogram for susceptibility calculation.
@@ -421,6 +440,9 @@ extern void (*WebPConvertRGBA32ToUV)(const uint16_t* rgb,
 // Convert RGB or BGR to Y
 extern void (*WebPConvertRGB24ToY)(const uint8_t* rgb, uint8_t* y, int width);
 extern void (*WebPConvertBGR24ToY)(const uint8_t* bgr, uint8_t* y, int width);
+// Convert RGBA or BGRA (the fourth byte is ignored) to Y
+extern void (*WebPConvertRGBAToY)(const uint8_t* rgba, uint8_t* y, int width);
+extern void (*WebPConvertBGRAToY)(const uint8_t* bgra, uint8_t* y, int width);
 
 // used for plain-C fallback.
 extern void WebPConvertARGBToUV_C(const uint32_t* argb, uint8_t* u, uint8_t* v,
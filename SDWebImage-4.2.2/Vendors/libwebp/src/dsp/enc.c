@@ -670,6 +670,38 @@ static int Quantize2Blocks(int16_t in[32], int16_t out[32],
   return nz;
 }
 
+static int TrellisPrepare(const int16_t in[16], int first,
+                          const VP8Matrix* const mtx,
+                          const uint16_t weights[16],
+                          VP8TrellisCoeffs* const tc) {
+  const int thresh = mtx->q_[1] * mtx->q_[1] / 4;
+  int last, end, n;
+  for (last = 15; last >= first; --last) {
+    const int j = kZigzag[last];
+    if (in[j] * in[j] > thresh) break;
+  }
+  // Most blocks are sparse: only fill the coefficients the trellis inspects.
+  end = (last < first) ? first : (last < 15) ? last + 1 : 15;
+  for (n = first; n <= end; ++n) {
+    const int j = kZigzag[n];
+    const uint32_t Q = mtx->q_[j];
+    const uint32_t iQ = mtx->iq_[j];
+    const uint32_t coeff0 = abs(in[j]) + mtx->sharpen_[j];
+    const int level0 = QUANTDIV(coeff0, iQ, BIAS(0x00));
+    const int thresh_level = QUANTDIV(coeff0, iQ, BIAS(0x80));
+    const int level = (level0 > MAX_LEVEL) ? MAX_LEVEL : level0;
+    const int max_level =
+        (thresh_level > MAX_LEVEL) ? MAX_LEVEL : thresh_level;
+    // (coeff0 - level * Q)^2 - coeff0^2 = level * Q * (level * Q - 2 * coeff0)
+    const uint32_t lq = level * Q;
+    tc->level[j] = level;
+    tc->max_level[j] = max_level;
+    tc->error[0][j] = weights[j] * (lq * (lq - 2 * coeff0));
+    tc->error[1][j] = weights[j] * ((lq + Q) * (lq + Q - 2 * coeff0));
+  }
+  return last;
+}
+
 //------------------------------------------------------------------------------
 // Block copy
 
@@ -847,6 +879,7 @@ VP8MeanMetric VP8Mean16x4;
 VP8QuantizeBlock VP8EncQuantizeBlock;
 VP8Quantize2Blocks VP8EncQuantize2Blocks;
 VP8QuantizeBlockWHT VP8EncQuantizeBlockWHT;
+VP8TrellisPrepareFunc VP8EncTrellisPrepare;
 VP8BlockCopy VP8Copy4x4;
 VP8BlockCopy VP8Copy16x8;
 
@@ -886,6 +919,7 @@ WEBP_TSAN_IGNORE_FUNCTION void VP8EncDspInit(void) {
   VP8EncQuantizeBlock = QuantizeBlock;
   VP8EncQuantize2Blocks = Quantize2Blocks;
   VP8EncQuantizeBlockWHT = QuantizeBlock;
+  VP8EncTrellisPrepare = TrellisPrepare;
   VP8Copy4x4 = Copy4x4;
   VP8Copy16x8 = Copy16x8;
 
@@ -8,14 +8,746 @@
 // -----------------------------------------------------------------------------
 //
 // AVX2 version of speed-critical encoding functions.
+//
+// Most functions work on two 4x4 blocks at once, one per 128-bit lane, with
+// the same arithmetic as their SSE2/SSE4.1 counterparts (enc_sse2.c and
+// enc_sse41.c) so that the results are bit-exact.
 
 #include "./dsp.h"
 
 #if defined(WEBP_USE_AVX2)
+#include <immintrin.h>
+#include <stdlib.h>  // for abs()
+#include <string.h>
 
-#endif  // WEBP_USE_AVX2
+#include "../enc/vp8i_enc.h"
+#include "../utils/utils.h"
+
+// Makes a __m256i from two __m128i: 'lo' goes to the low lane.
+static WEBP_INLINE __m256i MakeM256(const __m128i lo, const __m128i hi) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// Returns the sum of the eight 32b values of 'v'.
+static WEBP_INLINE int HorizontalAdd32b(const __m256i v) {
+  const __m128i a = _mm_add_epi32(_mm256_castsi256_si128(v),
+                                  _mm256_extracti128_si256(v, 1));
+  const __m128i b = _mm_add_epi32(a, _mm_srli_si128(a, 8));
+  const __m128i c = _mm_add_epi32(b, _mm_srli_si128(b, 4));
+  return _mm_cvtsi128_si32(c);
+}
+
+//------------------------------------------------------------------------------
+// Transforms (Paragraph 14.4)
+
+// One pass of the inverse transform (see enc_sse2.c for the explanation of
+// the k1/k2 constants), followed by a transpose. In each 128-bit lane, 'in01'
+// holds the rows in0 and in1 of a block, and 'in23' the rows in2 and in3.
+// Same for the outputs.
+static WEBP_INLINE void ITransformPass(const __m256i* const in01,
+                                       const __m256i* const in23,
+                                       __m256i* const out01,
+                                       __m256i* const out23) {
+  const __m256i k2k1 = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(20091, 20091, 20091, 20091,
+                    -30068, -30068, -30068, -30068));
+  const __m256i k1k2 = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(-30068, -30068, -30068, -30068,
+                    20091, 20091, 20091, 20091));
+  // in0 in2 / in1 in3
+  const __m256i even = _mm256_unpacklo_epi64(*in01, *in23);
+  const __m256i odd = _mm256_unpackhi_epi64(*in01, *in23);
+  // a = in0 + in2, b = in0 - in2
+  const __m256i even_s = _mm256_shuffle_epi32(even, _MM_SHUFFLE(1, 0, 3, 2));
+  const __m256i sum = _mm256_add_epi16(even, even_s);
+  const __m256i diff = _mm256_sub_epi16(even_s, even);
+  const __m256i ab = _mm256_blend_epi32(sum, diff, 0xcc);
+  // MUL(in1, K2) MUL(in3, K1) / MUL(in1, K1) MUL(in3, K2)
+  const __m256i m = _mm256_add_epi16(odd, _mm256_mulhi_epi16(odd, k2k1));
+  const __m256i n = _mm256_add_epi16(odd, _mm256_mulhi_epi16(odd, k1k2));
+  const __m256i m_s = _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2));
+  const __m256i n_s = _mm256_shuffle_epi32(n, _MM_SHUFFLE(1, 0, 3, 2));
+  // d = MUL(in1, K1) + MUL(in3, K2), c = MUL(in1, K2) - MUL(in3, K1)
+  const __m256i dc = _mm256_blend_epi32(_mm256_add_epi16(n, n_s),
+                                        _mm256_sub_epi16(m_s, m), 0xcc);
+  // (a + d, b + c) / (a - d, b - c)
+  const __m256i tmp01 = _mm256_add_epi16(ab, dc);
+  const __m256i tmp32 = _mm256_sub_epi16(ab, dc);
+  const __m256i tmp23 = _mm256_shuffle_epi32(tmp32, _MM_SHUFFLE(1, 0, 3, 2));
+  // Transpose.
+  const __m256i t0 = _mm256_unpacklo_epi16(tmp01, tmp23);
+  const __m256i t1 = _mm256_unpackhi_epi16(tmp01, tmp23);
+  *out01 = _mm256_unpacklo_epi16(t0, t1);
+  *out23 = _mm256_unpackhi_epi16(t0, t1);
+}
+
+// Does one or two inverse transforms.
+static void ITransform(const uint8_t* ref, const int16_t* in, uint8_t* dst,
+                       int do_two) {
+  const __m256i four = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(0, 0, 0, 0, 4, 4, 4, 4));
+  __m256i rows01, rows23;
+
+  // Load the coefficients, first block in the low lane. In the case of only
+  // one inverse transform, the high lane is never stored.
+  {
+    const __m256i A = _mm256_loadu_si256((const __m256i*)&in[0]);
+    const __m256i B =
+        do_two ? _mm256_loadu_si256((const __m256i*)&in[16]) : A;
+    rows01 = _mm256_permute2x128_si256(A, B, 0x20);
+    rows23 = _mm256_permute2x128_si256(A, B, 0x31);
+  }
+
+  // Vertical pass, then horizontal pass with rounding.
+  ITransformPass(&rows01, &rows23, &rows01, &rows23);
+  rows01 = _mm256_add_epi16(rows01, four);
+  ITransformPass(&rows01, &rows23, &rows01, &rows23);
+  rows01 = _mm256_srai_epi16(rows01, 3);
+  rows23 = _mm256_srai_epi16(rows23, 3);
+
+  // Add inverse transform to 'ref' and store.
+  {
+    __m128i ref0, ref1, ref2, ref3;
+    __m128i lo, hi;
+    __m256i sum01, sum23, packed;
+    if (do_two) {
+      ref0 = _mm_loadl_epi64((const __m128i*)&ref[0 * BPS]);
+      ref1 = _mm_loadl_epi64((const __m128i*)&ref[1 * BPS]);
+      ref2 = _mm_loadl_epi64((const __m128i*)&ref[2 * BPS]);
+      ref3 = _mm_loadl_epi64((const __m128i*)&ref[3 * BPS]);
+    } else {
+      ref0 = _mm_cvtsi32_si128(WebPMemToUint32(&ref[0 * BPS]));
+      ref1 = _mm_cvtsi32_si128(WebPMemToUint32(&ref[1 * BPS]));
+      ref2 = _mm_cvtsi32_si128(WebPMemToUint32(&ref[2 * BPS]));
+      ref3 = _mm_cvtsi32_si128(WebPMemToUint32(&ref[3 * BPS]));
+    }
+    // A0 A1 B0 B1 -> 16b, one block per lane
+    sum01 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(ref0, ref1));
+    sum23 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(ref2, ref3));
+    sum01 = _mm256_add_epi16(sum01, rows01);
+    sum23 = _mm256_add_epi16(sum23, rows23);
+    packed = _mm256_packus_epi16(sum01, sum23);   // A0 A1 A2 A3 | B0 B1 B2 B3
+    lo = _mm256_castsi256_si128(packed);
+    if (do_two) {
+      hi = _mm256_extracti128_si256(packed, 1);
+      {
+        const __m128i AB01 = _mm_unpacklo_epi32(lo, hi);
+        const __m128i AB23 = _mm_unpackhi_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*)&dst[0 * BPS], AB01);
+        _mm_storel_epi64((__m128i*)&dst[1 * BPS],
+                         _mm_unpackhi_epi64(AB01, AB01));
+        _mm_storel_epi64((__m128i*)&dst[2 * BPS], AB23);
+        _mm_storel_epi64((__m128i*)&dst[3 * BPS],
+                         _mm_unpackhi_epi64(AB23, AB23));
+      }
+    } else {
+      WebPUint32ToMem(&dst[0 * BPS], _mm_cvtsi128_si32(lo));
+      WebPUint32ToMem(&dst[1 * BPS], _mm_extract_epi32(lo, 1));
+      WebPUint32ToMem(&dst[2 * BPS], _mm_extract_epi32(lo, 2));
+      WebPUint32ToMem(&dst[3 * BPS], _mm_extract_epi32(lo, 3));
+    }
+  }
+}
+
+// Same as FTransformPass1() in enc_sse2.c, on each 128-bit lane.
+static WEBP_INLINE void FTransformPass1(const __m256i* const in01,
+                                        const __m256i* const in23,
+                                        __m256i* const out01,
+                                        __m256i* const out32) {
+  const __m256i k937 = _mm256_set1_epi32(937);
+  const __m256i k1812 = _mm256_set1_epi32(1812);
+  const __m256i k88p = _mm256_set1_epi16(8);
+  const __m256i k88m = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(-8, 8, -8, 8, -8, 8, -8, 8));
+  const __m256i k5352_2217p = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(2217, 5352, 2217, 5352, 2217, 5352, 2217, 5352));
+  const __m256i k5352_2217m = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(-5352, 2217, -5352, 2217, -5352, 2217, -5352, 2217));
+
+  // *in01 = 00 01 10 11 02 03 12 13
+  // *in23 = 20 21 30 31 22 23 32 33
+  const __m256i shuf01_p =
+      _mm256_shufflehi_epi16(*in01, _MM_SHUFFLE(2, 3, 0, 1));
+  const __m256i shuf23_p =
+      _mm256_shufflehi_epi16(*in23, _MM_SHUFFLE(2, 3, 0, 1));
+  // 00 01 10 11 03 02 13 12
+  // 20 21 30 31 23 22 33 32
+  const __m256i s01 = _mm256_unpacklo_epi64(shuf01_p, shuf23_p);
+  const __m256i s32 = _mm256_unpackhi_epi64(shuf01_p, shuf23_p);
+  // 00 01 10 11 20 21 30 31
+  // 03 02 13 12 23 22 33 32
+  const __m256i a01 = _mm256_add_epi16(s01, s32);
+  const __m256i a32 = _mm256_sub_epi16(s01, s32);
+  // [d0 + d3 | d1 + d2 | ...] = [a0 a1 | a0' a1' | ... ]
+  // [d0 - d3 | d1 - d2 | ...] = [a3 a2 | a3' a2' | ... ]
+
+  const __m256i tmp0 = _mm256_madd_epi16(a01, k88p);  // (a0 + a1) << 3
+  const __m256i tmp2 = _mm256_madd_epi16(a01, k88m);  // (a0 - a1) << 3
+  const __m256i tmp1_1 = _mm256_madd_epi16(a32, k5352_2217p);
+  const __m256i tmp3_1 = _mm256_madd_epi16(a32, k5352_2217m);
+  const __m256i tmp1_2 = _mm256_add_epi32(tmp1_1, k1812);
+  const __m256i tmp3_2 = _mm256_add_epi32(tmp3_1, k937);
+  const __m256i tmp1 = _mm256_srai_epi32(tmp1_2, 9);
+  const __m256i tmp3 = _mm256_srai_epi32(tmp3_2, 9);
+  const __m256i s03 = _mm256_packs_epi32(tmp0, tmp2);
+  const __m256i s12 = _mm256_packs_epi32(tmp1, tmp3);
+  const __m256i s_lo = _mm256_unpacklo_epi16(s03, s12);   // 0 1 0 1 0 1...
+  const __m256i s_hi = _mm256_unpackhi_epi16(s03, s12);   // 2 3 2 3 2 3
+  const __m256i v23 = _mm256_unpackhi_epi32(s_lo, s_hi);
+  *out01 = _mm256_unpacklo_epi32(s_lo, s_hi);
+  *out32 = _mm256_shuffle_epi32(v23, _MM_SHUFFLE(1, 0, 3, 2));  // 3 2 3 2 ..
+}
+
+// Same as FTransformPass2() in enc_sse2.c, on each 128-bit lane. The block
+// of the low lane is stored in out[0..15], the other one in out[16..31].
+static WEBP_INLINE void FTransformPass2(const __m256i* const v01,
+                                        const __m256i* const v32,
+                                        int16_t* out) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i seven = _mm256_set1_epi16(7);
+  const __m256i k5352_2217 = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(5352, 2217, 5352, 2217, 5352, 2217, 5352, 2217));
+  const __m256i k2217_5352 = _mm256_broadcastsi128_si256(
+      _mm_set_epi16(2217, -5352, 2217, -5352, 2217, -5352, 2217, -5352));
+  const __m256i k12000_plus_one = _mm256_set1_epi32(12000 + (1 << 16));
+  const __m256i k51000 = _mm256_set1_epi32(51000);
+
+  // a3 = v0 - v3
+  // a2 = v1 - v2
+  const __m256i a32 = _mm256_sub_epi16(*v01, *v32);
+  const __m256i a22 = _mm256_unpackhi_epi64(a32, a32);
+
+  const __m256i b23 = _mm256_unpacklo_epi16(a22, a32);
+  const __m256i c1 = _mm256_madd_epi16(b23, k5352_2217);
+  const __m256i c3 = _mm256_madd_epi16(b23, k2217_5352);
+  const __m256i d1 = _mm256_add_epi32(c1, k12000_plus_one);
+  const __m256i d3 = _mm256_add_epi32(c3, k51000);
+  const __m256i e1 = _mm256_srai_epi32(d1, 16);
+  const __m256i e3 = _mm256_srai_epi32(d3, 16);
+  // f1 = ((b3 * 5352 + b2 * 2217 + 12000) >> 16)
+  // f3 = ((b3 * 2217 - b2 * 5352 + 51000) >> 16)
+  const __m256i f1 = _mm256_packs_epi32(e1, e1);
+  const __m256i f3 = _mm256_packs_epi32(e3, e3);
+  // g1 = f1 + (a3 != 0) = f1 + 1 - (a3 == 0)
+  const __m256i g1 = _mm256_add_epi16(f1, _mm256_cmpeq_epi16(a32, zero));
+
+  // a0 = v0 + v3
+  // a1 = v1 + v2
+  const __m256i a01 = _mm256_add_epi16(*v01, *v32);
+  const __m256i a01_plus_7 = _mm256_add_epi16(a01, seven);
+  const __m256i a11 = _mm256_unpackhi_epi64(a01, a01);
+  const __m256i c0 = _mm256_add_epi16(a01_plus_7, a11);
+  const __m256i c2 = _mm256_sub_epi16(a01_plus_7, a11);
+  // d0 = (a0 + a1 + 7) >> 4;
+  // d2 = (a0 - a1 + 7) >> 4;
+  const __m256i d0 = _mm256_srai_epi16(c0, 4);
+  const __m256i d2 = _mm256_srai_epi16(c2, 4);
+
+  const __m256i d0_g1 = _mm256_unpacklo_epi64(d0, g1);
+  const __m256i d2_f3 = _mm256_unpacklo_epi64(d2, f3);
+  _mm256_storeu_si256((__m256i*)&out[0],
+                      _mm256_permute2x128_si256(d0_g1, d2_f3, 0x20));
+  _mm256_storeu_si256((__m256i*)&out[16],
+                      _mm256_permute2x128_si256(d0_g1, d2_f3, 0x31));
+}
+
+static void FTransform2(const uint8_t* src, const uint8_t* ref, int16_t* out) {
+  // Load eight pixels per line: the first block ends up in the low lane,
+  // as 00 01 10 11 02 03 12 13 / 20 21 30 31 22 23 32 33 (see enc_sse2.c).
+  const __m128i src0 = _mm_loadl_epi64((const __m128i*)&src[0 * BPS]);
+  const __m128i src1 = _mm_loadl_epi64((const __m128i*)&src[1 * BPS]);
+  const __m128i src2 = _mm_loadl_epi64((const __m128i*)&src[2 * BPS]);
+  const __m128i src3 = _mm_loadl_epi64((const __m128i*)&src[3 * BPS]);
+  const __m128i ref0 = _mm_loadl_epi64((const __m128i*)&ref[0 * BPS]);
+  const __m128i ref1 = _mm_loadl_epi64((const __m128i*)&ref[1 * BPS]);
+  const __m128i ref2 = _mm_loadl_epi64((const __m128i*)&ref[2 * BPS]);
+  const __m128i ref3 = _mm_loadl_epi64((const __m128i*)&ref[3 * BPS]);
+  const __m256i src_0 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi16(src0, src1));
+  const __m256i src_1 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi16(src2, src3));
+  const __m256i ref_0 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi16(ref0, ref1));
+  const __m256i ref_1 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi16(ref2, ref3));
+  // Compute the difference.
+  const __m256i row01 = _mm256_sub_epi16(src_0, ref_0);
+  const __m256i row23 = _mm256_sub_epi16(src_1, ref_1);
+  __m256i v01, v32;
+
+  FTransformPass1(&row01, &row23, &v01, &v32);
+  FTransformPass2(&v01, &v32, out);
+}
+
+//------------------------------------------------------------------------------
+// Compute susceptibility based on DCT-coeff histograms:
+// the higher, the "easier" the macroblock is to compress.
+
+static void CollectHistogram(const uint8_t* ref, const uint8_t* pred,
+                             int start_block, int end_block,
+                             VP8Histogram* const histo) {
+  const __m256i max_coeff_thresh = _mm256_set1_epi16(MAX_COEFF_THRESH);
+  int j;
+  int distribution[MAX_COEFF_THRESH + 1] = { 0 };
+  for (j = start_block; j < end_block;) {
+    int16_t out[32];
+    int k, num_coeffs;
+    // Two side-by-side blocks can be transformed at once.
+    if (j + 1 < end_block && VP8DspScan[j + 1] == VP8DspScan[j] + 4) {
+      FTransform2(ref + VP8DspScan[j], pred + VP8DspScan[j], out);
+      num_coeffs = 32;
+      j += 2;
+    } else {
+      VP8FTransform(ref + VP8DspScan[j], pred + VP8DspScan[j], out);
+      memset(out + 16, 0, 16 * sizeof(*out));
+      num_coeffs = 16;
+      j += 1;
+    }
+
+    // Convert coefficients to bin (within out[]).
+    {
+      // Load.
+      const __m256i out0 = _mm256_loadu_si256((__m256i*)&out[0]);
+      const __m256i out1 = _mm256_loadu_si256((__m256i*)&out[16]);
+      // v = abs(out) >> 3
+      const __m256i v0 = _mm256_srai_epi16(_mm256_abs_epi16(out0), 3);
+      const __m256i v1 = _mm256_srai_epi16(_mm256_abs_epi16(out1), 3);
+      // bin = min(v, MAX_COEFF_THRESH)
+      const __m256i bin0 = _mm256_min_epi16(v0, max_coeff_thresh);
+      const __m256i bin1 = _mm256_min_epi16(v1, max_coeff_thresh);
+      // Store.
+      _mm256_storeu_si256((__m256i*)&out[0], bin0);
+      _mm256_storeu_si256((__m256i*)&out[16], bin1);
+    }
+
+    // Convert coefficients to bin.
+    for (k = 0; k < num_coeffs; ++k) {
+      ++distribution[out[k]];
+    }
+  }
+  VP8SetHistogramData(distribution, histo);
+}
+
+//------------------------------------------------------------------------------
+// Metric
+
+// Returns the squared differences of 16 pixels, summed pairwise in 32b.
+static WEBP_INLINE __m256i SquaredDiff16(const __m128i a, const __m128i b) {
+  const __m256i a16 = _mm256_cvtepu8_epi16(a);
+  const __m256i b16 = _mm256_cvtepu8_epi16(b);
+  const __m256i d = _mm256_sub_epi16(a16, b16);
+  return _mm256_madd_epi16(d, d);
+}
+
+static WEBP_INLINE int SSE_16xN(const uint8_t* a, const uint8_t* b,
+                                int num_pairs) {
+  __m256i sum = _mm256_setzero_si256();
+  int i;
+  for (i = 0; i < num_pairs; ++i) {
+    const __m128i a0 = _mm_loadu_si128((const __m128i*)&a[BPS * 0]);
+    const __m128i b0 = _mm_loadu_si128((const __m128i*)&b[BPS * 0]);
+    const __m128i a1 = _mm_loadu_si128((const __m128i*)&a[BPS * 1]);
+    const __m128i b1 = _mm_loadu_si128((const __m128i*)&b[BPS * 1]);
+    const __m256i sum0 = SquaredDiff16(a0, b0);
+    const __m256i sum1 = SquaredDiff16(a1, b1);
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(sum0, sum1));
+    a += 2 * BPS;
+    b += 2 * BPS;
+  }
+  return HorizontalAdd32b(sum);
+}
+
+static int SSE16x16(const uint8_t* a, const uint8_t* b) {
+  return SSE_16xN(a, b, 8);
+}
+
+static int SSE16x8(const uint8_t* a, const uint8_t* b) {
+  return SSE_16xN(a, b, 4);
+}
+
+#define LOAD_8x2(ptr) \
+  _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(ptr)), \
+                     _mm_loadl_epi64((const __m128i*)((ptr) + BPS)))
+
+static int SSE8x8(const uint8_t* a, const uint8_t* b) {
+  __m256i sum = _mm256_setzero_si256();
+  int num_pairs = 2;
+  while (num_pairs-- > 0) {
+    const __m256i sum0 = SquaredDiff16(LOAD_8x2(a + 0 * BPS),
+                                       LOAD_8x2(b + 0 * BPS));
+    const __m256i sum1 = SquaredDiff16(LOAD_8x2(a + 2 * BPS),
+                                       LOAD_8x2(b + 2 * BPS));
+    sum = _mm256_add_epi32(sum, _mm256_add_epi32(sum0, sum1));
+    a += 4 * BPS;
+    b += 4 * BPS;
+  }
+  return HorizontalAdd32b(sum);
+}
+#undef LOAD_8x2
+
+//------------------------------------------------------------------------------
+
+static void Mean16x4(const uint8_t* ref, uint32_t dc[4]) {
+  const __m256i ones8 = _mm256_set1_epi8(1);
+  const __m256i ones16 = _mm256_set1_epi16(1);
+  const __m256i a01 =
+      MakeM256(_mm_loadu_si128((const __m128i*)&ref[BPS * 0]),
+               _mm_loadu_si128((const __m128i*)&ref[BPS * 1]));
+  const __m256i a23 =
+      MakeM256(_mm_loadu_si128((const __m128i*)&ref[BPS * 2]),
+               _mm_loadu_si128((const __m128i*)&ref[BPS * 3]));
+  // sums of horizontal pairs, rows 0 + 2 | rows 1 + 3
+  const __m256i b = _mm256_add_epi16(_mm256_maddubs_epi16(a01, ones8),
+                                     _mm256_maddubs_epi16(a23, ones8));
+  // sums of 4 pixels wide columns
+  const __m256i c = _mm256_madd_epi16(b, ones16);
+  const __m128i d = _mm_add_epi32(_mm256_castsi256_si128(c),
+                                  _mm256_extracti128_si256(c, 1));
+  _mm_storeu_si128((__m128i*)dc, d);
+}
+
+//------------------------------------------------------------------------------
+// Texture distortion
+//
+// We try to match the spectral content (weighted) between source and
+// reconstructed samples.
+
+// Same as VP8Transpose_2_4x4_16b(), on each 128-bit lane.
+static WEBP_INLINE void Transpose_4_4x4_16b(
+    const __m256i* const in0, const __m256i* const in1,
+    const __m256i* const in2, const __m256i* const in3, __m256i* const out0,
+    __m256i* const out1, __m256i* const out2, __m256i* const out3) {
+  const __m256i transpose0_0 = _mm256_unpacklo_epi16(*in0, *in1);
+  const __m256i transpose0_1 = _mm256_unpacklo_epi16(*in2, *in3);
+  const __m256i transpose0_2 = _mm256_unpackhi_epi16(*in0, *in1);
+  const __m256i transpose0_3 = _mm256_unpackhi_epi16(*in2, *in3);
+  const __m256i transpose1_0 =
+      _mm256_unpacklo_epi32(transpose0_0, transpose0_1);
+  const __m256i transpose1_1 =
+      _mm256_unpacklo_epi32(transpose0_2, transpose0_3);
+  const __m256i transpose1_2 =
+      _mm256_unpackhi_epi32(transpose0_0, transpose0_1);
+  const __m256i transpose1_3 =
+      _mm256_unpackhi_epi32(transpose0_2, transpose0_3);
+  *out0 = _mm256_unpacklo_epi64(transpose1_0, transpose1_1);
+  *out1 = _mm256_unpackhi_epi64(transpose1_0, transpose1_1);
+  *out2 = _mm256_unpacklo_epi64(transpose1_2, transpose1_3);
+  *out3 = _mm256_unpackhi_epi64(transpose1_2, transpose1_3);
+}
+
+// Hadamard transform of two side-by-side 4x4 blocks of 'inA' and 'inB'.
+// Returns the sum of their Disto4x4() values. w_0/w_8 contain the row-major
+// 4 by 4 symmetric weight matrix, on each lane.
+static int Disto8x4(const uint8_t* const inA, const uint8_t* const inB,
+                    const __m256i* const w_0, const __m256i* const w_8) {
+  __m256i tmp_0, tmp_1, tmp_2, tmp_3;
+  int sum0, sum1;
+
+  // Load and combine inputs: two transforms (inA and inB) per lane, the
+  // left block in the low lane.
+  {
+    const __m128i inA_0 = _mm_loadl_epi64((const __m128i*)&inA[BPS * 0]);
+    const __m128i inA_1 = _mm_loadl_epi64((const __m128i*)&inA[BPS * 1]);
+    const __m128i inA_2 = _mm_loadl_epi64((const __m128i*)&inA[BPS * 2]);
+    const __m128i inA_3 = _mm_loadl_epi64((const __m128i*)&inA[BPS * 3]);
+    const __m128i inB_0 = _mm_loadl_epi64((const __m128i*)&inB[BPS * 0]);
+    const __m128i inB_1 = _mm_loadl_epi64((const __m128i*)&inB[BPS * 1]);
+    const __m128i inB_2 = _mm_loadl_epi64((const __m128i*)&inB[BPS * 2]);
+    const __m128i inB_3 = _mm_loadl_epi64((const __m128i*)&inB[BPS * 3]);
+    tmp_0 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(inA_0, inB_0));
+    tmp_1 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(inA_1, inB_1));
+    tmp_2 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(inA_2, inB_2));
+    tmp_3 = _mm256_cvtepu8_epi16(_mm_unpacklo_epi32(inA_3, inB_3));
+    // a00 a01 a02 a03   b00 b01 b02 b03 | a04 a05 a06 a07   b04 b05 b06 b07
+    // a10 a11 a12 a13   b10 b11 b12 b13 | a14 a15 a16 a17   b14 b15 b16 b17
+    // a20 a21 a22 a23   b20 b21 b22 b23 | a24 a25 a26 a27   b24 b25 b26 b27
+    // a30 a31 a32 a33   b30 b31 b32 b33 | a34 a35 a36 a37   b34 b35 b36 b37
+  }
+
+  // Vertical pass first to avoid a transpose (vertical and horizontal passes
+  // are commutative because w/kWeightY is symmetric) and subsequent transpose.
+  {
+    const __m256i a0 = _mm256_add_epi16(tmp_0, tmp_2);
+    const __m256i a1 = _mm256_add_epi16(tmp_1, tmp_3);
+    const __m256i a2 = _mm256_sub_epi16(tmp_1, tmp_3);
+    const __m256i a3 = _mm256_sub_epi16(tmp_0, tmp_2);
+    const __m256i b0 = _mm256_add_epi16(a0, a1);
+    const __m256i b1 = _mm256_add_epi16(a3, a2);
+    const __m256i b2 = _mm256_sub_epi16(a3, a2);
+    const __m256i b3 = _mm256_sub_epi16(a0, a1);
+    Transpose_4_4x4_16b(&b0, &b1, &b2, &b3, &tmp_0, &tmp_1, &tmp_2, &tmp_3);
+  }
+
+  // Horizontal pass and difference of weighted sums.
+  {
+    const __m256i a0 = _mm256_add_epi16(tmp_0, tmp_2);
+    const __m256i a1 = _mm256_add_epi16(tmp_1, tmp_3);
+    const __m256i a2 = _mm256_sub_epi16(tmp_1, tmp_3);
+    const __m256i a3 = _mm256_sub_epi16(tmp_0, tmp_2);
+    const __m256i b0 = _mm256_add_epi16(a0, a1);
+    const __m256i b1 = _mm256_add_epi16(a3, a2);
+    const __m256i b2 = _mm256_sub_epi16(a3, a2);
+    const __m256i b3 = _mm256_sub_epi16(a0, a1);
+
+    // Separate the transforms of inA and inB.
+    __m256i A_b0 = _mm256_unpacklo_epi64(b0, b1);
+    __m256i A_b2 = _mm256_unpacklo_epi64(b2, b3);
+    __m256i B_b0 = _mm256_unpackhi_epi64(b0, b1);
+    __m256i B_b2 = _mm256_unpackhi_epi64(b2, b3);
+
+    A_b0 = _mm256_abs_epi16(A_b0);
+    A_b2 = _mm256_abs_epi16(A_b2);
+    B_b0 = _mm256_abs_epi16(B_b0);
+    B_b2 = _mm256_abs_epi16(B_b2);
+
+    // weighted sums
+    A_b0 = _mm256_madd_epi16(A_b0, *w_0);
+    A_b2 = _mm256_madd_epi16(A_b2, *w_8);
+    B_b0 = _mm256_madd_epi16(B_b0, *w_0);
+    B_b2 = _mm256_madd_epi16(B_b2, *w_8);
+    A_b0 = _mm256_add_epi32(A_b0, A_b2);
+    B_b0 = _mm256_add_epi32(B_b0, B_b2);
+
+    // difference of weighted sums, summed on each lane
+    A_b2 = _mm256_sub_epi32(A_b0, B_b0);
+    A_b2 = _mm256_hadd_epi32(A_b2, A_b2);
+    A_b2 = _mm256_hadd_epi32(A_b2, A_b2);
+    sum0 = _mm_cvtsi128_si32(_mm256_castsi256_si128(A_b2));
+    sum1 = _mm_cvtsi128_si32(_mm256_extracti128_si256(A_b2, 1));
+  }
+  return (abs(sum0) >> 5) + (abs(sum1) >> 5);
+}
+
+static int Disto16x16(const uint8_t* const a, const uint8_t* const b,
+                      const uint16_t* const w) {
+  const __m256i w_0 =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&w[0]));
+  const __m256i w_8 =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)&w[8]));
+  int D = 0;
+  int x, y;
+  for (y = 0; y < 16 * BPS; y += 4 * BPS) {
+    for (x = 0; x < 16; x += 8) {
+      D += Disto8x4(a + x + y, b + x + y, &w_0, &w_8);
+    }
+  }
+  return D;
+}
+
+//------------------------------------------------------------------------------
+// Quantization
+//
+
+// Generates a pshufb constant for shuffling 16b words.
+#define PSHUFB_CST(A,B,C,D,E,F,G,H) \
+  _mm_set_epi8(2 * (H) + 1, 2 * (H) + 0, 2 * (G) + 1, 2 * (G) + 0, \
+               2 * (F) + 1, 2 * (F) + 0, 2 * (E) + 1, 2 * (E) + 0, \
+               2 * (D) + 1, 2 * (D) + 0, 2 * (C) + 1, 2 * (C) + 0, \
+               2 * (B) + 1, 2 * (B) + 0, 2 * (A) + 1, 2 * (A) + 0)
+
+// Quantizes one block, held in a single register. 'bias_lo' and 'bias_hi'
+// hold the rounding biases of coefficients 0-3|8-11 and 4-7|12-15.
+static WEBP_INLINE int DoQuantizeBlock(int16_t in[16], int16_t out[16],
+                                       const __m256i* const sharpen,
+                                       const __m256i* const iq,
+                                       const __m256i* const q,
+                                       const __m256i* const bias_lo,
+                                       const __m256i* const bias_hi) {
+  const __m256i max_coeff_2047 = _mm256_set1_epi16(MAX_LEVEL);
+  // Two 128b loads: 'in' was usually just written by narrower stores, which
+  // can't be forwarded to a 256b load.
+  const __m256i in0 = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((__m128i*)&in[0])),
+      _mm_loadu_si128((__m128i*)&in[8]), 1);
+  __m256i coeff, out0;
+
+  // coeff = abs(in) + sharpen
+  coeff = _mm256_abs_epi16(in0);
+  if (sharpen != NULL) coeff = _mm256_add_epi16(coeff, *sharpen);
+
+  // out = (coeff * iQ + B) >> QFIX
+  {
+    // doing calculations with 32b precision (QFIX=17)
+    const __m256i coeff_iQH = _mm256_mulhi_epu16(coeff, *iq);
+    const __m256i coeff_iQL = _mm256_mullo_epi16(coeff, *iq);
+    __m256i out_lo = _mm256_unpacklo_epi16(coeff_iQL, coeff_iQH);
+    __m256i out_hi = _mm256_unpackhi_epi16(coeff_iQL, coeff_iQH);
+    out_lo = _mm256_add_epi32(out_lo, *bias_lo);
+    out_hi = _mm256_add_epi32(out_hi, *bias_hi);
+    out_lo = _mm256_srai_epi32(out_lo, QFIX);
+    out_hi = _mm256_srai_epi32(out_hi, QFIX);
+    // pack result as 16b, and clamp to 2047
+    out0 = _mm256_packs_epi32(out_lo, out_hi);
+    out0 = _mm256_min_epi16(out0, max_coeff_2047);
+  }
+
+  // put sign back
+  out0 = _mm256_sign_epi16(out0, in0);
+
+  // in = out * Q
+  _mm256_storeu_si256((__m256i*)&in[0], _mm256_mullo_epi16(out0, *q));
+
+  // zigzag the output before storing it. The re-ordering is:
+  //    0 1 2 3 4 5 6 7 | 8  9 10 11 12 13 14 15
+  // -> 0 1 4[8]5 2 3 6 | 9 12 13 10 [7]11 14 15
+  // The two entries ([8] and [7]) crossing the lanes are taken from a
+  // lane-swapped copy.
+  {
+    const __m256i kCst = MakeM256(PSHUFB_CST(0, 1, 4, -1, 5, 2, 3, 6),
+                                  PSHUFB_CST(1, 4, 5, 2, -1, 3, 6, 7));
+    const __m256i kCst_8_7 =
+        MakeM256(PSHUFB_CST(-1, -1, -1, 0, -1, -1, -1, -1),
+                 PSHUFB_CST(-1, -1, -1, -1, 7, -1, -1, -1));
+    const __m256i swapped = _mm256_permute4x64_epi64(out0, 0x4e);
+    const __m256i tmp = _mm256_shuffle_epi8(out0, kCst);
+    const __m256i tmp_8_7 = _mm256_shuffle_epi8(swapped, kCst_8_7);
+    _mm256_storeu_si256((__m256i*)&out[0], _mm256_or_si256(tmp, tmp_8_7));
+  }
+
+  // detect if all 'out' values are zeroes or not
+  return !_mm256_testz_si256(out0, out0);
+}
+
+#undef PSHUFB_CST
+
+// Loads the rounding biases in the order expected by DoQuantizeBlock().
+static WEBP_INLINE void LoadBias(const VP8Matrix* const mtx,
+                                 __m256i* const bias_lo,
+                                 __m256i* const bias_hi) {
+  const __m256i bias_0 = _mm256_loadu_si256((const __m256i*)&mtx->bias_[0]);
+  const __m256i bias_8 = _mm256_loadu_si256((const __m256i*)&mtx->bias_[8]);
+  *bias_lo = _mm256_permute2x128_si256(bias_0, bias_8, 0x20);
+  *bias_hi = _mm256_permute2x128_si256(bias_0, bias_8, 0x31);
+}
+
+static WEBP_INLINE int QuantizeOne(int16_t in[16], int16_t out[16],
+                                   const VP8Matrix* const mtx,
+                                   int use_sharpen) {
+  const __m256i iq = _mm256_loadu_si256((const __m256i*)&mtx->iq_[0]);
+  const __m256i q = _mm256_loadu_si256((const __m256i*)&mtx->q_[0]);
+  const __m256i sharpen =
+      _mm256_loadu_si256((const __m256i*)&mtx->sharpen_[0]);
+  __m256i bias_lo, bias_hi;
+  LoadBias(mtx, &bias_lo, &bias_hi);
+  return DoQuantizeBlock(in, out, use_sharpen ? &sharpen : NULL,
+                         &iq, &q, &bias_lo, &bias_hi);
+}
+
+static int QuantizeBlock(int16_t in[16], int16_t out[16],
+                         const VP8Matrix* const mtx) {
+  return QuantizeOne(in, out, mtx, 1);
+}
+
+static int QuantizeBlockWHT(int16_t in[16], int16_t out[16],
+                            const VP8Matrix* const mtx) {
+  return QuantizeOne(in, out, mtx, 0);
+}
+
+static int Quantize2Blocks(int16_t in[32], int16_t out[32],
+                           const VP8Matrix* const mtx) {
+  const __m256i iq = _mm256_loadu_si256((const __m256i*)&mtx->iq_[0]);
+  const __m256i q = _mm256_loadu_si256((const __m256i*)&mtx->q_[0]);
+  const __m256i sharpen =
+      _mm256_loadu_si256((const __m256i*)&mtx->sharpen_[0]);
+  __m256i bias_lo, bias_hi;
+  int nz;
+  LoadBias(mtx, &bias_lo, &bias_hi);
+  nz  = DoQuantizeBlock(in + 0 * 16, out + 0 * 16, &sharpen, &iq, &q,
+                        &bias_lo, &bias_hi) << 0;
+  nz |= DoQuantizeBlock(in + 1 * 16, out + 1 * 16, &sharpen, &iq, &q,
+                        &bias_lo, &bias_hi) << 1;
+  return nz;
+}
+
+// The weighted distortion delta W * ((coeff - level * Q)^2 - coeff^2) is
+// computed as (level * W * Q) * (level * Q - 2 * coeff), which is equal modulo
+// 2^32. Levels, Q and W * Q fit in 15 bits: their products are done with
+// madd_epi16() on the 32b lanes, which is faster than mullo_epi32().
+static int TrellisPrepare(const int16_t in[16], int first,
+                          const VP8Matrix* const mtx,
+                          const uint16_t weights[16],
+                          VP8TrellisCoeffs* const tc) {
+  const __m256i max_level = _mm256_set1_epi32(MAX_LEVEL);
+  const __m256i bias_80 = _mm256_set1_epi32(BIAS(0x80));
+  const __m256i thresh = _mm256_set1_epi32(mtx->q_[1] * mtx->q_[1] / 4);
+  const __m128i kZigzag = _mm_setr_epi8(0, 1, 4, 8, 5, 2, 3, 6,
+                                        9, 12, 13, 10, 7, 11, 14, 15);
+  __m256i level[2], thresh_level[2], significant[2];
+  int i;
+
+  for (i = 0; i < 2; ++i) {
+#define LOAD_8x16b(ptr) _mm_loadu_si128((const __m128i*)&(ptr)[8 * i])
+    const __m128i A = LOAD_8x16b(in);
+    const __m256i A_u = _mm256_cvtepu16_epi32(A);   // for madd_epi16()
+    const __m256i q = _mm256_cvtepu16_epi32(LOAD_8x16b(mtx->q_));
+    const __m256i iq = _mm256_cvtepu16_epi32(LOAD_8x16b(mtx->iq_));
+    const __m256i sharpen = _mm256_cvtepu16_epi32(LOAD_8x16b(mtx->sharpen_));
+    const __m256i w = _mm256_cvtepu16_epi32(LOAD_8x16b(weights));
+#undef LOAD_8x16b
+    const __m256i wq = _mm256_madd_epi16(w, q);
+    // coeff = abs(in) + sharpen
+    const __m256i coeff =
+        _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm_abs_epi16(A)), sharpen);
+    const __m256i coeff_x2 = _mm256_add_epi32(coeff, coeff);
+    // level = QUANTDIV(coeff, iQ, B), with B = 0 or 0x80
+    const __m256i coeff_iq = _mm256_mullo_epi32(coeff, iq);
+    const __m256i level0 =
+        _mm256_min_epi32(_mm256_srli_epi32(coeff_iq, QFIX), max_level);
+    const __m256i level1 = _mm256_srli_epi32(
+        _mm256_add_epi32(coeff_iq, bias_80), QFIX);
+    // error = (level * W * Q) * (level * Q - 2 * coeff), for level and level+1
+    const __m256i lq0 = _mm256_madd_epi16(level0, q);
+    const __m256i lwq0 = _mm256_madd_epi16(level0, wq);
+    const __m256i lq1 = _mm256_add_epi32(lq0, q);
+    const __m256i lwq1 = _mm256_add_epi32(lwq0, wq);
+    const __m256i error0 =
+        _mm256_mullo_epi32(lwq0, _mm256_sub_epi32(lq0, coeff_x2));
+    const __m256i error1 =
+        _mm256_mullo_epi32(lwq1, _mm256_sub_epi32(lq1, coeff_x2));
+    _mm256_storeu_si256((__m256i*)&tc->error[0][8 * i], error0);
+    _mm256_storeu_si256((__m256i*)&tc->error[1][8 * i], error1);
+    level[i] = level0;
+    thresh_level[i] = _mm256_min_epi32(level1, max_level);
+    significant[i] = _mm256_cmpgt_epi32(_mm256_madd_epi16(A_u, A_u), thresh);
+  }
+  {
+    // Pack back to 16b. packs_epi32() interleaves the 64b halves of the
+    // inputs: 0-3|8-11|4-7|12-15, which permute4x64() puts back in order.
+    const __m256i levels = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(level[0], level[1]), 0xd8);
+    const __m256i thresh_levels = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(thresh_level[0], thresh_level[1]), 0xd8);
+    const __m256i sig = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(significant[0], significant[1]), 0xd8);
+    // Significance flags as bytes, in zigzag order.
+    const __m128i sig_z = _mm_shuffle_epi8(
+        _mm_packs_epi16(_mm256_castsi256_si128(sig),
+                        _mm256_extracti128_si256(sig, 1)), kZigzag);
+    const uint32_t mask = _mm_movemask_epi8(sig_z) >> first;
+    _mm256_storeu_si256((__m256i*)tc->level, levels);
+    _mm256_storeu_si256((__m256i*)tc->max_level, thresh_levels);
+    return first + ((mask != 0) ? BitsLog2Floor(mask) : -1);
+  }
+}
 
 //------------------------------------------------------------------------------
 // Entry point
 
+extern void VP8EncDspInitAVX2(void);
+
+WEBP_TSAN_IGNORE_FUNCTION void VP8EncDspInitAVX2(void) {
+  VP8CollectHistogram = CollectHistogram;
+  VP8ITransform = ITransform;
+  VP8FTransform2 = FTransform2;
+  VP8SSE16x16 = SSE16x16;
+  VP8SSE16x8 = SSE16x8;
+  VP8SSE8x8 = SSE8x8;
+  VP8TDisto16x16 = Disto16x16;
+  VP8Mean16x4 = Mean16x4;
+  VP8EncQuantizeBlock = QuantizeBlock;
+  VP8EncQuantize2Blocks = Quantize2Blocks;
+  VP8EncQuantizeBlockWHT = QuantizeBlockWHT;
+  VP8EncTrellisPrepare = TrellisPrepare;
+}
+
+#else  // !WEBP_USE_AVX2
+
 WEBP_DSP_INIT_STUB(VP8EncDspInitAVX2)
+
+#endif  // WEBP_USE_AVX2
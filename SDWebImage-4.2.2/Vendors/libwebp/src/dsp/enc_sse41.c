@@ -19,6 +19,7 @@
 
 #include "./common_sse2.h"
 #include "../enc/vp8i_enc.h"
+#include "../utils/utils.h"
 
 //------------------------------------------------------------------------------
 // Compute susceptibility based on DCT-coeff histograms.
@@ -319,6 +320,75 @@ static int Quantize2Blocks(int16_t in[32], int16_t out[32],
   return nz;
 }
 
+// Trellis terms. The weighted distortion delta W * ((coeff - level * Q)^2 -
+// coeff^2) is computed as (level * W * Q) * (level * Q - 2 * coeff), which is
+// equal modulo 2^32. Levels, Q and W * Q fit in 15 bits: their products are
+// done with _mm_madd_epi16() on the 32b lanes.
+static int TrellisPrepare(const int16_t in[16], int first,
+                          const VP8Matrix* const mtx,
+                          const uint16_t weights[16],
+                          VP8TrellisCoeffs* const tc) {
+  const __m128i max_level = _mm_set1_epi32(MAX_LEVEL);
+  const __m128i bias_80 = _mm_set1_epi32(BIAS(0x80));
+  const __m128i thresh = _mm_set1_epi32(mtx->q_[1] * mtx->q_[1] / 4);
+  const __m128i kZigzag = _mm_setr_epi8(0, 1, 4, 8, 5, 2, 3, 6,
+                                        9, 12, 13, 10, 7, 11, 14, 15);
+  __m128i level[4], thresh_level[4], significant[4];
+  int i;
+
+  for (i = 0; i < 4; ++i) {
+#define LOAD_4x16b(ptr) \
+    _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)&(ptr)[4 * i]))
+    const __m128i in16 = _mm_loadl_epi64((const __m128i*)&in[4 * i]);
+    const __m128i A = _mm_cvtepu16_epi32(in16);   // for _mm_madd_epi16()
+    const __m128i q = LOAD_4x16b(mtx->q_);
+    const __m128i iq = LOAD_4x16b(mtx->iq_);
+    const __m128i sharpen = LOAD_4x16b(mtx->sharpen_);
+    const __m128i w = LOAD_4x16b(weights);
+#undef LOAD_4x16b
+    const __m128i wq = _mm_madd_epi16(w, q);
+    // coeff = abs(in) + sharpen
+    const __m128i coeff =
+        _mm_add_epi32(_mm_cvtepu16_epi32(_mm_abs_epi16(in16)), sharpen);
+    const __m128i coeff_x2 = _mm_add_epi32(coeff, coeff);
+    // level = QUANTDIV(coeff, iQ, B), with B = 0 or 0x80
+    const __m128i coeff_iq = _mm_mullo_epi32(coeff, iq);
+    const __m128i level0 =
+        _mm_min_epi32(_mm_srli_epi32(coeff_iq, QFIX), max_level);
+    const __m128i level1 =
+        _mm_srli_epi32(_mm_add_epi32(coeff_iq, bias_80), QFIX);
+    // error = (level * W * Q) * (level * Q - 2 * coeff), for level and level+1
+    const __m128i lq0 = _mm_madd_epi16(level0, q);
+    const __m128i lwq0 = _mm_madd_epi16(level0, wq);
+    const __m128i lq1 = _mm_add_epi32(lq0, q);
+    const __m128i lwq1 = _mm_add_epi32(lwq0, wq);
+    const __m128i error0 = _mm_mullo_epi32(lwq0, _mm_sub_epi32(lq0, coeff_x2));
+    const __m128i error1 = _mm_mullo_epi32(lwq1, _mm_sub_epi32(lq1, coeff_x2));
+    _mm_storeu_si128((__m128i*)&tc->error[0][4 * i], error0);
+    _mm_storeu_si128((__m128i*)&tc->error[1][4 * i], error1);
+    level[i] = level0;
+    thresh_level[i] = _mm_min_epi32(level1, max_level);
+    significant[i] = _mm_cmpgt_epi32(_mm_madd_epi16(A, A), thresh);
+  }
+  {
+    // Significance flags as bytes, in zigzag order.
+    const __m128i sig_z = _mm_shuffle_epi8(
+        _mm_packs_epi16(_mm_packs_epi32(significant[0], significant[1]),
+                        _mm_packs_epi32(significant[2], significant[3])),
+        kZigzag);
+    const uint32_t mask = _mm_movemask_epi8(sig_z) >> first;
+    _mm_storeu_si128((__m128i*)&tc->level[0],
+                     _mm_packs_epi32(level[0], level[1]));
+    _mm_storeu_si128((__m128i*)&tc->level[8],
+                     _mm_packs_epi32(level[2], level[3]));
+    _mm_storeu_si128((__m128i*)&tc->max_level[0],
+                     _mm_packs_epi32(thresh_level[0], thresh_level[1]));
+    _mm_storeu_si128((__m128i*)&tc->max_level[8],
+                     _mm_packs_epi32(thresh_level[2], thresh_level[3]));
+    return first + ((mask != 0) ? BitsLog2Floor(mask) : -1);
+  }
+}
+
 //------------------------------------------------------------------------------
 // Entry point
 
@@ -330,6 +400,7 @@ WEBP_TSAN_IGNORE_FUNCTION void VP8EncDspInitSSE41(void) {
   VP8EncQuantizeBlockWHT = QuantizeBlockWHT;
   VP8TDisto4x4 = Disto4x4;
   VP8TDisto16x16 = Disto16x16;
+  VP8EncTrellisPrepare = TrellisPrepare;
 }
 
 #else  // !WEBP_USE_SSE41
@@ -0,0 +1,555 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the COPYING file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS. All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+// -----------------------------------------------------------------------------
+//
+// AVX2 variant of methods for lossless encoder
+//
+// The functions process twice as many values per step as lossless_enc_sse2.c,
+// with the same arithmetic, so that the results are bit-exact.
+
+#include "./dsp.h"
+
+#if defined(WEBP_USE_AVX2)
+#include <assert.h>
+#include <immintrin.h>
+#include "./lossless.h"
+#include "./lossless_common.h"
+#include "../utils/utils.h"
+
+// For sign-extended multiplying constants, pre-shifted by 5:
+#define CST_5b(X)  (((int16_t)((uint16_t)X << 8)) >> 5)
+
+// Returns the index of the lowest bit set in the non-zero 'mask'.
+static WEBP_INLINE int LowestBit(uint32_t mask) {
+  assert(mask != 0);
+  return BitsLog2Floor(mask & (0u - mask));
+}
+
+// Returns the mask of the 32b values of A and B that differ.
+static WEBP_INLINE uint32_t DiffMask8(const __m256i A, const __m256i B) {
+  const __m256i cmp = _mm256_cmpeq_epi32(A, B);
+  return ~(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(cmp)) & 0xff;
+}
+
+//------------------------------------------------------------------------------
+// Subtract-Green Transform
+
+static void SubtractGreenFromBlueAndRed(uint32_t* argb_data, int num_pixels) {
+  int i;
+  const __m256i kCstShuffle = _mm256_set_epi8(-1, 13, -1, 13, -1, 9, -1, 9,
+                                              -1,  5, -1,  5, -1, 1, -1, 1,
+                                              -1, 13, -1, 13, -1, 9, -1, 9,
+                                              -1,  5, -1,  5, -1, 1, -1, 1);
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i in = _mm256_loadu_si256((__m256i*)&argb_data[i]);
+    const __m256i in_0g0g = _mm256_shuffle_epi8(in, kCstShuffle);
+    const __m256i out = _mm256_sub_epi8(in, in_0g0g);
+    _mm256_storeu_si256((__m256i*)&argb_data[i], out);
+  }
+  // fallthrough and finish off with plain-C
+  if (i != num_pixels) {
+    VP8LSubtractGreenFromBlueAndRed_C(argb_data + i, num_pixels - i);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Color Transform
+
+static void TransformColor(const VP8LMultipliers* const m,
+                           uint32_t* argb_data, int num_pixels) {
+  const uint32_t cst_g2r = (uint16_t)CST_5b(m->green_to_red_);
+  const uint32_t cst_g2b = (uint16_t)CST_5b(m->green_to_blue_);
+  const uint32_t cst_r2b = (uint16_t)CST_5b(m->red_to_blue_);
+  const __m256i mults_rb = _mm256_set1_epi32((int)((cst_g2r << 16) | cst_g2b));
+  const __m256i mults_b2 = _mm256_set1_epi32((int)(cst_r2b << 16));
+  const __m256i mask_ag = _mm256_set1_epi32(0xff00ff00);  // alpha-green masks
+  const __m256i mask_rb = _mm256_set1_epi32(0x00ff00ff);  // red-blue masks
+  int i;
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i in = _mm256_loadu_si256((__m256i*)&argb_data[i]); // argb
+    const __m256i A = _mm256_and_si256(in, mask_ag);     // a   0   g   0
+    const __m256i B = _mm256_shufflelo_epi16(A, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m256i C = _mm256_shufflehi_epi16(B, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m256i D = _mm256_mulhi_epi16(C, mults_rb);   // x dr  x db1
+    const __m256i E = _mm256_slli_epi16(in, 8);          // r 0   b   0
+    const __m256i F = _mm256_mulhi_epi16(E, mults_b2);   // x db2 0   0
+    const __m256i G = _mm256_srli_epi32(F, 16);          // 0 0   x db2
+    const __m256i H = _mm256_add_epi8(G, D);             // x dr  x  db
+    const __m256i I = _mm256_and_si256(H, mask_rb);      // 0 dr  0  db
+    const __m256i out = _mm256_sub_epi8(in, I);
+    _mm256_storeu_si256((__m256i*)&argb_data[i], out);
+  }
+  // fallthrough and finish off with plain-C
+  if (i != num_pixels) {
+    VP8LTransformColor_C(m, argb_data + i, num_pixels - i);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+// 'out' may be the same as 'b'.
+static void AddVector(const uint32_t* a, const uint32_t* b, uint32_t* out,
+                      int size) {
+  int i;
+  for (i = 0; i + 16 <= size; i += 16) {
+    const __m256i a0 = _mm256_loadu_si256((const __m256i*)&a[i + 0]);
+    const __m256i a1 = _mm256_loadu_si256((const __m256i*)&a[i + 8]);
+    const __m256i b0 = _mm256_loadu_si256((const __m256i*)&b[i + 0]);
+    const __m256i b1 = _mm256_loadu_si256((const __m256i*)&b[i + 8]);
+    _mm256_storeu_si256((__m256i*)&out[i + 0], _mm256_add_epi32(a0, b0));
+    _mm256_storeu_si256((__m256i*)&out[i + 8], _mm256_add_epi32(a1, b1));
+  }
+  if (i + 8 <= size) {
+    const __m256i a0 = _mm256_loadu_si256((const __m256i*)&a[i]);
+    const __m256i b0 = _mm256_loadu_si256((const __m256i*)&b[i]);
+    _mm256_storeu_si256((__m256i*)&out[i], _mm256_add_epi32(a0, b0));
+    i += 8;
+  }
+  for (; i < size; ++i) out[i] = a[i] + b[i];
+}
+
+// Note we are adding uint32_t's as *signed* int32's (using _mm256_add_epi32).
+// But that's ok since the histogram values are less than 1<<28 (max picture
+// size).
+static void HistogramAdd(const VP8LHistogram* const a,
+                         const VP8LHistogram* const b,
+                         VP8LHistogram* const out) {
+  const int literal_size = VP8LHistogramNumCodes(a->palette_code_bits_);
+  assert(a->palette_code_bits_ == b->palette_code_bits_);
+  AddVector(a->literal_, b->literal_, out->literal_, literal_size);
+  AddVector(a->red_, b->red_, out->red_, NUM_LITERAL_CODES);
+  AddVector(a->blue_, b->blue_, out->blue_, NUM_LITERAL_CODES);
+  AddVector(a->alpha_, b->alpha_, out->alpha_, NUM_LITERAL_CODES);
+  AddVector(a->distance_, b->distance_, out->distance_, NUM_DISTANCE_CODES);
+}
+
+//------------------------------------------------------------------------------
+// Extra cost
+//
+// The products and their sum are integers below 2^53, so accumulating them as
+// 64b integers gives the same result as the C version's double accumulation.
+
+// Adds the products of the eight 32b values 'v' by their weights to 'sum'. The
+// values 2k and 2k + 1 share the weight held in the 64b lane k of 'weights'.
+static WEBP_INLINE __m256i AddExtraCost8(const __m256i v,
+                                         const __m256i weights,
+                                         const __m256i sum) {
+  const __m256i even = _mm256_mul_epu32(v, weights);
+  const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), weights);
+  return _mm256_add_epi64(sum, _mm256_add_epi64(even, odd));
+}
+
+static WEBP_INLINE int64_t HorizontalSum64(const __m256i sum) {
+  int64_t tmp[4];
+  _mm256_storeu_si256((__m256i*)tmp, sum);
+  return tmp[0] + tmp[1] + tmp[2] + tmp[3];
+}
+
+static double ExtraCost(const uint32_t* population, int length) {
+  int i;
+  const __m256i four = _mm256_set1_epi64x(4);
+  __m256i weights = _mm256_set_epi64x(4, 3, 2, 1);   // i >> 1, for i = 2..9
+  __m256i sum = _mm256_setzero_si256();
+  int64_t cost;
+  for (i = 2; i + 8 <= length - 2; i += 8) {
+    const __m256i v =
+        _mm256_loadu_si256((const __m256i*)&population[i + 2]);
+    sum = AddExtraCost8(v, weights, sum);
+    weights = _mm256_add_epi64(weights, four);
+  }
+  cost = HorizontalSum64(sum);
+  for (; i < length - 2; ++i) cost += (i >> 1) * (int64_t)population[i + 2];
+  return (double)cost;
+}
+
+static double ExtraCostCombined(const uint32_t* X, const uint32_t* Y,
+                                int length) {
+  int i;
+  const __m256i four = _mm256_set1_epi64x(4);
+  __m256i weights = _mm256_set_epi64x(4, 3, 2, 1);   // i >> 1, for i = 2..9
+  __m256i sum = _mm256_setzero_si256();
+  int64_t cost;
+  for (i = 2; i + 8 <= length - 2; i += 8) {
+    const __m256i x = _mm256_loadu_si256((const __m256i*)&X[i + 2]);
+    const __m256i y = _mm256_loadu_si256((const __m256i*)&Y[i + 2]);
+    sum = AddExtraCost8(_mm256_add_epi32(x, y), weights, sum);
+    weights = _mm256_add_epi64(weights, four);
+  }
+  cost = HorizontalSum64(sum);
+  for (; i < length - 2; ++i) {
+    const int xy = X[i + 2] + Y[i + 2];
+    cost += (i >> 1) * (int64_t)xy;
+  }
+  return (double)cost;
+}
+
+//------------------------------------------------------------------------------
+
+// Returns the index of the first mismatch of 8 pixels, or 8 if they all match.
+static WEBP_INLINE int Mismatch8(const uint32_t* const array1,
+                                 const uint32_t* const array2) {
+  const __m256i A = _mm256_loadu_si256((const __m256i*)array1);
+  const __m256i B = _mm256_loadu_si256((const __m256i*)array2);
+  const uint32_t diff = DiffMask8(A, B);
+  return (diff == 0) ? 8 : LowestBit(diff);
+}
+
+static int VectorMismatch(const uint32_t* const array1,
+                          const uint32_t* const array2, int length) {
+  int match_len = 0;
+  // max_limit can be MAX_LENGTH=4096 at most: check 16 pixels at a time
+  // before locating the mismatch.
+  while (match_len + 16 <= length) {
+    const __m256i A0 = _mm256_loadu_si256((const __m256i*)&array1[match_len]);
+    const __m256i B0 = _mm256_loadu_si256((const __m256i*)&array2[match_len]);
+    const __m256i A1 =
+        _mm256_loadu_si256((const __m256i*)&array1[match_len + 8]);
+    const __m256i B1 =
+        _mm256_loadu_si256((const __m256i*)&array2[match_len + 8]);
+    const __m256i cmp = _mm256_and_si256(_mm256_cmpeq_epi32(A0, B0),
+                                         _mm256_cmpeq_epi32(A1, B1));
+    if (_mm256_movemask_epi8(cmp) != -1) {
+      const int len = Mismatch8(&array1[match_len], &array2[match_len]);
+      if (len < 8) return match_len + len;
+      return match_len + 8 +
+             Mismatch8(&array1[match_len + 8], &array2[match_len + 8]);
+    }
+    match_len += 16;
+  }
+  if (match_len + 8 <= length) {
+    const int len = Mismatch8(&array1[match_len], &array2[match_len]);
+    if (len < 8) return match_len + len;
+    match_len += 8;
+  }
+  while (match_len < length && array1[match_len] == array2[match_len]) {
+    ++match_len;
+  }
+  return match_len;
+}
+
+// Bundles multiple (1, 2, 4 or 8) pixels into a single pixel.
+static void BundleColorMap(const uint8_t* const row, int width, int xbits,
+                           uint32_t* dst) {
+  int x;
+  assert(xbits >= 0);
+  assert(xbits <= 3);
+  switch (xbits) {
+    case 0: {
+      const __m256i ff = _mm256_set1_epi32(0xff000000);
+      // Store 0xff000000 | (row[x] << 8).
+      for (x = 0; x + 32 <= width; x += 32, dst += 32) {
+        int k;
+        for (k = 0; k < 32; k += 8) {
+          const __m128i in = _mm_loadl_epi64((const __m128i*)&row[x + k]);
+          const __m256i in32 = _mm256_cvtepu8_epi32(in);
+          const __m256i res = _mm256_or_si256(_mm256_slli_epi32(in32, 8), ff);
+          _mm256_storeu_si256((__m256i*)&dst[k], res);
+        }
+      }
+      break;
+    }
+    case 1: {
+      const __m256i ff = _mm256_set1_epi32(0xff000000);
+      const __m256i mask = _mm256_set1_epi16(0xff00);
+      const __m256i mul = _mm256_set1_epi16(0x110);
+      for (x = 0; x + 32 <= width; x += 32, dst += 16) {
+        // 0a0b | (where a/b are 4 bits).
+        const __m256i in = _mm256_loadu_si256((const __m256i*)&row[x]);
+        const __m256i tmp = _mm256_mullo_epi16(in, mul);   // aba0
+        const __m256i pack = _mm256_and_si256(tmp, mask);  // ab00
+        const __m256i pack0 =
+            _mm256_cvtepu16_epi32(_mm256_castsi256_si128(pack));
+        const __m256i pack1 =
+            _mm256_cvtepu16_epi32(_mm256_extracti128_si256(pack, 1));
+        _mm256_storeu_si256((__m256i*)&dst[0], _mm256_or_si256(pack0, ff));
+        _mm256_storeu_si256((__m256i*)&dst[8], _mm256_or_si256(pack1, ff));
+      }
+      break;
+    }
+    case 2: {
+      const __m256i mask_or = _mm256_set1_epi32(0xff000000);
+      const __m256i mul_cst = _mm256_set1_epi16(0x0104);
+      const __m256i mask_mul = _mm256_set1_epi16(0x0f00);
+      for (x = 0; x + 32 <= width; x += 32, dst += 8) {
+        // 000a000b000c000d | (where a/b/c/d are 2 bits).
+        const __m256i in = _mm256_loadu_si256((const __m256i*)&row[x]);
+        const __m256i mul = _mm256_mullo_epi16(in, mul_cst);  // 00ab00b0..
+        const __m256i tmp = _mm256_and_si256(mul, mask_mul);  // 00ab0000..
+        const __m256i shift = _mm256_srli_epi32(tmp, 12);     // 00000000ab..
+        const __m256i pack = _mm256_or_si256(shift, tmp);     // 00000000abcd..
+        // Convert to 0xff00**00.
+        const __m256i res = _mm256_or_si256(pack, mask_or);
+        _mm256_storeu_si256((__m256i*)dst, res);
+      }
+      break;
+    }
+    default: {
+      assert(xbits == 3);
+      for (x = 0; x + 32 <= width; x += 32, dst += 4) {
+        // 0000000a00000000b... | (where a/b are 1 bit).
+        const __m256i in = _mm256_loadu_si256((const __m256i*)&row[x]);
+        const __m256i shift = _mm256_slli_epi64(in, 7);
+        const uint32_t move = (uint32_t)_mm256_movemask_epi8(shift);
+        dst[0] = 0xff000000 | ((move & 0xff) << 8);
+        dst[1] = 0xff000000 | (move & 0xff00);
+        dst[2] = 0xff000000 | ((move >> 8) & 0xff00);
+        dst[3] = 0xff000000 | ((move >> 16) & 0xff00);
+      }
+      break;
+    }
+  }
+  if (x != width) {
+    VP8LBundleColorMap_C(row + x, width - x, xbits, dst);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Batch version of Predictor Transform subtraction
+
+static WEBP_INLINE __m256i Average2(const __m256i a0, const __m256i a1) {
+  // (a + b) >> 1 = ((a + b + 1) >> 1) - ((a ^ b) & 1)
+  const __m256i ones = _mm256_set1_epi8(1);
+  const __m256i avg1 = _mm256_avg_epu8(a0, a1);
+  const __m256i one = _mm256_and_si256(_mm256_xor_si256(a0, a1), ones);
+  return _mm256_sub_epi8(avg1, one);
+}
+
+// Predictor0: ARGB_BLACK.
+static void PredictorSub0(const uint32_t* in, const uint32_t* upper,
+                          int num_pixels, uint32_t* out) {
+  int i;
+  const __m256i black = _mm256_set1_epi32(ARGB_BLACK);
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);
+    const __m256i res = _mm256_sub_epi8(src, black);
+    _mm256_storeu_si256((__m256i*)&out[i], res);
+  }
+  if (i != num_pixels) {
+    VP8LPredictorsSub_C[0](in + i, upper + i, num_pixels - i, out + i);
+  }
+}
+
+#define GENERATE_PREDICTOR_1(X, IN)                                           \
+static void PredictorSub##X(const uint32_t* in, const uint32_t* upper,        \
+                            int num_pixels, uint32_t* out) {                  \
+  int i;                                                                      \
+  for (i = 0; i + 8 <= num_pixels; i += 8) {                                  \
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);           \
+    const __m256i pred = _mm256_loadu_si256((const __m256i*)&(IN));           \
+    const __m256i res = _mm256_sub_epi8(src, pred);                           \
+    _mm256_storeu_si256((__m256i*)&out[i], res);                              \
+  }                                                                           \
+  if (i != num_pixels) {                                                      \
+    VP8LPredictorsSub_C[(X)](in + i, upper + i, num_pixels - i, out + i);     \
+  }                                                                           \
+}
+
+GENERATE_PREDICTOR_1(1, in[i - 1])       // Predictor1: L
+GENERATE_PREDICTOR_1(2, upper[i])        // Predictor2: T
+GENERATE_PREDICTOR_1(3, upper[i + 1])    // Predictor3: TR
+GENERATE_PREDICTOR_1(4, upper[i - 1])    // Predictor4: TL
+#undef GENERATE_PREDICTOR_1
+
+// Predictor5: avg2(avg2(L, TR), T)
+static void PredictorSub5(const uint32_t* in, const uint32_t* upper,
+                          int num_pixels, uint32_t* out) {
+  int i;
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i L = _mm256_loadu_si256((const __m256i*)&in[i - 1]);
+    const __m256i T = _mm256_loadu_si256((const __m256i*)&upper[i]);
+    const __m256i TR = _mm256_loadu_si256((const __m256i*)&upper[i + 1]);
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);
+    const __m256i pred = Average2(Average2(L, TR), T);
+    const __m256i res = _mm256_sub_epi8(src, pred);
+    _mm256_storeu_si256((__m256i*)&out[i], res);
+  }
+  if (i != num_pixels) {
+    VP8LPredictorsSub_C[5](in + i, upper + i, num_pixels - i, out + i);
+  }
+}
+
+#define GENERATE_PREDICTOR_2(X, A, B)                                         \
+static void PredictorSub##X(const uint32_t* in, const uint32_t* upper,        \
+                            int num_pixels, uint32_t* out) {                  \
+  int i;                                                                      \
+  for (i = 0; i + 8 <= num_pixels; i += 8) {                                  \
+    const __m256i tA = _mm256_loadu_si256((const __m256i*)&(A));              \
+    const __m256i tB = _mm256_loadu_si256((const __m256i*)&(B));              \
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);           \
+    const __m256i res = _mm256_sub_epi8(src, Average2(tA, tB));               \
+    _mm256_storeu_si256((__m256i*)&out[i], res);                              \
+  }                                                                           \
+  if (i != num_pixels) {                                                      \
+    VP8LPredictorsSub_C[(X)](in + i, upper + i, num_pixels - i, out + i);     \
+  }                                                                           \
+}
+
+GENERATE_PREDICTOR_2(6, in[i - 1], upper[i - 1])   // Predictor6: avg(L, TL)
+GENERATE_PREDICTOR_2(7, in[i - 1], upper[i])       // Predictor7: avg(L, T)
+GENERATE_PREDICTOR_2(8, upper[i - 1], upper[i])    // Predictor8: avg(TL, T)
+GENERATE_PREDICTOR_2(9, upper[i], upper[i + 1])    // Predictor9: average(T, TR)
+#undef GENERATE_PREDICTOR_2
+
+// Predictor10: avg(avg(L,TL), avg(T, TR)).
+static void PredictorSub10(const uint32_t* in, const uint32_t* upper,
+                           int num_pixels, uint32_t* out) {
+  int i;
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i L = _mm256_loadu_si256((const __m256i*)&in[i - 1]);
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);
+    const __m256i TL = _mm256_loadu_si256((const __m256i*)&upper[i - 1]);
+    const __m256i T = _mm256_loadu_si256((const __m256i*)&upper[i]);
+    const __m256i TR = _mm256_loadu_si256((const __m256i*)&upper[i + 1]);
+    const __m256i avg = Average2(Average2(T, TR), Average2(L, TL));
+    const __m256i res = _mm256_sub_epi8(src, avg);
+    _mm256_storeu_si256((__m256i*)&out[i], res);
+  }
+  if (i != num_pixels) {
+    VP8LPredictorsSub_C[10](in + i, upper + i, num_pixels - i, out + i);
+  }
+}
+
+// Predictor11: select.
+static WEBP_INLINE __m256i GetSumAbsDiff32(const __m256i A, const __m256i B) {
+  // We can unpack with any value on the upper 32 bits, provided it's the same
+  // on both operands (to that their sum of abs diff is zero). Here we use A.
+  const __m256i A_lo = _mm256_unpacklo_epi32(A, A);
+  const __m256i B_lo = _mm256_unpacklo_epi32(B, A);
+  const __m256i A_hi = _mm256_unpackhi_epi32(A, A);
+  const __m256i B_hi = _mm256_unpackhi_epi32(B, A);
+  const __m256i s_lo = _mm256_sad_epu8(A_lo, B_lo);
+  const __m256i s_hi = _mm256_sad_epu8(A_hi, B_hi);
+  return _mm256_packs_epi32(s_lo, s_hi);
+}
+
+static void PredictorSub11(const uint32_t* in, const uint32_t* upper,
+                           int num_pixels, uint32_t* out) {
+  int i;
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i L = _mm256_loadu_si256((const __m256i*)&in[i - 1]);
+    const __m256i T = _mm256_loadu_si256((const __m256i*)&upper[i]);
+    const __m256i TL = _mm256_loadu_si256((const __m256i*)&upper[i - 1]);
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);
+    const __m256i pa = GetSumAbsDiff32(T, TL);   // pa = sum |T-TL|
+    const __m256i pb = GetSumAbsDiff32(L, TL);   // pb = sum |L-TL|
+    const __m256i mask = _mm256_cmpgt_epi32(pb, pa);
+    const __m256i pred = _mm256_blendv_epi8(T, L, mask);  // (L > T)? L : T
+    const __m256i res = _mm256_sub_epi8(src, pred);
+    _mm256_storeu_si256((__m256i*)&out[i], res);
+  }
+  if (i != num_pixels) {
+    VP8LPredictorsSub_C[11](in + i, upper + i, num_pixels - i, out + i);
+  }
+}
+
+// Predictor12: ClampedSubSubtractFull.
+static void PredictorSub12(const uint32_t* in, const uint32_t* upper,
+                           int num_pixels, uint32_t* out) {
+  int i;
+  const __m256i zero = _mm256_setzero_si256();
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);
+    const __m256i L = _mm256_loadu_si256((const __m256i*)&in[i - 1]);
+    const __m256i L_lo = _mm256_unpacklo_epi8(L, zero);
+    const __m256i L_hi = _mm256_unpackhi_epi8(L, zero);
+    const __m256i T = _mm256_loadu_si256((const __m256i*)&upper[i]);
+    const __m256i T_lo = _mm256_unpacklo_epi8(T, zero);
+    const __m256i T_hi = _mm256_unpackhi_epi8(T, zero);
+    const __m256i TL = _mm256_loadu_si256((const __m256i*)&upper[i - 1]);
+    const __m256i TL_lo = _mm256_unpacklo_epi8(TL, zero);
+    const __m256i TL_hi = _mm256_unpackhi_epi8(TL, zero);
+    const __m256i diff_lo = _mm256_sub_epi16(T_lo, TL_lo);
+    const __m256i diff_hi = _mm256_sub_epi16(T_hi, TL_hi);
+    const __m256i pred_lo = _mm256_add_epi16(L_lo, diff_lo);
+    const __m256i pred_hi = _mm256_add_epi16(L_hi, diff_hi);
+    // The packing is done per 128b lane, which keeps the pixels in order.
+    const __m256i pred = _mm256_packus_epi16(pred_lo, pred_hi);
+    const __m256i res = _mm256_sub_epi8(src, pred);
+    _mm256_storeu_si256((__m256i*)&out[i], res);
+  }
+  if (i != num_pixels) {
+    VP8LPredictorsSub_C[12](in + i, upper + i, num_pixels - i, out + i);
+  }
+}
+
+// Predictors13: ClampedAddSubtractHalf
+static WEBP_INLINE __m256i ClampedAddSubtractHalf(const __m256i L,
+                                                  const __m256i T,
+                                                  const __m256i TL) {
+  const __m256i sum = _mm256_add_epi16(T, L);
+  const __m256i avg = _mm256_srli_epi16(sum, 1);
+  const __m256i A1 = _mm256_sub_epi16(avg, TL);
+  const __m256i bit_fix = _mm256_cmpgt_epi16(TL, avg);
+  const __m256i A2 = _mm256_sub_epi16(A1, bit_fix);
+  const __m256i A3 = _mm256_srai_epi16(A2, 1);
+  return _mm256_add_epi16(avg, A3);
+}
+
+static void PredictorSub13(const uint32_t* in, const uint32_t* upper,
+                           int num_pixels, uint32_t* out) {
+  int i;
+  const __m256i zero = _mm256_setzero_si256();
+  for (i = 0; i + 8 <= num_pixels; i += 8) {
+    const __m256i src = _mm256_loadu_si256((const __m256i*)&in[i]);
+    const __m256i L = _mm256_loadu_si256((const __m256i*)&in[i - 1]);
+    const __m256i T = _mm256_loadu_si256((const __m256i*)&upper[i]);
+    const __m256i TL = _mm256_loadu_si256((const __m256i*)&upper[i - 1]);
+    const __m256i pred_lo =
+        ClampedAddSubtractHalf(_mm256_unpacklo_epi8(L, zero),
+                               _mm256_unpacklo_epi8(T, zero),
+                               _mm256_unpacklo_epi8(TL, zero));
+    const __m256i pred_hi =
+        ClampedAddSubtractHalf(_mm256_unpackhi_epi8(L, zero),
+                               _mm256_unpackhi_epi8(T, zero),
+                               _mm256_unpackhi_epi8(TL, zero));
+    const __m256i pred = _mm256_packus_epi16(pred_lo, pred_hi);
+    const __m256i res = _mm256_sub_epi8(src, pred);
+    _mm256_storeu_si256((__m256i*)&out[i], res);
+  }
+  if (i != num_pixels) {
+    VP8LPredictorsSub_C[13](in + i, upper + i, num_pixels - i, out + i);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Entry point
+
+extern void VP8LEncDspInitAVX2(void);
+
+WEBP_TSAN_IGNORE_FUNCTION void VP8LEncDspInitAVX2(void) {
+  VP8LSubtractGreenFromBlueAndRed = SubtractGreenFromBlueAndRed;
+  VP8LTransformColor = TransformColor;
+  VP8LHistogramAdd = HistogramAdd;
+  VP8LExtraCost = ExtraCost;
+  VP8LExtraCostCombined = ExtraCostCombined;
+  VP8LVectorMismatch = VectorMismatch;
+  VP8LBundleColorMap = BundleColorMap;
+
+  VP8LPredictorsSub[0] = PredictorSub0;
+  VP8LPredictorsSub[1] = PredictorSub1;
+  VP8LPredictorsSub[2] = PredictorSub2;
+  VP8LPredictorsSub[3] = PredictorSub3;
+  VP8LPredictorsSub[4] = PredictorSub4;
+  VP8LPredictorsSub[5] = PredictorSub5;
+  VP8LPredictorsSub[6] = PredictorSub6;
+  VP8LPredictorsSub[7] = PredictorSub7;
+  VP8LPredictorsSub[8] = PredictorSub8;
+  VP8LPredictorsSub[9] = PredictorSub9;
+  VP8LPredictorsSub[10] = PredictorSub10;
+  VP8LPredictorsSub[11] = PredictorSub11;
+  VP8LPredictorsSub[12] = PredictorSub12;
+  VP8LPredictorsSub[13] = PredictorSub13;
+  VP8LPredictorsSub[14] = PredictorSub0;  // <- padding security sentinels
+  VP8LPredictorsSub[15] = PredictorSub0;
+}
+
+#else  // !WEBP_USE_AVX2
+
+WEBP_DSP_INIT_STUB(VP8LEncDspInitAVX2)
+
+#endif  // WEBP_USE_AVX2
@@ -234,6 +234,20 @@ static void ConvertBGR24ToY(const uint8_t* bgr, uint8_t* y, int width) {
   }
 }
 
+static void ConvertRGBAToY(const uint8_t* rgba, uint8_t* y, int width) {
+  int i;
+  for (i = 0; i < width; ++i, rgba += 4) {
+    y[i] = VP8RGBToY(rgba[0], rgba[1], rgba[2], YUV_HALF);
+  }
+}
+
+static void ConvertBGRAToY(const uint8_t* bgra, uint8_t* y, int width) {
+  int i;
+  for (i = 0; i < width; ++i, bgra += 4) {
+    y[i] = VP8RGBToY(bgra[2], bgra[1], bgra[0], YUV_HALF);
+  }
+}
+
 void WebPConvertRGBA32ToUV_C(const uint16_t* rgb,
                              uint8_t* u, uint8_t* v, int width) {
   int i;
@@ -290,6 +304,8 @@ static void SharpYUVFilterRow_C(const int16_t* A, const int16_t* B, int len,
 
 void (*WebPConvertRGB24ToY)(const uint8_t* rgb, uint8_t* y, int width);
 void (*WebPConvertBGR24ToY)(const uint8_t* bgr, uint8_t* y, int width);
+void (*WebPConvertRGBAToY)(const uint8_t* rgba, uint8_t* y, int width);
+void (*WebPConvertBGRAToY)(const uint8_t* bgra, uint8_t* y, int width);
 void (*WebPConvertRGBA32ToUV)(const uint16_t* rgb,
                               uint8_t* u, uint8_t* v, int width);
 
@@ -309,6 +325,8 @@ static volatile VP8CPUInfo rgba_to_yuv_last_cpuinfo_used =
 
 extern void WebPInitConvertARGBToYUVSSE2(void);
 extern void WebPInitSharpYUVSSE2(void);
+extern void WebPInitConvertARGBToYUVAVX2(void);
+extern void WebPInitSharpYUVAVX2(void);
 
 WEBP_TSAN_IGNORE_FUNCTION void WebPInitConvertARGBToYUV(void) {
   if (rgba_to_yuv_last_cpuinfo_used == VP8GetCPUInfo) return;
@@ -318,6 +336,8 @@ WEBP_TSAN_IGNORE_FUNCTION void WebPInitConvertARGBToYUV(void) {
 
   WebPConvertRGB24ToY = ConvertRGB24ToY;
   WebPConvertBGR24ToY = ConvertBGR24ToY;
+  WebPConvertRGBAToY = ConvertRGBAToY;
+  WebPConvertBGRAToY = ConvertBGRAToY;
 
   WebPConvertRGBA32ToUV = WebPConvertRGBA32ToUV_C;
 
@@ -332,6 +352,12 @@ WEBP_TSAN_IGNORE_FUNCTION void WebPInitConvertARGBToYUV(void) {
       WebPInitSharpYUVSSE2();
     }
 #endif  // WEBP_USE_SSE2
+#if defined(WEBP_USE_AVX2)
+    if (VP8GetCPUInfo(kAVX2)) {
+      WebPInitConvertARGBToYUVAVX2();
+      WebPInitSharpYUVAVX2();
+    }
+#endif  // WEBP_USE_AVX2
   }
   rgba_to_yuv_last_cpuinfo_used = VP8GetCPUInfo;
 }
@@ -0,0 +1,466 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the COPYING file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS. All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+// -----------------------------------------------------------------------------
+//
+// AVX2 version of the RGB->YUV conversion functions.
+//
+// The functions process 16 values where yuv_sse2.c processes 8, with the
+// same arithmetic, so that the results are bit-exact.
+
+#include "./yuv.h"
+
+#if defined(WEBP_USE_AVX2)
+
+#include <immintrin.h>
+#include <stdlib.h>  // for abs()
+
+//------------------------------------------------------------------------------
+// Convert spans of 32 pixels to various RGB formats for the encoder.
+
+// Load a 128b value in each lane.
+static WEBP_INLINE __m256i LoadTwo(const uint8_t* const lo,
+                                   const uint8_t* const hi) {
+  const __m128i a = _mm_loadu_si128((const __m128i*)lo);
+  const __m128i b = _mm_loadu_si128((const __m128i*)hi);
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+}
+
+// 'A' and 'B' hold four pixels per lane (8 pixels each), which 'shuffle'
+// gathers as four 32b groups of channels c0 | c1 | c2 | c3. The first three
+// channels of the 16 pixels are returned as 16b values, in pixel order.
+static WEBP_INLINE void PackedToPlanar(const __m256i* const A,
+                                       const __m256i* const B,
+                                       const __m256i* const shuffle,
+                                       __m256i* const c0, __m256i* const c1,
+                                       __m256i* const c2) {
+  const __m256i kPerm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  const __m256i A1 = _mm256_shuffle_epi8(*A, *shuffle);
+  const __m256i B1 = _mm256_shuffle_epi8(*B, *shuffle);
+  // c0 x8 | c1 x8 || c2 x8 | c3 x8
+  const __m256i A2 = _mm256_permutevar8x32_epi32(A1, kPerm);
+  const __m256i B2 = _mm256_permutevar8x32_epi32(B1, kPerm);
+  const __m256i C02 = _mm256_unpacklo_epi64(A2, B2);   // c0 x16 || c2 x16
+  const __m256i C13 = _mm256_unpackhi_epi64(A2, B2);   // c1 x16 || c3 x16
+  *c0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(C02));
+  *c1 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(C13));
+  *c2 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(C02, 1));
+}
+
+// Shuffles for the 24b layouts (12 bytes per lane) and the 32b ones.
+#define SHUFFLE_24B                                        \
+  _mm256_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11,   \
+                   -1, -1, -1, -1,                         \
+                   0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11,   \
+                   -1, -1, -1, -1)
+#define SHUFFLE_32B                                              \
+  _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14,       \
+                   3, 7, 11, 15,                                 \
+                   0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14,       \
+                   3, 7, 11, 15)
+
+// Load 16 pixels of 3 bytes. Reads 4 bytes past the last pixel.
+static WEBP_INLINE void Load16x24b(const uint8_t* const src,
+                                   __m256i* const c0, __m256i* const c1,
+                                   __m256i* const c2) {
+  const __m256i kShuffle = SHUFFLE_24B;
+  const __m256i A = LoadTwo(src +  0, src + 12);
+  const __m256i B = LoadTwo(src + 24, src + 36);
+  PackedToPlanar(&A, &B, &kShuffle, c0, c1, c2);
+}
+
+// Load 16 pixels of 4 bytes.
+static WEBP_INLINE void Load16x32b(const uint8_t* const src,
+                                   __m256i* const c0, __m256i* const c1,
+                                   __m256i* const c2) {
+  const __m256i kShuffle = SHUFFLE_32B;
+  const __m256i A = _mm256_loadu_si256((const __m256i*)(src +  0));
+  const __m256i B = _mm256_loadu_si256((const __m256i*)(src + 32));
+  PackedToPlanar(&A, &B, &kShuffle, c0, c1, c2);
+}
+
+#undef SHUFFLE_24B
+#undef SHUFFLE_32B
+
+// Same as the TRANSFORM macro of yuv_sse2.c:
+// computes (RG * MULT_RG + GB * MULT_GB + ROUNDER) >> DESCALE_FIX
+#define TRANSFORM(RG_LO, RG_HI, GB_LO, GB_HI, MULT_RG, MULT_GB, \
+                  ROUNDER, DESCALE_FIX, OUT) do {               \
+  const __m256i V0_lo = _mm256_madd_epi16(RG_LO, MULT_RG);      \
+  const __m256i V0_hi = _mm256_madd_epi16(RG_HI, MULT_RG);      \
+  const __m256i V1_lo = _mm256_madd_epi16(GB_LO, MULT_GB);      \
+  const __m256i V1_hi = _mm256_madd_epi16(GB_HI, MULT_GB);      \
+  const __m256i V2_lo = _mm256_add_epi32(V0_lo, V1_lo);         \
+  const __m256i V2_hi = _mm256_add_epi32(V0_hi, V1_hi);         \
+  const __m256i V3_lo = _mm256_add_epi32(V2_lo, ROUNDER);       \
+  const __m256i V3_hi = _mm256_add_epi32(V2_hi, ROUNDER);       \
+  const __m256i V5_lo = _mm256_srai_epi32(V3_lo, DESCALE_FIX);  \
+  const __m256i V5_hi = _mm256_srai_epi32(V3_hi, DESCALE_FIX);  \
+  (OUT) = _mm256_packs_epi32(V5_lo, V5_hi);                     \
+} while (0)
+
+#define MK_CST_16(A, B) _mm256_set1_epi32((int)(((uint32_t)(B) << 16) | \
+                                                ((A) & 0xffff)))
+static WEBP_INLINE void ConvertRGBToY(const __m256i* const R,
+                                      const __m256i* const G,
+                                      const __m256i* const B,
+                                      __m256i* const Y) {
+  const __m256i kRG_y = MK_CST_16(16839, 33059 - 16384);
+  const __m256i kGB_y = MK_CST_16(16384, 6420);
+  const __m256i kHALF_Y = _mm256_set1_epi32((16 << YUV_FIX) + YUV_HALF);
+
+  const __m256i RG_lo = _mm256_unpacklo_epi16(*R, *G);
+  const __m256i RG_hi = _mm256_unpackhi_epi16(*R, *G);
+  const __m256i GB_lo = _mm256_unpacklo_epi16(*G, *B);
+  const __m256i GB_hi = _mm256_unpackhi_epi16(*G, *B);
+  TRANSFORM(RG_lo, RG_hi, GB_lo, GB_hi, kRG_y, kGB_y, kHALF_Y, YUV_FIX, *Y);
+}
+
+static WEBP_INLINE void ConvertRGBToUV(const __m256i* const R,
+                                       const __m256i* const G,
+                                       const __m256i* const B,
+                                       __m256i* const U, __m256i* const V) {
+  const __m256i kRG_u = MK_CST_16(-9719, -19081);
+  const __m256i kGB_u = MK_CST_16(0, 28800);
+  const __m256i kRG_v = MK_CST_16(28800, 0);
+  const __m256i kGB_v = MK_CST_16(-24116, -4684);
+  const __m256i kHALF_UV =
+      _mm256_set1_epi32(((128 << YUV_FIX) + YUV_HALF) << 2);
+
+  const __m256i RG_lo = _mm256_unpacklo_epi16(*R, *G);
+  const __m256i RG_hi = _mm256_unpackhi_epi16(*R, *G);
+  const __m256i GB_lo = _mm256_unpacklo_epi16(*G, *B);
+  const __m256i GB_hi = _mm256_unpackhi_epi16(*G, *B);
+  TRANSFORM(RG_lo, RG_hi, GB_lo, GB_hi, kRG_u, kGB_u,
+            kHALF_UV, YUV_FIX + 2, *U);
+  TRANSFORM(RG_lo, RG_hi, GB_lo, GB_hi, kRG_v, kGB_v,
+            kHALF_UV, YUV_FIX + 2, *V);
+}
+
+#undef MK_CST_16
+#undef TRANSFORM
+
+// Pack two vectors of 16 16b values into 32 bytes, in order.
+static WEBP_INLINE __m256i PackUS16(const __m256i* const A,
+                                    const __m256i* const B) {
+  return _mm256_permute4x64_epi64(_mm256_packus_epi16(*A, *B), 0xd8);
+}
+
+static void ConvertRGB24ToY(const uint8_t* rgb, uint8_t* y, int width) {
+  int i;
+  // Leave room for the 4 bytes read past the last pixel.
+  for (i = 0; i + 32 + 2 <= width; i += 32, rgb += 3 * 32) {
+    __m256i r, g, b, Y0, Y1;
+    Load16x24b(rgb +  0, &r, &g, &b);
+    ConvertRGBToY(&r, &g, &b, &Y0);
+    Load16x24b(rgb + 48, &r, &g, &b);
+    ConvertRGBToY(&r, &g, &b, &Y1);
+    _mm256_storeu_si256((__m256i*)(y + i), PackUS16(&Y0, &Y1));
+  }
+  for (; i < width; ++i, rgb += 3) {   // left-over
+    y[i] = VP8RGBToY(rgb[0], rgb[1], rgb[2], YUV_HALF);
+  }
+}
+
+static void ConvertBGR24ToY(const uint8_t* bgr, uint8_t* y, int width) {
+  int i;
+  for (i = 0; i + 32 + 2 <= width; i += 32, bgr += 3 * 32) {
+    __m256i r, g, b, Y0, Y1;
+    Load16x24b(bgr +  0, &b, &g, &r);
+    ConvertRGBToY(&r, &g, &b, &Y0);
+    Load16x24b(bgr + 48, &b, &g, &r);
+    ConvertRGBToY(&r, &g, &b, &Y1);
+    _mm256_storeu_si256((__m256i*)(y + i), PackUS16(&Y0, &Y1));
+  }
+  for (; i < width; ++i, bgr += 3) {   // left-over
+    y[i] = VP8RGBToY(bgr[2], bgr[1], bgr[0], YUV_HALF);
+  }
+}
+
+static void ConvertRGBAToY(const uint8_t* rgba, uint8_t* y, int width) {
+  const int max_width = width & ~31;
+  int i;
+  for (i = 0; i < max_width; i += 32, rgba += 4 * 32) {
+    __m256i r, g, b, Y0, Y1;
+    Load16x32b(rgba +  0, &r, &g, &b);
+    ConvertRGBToY(&r, &g, &b, &Y0);
+    Load16x32b(rgba + 64, &r, &g, &b);
+    ConvertRGBToY(&r, &g, &b, &Y1);
+    _mm256_storeu_si256((__m256i*)(y + i), PackUS16(&Y0, &Y1));
+  }
+  for (; i < width; ++i, rgba += 4) {   // left-over
+    y[i] = VP8RGBToY(rgba[0], rgba[1], rgba[2], YUV_HALF);
+  }
+}
+
+static void ConvertBGRAToY(const uint8_t* bgra, uint8_t* y, int width) {
+  const int max_width = width & ~31;
+  int i;
+  for (i = 0; i < max_width; i += 32, bgra += 4 * 32) {
+    __m256i r, g, b, Y0, Y1;
+    Load16x32b(bgra +  0, &b, &g, &r);
+    ConvertRGBToY(&r, &g, &b, &Y0);
+    Load16x32b(bgra + 64, &b, &g, &r);
+    ConvertRGBToY(&r, &g, &b, &Y1);
+    _mm256_storeu_si256((__m256i*)(y + i), PackUS16(&Y0, &Y1));
+  }
+  for (; i < width; ++i, bgra += 4) {   // left-over
+    y[i] = VP8RGBToY(bgra[2], bgra[1], bgra[0], YUV_HALF);
+  }
+}
+
+// ARGB words are stored as B, G, R, A bytes (the SSE2 code does the same).
+static void ConvertARGBToY(const uint32_t* argb, uint8_t* y, int width) {
+  ConvertBGRAToY((const uint8_t*)argb, y, width);
+}
+
+// Horizontal add (doubled) of 16b values, result is 16b and in order.
+// in: A | B | C | D | ... -> out: 2*(A+B) | 2*(C+D) | ...
+static WEBP_INLINE void HorizontalAddPack(const __m256i* const A,
+                                          const __m256i* const B,
+                                          __m256i* const out) {
+  const __m256i k2 = _mm256_set1_epi16(2);
+  const __m256i C = _mm256_madd_epi16(*A, k2);
+  const __m256i D = _mm256_madd_epi16(*B, k2);
+  *out = _mm256_permute4x64_epi64(_mm256_packs_epi32(C, D), 0xd8);
+}
+
+// Compute the U/V of 32 ARGB pixels, as 16b values.
+static WEBP_INLINE void ARGB32ToUV(const uint32_t* const argb,
+                                   __m256i* const U, __m256i* const V) {
+  __m256i r0, g0, b0, r1, g1, b1, r, g, b;
+  Load16x32b((const uint8_t*)(argb +  0), &b0, &g0, &r0);
+  Load16x32b((const uint8_t*)(argb + 16), &b1, &g1, &r1);
+  HorizontalAddPack(&r0, &r1, &r);
+  HorizontalAddPack(&g0, &g1, &g);
+  HorizontalAddPack(&b0, &b1, &b);
+  ConvertRGBToUV(&r, &g, &b, U, V);
+}
+
+static void ConvertARGBToUV(const uint32_t* argb, uint8_t* u, uint8_t* v,
+                            int src_width, int do_store) {
+  const int max_width = src_width & ~63;
+  int i;
+  for (i = 0; i < max_width; i += 64, u += 32, v += 32) {
+    __m256i U0, V0, U1, V1;
+    ARGB32ToUV(&argb[i +  0], &U0, &V0);
+    ARGB32ToUV(&argb[i + 32], &U1, &V1);
+    U0 = PackUS16(&U0, &U1);
+    V0 = PackUS16(&V0, &V1);
+    if (!do_store) {
+      const __m256i prev_u = _mm256_loadu_si256((const __m256i*)u);
+      const __m256i prev_v = _mm256_loadu_si256((const __m256i*)v);
+      U0 = _mm256_avg_epu8(U0, prev_u);
+      V0 = _mm256_avg_epu8(V0, prev_v);
+    }
+    _mm256_storeu_si256((__m256i*)u, U0);
+    _mm256_storeu_si256((__m256i*)v, V0);
+  }
+  if (i < src_width) {  // left-over
+    WebPConvertARGBToUV_C(argb + i, u, v, src_width - i, do_store);
+  }
+}
+
+// Convert 16 accumulated r/g/b/x 16b-values to r[], g[], b[]
+static WEBP_INLINE void RGBA32PackedToPlanar_16b(const uint16_t* const rgbx,
+                                                 __m256i* const r,
+                                                 __m256i* const g,
+                                                 __m256i* const b) {
+  // Gather r0 r1 | g0 g1 | b0 b1 | x0 x1 in each lane, then group the lanes.
+  const __m256i kShuffle =
+      _mm256_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+                       0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+  const __m256i kPerm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256i in[4];
+  int k;
+  for (k = 0; k < 4; ++k) {
+    const __m256i A = _mm256_loadu_si256((const __m256i*)(rgbx + 16 * k));
+    // r x4 | g x4 || b x4 | x x4
+    in[k] = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(A, kShuffle),
+                                        kPerm);
+  }
+  {
+    const __m256i RB0 = _mm256_unpacklo_epi64(in[0], in[1]);  // r x8 || b x8
+    const __m256i GX0 = _mm256_unpackhi_epi64(in[0], in[1]);  // g x8 || x x8
+    const __m256i RB1 = _mm256_unpacklo_epi64(in[2], in[3]);
+    const __m256i GX1 = _mm256_unpackhi_epi64(in[2], in[3]);
+    *r = _mm256_permute2x128_si256(RB0, RB1, 0x20);
+    *g = _mm256_permute2x128_si256(GX0, GX1, 0x20);
+    *b = _mm256_permute2x128_si256(RB0, RB1, 0x31);
+  }
+}
+
+static void ConvertRGBA32ToUV(const uint16_t* rgb,
+                              uint8_t* u, uint8_t* v, int width) {
+  const int max_width = width & ~31;
+  const uint16_t* const last_rgb = rgb + 4 * max_width;
+  while (rgb < last_rgb) {
+    __m256i r, g, b, U0, V0, U1, V1;
+    RGBA32PackedToPlanar_16b(rgb +  0, &r, &g, &b);
+    ConvertRGBToUV(&r, &g, &b, &U0, &V0);
+    RGBA32PackedToPlanar_16b(rgb + 64, &r, &g, &b);
+    ConvertRGBToUV(&r, &g, &b, &U1, &V1);
+    _mm256_storeu_si256((__m256i*)u, PackUS16(&U0, &U1));
+    _mm256_storeu_si256((__m256i*)v, PackUS16(&V0, &V1));
+    u += 32;
+    v += 32;
+    rgb += 2 * 64;
+  }
+  if (max_width < width) {  // left-over
+    WebPConvertRGBA32ToUV_C(rgb, u, v, width - max_width);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+extern void WebPInitConvertARGBToYUVAVX2(void);
+
+WEBP_TSAN_IGNORE_FUNCTION void WebPInitConvertARGBToYUVAVX2(void) {
+  WebPConvertARGBToY = ConvertARGBToY;
+  WebPConvertARGBToUV = ConvertARGBToUV;
+
+  WebPConvertRGB24ToY = ConvertRGB24ToY;
+  WebPConvertBGR24ToY = ConvertBGR24ToY;
+  WebPConvertRGBAToY = ConvertRGBAToY;
+  WebPConvertBGRAToY = ConvertBGRAToY;
+
+  WebPConvertRGBA32ToUV = ConvertRGBA32ToUV;
+}
+
+//------------------------------------------------------------------------------
+// Sharp RGB->YUV conversion
+
+#define MAX_Y ((1 << 10) - 1)    // 10b precision over 16b-arithmetic
+static uint16_t clip_y(int v) {
+  return (v < 0) ? 0 : (v > MAX_Y) ? MAX_Y : (uint16_t)v;
+}
+
+static uint64_t SharpYUVUpdateY(const uint16_t* ref, const uint16_t* src,
+                                uint16_t* dst, int len) {
+  uint64_t diff = 0;
+  uint32_t tmp[8];
+  int i;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi16(MAX_Y);
+  const __m256i one = _mm256_set1_epi16(1);
+  __m256i sum = zero;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    const __m256i A = _mm256_loadu_si256((const __m256i*)(ref + i));
+    const __m256i B = _mm256_loadu_si256((const __m256i*)(src + i));
+    const __m256i C = _mm256_loadu_si256((const __m256i*)(dst + i));
+    const __m256i D = _mm256_sub_epi16(A, B);       // diff_y
+    const __m256i E = _mm256_cmpgt_epi16(zero, D);  // sign (-1 or 0)
+    const __m256i F = _mm256_add_epi16(C, D);       // new_y
+    const __m256i G = _mm256_or_si256(E, one);      // -1 or 1
+    const __m256i H = _mm256_max_epi16(_mm256_min_epi16(F, max), zero);
+    const __m256i I = _mm256_madd_epi16(D, G);      // sum(abs(...))
+    _mm256_storeu_si256((__m256i*)(dst + i), H);
+    sum = _mm256_add_epi32(sum, I);
+  }
+  _mm256_storeu_si256((__m256i*)tmp, sum);
+  diff = (uint64_t)tmp[0] + tmp[1] + tmp[2] + tmp[3] +
+         tmp[4] + tmp[5] + tmp[6] + tmp[7];
+  for (; i < len; ++i) {
+    const int diff_y = ref[i] - src[i];
+    const int new_y = (int)dst[i] + diff_y;
+    dst[i] = clip_y(new_y);
+    diff += (uint64_t)abs(diff_y);
+  }
+  return diff;
+}
+
+static void SharpYUVUpdateRGB(const int16_t* ref, const int16_t* src,
+                              int16_t* dst, int len) {
+  int i;
+  for (i = 0; i + 16 <= len; i += 16) {
+    const __m256i A = _mm256_loadu_si256((const __m256i*)(ref + i));
+    const __m256i B = _mm256_loadu_si256((const __m256i*)(src + i));
+    const __m256i C = _mm256_loadu_si256((const __m256i*)(dst + i));
+    const __m256i D = _mm256_sub_epi16(A, B);   // diff_uv
+    const __m256i E = _mm256_add_epi16(C, D);   // new_uv
+    _mm256_storeu_si256((__m256i*)(dst + i), E);
+  }
+  for (; i < len; ++i) {
+    const int diff_uv = ref[i] - src[i];
+    dst[i] += diff_uv;
+  }
+}
+
+static void SharpYUVFilterRow(const int16_t* A, const int16_t* B, int len,
+                              const uint16_t* best_y, uint16_t* out) {
+  int i;
+  const __m256i kCst8 = _mm256_set1_epi16(8);
+  const __m256i max = _mm256_set1_epi16(MAX_Y);
+  const __m256i zero = _mm256_setzero_si256();
+  for (i = 0; i + 16 <= len; i += 16) {
+    const __m256i a0 = _mm256_loadu_si256((const __m256i*)(A + i + 0));
+    const __m256i a1 = _mm256_loadu_si256((const __m256i*)(A + i + 1));
+    const __m256i b0 = _mm256_loadu_si256((const __m256i*)(B + i + 0));
+    const __m256i b1 = _mm256_loadu_si256((const __m256i*)(B + i + 1));
+    const __m256i a0b1 = _mm256_add_epi16(a0, b1);
+    const __m256i a1b0 = _mm256_add_epi16(a1, b0);
+    const __m256i a0a1b0b1 = _mm256_add_epi16(a0b1, a1b0);  // A0+A1+B0+B1
+    const __m256i a0a1b0b1_8 = _mm256_add_epi16(a0a1b0b1, kCst8);
+    const __m256i a0b1_2 = _mm256_add_epi16(a0b1, a0b1);    // 2*(A0+B1)
+    const __m256i a1b0_2 = _mm256_add_epi16(a1b0, a1b0);    // 2*(A1+B0)
+    const __m256i c0 = _mm256_srai_epi16(_mm256_add_epi16(a0b1_2, a0a1b0b1_8),
+                                         3);
+    const __m256i c1 = _mm256_srai_epi16(_mm256_add_epi16(a1b0_2, a0a1b0b1_8),
+                                         3);
+    const __m256i d0 = _mm256_add_epi16(c1, a0);
+    const __m256i d1 = _mm256_add_epi16(c0, a1);
+    const __m256i e0 = _mm256_srai_epi16(d0, 1);
+    const __m256i e1 = _mm256_srai_epi16(d1, 1);
+    // The unpacking is done per 128-bit lane: put the lanes back in order.
+    const __m256i f0 = _mm256_unpacklo_epi16(e0, e1);
+    const __m256i f1 = _mm256_unpackhi_epi16(e0, e1);
+    const __m256i g0 = _mm256_permute2x128_si256(f0, f1, 0x20);
+    const __m256i g1 = _mm256_permute2x128_si256(f0, f1, 0x31);
+    const __m256i h0 =
+        _mm256_loadu_si256((const __m256i*)(best_y + 2 * i + 0));
+    const __m256i h1 =
+        _mm256_loadu_si256((const __m256i*)(best_y + 2 * i + 16));
+    const __m256i i0 = _mm256_add_epi16(h0, g0);
+    const __m256i i1 = _mm256_add_epi16(h1, g1);
+    const __m256i j0 = _mm256_max_epi16(_mm256_min_epi16(i0, max), zero);
+    const __m256i j1 = _mm256_max_epi16(_mm256_min_epi16(i1, max), zero);
+    _mm256_storeu_si256((__m256i*)(out + 2 * i + 0), j0);
+    _mm256_storeu_si256((__m256i*)(out + 2 * i + 16), j1);
+  }
+  for (; i < len; ++i) {
+    //   (9 * A0 + 3 * A1 + 3 * B0 + B1 + 8) >> 4 =
+    // = (8 * A0 + 2 * (A1 + B0) + (A0 + A1 + B0 + B1 + 8)) >> 4
+    // We reuse the common sub-expressions.
+    const int a0b1 = A[i + 0] + B[i + 1];
+    const int a1b0 = A[i + 1] + B[i + 0];
+    const int a0a1b0b1 = a0b1 + a1b0 + 8;
+    const int v0 = (8 * A[i + 0] + 2 * a1b0 + a0a1b0b1) >> 4;
+    const int v1 = (8 * A[i + 1] + 2 * a0b1 + a0a1b0b1) >> 4;
+    out[2 * i + 0] = clip_y(best_y[2 * i + 0] + v0);
+    out[2 * i + 1] = clip_y(best_y[2 * i + 1] + v1);
+  }
+}
+
+#undef MAX_Y
+
+//------------------------------------------------------------------------------
+
+extern void WebPInitSharpYUVAVX2(void);
+
+WEBP_TSAN_IGNORE_FUNCTION void WebPInitSharpYUVAVX2(void) {
+  WebPSharpYUVUpdateY = SharpYUVUpdateY;
+  WebPSharpYUVUpdateRGB = SharpYUVUpdateRGB;
+  WebPSharpYUVFilterRow = SharpYUVFilterRow;
+}
+
+#else  // !WEBP_USE_AVX2
+
+WEBP_DSP_INIT_STUB(WebPInitConvertARGBToYUVAVX2)
+WEBP_DSP_INIT_STUB(WebPInitSharpYUVAVX2)
+
+#endif  // WEBP_USE_AVX2
@@ -634,6 +634,37 @@ static void ConvertARGBToY(const uint32_t* argb, uint8_t* y, int width) {
   }
 }
 
+// The 4-bytes RGBA and BGRA layouts are loaded as little-endian ARGB words.
+static void ConvertBGRAToY(const uint8_t* bgra, uint8_t* y, int width) {
+  const int max_width = width & ~15;
+  int i;
+  for (i = 0; i < max_width; i += 16, bgra += 4 * 16) {
+    __m128i Y0, Y1, rgb[6];
+    RGB32PackedToPlanar((const uint32_t*)bgra, rgb);
+    ConvertRGBToY(&rgb[0], &rgb[2], &rgb[4], &Y0);
+    ConvertRGBToY(&rgb[1], &rgb[3], &rgb[5], &Y1);
+    STORE_16(_mm_packus_epi16(Y0, Y1), y + i);
+  }
+  for (; i < width; ++i, bgra += 4) {   // left-over
+    y[i] = VP8RGBToY(bgra[2], bgra[1], bgra[0], YUV_HALF);
+  }
+}
+
+static void ConvertRGBAToY(const uint8_t* rgba, uint8_t* y, int width) {
+  const int max_width = width & ~15;
+  int i;
+  for (i = 0; i < max_width; i += 16, rgba += 4 * 16) {
+    __m128i Y0, Y1, bgr[6];
+    RGB32PackedToPlanar((const uint32_t*)rgba, bgr);
+    ConvertRGBToY(&bgr[4], &bgr[2], &bgr[0], &Y0);
+    ConvertRGBToY(&bgr[5], &bgr[3], &bgr[1], &Y1);
+    STORE_16(_mm_packus_epi16(Y0, Y1), y + i);
+  }
+  for (; i < width; ++i, rgba += 4) {   // left-over
+    y[i] = VP8RGBToY(rgba[0], rgba[1], rgba[2], YUV_HALF);
+  }
+}
+
 // Horizontal add (doubled) of two 16b values, result is 16b.
 // in: A | B | C | D | ... -> out: 2*(A+B) | 2*(C+D) | ...
 static void HorizontalAddPack(const __m128i* const A, const __m128i* const B,
@@ -732,6 +763,8 @@ WEBP_TSAN_IGNORE_FUNCTION void WebPInitConvertARGBToYUVSSE2(void) {
 
   WebPConvertRGB24ToY = ConvertRGB24ToY;
   WebPConvertBGR24ToY = ConvertBGR24ToY;
+  WebPConvertRGBAToY = ConvertRGBAToY;
+  WebPConvertBGRAToY = ConvertBGRAToY;
 
   WebPConvertRGBA32ToUV = ConvertRGBA32ToUV;
 }
@@ -357,11 +357,33 @@ static int MBAnalyzeBestUVMode(VP8EncIterator* const it) {
   return best_alpha;
 }
 
+// Records the distribution of the residuals' coefficients for the rate
+// control, using the Intra16 mode 'i16_mode' and the chroma mode picked.
+static void RecordRateStats(VP8EncIterator* const it, int i16_mode) {
+  VP8RCRowStats* const stats = &it->enc_->rc_stats_[it->y_];
+  const uint8_t* const y_ref = it->yuv_p_ + VP8I16ModeOffsets[i16_mode];
+  const uint8_t* const uv_ref =
+      it->yuv_p_ + VP8UVModeOffsets[it->mb_->uv_mode_];
+  int16_t out[16];
+  int j, i;
+  for (j = 0; j < 16; ++j) {
+    VP8FTransform(it->yuv_in_ + Y_OFF_ENC + VP8DspScan[j],
+                  y_ref + VP8DspScan[j], out);
+    for (i = 0; i < 16; ++i) ++stats->y_[VP8RCBin(abs(out[i]))];
+  }
+  for (j = 16; j < 16 + 4 + 4; ++j) {
+    VP8FTransform(it->yuv_in_ + U_OFF_ENC + VP8DspScan[j],
+                  uv_ref + VP8DspScan[j], out);
+    for (i = 0; i < 16; ++i) ++stats->uv_[VP8RCBin(abs(out[i]))];
+  }
+}
+
 static void MBAnalyze(VP8EncIterator* const it,
                       int alphas[MAX_ALPHA + 1],
                       int* const alpha, int* const uv_alpha) {
   const VP8Encoder* const enc = it->enc_;
   int best_alpha, best_uv_alpha;
+  int i16_mode = 0;  // DC_PRED
 
   VP8SetIntra16Mode(it, 0);  // default: Intra16, DC_PRED
   VP8SetSkip(it, 0);         // not skipped
@@ -369,8 +391,10 @@ static void MBAnalyze(VP8EncIterator* const it,
 
   if (enc->method_ <= 1) {
     best_alpha = FastMBAnalyze(it);
+    if (enc->rc_stats_ != NULL) VP8MakeLuma16Preds(it);
   } else {
     best_alpha = MBAnalyzeBestIntra16Mode(it);
+    i16_mode = it->preds_[0];
     if (enc->method_ >= 5) {
       // We go and make a fast decision for intra4/intra16.
       // It's usually not a good and definitive pick, but helps seeding the
@@ -380,6 +404,7 @@ static void MBAnalyze(VP8EncIterator* const it,
     }
   }
   best_uv_alpha = MBAnalyzeBestUVMode(it);
+  if (enc->rc_stats_ != NULL) RecordRateStats(it, i16_mode);
 
   // Final susceptibility mix
   best_alpha = (3 * best_alpha + best_uv_alpha + 2) >> 2;
@@ -480,7 +505,8 @@ int VP8EncAnalyze(VP8Encoder* const enc) {
   const int do_segments =
       enc->config_->emulate_jpeg_size ||   // We need the complexity evaluation.
       (enc->segment_hdr_.num_segments_ > 1) ||
-      (enc->method_ <= 1);  // for method 0 - 1, we need preds_[] to be filled.
+      (enc->method_ <= 1) ||  // for method 0 - 1, we need preds_[] to be filled
+      (enc->rc_stats_ != NULL);  // The rate control needs the statistics.
   if (do_segments) {
     const int last_row = enc->mb_h_;
     // We give a little more than a half work to the main thread.
@@ -19,6 +19,7 @@
 #include "../dsp/lossless_common.h"
 #include "../dsp/dsp.h"
 #include "../utils/color_cache_utils.h"
+#include "../utils/thread_utils.h"
 #include "../utils/utils.h"
 
 #define VALUES_IN_BYTE 256
@@ -243,36 +244,18 @@ static WEBP_INLINE int MaxFindCopyLength(int len) {
   return (len < MAX_LENGTH) ? len : MAX_LENGTH;
 }
 
-int VP8LHashChainFill(VP8LHashChain* const p, int quality,
-                      const uint32_t* const argb, int xsize, int ysize,
-                      int low_effort) {
-  const int size = xsize * ysize;
-  const int iter_max = GetMaxItersForQuality(quality);
-  const uint32_t window_size = GetWindowSizeForHashChain(quality, xsize);
+// Fills the hash chain for the positions in [start, end[. 'head' holds, for
+// each hash, the last position seen with that hash (or -1). If not NULL,
+// 'first' receives the first position seen for each hash, whose chain value
+// then needs to be linked to the positions before 'start'.
+// 'start' is either 0 or a position where the pixel differs from its left
+// neighbor: no run of identical pixels can then cross 'start' or 'end'.
+static void FillChain(const uint32_t* const argb, int size, int start, int end,
+                      int32_t* const chain, int32_t* const head,
+                      int32_t* const first) {
   int pos;
-  int argb_comp;
-  uint32_t base_position;
-  int32_t* hash_to_first_index;
-  // Temporarily use the p->offset_length_ as a hash chain.
-  int32_t* chain = (int32_t*)p->offset_length_;
-  assert(size > 0);
-  assert(p->size_ != 0);
-  assert(p->offset_length_ != NULL);
-
-  if (size <= 2) {
-    p->offset_length_[0] = p->offset_length_[size - 1] = 0;
-    return 1;
-  }
-
-  hash_to_first_index =
-      (int32_t*)WebPSafeMalloc(HASH_SIZE, sizeof(*hash_to_first_index));
-  if (hash_to_first_index == NULL) return 0;
-
-  // Set the int32_t array to -1.
-  memset(hash_to_first_index, 0xff, HASH_SIZE * sizeof(*hash_to_first_index));
-  // Fill the chain linking pixels with the same hash.
-  argb_comp = (argb[0] == argb[1]);
-  for (pos = 0; pos < size - 2;) {
+  int argb_comp = (argb[start] == argb[start + 1]);
+  for (pos = start; pos < end;) {
     uint32_t hash_code;
     const int argb_comp_next = (argb[pos + 1] == argb[pos + 2]);
     if (argb_comp && argb_comp_next) {
@@ -302,30 +285,38 @@ int VP8LHashChainFill(VP8LHashChain* const p, int quality,
       while (len) {
         tmp[1] = len--;
         hash_code = GetPixPairHash64(tmp);
-        chain[pos] = hash_to_first_index[hash_code];
-        hash_to_first_index[hash_code] = pos++;
+        chain[pos] = head[hash_code];
+        if (first != NULL && head[hash_code] < 0) first[hash_code] = pos;
+        head[hash_code] = pos++;
       }
       argb_comp = 0;
     } else {
       // Just move one pixel forward.
       hash_code = GetPixPairHash64(argb + pos);
-      chain[pos] = hash_to_first_index[hash_code];
-      hash_to_first_index[hash_code] = pos++;
+      chain[pos] = head[hash_code];
+      if (first != NULL && head[hash_code] < 0) first[hash_code] = pos;
+      head[hash_code] = pos++;
       argb_comp = argb_comp_next;
     }
   }
-  // Process the penultimate pixel.
-  chain[pos] = hash_to_first_index[GetPixPairHash64(argb + pos)];
-
-  WebPSafeFree(hash_to_first_index);
+  assert(pos == end);
+}
 
-  // Find the best match interval at each pixel, defined by an offset to the
-  // pixel and a length. The right-most pixel cannot match anything to the right
-  // (hence a best length of 0) and the left-most pixel nothing to the left
-  // (hence an offset of 0).
-  assert(size > 2);
-  p->offset_length_[0] = p->offset_length_[size - 1] = 0;
-  for (base_position = size - 2; base_position > 0;) {
+// Finds the best match interval at each position in [start, end[, from the
+// last one to the first one. 'offset_length' and 'chain' may be the same
+// buffer if the positions after 'end' are done before. A match is not
+// extended to the left of 'start'.
+static void FindBestMatches(const uint32_t* const argb, int xsize, int size,
+                            int quality, int low_effort, int start, int end,
+                            const int32_t* const chain,
+                            uint32_t* const offset_length) {
+  const int iter_max = GetMaxItersForQuality(quality);
+  const uint32_t window_size = GetWindowSizeForHashChain(quality, xsize);
+  // The left-most pixel cannot match anything to the left.
+  const uint32_t min_base_position = (start > 0) ? start : 1;
+  uint32_t base_position;
+  int pos;
+  for (base_position = end - 1; base_position >= min_base_position;) {
     const int max_len = MaxFindCopyLength(size - 1 - base_position);
     const uint32_t* const argb_start = argb + base_position;
     int iter = iter_max;
@@ -384,11 +375,11 @@ int VP8LHashChainFill(VP8LHashChain* const p, int quality,
     while (1) {
       assert(best_length <= MAX_LENGTH);
       assert(best_distance <= WINDOW_SIZE);
-      p->offset_length_[base_position] =
+      offset_length[base_position] =
           (best_distance << MAX_LENGTH_BITS) | (uint32_t)best_length;
       --base_position;
       // Stop if we don't have a match or if we are out of bounds.
-      if (best_distance == 0 || base_position == 0) break;
+      if (best_distance == 0 || base_position < min_base_position) break;
       // Stop if we cannot extend the matching intervals to the left.
       if (base_position < best_distance ||
           argb[base_position - best_distance] != argb[base_position]) {
@@ -408,6 +399,208 @@ int VP8LHashChainFill(VP8LHashChain* const p, int quality,
       }
     }
   }
+}
+
+// With multi-threading, the best matches are searched by bands of this many
+// pixels. The bands do not depend on the number of threads.
+#define HASH_CHAIN_BAND_SIZE (1 << 18)
+#define MAX_HASH_CHAIN_JOBS 16
+
+// Hash chain fill for a range of bands, by one worker.
+typedef struct {
+  WebPWorker worker_;
+  const uint32_t* argb_;
+  int xsize_, size_;
+  int quality_, low_effort_;
+  // First pass: chain of the positions in [chain_start_, chain_end_[, linked
+  // to the previous jobs in a second pass through 'first_'.
+  int chain_start_, chain_end_;
+  int32_t* head_;               // HASH_SIZE last positions
+  int32_t* first_;              // HASH_SIZE first positions
+  int32_t* chain_;
+  // Third pass: best matches of the bands [first_band_, last_band_[.
+  int first_band_, last_band_;
+  uint32_t* offset_length_;
+} HashChainJob;
+
+static int FillChainHook(HashChainJob* const job, void* unused) {
+  (void)unused;
+  memset(job->head_, 0xff, HASH_SIZE * sizeof(*job->head_));
+  memset(job->first_, 0xff, HASH_SIZE * sizeof(*job->first_));
+  FillChain(job->argb_, job->size_, job->chain_start_, job->chain_end_,
+            job->chain_, job->head_, job->first_);
+  return 1;
+}
+
+// Finds the best matches of the bands [first_band, last_band[, from the last
+// one to the first one.
+static void FindBestMatchesBands(const uint32_t* const argb, int xsize,
+                                 int size, int quality, int low_effort,
+                                 int first_band, int last_band,
+                                 const int32_t* const chain,
+                                 uint32_t* const offset_length) {
+  int band;
+  for (band = last_band - 1; band >= first_band; --band) {
+    const int start = band * HASH_CHAIN_BAND_SIZE;
+    const int end = (start + HASH_CHAIN_BAND_SIZE < size - 1)
+                  ? start + HASH_CHAIN_BAND_SIZE : size - 1;
+    FindBestMatches(argb, xsize, size, quality, low_effort, start, end, chain,
+                    offset_length);
+  }
+}
+
+static int FindBestMatchesHook(HashChainJob* const job, void* unused) {
+  (void)unused;
+  FindBestMatchesBands(job->argb_, job->xsize_, job->size_, job->quality_,
+                       job->low_effort_, job->first_band_, job->last_band_,
+                       job->chain_, job->offset_length_);
+  return 1;
+}
+
+static void RunHashChainJobs(HashChainJob* const jobs, int num_jobs,
+                             WebPWorkerHook hook) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  int n;
+  for (n = 0; n < num_jobs; ++n) jobs[n].worker_.hook = hook;
+  // Without a thread, the job is run by the calling thread.
+  for (n = 1; n < num_jobs; ++n) {
+    if (worker_interface->Reset(&jobs[n].worker_)) {
+      worker_interface->Launch(&jobs[n].worker_);
+    } else {
+      worker_interface->Execute(&jobs[n].worker_);
+    }
+  }
+  worker_interface->Execute(&jobs[0].worker_);
+  for (n = 0; n < num_jobs; ++n) worker_interface->Sync(&jobs[n].worker_);
+}
+
+// Multi-threaded version of the fill, for more than one band. The per-job
+// chains are identical to the single-threaded one once linked. As the best
+// matches of a band read the chain of all the previous positions, the chain is
+// kept in its own buffer. Returns false if it could not be allocated.
+static int HashChainFillMT(VP8LHashChain* const p, int quality,
+                           const uint32_t* const argb, int xsize, int size,
+                           int low_effort, int num_bands, int num_threads) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  HashChainJob jobs[MAX_HASH_CHAIN_JOBS];
+  const int num_jobs =
+      (num_threads < num_bands) ? num_threads : num_bands;
+  int32_t* const chain =
+      (int32_t*)WebPSafeMalloc(size + 2ULL * HASH_SIZE * num_jobs,
+                               sizeof(*chain));
+  int32_t* const tables = chain + size;
+  int chain_start = 0;
+  int n, i;
+  if (chain == NULL) return 0;
+  assert(num_jobs <= MAX_HASH_CHAIN_JOBS);
+
+  for (n = 0; n < num_jobs; ++n) {
+    HashChainJob* const job = &jobs[n];
+    const int first_band = n * num_bands / num_jobs;
+    const int last_band = (n + 1) * num_bands / num_jobs;
+    int chain_end = size - 2;
+    if (n + 1 < num_jobs) {
+      // Start the next job on a change of color, at or after its first band.
+      chain_end = last_band * HASH_CHAIN_BAND_SIZE;
+      while (chain_end < size - 2 && argb[chain_end - 1] == argb[chain_end]) {
+        ++chain_end;
+      }
+    }
+    if (chain_end < chain_start) chain_end = chain_start;
+    worker_interface->Init(&job->worker_);
+    job->worker_.data1 = job;
+    job->worker_.data2 = NULL;
+    job->argb_ = argb;
+    job->xsize_ = xsize;
+    job->size_ = size;
+    job->quality_ = quality;
+    job->low_effort_ = low_effort;
+    job->chain_start_ = chain_start;
+    job->chain_end_ = chain_end;
+    job->head_ = tables + 2 * n * HASH_SIZE;
+    job->first_ = job->head_ + HASH_SIZE;
+    job->chain_ = chain;
+    job->first_band_ = first_band;
+    job->last_band_ = last_band;
+    job->offset_length_ = p->offset_length_;
+    chain_start = chain_end;
+  }
+
+  RunHashChainJobs(jobs, num_jobs, (WebPWorkerHook)FillChainHook);
+  // Link the first positions of each hash in a job to the last ones of the
+  // previous jobs, gathered in jobs[0].head_.
+  for (n = 1; n < num_jobs; ++n) {
+    int32_t* const head = jobs[0].head_;
+    const int32_t* const job_head = jobs[n].head_;
+    const int32_t* const job_first = jobs[n].first_;
+    for (i = 0; i < HASH_SIZE; ++i) {
+      if (job_first[i] >= 0) chain[job_first[i]] = head[i];
+      if (job_head[i] >= 0) head[i] = job_head[i];
+    }
+  }
+  // Process the penultimate pixel.
+  chain[size - 2] = jobs[0].head_[GetPixPairHash64(argb + size - 2)];
+
+  p->offset_length_[0] = p->offset_length_[size - 1] = 0;
+  RunHashChainJobs(jobs, num_jobs, (WebPWorkerHook)FindBestMatchesHook);
+  for (n = 0; n < num_jobs; ++n) worker_interface->End(&jobs[n].worker_);
+  WebPSafeFree(chain);
+  return 1;
+}
+
+int VP8LHashChainFill(VP8LHashChain* const p, int quality,
+                      const uint32_t* const argb, int xsize, int ysize,
+                      int low_effort, int num_threads) {
+  const int size = xsize * ysize;
+  const int num_bands =
+      (size - 1 + HASH_CHAIN_BAND_SIZE - 1) / HASH_CHAIN_BAND_SIZE;
+  int32_t* hash_to_first_index;
+  // Temporarily use the p->offset_length_ as a hash chain.
+  int32_t* chain = (int32_t*)p->offset_length_;
+  assert(size > 0);
+  assert(p->size_ != 0);
+  assert(p->offset_length_ != NULL);
+
+  if (size <= 2) {
+    p->offset_length_[0] = p->offset_length_[size - 1] = 0;
+    return 1;
+  }
+
+  if (num_threads > MAX_HASH_CHAIN_JOBS) num_threads = MAX_HASH_CHAIN_JOBS;
+  if (num_threads > 1 && num_bands > 1 &&
+      HashChainFillMT(p, quality, argb, xsize, size, low_effort, num_bands,
+                      num_threads)) {
+    return 1;
+  }
+
+  hash_to_first_index =
+      (int32_t*)WebPSafeMalloc(HASH_SIZE, sizeof(*hash_to_first_index));
+  if (hash_to_first_index == NULL) return 0;
+
+  // Set the int32_t array to -1.
+  memset(hash_to_first_index, 0xff, HASH_SIZE * sizeof(*hash_to_first_index));
+  // Fill the chain linking pixels with the same hash.
+  FillChain(argb, size, 0, size - 2, chain, hash_to_first_index, NULL);
+  // Process the penultimate pixel.
+  chain[size - 2] = hash_to_first_index[GetPixPairHash64(argb + size - 2)];
+
+  WebPSafeFree(hash_to_first_index);
+
+  // Find the best match interval at each pixel, defined by an offset to the
+  // pixel and a length. The right-most pixel cannot match anything to the right
+  // (hence a best length of 0) and the left-most pixel nothing to the left
+  // (hence an offset of 0).
+  // With several threads, the bands are also used when running alone so that
+  // the result does not depend on the memory available.
+  assert(size > 2);
+  p->offset_length_[0] = p->offset_length_[size - 1] = 0;
+  if (num_threads <= 1) {
+    FindBestMatches(argb, xsize, size, quality, low_effort, 0, size - 1,
+                    chain, p->offset_length_);
+  } else {
+    FindBestMatchesBands(argb, xsize, size, quality, low_effort, 0, num_bands,
+                         chain, p->offset_length_);
+  }
   return 1;
 }
 
@@ -662,8 +855,8 @@ static void AddSingleLiteralWithCostModel(const uint32_t* const argb,
     if (use_color_cache) VP8LColorCacheInsert(hashers, color);
     cost_val += GetLiteralCost(cost_model, color) * mul1;
   }
-  if (cost[idx] > cost_val) {
-    cost[idx] = (float)cost_val;
+  if (*cost > cost_val) {
+    *cost = (float)cost_val;
     dist_array[idx] = 1;  // only one is inserted.
   }
 }
@@ -674,6 +867,14 @@ static void AddSingleLiteralWithCostModel(const uint32_t* const argb,
 // Empirical value to avoid high memory consumption but good for performance.
 #define COST_CACHE_INTERVAL_SIZE_MAX 100
 
+// The costs are only read for the pixel before the current one and written at
+// most MAX_LENGTH pixels after it. They are kept in a window of
+// COST_WINDOW_SIZE pixels (a power of 2 larger than MAX_LENGTH + 1) instead of
+// an array of the size of the image.
+#define COST_WINDOW_BITS (MAX_LENGTH_BITS + 1)
+#define COST_WINDOW_SIZE (1 << COST_WINDOW_BITS)
+#define COST_WINDOW_MASK (COST_WINDOW_SIZE - 1)
+
 // To perform backward reference every pixel at index index_ is considered and
 // the cost for the MAX_LENGTH following pixels computed. Those following pixels
 // at index index_ + k (k from 0 to MAX_LENGTH) have a cost of:
@@ -717,7 +918,6 @@ typedef struct {
 // It caches the different CostCacheInterval, caches the different
 // GetLengthCost(cost_model, k) in cost_cache_ and the CostInterval's (whose
 // count_ is limited by COST_CACHE_INTERVAL_SIZE_MAX).
-#define COST_MANAGER_MAX_FREE_LIST 10
 typedef struct {
   CostInterval* head_;
   int count_;  // The number of stored intervals.
@@ -726,15 +926,15 @@ typedef struct {
   double cost_cache_[MAX_LENGTH];  // Contains the GetLengthCost(cost_model, k).
   double min_cost_cache_;          // The minimum value in cost_cache_[1:].
   double max_cost_cache_;          // The maximum value in cost_cache_[1:].
-  float* costs_;
+  // The cost of pixel i is stored at costs_[i & COST_WINDOW_MASK]. The slots
+  // of the pixels before window_start_ have been reset for the next pixels.
+  float costs_[COST_WINDOW_SIZE];
+  int window_start_;
   uint16_t* dist_array_;
-  // Most of the time, we only need few intervals -> use a free-list, to avoid
-  // fragmentation with small allocs in most common cases.
-  CostInterval intervals_[COST_MANAGER_MAX_FREE_LIST];
+  // There can't be more than COST_CACHE_INTERVAL_SIZE_MAX intervals at once:
+  // they are all taken from this pool, through a free-list.
+  CostInterval intervals_[COST_CACHE_INTERVAL_SIZE_MAX];
   CostInterval* free_intervals_;
-  // These are regularly malloc'd remains. This list can't grow larger than than
-  // size COST_CACHE_INTERVAL_SIZE_MAX - COST_MANAGER_MAX_FREE_LIST, note.
-  CostInterval* recycled_intervals_;
   // Buffer used in BackwardReferencesHashChainDistanceOnly to store the ends
   // of the intervals that can have impacted the cost at a pixel.
   int* interval_ends_;
@@ -757,44 +957,20 @@ static void CostIntervalAddToFreeList(CostManager* const manager,
   manager->free_intervals_ = interval;
 }
 
-static int CostIntervalIsInFreeList(const CostManager* const manager,
-                                    const CostInterval* const interval) {
-  return (interval >= &manager->intervals_[0] &&
-          interval <= &manager->intervals_[COST_MANAGER_MAX_FREE_LIST - 1]);
-}
-
 static void CostManagerInitFreeList(CostManager* const manager) {
   int i;
   manager->free_intervals_ = NULL;
-  for (i = 0; i < COST_MANAGER_MAX_FREE_LIST; ++i) {
+  for (i = 0; i < COST_CACHE_INTERVAL_SIZE_MAX; ++i) {
     CostIntervalAddToFreeList(manager, &manager->intervals_[i]);
   }
 }
 
-static void DeleteIntervalList(CostManager* const manager,
-                               const CostInterval* interval) {
-  while (interval != NULL) {
-    const CostInterval* const next = interval->next_;
-    if (!CostIntervalIsInFreeList(manager, interval)) {
-      WebPSafeFree((void*)interval);
-    }  // else: do nothing
-    interval = next;
-  }
-}
-
 static void CostManagerClear(CostManager* const manager) {
   if (manager == NULL) return;
 
-  WebPSafeFree(manager->costs_);
   WebPSafeFree(manager->cache_intervals_);
   WebPSafeFree(manager->interval_ends_);
 
-  // Clear the interval lists.
-  DeleteIntervalList(manager, manager->head_);
-  manager->head_ = NULL;
-  DeleteIntervalList(manager, manager->recycled_intervals_);
-  manager->recycled_intervals_ = NULL;
-
   // Reset pointers, count_ and cache_intervals_size_.
   memset(manager, 0, sizeof(*manager));
   CostManagerInitFreeList(manager);
@@ -809,11 +985,9 @@ static int CostManagerInit(CostManager* const manager,
   // Empirically, differences between intervals is usually of more than 1.
   const double min_cost_diff = 0.1;
 
-  manager->costs_ = NULL;
   manager->cache_intervals_ = NULL;
   manager->interval_ends_ = NULL;
   manager->head_ = NULL;
-  manager->recycled_intervals_ = NULL;
   manager->count_ = 0;
   manager->dist_array_ = dist_array;
   CostManagerInitFreeList(manager);
@@ -903,13 +1077,9 @@ static int CostManagerInit(CostManager* const manager,
     manager->cache_intervals_size_ = cur + 1 - manager->cache_intervals_;
   }
 
-  manager->costs_ = (float*)WebPSafeMalloc(pix_count, sizeof(*manager->costs_));
-  if (manager->costs_ == NULL) {
-    CostManagerClear(manager);
-    return 0;
-  }
   // Set the initial costs_ high for every pixel as we will keep the minimum.
-  for (i = 0; i < pix_count; ++i) manager->costs_[i] = 1e38f;
+  for (i = 0; i < COST_WINDOW_SIZE; ++i) manager->costs_[i] = 1e38f;
+  manager->window_start_ = 0;
 
   // The cost at pixel is influenced by the cost intervals from previous pixels.
   // Let us take the specific case where the offset is the same (which actually
@@ -962,17 +1132,33 @@ static int CostManagerInit(CostManager* const manager,
   return 1;
 }
 
+// Returns the slot of the cost of pixel 'i'.
+static WEBP_INLINE float* GetCost(CostManager* const manager, int i) {
+  assert(i >= manager->window_start_ &&
+         i < manager->window_start_ + COST_WINDOW_SIZE);
+  return &manager->costs_[i & COST_WINDOW_MASK];
+}
+
+// Resets the slots of the pixels before 'i - 1', whose costs are not needed
+// anymore when processing pixel 'i'.
+static WEBP_INLINE void SlideCostWindow(CostManager* const manager, int i) {
+  for (; manager->window_start_ < i - 1; ++manager->window_start_) {
+    manager->costs_[manager->window_start_ & COST_WINDOW_MASK] = 1e38f;
+  }
+}
+
 // Given the distance_cost for pixel 'index', update the cost at pixel 'i' if it
 // is smaller than the previously computed value.
 static WEBP_INLINE void UpdateCost(CostManager* const manager, int i, int index,
                                    double distance_cost) {
   int k = i - index;
   double cost_tmp;
+  float* const cost = GetCost(manager, i);
   assert(k >= 0 && k < MAX_LENGTH);
   cost_tmp = distance_cost + manager->cost_cache_[k];
 
-  if (manager->costs_[i] > cost_tmp) {
-    manager->costs_[i] = (float)cost_tmp;
+  if (*cost > cost_tmp) {
+    *cost = (float)cost_tmp;
     manager->dist_array_[i] = k + 1;
   }
 }
@@ -1007,12 +1193,7 @@ static WEBP_INLINE void PopInterval(CostManager* const manager,
   if (interval == NULL) return;
 
   ConnectIntervals(manager, interval->previous_, next);
-  if (CostIntervalIsInFreeList(manager, interval)) {
-    CostIntervalAddToFreeList(manager, interval);
-  } else {  // recycle regularly malloc'd intervals too
-    interval->next_ = manager->recycled_intervals_;
-    manager->recycled_intervals_ = interval;
-  }
+  CostIntervalAddToFreeList(manager, interval);
   --manager->count_;
   assert(manager->count_ >= 0);
 }
@@ -1075,20 +1256,10 @@ static WEBP_INLINE void InsertInterval(CostManager* const manager,
     UpdateCostPerInterval(manager, start, end, index, distance_cost);
     return;
   }
-  if (manager->free_intervals_ != NULL) {
-    interval_new = manager->free_intervals_;
-    manager->free_intervals_ = interval_new->next_;
-  } else if (manager->recycled_intervals_ != NULL) {
-    interval_new = manager->recycled_intervals_;
-    manager->recycled_intervals_ = interval_new->next_;
-  } else {   // malloc for good
-    interval_new = (CostInterval*)WebPSafeMalloc(1, sizeof(*interval_new));
-    if (interval_new == NULL) {
-      // Write down the interval if we cannot create it.
-      UpdateCostPerInterval(manager, start, end, index, distance_cost);
-      return;
-    }
-  }
+  // The pool can't be empty as count_ is below its size.
+  assert(manager->free_intervals_ != NULL);
+  interval_new = manager->free_intervals_;
+  manager->free_intervals_ = interval_new->next_;
 
   interval_new->distance_cost_ = distance_cost;
   interval_new->lower_ = lower;
@@ -1280,12 +1451,14 @@ static int BackwardReferencesHashChainDistanceOnly(
   dist_array[0] = 0;
   // Add first pixel as literal.
   AddSingleLiteralWithCostModel(argb + 0, &hashers, cost_model, 0,
-                                use_color_cache, 0.0, cost_manager->costs_,
+                                use_color_cache, 0.0, GetCost(cost_manager, 0),
                                 dist_array);
 
   for (i = 1; i < pix_count - 1; ++i) {
     int offset = 0, len = 0;
-    double prev_cost = cost_manager->costs_[i - 1];
+    double prev_cost;
+    SlideCostWindow(cost_manager, i);
+    prev_cost = *GetCost(cost_manager, i - 1);
     HashChainFindCopy(hash_chain, i, &offset, &len);
     if (len >= 2) {
       // If we are dealing with a non-literal.
@@ -1314,7 +1487,8 @@ static int BackwardReferencesHashChainDistanceOnly(
       // previous set (e.g. constant color regions).
       for (; i < pix_count - 1; ++i) {
         int offset_next, len_next;
-        prev_cost = cost_manager->costs_[i - 1];
+        SlideCostWindow(cost_manager, i);
+        prev_cost = *GetCost(cost_manager, i - 1);
 
         if (is_offset_zero) {
           // No optimization can be made so we just push all of the
@@ -1352,7 +1526,7 @@ static int BackwardReferencesHashChainDistanceOnly(
         UpdateCostPerIndex(cost_manager, i);
         AddSingleLiteralWithCostModel(argb + i, &hashers, cost_model, i,
                                       use_color_cache, prev_cost,
-                                      cost_manager->costs_, dist_array);
+                                      GetCost(cost_manager, i), dist_array);
       }
       // Submit the last pixel.
       UpdateCostPerIndex(cost_manager, i + 1);
@@ -1381,8 +1555,9 @@ static int BackwardReferencesHashChainDistanceOnly(
         // Also try the smallest interval possible (size 2).
         double cost_total =
             prev_cost + offset_cost + GetLengthCost(cost_model, 1);
-        if (cost_manager->costs_[i + 1] > cost_total) {
-          cost_manager->costs_[i + 1] = (float)cost_total;
+        float* const cost = GetCost(cost_manager, i + 1);
+        if (*cost > cost_total) {
+          *cost = (float)cost_total;
           dist_array[i + 1] = 2;
         }
       }
@@ -1393,7 +1568,7 @@ static int BackwardReferencesHashChainDistanceOnly(
 
     AddSingleLiteralWithCostModel(argb + i, &hashers, cost_model, i,
                                   use_color_cache, prev_cost,
-                                  cost_manager->costs_, dist_array);
+                                  GetCost(cost_manager, i), dist_array);
 
  next_symbol: ;
   }
@@ -1401,7 +1576,7 @@ static int BackwardReferencesHashChainDistanceOnly(
   if (i == (pix_count - 1)) {
     AddSingleLiteralWithCostModel(
         argb + i, &hashers, cost_model, i, use_color_cache,
-        cost_manager->costs_[pix_count - 2], cost_manager->costs_, dist_array);
+        *GetCost(cost_manager, i - 1), GetCost(cost_manager, i), dist_array);
   }
 
   ok = !refs->error_;
@@ -129,9 +129,13 @@ struct VP8LHashChain {
 // Must be called first, to set size.
 int VP8LHashChainInit(VP8LHashChain* const p, int size);
 // Pre-compute the best matches for argb.
+// If 'num_threads' > 1, the best matches are searched by bands of pixels on up
+// to 'num_threads' threads, and are not extended across the bands. The result
+// then differs slightly from the single-threaded search, but does not depend
+// on the actual number of threads.
 int VP8LHashChainFill(VP8LHashChain* const p, int quality,
                       const uint32_t* const argb, int xsize, int ysize,
-                      int low_effort);
+                      int low_effort, int num_threads);
 void VP8LHashChainClear(VP8LHashChain* const p);  // release memory
 
 // -----------------------------------------------------------------------------
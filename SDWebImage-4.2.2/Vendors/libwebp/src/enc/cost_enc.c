@@ -11,6 +11,8 @@
 //
 // Author: Skal (pascal.massimino@gmail.com)
 
+#include <string.h>
+
 #include "./cost_enc.h"
 
 //------------------------------------------------------------------------------
@@ -67,10 +69,14 @@ void VP8CalculateLevelCosts(VP8EncProba* const proba) {
     for (band = 0; band < NUM_BANDS; ++band) {
       for (ctx = 0; ctx < NUM_CTX; ++ctx) {
         const uint8_t* const p = proba->coeffs_[ctype][band][ctx];
+        uint8_t* const table_p = proba->level_cost_probas_[ctype][band][ctx];
         uint16_t* const table = proba->level_cost_[ctype][band][ctx];
         const int cost0 = (ctx > 0) ? VP8BitCost(1, p[0]) : 0;
         const int cost_base = VP8BitCost(1, p[1]) + cost0;
         int v;
+        // The table only depends on 'p': skip it if it is already up to date.
+        if (!memcmp(table_p, p, NUM_PROBAS)) continue;
+        memcpy(table_p, p, NUM_PROBAS);
         table[0] = VP8BitCost(0, p[1]) + cost0;
         for (v = 1; v <= MAX_VARIABLE_LEVEL; ++v) {
           table[v] = cost_base + VariableLevelCost(v, p);
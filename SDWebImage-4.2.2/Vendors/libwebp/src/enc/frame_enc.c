@@ -47,7 +47,9 @@ static int InitPassStats(const VP8Encoder* const enc, PassStats* const s) {
 
   s->is_first = 1;
   s->dq = 10.f;
-  s->q = s->last_q = enc->config_->quality;
+  // With the single-pass rate control, start from the predicted quality.
+  s->q = s->last_q = (enc->rc_stats_ != NULL) ?
+      VP8RCPredictQuality(enc, (double)target_size) : enc->config_->quality;
   s->target = do_size_search ? (double)target_size
             : (target_PSNR > 0.) ? target_PSNR
             : 40.;   // default, just in case
@@ -79,6 +81,133 @@ static float ComputeNextQ(PassStats* const s) {
   return s->q;
 }
 
+//------------------------------------------------------------------------------
+// Single-pass rate control (enc->rc_stats_ != NULL)
+//
+// The pass is coded at the quality predicted by the rate model. After each row,
+// the bits spent so far are compared to the ones expected from the model. If
+// the remaining budget is running short, the next rows are quantized more
+// coarsely by VP8SetRateCorrection(). The quantizers of the segments can't be
+// changed, since they're coded in the frame header.
+
+typedef struct {
+  double budget;       // bits available for all the rows
+  double scale;        // scale from the predicted bits to the budget
+  double expected;     // bits expected for the rows coded so far
+  double spent;        // bits spent on them
+  double norm_spent;   // estimate of the bits spent without correction
+  float strength;      // current correction
+  int first_row;       // no correction before this row
+} RateControl;
+
+// Relative decrease of the rate, for a correction of strength 1.
+static double RateCorrectionSlope(const VP8Encoder* const enc) {
+  return (enc->method_ >= 5) ? 0.25 : 0.3;
+}
+
+static void InitRateControl(const VP8Encoder* const enc,
+                            RateControl* const rc, double budget,
+                            int first_row) {
+  double total = 0.;
+  int y;
+  for (y = 0; y < enc->mb_h_; ++y) total += enc->rc_stats_[y].bits_;
+  rc->budget = (budget > 0.) ? budget : 0.;
+  rc->scale = (total > 0.) ? rc->budget / total : 0.;
+  rc->expected = 0.;
+  rc->spent = 0.;
+  rc->norm_spent = 0.;
+  rc->strength = 0.f;
+  rc->first_row = first_row;
+}
+
+// Records the bits spent on the row 'y' and adjusts the correction for the
+// next rows.
+static void UpdateRateControl(VP8Encoder* const enc, RateControl* const rc,
+                              int y, double bits) {
+  const double slope = RateCorrectionSlope(enc);
+  // Until enough rows are coded, the model is assumed to be right.
+  const double prior = 0.1 * rc->budget;
+  double ratio, left, expected_left;
+  float strength;
+  rc->expected += rc->scale * enc->rc_stats_[y].bits_;
+  rc->spent += bits;
+  rc->norm_spent += bits / (1. - slope * rc->strength);
+  if (y + 1 < rc->first_row) return;
+  ratio = (rc->norm_spent + prior) / (rc->expected + prior);
+  left = rc->budget - rc->spent;
+  expected_left = ratio * (rc->budget - rc->expected);
+  if (expected_left <= left) {
+    strength = 0.f;
+  } else if (left <= 0.) {
+    strength = 1.f;
+  } else {
+    strength = (float)((1. - left / expected_left) / slope);
+    if (strength > 1.f) strength = 1.f;
+  }
+  if (strength != rc->strength) {
+    rc->strength = strength;
+    VP8SetRateCorrection(enc, strength);
+  }
+}
+
+// Records the bits spent on the rows [0, num_rows), which the wavefront codes
+// at once. The correction, if any, is set for the next rows.
+static void UpdateRateControlRows(VP8Encoder* const enc,
+                                  RateControl* const rc, int num_rows,
+                                  double bits) {
+  int y;
+  for (y = 0; y < num_rows; ++y) {
+    UpdateRateControl(enc, rc, y, (y + 1 == num_rows) ? bits : 0.);
+  }
+}
+
+// The correction can only lower the rate, and the prediction is less reliable
+// than a measure. If the bits spent on the first quarter of the rows are too
+// far from the prediction, the quality is predicted again, taking the error
+// into account, and the frame is coded again from the start. The first rows
+// of that pass are checked again, for a last restart if need be. If the target
+// is between the two checks, the quality is then interpolated. This is done in
+// all the coding loops.
+#define RC_MAX_ERROR 1.1   // maximum ratio between spent and predicted bits
+// The rates estimated during the token loop use the probabilities of the last
+// refresh, and exceed the final size by a few percents. Before the first
+// refresh, they can be off by much more: the check measures the tokens.
+#define RC_TOKEN_RATE 0.97
+
+// Returns the number of rows coded before the check, 0 if there's none.
+static int GetCheckRows(const VP8Encoder* const enc) {
+  const int num_rows = (enc->mb_h_ + 3) >> 2;
+  return (enc->rc_stats_ != NULL && num_rows < enc->mb_h_) ? num_rows : 0;
+}
+
+// Returns true if 's->q' was changed. '*check_rows' is cleared if the next
+// pass isn't to be checked.
+static int CheckRatePrediction(const VP8Encoder* const enc,
+                               const RateControl* const rc,
+                               PassStats* const s, int* const check_rows) {
+  const double ratio =
+      (rc->expected > 0.) ? rc->norm_spent / rc->expected : 1.;
+  if (ratio <= RC_MAX_ERROR && ratio * RC_MAX_ERROR >= 1.) {
+    *check_rows = 0;
+    return 0;
+  }
+  s->value = s->target * ratio;   // size expected at 's->q'
+  if (!s->is_first && (s->value > s->target) != (s->last_value > s->target)) {
+    // The target is between the two checks: interpolate the log of the size.
+    const double a = log(s->last_value / s->target), b = log(ratio);
+    s->q = s->last_q + (float)((s->q - s->last_q) * a / (a - b));
+    VP8RCPredictSize(enc, s->q);   // store the rows' bits for the new quality
+  } else {
+    // The error is assumed to be the same at all qualities.
+    s->last_q = s->q;
+    s->last_value = s->value;
+    s->q = VP8RCPredictQuality(enc, VP8RCPredictSize(enc, s->q) / ratio);
+  }
+  if (!s->is_first) *check_rows = 0;
+  s->is_first = 0;
+  return 1;
+}
+
 //------------------------------------------------------------------------------
 // Tables for level coding
 
@@ -353,24 +482,32 @@ static void CodeResiduals(VP8BitWriter* const bw, VP8EncIterator* const it,
   VP8IteratorBytesToNz(it);
 }
 
+// Same as VP8InitResidual(), but the event distribution is recorded in the
+// iterator's statistics, which are private to the row in the wavefront case.
+static void InitResidual(int first, int coeff_type,
+                         const VP8EncIterator* const it,
+                         VP8Residual* const res) {
+  VP8InitResidual(first, coeff_type, it->enc_, res);
+  res->stats = it->stats_[coeff_type];
+}
+
 // Same as CodeResiduals, but doesn't actually write anything.
 // Instead, it just records the event distribution.
 static void RecordResiduals(VP8EncIterator* const it,
                             const VP8ModeScore* const rd) {
   int x, y, ch;
   VP8Residual res;
-  VP8Encoder* const enc = it->enc_;
 
   VP8IteratorNzToBytes(it);
 
   if (it->mb_->type_ == 1) {   // i16x16
-    VP8InitResidual(0, 1, enc, &res);
+    InitResidual(0, 1, it, &res);
     VP8SetResidualCoeffs(rd->y_dc_levels, &res);
     it->top_nz_[8] = it->left_nz_[8] =
       VP8RecordCoeffs(it->top_nz_[8] + it->left_nz_[8], &res);
-    VP8InitResidual(1, 0, enc, &res);
+    InitResidual(1, 0, it, &res);
   } else {
-    VP8InitResidual(0, 3, enc, &res);
+    InitResidual(0, 3, it, &res);
   }
 
   // luma-AC
@@ -383,7 +520,7 @@ static void RecordResiduals(VP8EncIterator* const it,
   }
 
   // U/V
-  VP8InitResidual(0, 2, enc, &res);
+  InitResidual(0, 2, it, &res);
   for (ch = 0; ch <= 2; ch += 2) {
     for (y = 0; y < 2; ++y) {
       for (x = 0; x < 2; ++x) {
@@ -407,18 +544,17 @@ static int RecordTokens(VP8EncIterator* const it, const VP8ModeScore* const rd,
                         VP8TBuffer* const tokens) {
   int x, y, ch;
   VP8Residual res;
-  VP8Encoder* const enc = it->enc_;
 
   VP8IteratorNzToBytes(it);
   if (it->mb_->type_ == 1) {   // i16x16
     const int ctx = it->top_nz_[8] + it->left_nz_[8];
-    VP8InitResidual(0, 1, enc, &res);
+    InitResidual(0, 1, it, &res);
     VP8SetResidualCoeffs(rd->y_dc_levels, &res);
     it->top_nz_[8] = it->left_nz_[8] =
         VP8RecordCoeffTokens(ctx, &res, tokens);
-    VP8InitResidual(1, 0, enc, &res);
+    InitResidual(1, 0, it, &res);
   } else {
-    VP8InitResidual(0, 3, enc, &res);
+    InitResidual(0, 3, it, &res);
   }
 
   // luma-AC
@@ -432,7 +568,7 @@ static int RecordTokens(VP8EncIterator* const it, const VP8ModeScore* const rd,
   }
 
   // U/V
-  VP8InitResidual(0, 2, enc, &res);
+  InitResidual(0, 2, it, &res);
   for (ch = 0; ch <= 2; ch += 2) {
     for (y = 0; y < 2; ++y) {
       for (x = 0; x < 2; ++x) {
@@ -470,27 +606,30 @@ static void ResetSSE(VP8Encoder* const enc) {
   enc->sse_count_ = 0;
 }
 
-static void StoreSSE(const VP8EncIterator* const it) {
-  VP8Encoder* const enc = it->enc_;
+static void StoreSSE(const VP8EncIterator* const it, uint64_t sse[3],
+                     uint64_t* const sse_count) {
   const uint8_t* const in = it->yuv_in_;
   const uint8_t* const out = it->yuv_out_;
   // Note: not totally accurate at boundary. And doesn't include in-loop filter.
-  enc->sse_[0] += VP8SSE16x16(in + Y_OFF_ENC, out + Y_OFF_ENC);
-  enc->sse_[1] += VP8SSE8x8(in + U_OFF_ENC, out + U_OFF_ENC);
-  enc->sse_[2] += VP8SSE8x8(in + V_OFF_ENC, out + V_OFF_ENC);
-  enc->sse_count_ += 16 * 16;
+  sse[0] += VP8SSE16x16(in + Y_OFF_ENC, out + Y_OFF_ENC);
+  sse[1] += VP8SSE8x8(in + U_OFF_ENC, out + U_OFF_ENC);
+  sse[2] += VP8SSE8x8(in + V_OFF_ENC, out + V_OFF_ENC);
+  *sse_count += 16 * 16;
 }
 
-static void StoreSideInfo(const VP8EncIterator* const it) {
+// Side statistics are accumulated in 'sse', 'sse_count' and 'block_count',
+// which are either the encoder's or the ones of a row job.
+static void StoreSideInfo(const VP8EncIterator* const it, uint64_t sse[3],
+                          uint64_t* const sse_count, int block_count[3]) {
   VP8Encoder* const enc = it->enc_;
   const VP8MBInfo* const mb = it->mb_;
   WebPPicture* const pic = enc->pic_;
 
   if (pic->stats != NULL) {
-    StoreSSE(it);
-    enc->block_count_[0] += (mb->type_ == 0);
-    enc->block_count_[1] += (mb->type_ == 1);
-    enc->block_count_[2] += (mb->skip_ != 0);
+    StoreSSE(it, sse, sse_count);
+    block_count[0] += (mb->type_ == 0);
+    block_count[1] += (mb->type_ == 1);
+    block_count[2] += (mb->skip_ != 0);
   }
 
   if (pic->extra_info != NULL) {
@@ -576,21 +715,330 @@ static uint64_t OneStatPass(VP8Encoder* const enc, VP8RDLevel rd_opt,
   return size_p0;
 }
 
-static int StatLoop(VP8Encoder* const enc) {
+//------------------------------------------------------------------------------
+// Parallel quality search (thread_level_ > 1)
+//
+// Instead of stepping through one q value per pass, several candidate values
+// are evaluated at once by OneStatPass(), each on a VP8EncProbe: a private
+// copy of the q-dependent encoder state. The candidates are spread around the
+// secant estimate of the target, so that the bracket [lo, hi] around it is
+// narrowed in fewer rounds. The state of the best probe is then adopted by
+// the encoder, as if its pass had been the last one.
+// The number of probes per round is fixed, so that the result does not
+// depend on the number of threads: these only share the probes of a round.
+
+#define NUM_PROBES 4
+#define MAX_NUM_POINTS (NUM_PROBES * 10)   // 10 = maximum config->pass
+
+typedef struct {
+  VP8Encoder enc_;        // copy of the encoder state, see InitProbe()
+  WebPPicture pic_;       // copy of the picture, without stats nor hooks
+  PassStats stats_;       // q and resulting value of the probe
+  VP8RDLevel rd_opt_;
+  int nb_mbs_;
+  uint64_t size_p0_;
+  uint8_t* mem_;          // memory for enc_'s mb_info_, preds_, nz_ and tops
+} VP8EncProbe;
+
+static void ProbeQuality(VP8EncProbe* const probe) {
+  probe->size_p0_ = OneStatPass(&probe->enc_, probe->rd_opt_, probe->nb_mbs_,
+                                0, &probe->stats_);
+}
+
+// Worker hook: runs the probes in [first, last).
+static int ProbeQualities(VP8EncProbe** first, VP8EncProbe** const last) {
+  for (; first < last; ++first) ProbeQuality(*first);
+  return 1;
+}
+
+static size_t ProbeInfoSize(const VP8Encoder* const enc) {
+  return enc->mb_w_ * enc->mb_h_ * sizeof(*enc->mb_info_);
+}
+
+static size_t ProbePredsSize(const VP8Encoder* const enc) {
+  return enc->preds_w_ * (4 * enc->mb_h_ + 1) * sizeof(*enc->preds_);
+}
+
+static int AllocateProbe(const VP8Encoder* const enc,
+                         VP8EncProbe* const probe) {
+  const size_t nz_size = (enc->mb_w_ + 1) * sizeof(*enc->nz_) + WEBP_ALIGN_CST;
+  const size_t top_size = 2 * enc->mb_w_ * 16 + WEBP_ALIGN_CST;
+  uint8_t* mem;
+  probe->mem_ = (uint8_t*)WebPSafeMalloc(
+      ProbeInfoSize(enc) + ProbePredsSize(enc) + nz_size + top_size, 1);
+  if (probe->mem_ == NULL) return 0;
+  mem = probe->mem_;
+  probe->enc_.mb_info_ = (VP8MBInfo*)mem;
+  mem += ProbeInfoSize(enc);
+  probe->enc_.preds_ = mem + 1 + enc->preds_w_;
+  mem += ProbePredsSize(enc);
+  probe->enc_.nz_ = 1 + (uint32_t*)WEBP_ALIGN(mem);
+  mem += nz_size;
+  probe->enc_.y_top_ = (uint8_t*)WEBP_ALIGN(mem);
+  probe->enc_.uv_top_ = probe->enc_.y_top_ + enc->mb_w_ * 16;
+  return 1;
+}
+
+// Makes the remapped_costs_ of a copied 'proba' point to its own level_cost_.
+// The tables themselves are up to date (or get refreshed) after the copy.
+static void RemapLevelCosts(VP8EncProba* const proba) {
+  proba->dirty_ = 1;
+  VP8CalculateLevelCosts(proba);
+}
+
+// Sets the probe up for a pass at quality 'q', from the current state of
+// 'enc' and the token probabilities 'proba'. This is not a plain struct copy,
+// since the alpha worker may be writing the other fields of 'enc' meanwhile.
+static void InitProbe(const VP8Encoder* const enc,
+                      const VP8EncProba* const proba,
+                      const PassStats* const s, VP8RDLevel rd_opt, int nb_mbs,
+                      float q, VP8EncProbe* const probe) {
+  VP8Encoder* const penc = &probe->enc_;
+  probe->pic_ = *enc->pic_;
+  probe->pic_.stats = NULL;
+  probe->pic_.extra_info = NULL;
+  probe->pic_.progress_hook = NULL;
+  penc->config_ = enc->config_;
+  penc->pic_ = &probe->pic_;
+  penc->filter_hdr_ = enc->filter_hdr_;
+  penc->segment_hdr_ = enc->segment_hdr_;
+  penc->profile_ = enc->profile_;
+  penc->mb_w_ = enc->mb_w_;
+  penc->mb_h_ = enc->mb_h_;
+  penc->preds_w_ = enc->preds_w_;
+  penc->num_parts_ = enc->num_parts_;
+  penc->percent_ = enc->percent_;
+  memcpy(penc->dqm_, enc->dqm_, sizeof(enc->dqm_));
+  penc->base_quant_ = enc->base_quant_;
+  penc->alpha_ = enc->alpha_;
+  penc->uv_alpha_ = enc->uv_alpha_;
+  penc->dq_y1_dc_ = enc->dq_y1_dc_;
+  penc->dq_y2_dc_ = enc->dq_y2_dc_;
+  penc->dq_y2_ac_ = enc->dq_y2_ac_;
+  penc->dq_uv_dc_ = enc->dq_uv_dc_;
+  penc->dq_uv_ac_ = enc->dq_uv_ac_;
+  penc->proba_ = *proba;
+  // The remapped_costs_ still point to the level_cost_ of 'proba'.
+  RemapLevelCosts(&penc->proba_);
+  penc->method_ = enc->method_;
+  penc->rd_opt_level_ = enc->rd_opt_level_;
+  penc->max_i4_header_bits_ = enc->max_i4_header_bits_;
+  penc->mb_header_limit_ = enc->mb_header_limit_;
+  penc->thread_level_ = 0;
+  penc->do_search_ = enc->do_search_;
+  penc->use_tokens_ = enc->use_tokens_;
+  penc->lf_stats_ = NULL;
+  // segments can be simplified by the pass, and preds_ has constant borders
+  memcpy(penc->mb_info_, enc->mb_info_, ProbeInfoSize(enc));
+  memcpy(penc->preds_ - 1 - penc->preds_w_, enc->preds_ - 1 - enc->preds_w_,
+         ProbePredsSize(enc));
+  penc->nz_[-1] = 0;
+  probe->stats_ = *s;
+  probe->stats_.q = q;
+  probe->rd_opt_ = rd_opt;
+  probe->nb_mbs_ = nb_mbs;
+}
+
+// Takes over the state left by the probe's pass.
+static void AdoptProbe(VP8Encoder* const enc, const VP8EncProbe* const probe) {
+  const VP8Encoder* const penc = &probe->enc_;
+  enc->filter_hdr_ = penc->filter_hdr_;
+  enc->segment_hdr_ = penc->segment_hdr_;
+  memcpy(enc->dqm_, penc->dqm_, sizeof(enc->dqm_));
+  enc->base_quant_ = penc->base_quant_;
+  enc->dq_y1_dc_ = penc->dq_y1_dc_;
+  enc->dq_y2_dc_ = penc->dq_y2_dc_;
+  enc->dq_y2_ac_ = penc->dq_y2_ac_;
+  enc->dq_uv_dc_ = penc->dq_uv_dc_;
+  enc->dq_uv_ac_ = penc->dq_uv_ac_;
+  enc->proba_ = penc->proba_;
+  RemapLevelCosts(&enc->proba_);   // the probe is about to be deleted
+  memcpy(enc->mb_info_, penc->mb_info_, ProbeInfoSize(enc));
+  SetSegmentProbas(enc);   // for pic->stats
+  ResetSSE(enc);
+}
+
+// Returns the estimated quality reaching the target, from the 'num' points
+// (q[], value[]) evaluated so far. The value is assumed to increase with q.
+// '*step' is set to the distance to the nearest evaluated point.
+static float EstimateQuality(const float q[], const double value[], int num,
+                             double target, float* const step) {
+  int lo = -1, hi = -1;  // best points below and above the target
+  int a, b;              // points used for the secant
+  int i;
+  float est;
+  for (i = 0; i < num; ++i) {
+    if (value[i] <= target) {
+      if (lo < 0 || q[i] > q[lo]) lo = i;
+    } else {
+      if (hi < 0 || q[i] < q[hi]) hi = i;
+    }
+  }
+  if (lo >= 0 && hi >= 0) {
+    a = lo;
+    b = hi;
+  } else {   // extrapolate from the two points closest to the target
+    a = (lo >= 0) ? lo : hi;
+    b = -1;
+    for (i = 0; i < num; ++i) {
+      if (i != a && (b < 0 || fabs(q[i] - q[a]) < fabs(q[b] - q[a]))) b = i;
+    }
+  }
+  if (b >= 0 && value[b] != value[a] && q[b] != q[a]) {
+    const double slope = (value[b] - value[a]) / (q[b] - q[a]);
+    est = (slope > 0.) ? (float)(q[a] + (target - value[a]) / slope)
+        : (lo >= 0 && hi >= 0) ? 0.5f * (q[a] + q[b])
+        : q[a] + ((value[a] > target) ? -30.f : 30.f);
+  } else {
+    est = q[a] + ((value[a] > target) ? -10.f : 10.f);
+  }
+  // Limit variable to avoid large swings, and stay within the bracket.
+  est = Clamp(est, q[a] - 30.f, q[a] + 30.f);
+  if (lo >= 0 && est < q[lo]) est = q[lo];
+  if (hi >= 0 && est > q[hi]) est = q[hi];
+  est = Clamp(est, 0.f, 100.f);
+  *step = 100.f;
+  for (i = 0; i < num; ++i) {
+    const float d = (float)fabs(est - q[i]);
+    if (d < *step) *step = d;
+  }
+  return est;
+}
+
+// Performs up to 'num_rounds' rounds of NUM_PROBES passes, shared by the
+// calling thread and 'num_workers - 1' workers.
+// Returns false in case of user abort.
+static int SearchQualityMT(VP8Encoder* const enc, VP8EncProbe* probes[],
+                           WebPWorker workers[], int num_workers,
+                           VP8RDLevel rd_opt, int nb_mbs, int num_rounds,
+                           int percent_per_round, PassStats* const s) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  VP8EncProbe* best = probes[NUM_PROBES];   // spare probe, for the best one
+  int has_best = 0;
+  float q[MAX_NUM_POINTS];
+  double value[MAX_NUM_POINTS];
+  int num_points = 0;
+  float center = s->q;
+  float spacing = s->dq;
+  int round;
+  int ok = 1;
+
+  for (round = 0; ok && round < num_rounds; ++round) {
+    int n = 0, i, j;
+    // Candidates: center, center + spacing, center - spacing, ...
+    for (i = 0; n < NUM_PROBES && i < 4 * NUM_PROBES; ++i) {
+      const int k = (i + 1) >> 1;
+      const float cand = center + ((i & 1) ? k : -k) * spacing;
+      int is_new = (cand >= 0.f && cand <= 100.f);
+      for (j = 0; is_new && j < num_points; ++j) {
+        is_new = (fabs(cand - q[j]) > DQ_LIMIT / 2);
+      }
+      for (j = 0; is_new && j < n; ++j) {
+        is_new = (fabs(cand - probes[j]->stats_.q) > DQ_LIMIT / 2);
+      }
+      // Later rounds start from the probabilities refined by the best pass,
+      // like the passes of the sequential search do.
+      if (is_new) {
+        InitProbe(enc, has_best ? &best->enc_.proba_ : &enc->proba_, s,
+                  rd_opt, nb_mbs, cand, probes[n++]);
+      }
+    }
+    if (n == 0) break;
+
+    for (i = 1; i < num_workers; ++i) {
+      workers[i].data1 = probes + i * n / num_workers;
+      workers[i].data2 = probes + (i + 1) * n / num_workers;
+      winterface->Launch(&workers[i]);
+    }
+    ProbeQualities(probes, probes + n / num_workers);
+    for (i = 1; i < num_workers; ++i) winterface->Sync(&workers[i]);
+
+    for (i = 0; i < n; ++i) {
+      VP8EncProbe* const probe = probes[i];
+      if (num_points < MAX_NUM_POINTS) {
+        q[num_points] = probe->stats_.q;
+        value[num_points] = probe->stats_.value;
+        ++num_points;
+      }
+      if (!has_best || fabs(probe->stats_.value - s->target) <
+                       fabs(best->stats_.value - s->target)) {
+        probes[i] = best;   // swap with the spare probe
+        best = probe;
+        has_best = 1;
+      }
+    }
+    ok = WebPReportProgress(enc->pic_, enc->percent_ + percent_per_round,
+                            &enc->percent_);
+    if (enc->max_i4_header_bits_ > 0 &&
+        best->size_p0_ > PARTITION0_SIZE_LIMIT) {
+      enc->max_i4_header_bits_ >>= 1;  // strengthen header bit limitation...
+      num_points = 0;                  // ...and start over
+      has_best = 0;
+      center = best->stats_.q;
+      --round;
+      continue;
+    }
+    center = EstimateQuality(q, value, num_points, s->target, &spacing);
+    if (spacing <= DQ_LIMIT) break;   // converged
+    spacing /= NUM_PROBES;
+    if (spacing < DQ_LIMIT) spacing = DQ_LIMIT;
+  }
+  probes[NUM_PROBES] = best;   // keep track of all the probes
+  if (!ok) return 0;
+  assert(has_best);
+  AdoptProbe(enc, best);
+  s->q = best->stats_.q;
+  s->value = best->stats_.value;
+  return 1;
+}
+
+static void DeleteProbes(VP8EncProbe* probes[], WebPWorker workers[],
+                         int num_workers) {
+  int i;
+  for (i = 0; i <= NUM_PROBES; ++i) {
+    if (i < num_workers) WebPGetWorkerInterface()->End(&workers[i]);
+    if (probes[i] != NULL) WebPSafeFree(probes[i]->mem_);
+    WebPSafeFree(probes[i]);
+  }
+}
+
+// Returns false if the probes can't be allocated.
+static int NewProbes(const VP8Encoder* const enc, VP8EncProbe* probes[],
+                     WebPWorker workers[], int num_workers) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  int i, ok = 1;
+  for (i = 0; i <= NUM_PROBES; ++i) {
+    if (i < num_workers) winterface->Init(&workers[i]);
+    probes[i] = (VP8EncProbe*)WebPSafeCalloc(1ULL, sizeof(*probes[i]));
+    ok = ok && (probes[i] != NULL) && AllocateProbe(enc, probes[i]);
+  }
+  for (i = 1; ok && i < num_workers; ++i) {
+    ok = winterface->Reset(&workers[i]);
+    workers[i].hook = (WebPWorkerHook)ProbeQualities;
+  }
+  if (!ok) DeleteProbes(probes, workers, num_workers);
+  return ok;
+}
+
+#undef MAX_NUM_POINTS
+
+// 'stats' must be initialized with InitPassStats(). With the rate control,
+// the statistics are collected at the quality 'stats->q'. 'task_percent' is
+// the progress to report.
+static int StatLoop(VP8Encoder* const enc, PassStats* const stats,
+                    int task_percent) {
   const int method = enc->method_;
-  const int do_search = enc->do_search_;
+  // The rate control predicts the quality: the stats alone are needed.
+  const int do_search = enc->do_search_ && (enc->rc_stats_ == NULL);
   const int fast_probe = ((method == 0 || method == 3) && !do_search);
   int num_pass_left = enc->config_->pass;
-  const int task_percent = 20;
   const int percent_per_pass =
       (task_percent + num_pass_left / 2) / num_pass_left;
   const int final_percent = enc->percent_ + task_percent;
   const VP8RDLevel rd_opt =
       (method >= 3 || do_search) ? RD_OPT_BASIC : RD_OPT_NONE;
   int nb_mbs = enc->mb_w_ * enc->mb_h_;
-  PassStats stats;
 
-  InitPassStats(enc, &stats);
   ResetTokenStats(enc);
 
   // Fast mode: quick analysis pass over few mbs. Better than nothing.
@@ -602,16 +1050,32 @@ static int StatLoop(VP8Encoder* const enc) {
     }
   }
 
+  if (do_search && enc->thread_level_ > 1 && num_pass_left > 1) {
+    const int num_workers = (enc->thread_level_ < NUM_PROBES) ?
+                            enc->thread_level_ : NUM_PROBES;
+    VP8EncProbe* probes[NUM_PROBES + 1];
+    WebPWorker workers[NUM_PROBES];
+    if (NewProbes(enc, probes, workers, num_workers)) {
+      const int ok = SearchQualityMT(enc, probes, workers, num_workers, rd_opt,
+                                     nb_mbs, num_pass_left, percent_per_pass,
+                                     stats);
+      DeleteProbes(probes, workers, num_workers);
+      if (!ok) return 0;
+      num_pass_left = 0;   // done: skip the sequential search below
+    }   // else, not enough memory: fall back to the sequential search
+  }
+
   while (num_pass_left-- > 0) {
-    const int is_last_pass = (fabs(stats.dq) <= DQ_LIMIT) ||
+    const int is_last_pass = (fabs(stats->dq) <= DQ_LIMIT) ||
                              (num_pass_left == 0) ||
                              (enc->max_i4_header_bits_ == 0);
     const uint64_t size_p0 =
-        OneStatPass(enc, rd_opt, nb_mbs, percent_per_pass, &stats);
+        OneStatPass(enc, rd_opt, nb_mbs, percent_per_pass, stats);
     if (size_p0 == 0) return 0;
 #if (DEBUG_SEARCH > 0)
     printf("#%d value:%.1lf -> %.1lf   q:%.2f -> %.2f\n",
-           num_pass_left, stats.last_value, stats.value, stats.last_q, stats.q);
+           num_pass_left, stats->last_value, stats->value,
+           stats->last_q, stats->q);
 #endif
     if (enc->max_i4_header_bits_ > 0 && size_p0 > PARTITION0_SIZE_LIMIT) {
       ++num_pass_left;
@@ -623,11 +1087,11 @@ static int StatLoop(VP8Encoder* const enc) {
     }
     // If no target size: just do several pass without changing 'q'
     if (do_search) {
-      ComputeNextQ(&stats);
-      if (fabs(stats.dq) <= DQ_LIMIT) break;
+      ComputeNextQ(stats);
+      if (fabs(stats->dq) <= DQ_LIMIT) break;
     }
   }
-  if (!do_search || !stats.do_size_search) {
+  if (!do_search || !stats->do_size_search) {
     // Need to finalize probas now, since it wasn't done during the search.
     FinalizeSkipProba(enc);
     FinalizeTokenProbas(&enc->proba_);
@@ -636,12 +1100,18 @@ static int StatLoop(VP8Encoder* const enc) {
   return WebPReportProgress(enc->pic_, final_percent, &enc->percent_);
 }
 
+#undef NUM_PROBES
+
 //------------------------------------------------------------------------------
 // Main loops
 //
 
 static const int kAverageBytesPerMB[8] = { 50, 24, 16, 9, 7, 5, 3, 2 };
 
+// In low_memory mode, the partitions are stored as a list of chunks of at most
+// this size, which are then released one by one while being written out.
+#define MAX_PARTITION_CHUNK_SIZE (1 << 16)
+
 static int PreLoopInitialize(VP8Encoder* const enc) {
   int p;
   int ok = 1;
@@ -650,7 +1120,17 @@ static int PreLoopInitialize(VP8Encoder* const enc) {
       enc->mb_w_ * enc->mb_h_ * average_bytes_per_MB / enc->num_parts_;
   // Initialize the bit-writers
   for (p = 0; ok && p < enc->num_parts_; ++p) {
-    ok = VP8BitWriterInit(enc->parts_ + p, bytes_per_parts);
+    if (enc->config_->low_memory) {
+      size_t chunk_size = (size_t)bytes_per_parts;
+      if (chunk_size > MAX_PARTITION_CHUNK_SIZE) {
+        chunk_size = MAX_PARTITION_CHUNK_SIZE;
+      } else if (chunk_size < 1024) {
+        chunk_size = 1024;
+      }
+      ok = VP8BitWriterInitChunked(enc->parts_ + p, chunk_size);
+    } else {
+      ok = VP8BitWriterInit(enc->parts_ + p, bytes_per_parts);
+    }
   }
   if (!ok) {
     VP8EncFreeBitWriters(enc);  // malloc error occurred
@@ -698,35 +1178,461 @@ static void ResetAfterSkip(VP8EncIterator* const it) {
   }
 }
 
-int VP8EncLoop(VP8Encoder* const enc) {
-  VP8EncIterator it;
-  int ok = PreLoopInitialize(enc);
-  if (!ok) return 0;
+//------------------------------------------------------------------------------
+// Wavefront-parallel coding (thread_level_ > 1)
+//
+// Besides its left neighbour, the macroblock at (x, y) depends on the ones at
+// (x, y - 1) and (x + 1, y - 1), through the top samples, the non-zero context
+// and the intra4x4 modes. Rows of macroblocks are hence coded as a wavefront:
+// the rows are split into chunks of 'chunk_size_' macroblocks and, at each
+// step, a row codes its next chunk only if the row above is at least two
+// chunks ahead (or finished). Up to 'num_jobs_' consecutive rows are in
+// flight, the oldest one being coded in the calling thread.
+// Rows don't share any other state: each VP8EncRowJob has its own iterator,
+// left context and statistics. Token and filter statistics are merged when a
+// row is finished, in row order, so that the output doesn't depend on the
+// number of threads.
+
+#define WAVEFRONT_CHUNK_SIZE 8   // maximum chunk size, in macroblocks
+
+// Coding job for one row of macroblocks
+typedef struct {
+  VP8EncIterator it_;        // iterator, positioned on the next macroblock
+  StatsArray stats_[NUM_TYPES][NUM_BANDS];  // token statistics of the row
+  LFStats lf_stats_;         // filter statistics of the row
+  VP8TBuffer* tokens_;       // token buffer of the row (token loop only)
+  uint64_t size_p0_;         // header bits and distortion, for the pass
+  uint64_t distortion_;
+  uint64_t sse_[3];          // side statistics, for the pass
+  uint64_t sse_count_;
+  int block_count_[3];
+  int max_edge_[NUM_MB_SEGMENTS];  // see VP8SegmentInfo
+  int first_x_, last_x_;     // macroblocks to code: [first_x_, last_x_)
+  int num_done_;             // number of chunks of the row already coded
+} VP8EncRowJob;
+
+// Wavefront state, shared by all the jobs.
+typedef struct {
+  VP8Encoder* enc_;
+  VP8EncRowJob* jobs_;       // row y is coded by jobs_[y % num_jobs_]
+  WebPWorker* workers_;      // one per job
+  VP8TBuffer* tokens_;       // one token buffer per row (token loop only)
+  int num_jobs_;
+  int chunk_size_;           // in macroblocks
+  int num_chunks_;           // number of chunks per row
+  int use_tokens_;           // true: record tokens. false: code residuals.
+  int is_last_pass_;         // if true, store side info and filter stats
+  int percent0_;             // progress at the start of the pass
+} VP8EncWavefront;
+
+// Worker hook: codes the macroblocks [first_x_, last_x_) of the job's row.
+// Returns false in case of memory error.
+static int CodeRowChunk(const VP8EncWavefront* const wf,
+                        VP8EncRowJob* const job) {
+  VP8Encoder* const enc = wf->enc_;
+  VP8EncIterator* const it = &job->it_;
+  const VP8RDLevel rd_opt = enc->rd_opt_level_;
+  int x;
+  for (x = job->first_x_; x < job->last_x_; ++x) {
+    VP8ModeScore info;
+    assert(it->x_ == x);
+    VP8IteratorImport(it, NULL);
+    if (wf->use_tokens_) {
+#if !defined(DISABLE_TOKEN_BUFFER)
+      VP8Decimate(it, &info, rd_opt);
+      if (!RecordTokens(it, &info, job->tokens_)) return 0;
+      job->size_p0_ += info.H;
+      job->distortion_ += info.D;
+#endif
+    } else {
+      // Same as in VP8EncLoop(): VP8Decimate() must be called first.
+      if (!VP8Decimate(it, &info, rd_opt) || !enc->proba_.use_skip_proba_) {
+        CodeResiduals(it->bw_, it, &info);
+      } else {
+        ResetAfterSkip(it);
+      }
+    }
+    if (wf->is_last_pass_) {
+      StoreSideInfo(it, job->sse_, &job->sse_count_, job->block_count_);
+      VP8StoreFilterStats(it);
+      VP8IteratorExport(it);
+    }
+    VP8IteratorSaveBoundary(it);
+    VP8IteratorNext(it);
+  }
+  return 1;
+}
 
-  StatLoop(enc);  // stats-collection loop
+static void DeleteWavefront(VP8EncWavefront* const wf) {
+  int n, y;
+  if (wf->workers_ != NULL) {
+    for (n = 0; n < wf->num_jobs_; ++n) {
+      WebPGetWorkerInterface()->End(&wf->workers_[n]);
+    }
+  }
+  if (wf->tokens_ != NULL) {
+    for (y = 0; y < wf->enc_->mb_h_; ++y) VP8TBufferClear(&wf->tokens_[y]);
+  }
+  WebPSafeFree(wf->workers_);
+  WebPSafeFree(wf->jobs_);
+  WebPSafeFree(wf->tokens_);
+  memset(wf, 0, sizeof(*wf));
+}
 
-  VP8IteratorInit(enc, &it);
-  VP8InitFilter(&it);
+// Sets up at most 'max_jobs' row jobs, with their workers.
+static int InitWavefront(VP8Encoder* const enc, int max_jobs, int use_tokens,
+                         VP8EncWavefront* const wf) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const int mb_w = enc->mb_w_;
+  int num_jobs = enc->thread_level_;
+  int n;
+
+  if (num_jobs > max_jobs) num_jobs = max_jobs;
+  if (num_jobs > enc->mb_h_) num_jobs = enc->mb_h_;
+  memset(wf, 0, sizeof(*wf));
+  wf->enc_ = enc;
+  wf->num_jobs_ = num_jobs;
+  // Rows are two chunks apart: try and keep all the jobs busy.
+  wf->chunk_size_ = mb_w / (2 * num_jobs);
+  if (wf->chunk_size_ > WAVEFRONT_CHUNK_SIZE) {
+    wf->chunk_size_ = WAVEFRONT_CHUNK_SIZE;
+  } else if (wf->chunk_size_ < 1) {
+    wf->chunk_size_ = 1;
+  }
+  wf->num_chunks_ = (mb_w + wf->chunk_size_ - 1) / wf->chunk_size_;
+  wf->use_tokens_ = use_tokens;
+
+  wf->jobs_ = (VP8EncRowJob*)WebPSafeCalloc(num_jobs, sizeof(*wf->jobs_));
+  wf->workers_ = (WebPWorker*)WebPSafeCalloc(num_jobs, sizeof(*wf->workers_));
+  if (use_tokens) {
+    wf->tokens_ =
+        (VP8TBuffer*)WebPSafeMalloc(enc->mb_h_, sizeof(*wf->tokens_));
+  }
+  if (wf->jobs_ == NULL || wf->workers_ == NULL ||
+      (use_tokens && wf->tokens_ == NULL)) {
+    DeleteWavefront(wf);
+    return WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
+  }
+#if !defined(DISABLE_TOKEN_BUFFER)
+  if (use_tokens) {
+    // same page size modulation as for enc->tokens_, but for one row
+    const float scale = 1.f + enc->config_->quality * 5.f / 100.f;
+    int y;
+    for (y = 0; y < enc->mb_h_; ++y) {
+      VP8TBufferInit(&wf->tokens_[y], (int)(mb_w * 4 * scale));
+    }
+  }
+#endif
+  for (n = 0; n < num_jobs; ++n) winterface->Init(&wf->workers_[n]);
+  for (n = 0; n < num_jobs; ++n) {
+    WebPWorker* const worker = &wf->workers_[n];
+    if (!winterface->Reset(worker)) {
+      DeleteWavefront(wf);
+      return WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
+    }
+    worker->data1 = wf;
+    worker->data2 = &wf->jobs_[n];
+    worker->hook = (WebPWorkerHook)CodeRowChunk;
+  }
+  return 1;
+}
+
+// Must be called at the start of each pass, after VP8IteratorInit().
+static void ResetWavefront(VP8EncWavefront* const wf, int is_last_pass) {
+  VP8Encoder* const enc = wf->enc_;
+  int n;
+  wf->is_last_pass_ = is_last_pass;
+  wf->percent0_ = enc->percent_;
+  for (n = 0; n < wf->num_jobs_; ++n) {
+    VP8EncRowJob* const job = &wf->jobs_[n];
+    VP8IteratorInit(enc, &job->it_);
+    job->it_.stats_ = job->stats_;
+    job->it_.lf_stats_ = (enc->lf_stats_ != NULL) ? &job->lf_stats_ : NULL;
+    job->it_.max_edge_ = job->max_edge_;
+    VP8InitFilter(&job->it_);
+    memset(job->stats_, 0, sizeof(job->stats_));
+    job->size_p0_ = 0;
+    job->distortion_ = 0;
+    memset(job->sse_, 0, sizeof(job->sse_));
+    job->sse_count_ = 0;
+    memset(job->block_count_, 0, sizeof(job->block_count_));
+    memset(job->max_edge_, 0, sizeof(job->max_edge_));
+  }
+#if !defined(DISABLE_TOKEN_BUFFER)
+  if (wf->tokens_ != NULL) {
+    int y;
+    for (y = 0; y < enc->mb_h_; ++y) VP8TBufferClear(&wf->tokens_[y]);
+  }
+#endif
+}
+
+// Adds the statistics 'src' to 'dst', halving them before they overflow
+// (see VP8RecordStats()).
+static void MergeTokenStats(proba_t* const dst, const proba_t* const src,
+                            int size) {
+  int i;
+  for (i = 0; i < size; ++i) {
+    if (src[i] != 0) {
+      uint32_t nb = (dst[i] & 0xffffu) + (src[i] & 0xffffu);
+      uint32_t total = (dst[i] >> 16) + (src[i] >> 16);
+      while (total >= 0xfffeu) {
+        nb = (nb + 1) >> 1;
+        total = (total + 1) >> 1;
+      }
+      dst[i] = (total << 16) | nb;
+    }
+  }
+}
+
+static void FinishRow(const VP8EncWavefront* const wf,
+                      VP8EncRowJob* const job) {
+  VP8Encoder* const enc = wf->enc_;
+  if (wf->use_tokens_) {
+    MergeTokenStats(&enc->proba_.stats_[0][0][0][0], &job->stats_[0][0][0][0],
+                    sizeof(job->stats_) / sizeof(proba_t));
+    memset(job->stats_, 0, sizeof(job->stats_));
+  }
+  if (job->it_.lf_stats_ != NULL && wf->is_last_pass_) {
+    int s, i;
+    for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
+      for (i = 0; i < MAX_LF_LEVELS; ++i) {
+        (*enc->lf_stats_)[s][i] += job->lf_stats_[s][i];
+        job->lf_stats_[s][i] = 0.;
+      }
+    }
+  }
+}
+
+static void StartRow(const VP8EncWavefront* const wf, VP8EncRowJob* const job,
+                     int y) {
+  VP8IteratorSetRow(&job->it_, y);
+  job->tokens_ = (wf->tokens_ != NULL) ? &wf->tokens_[y] : NULL;
+  job->num_done_ = 0;
+}
+
+// Codes the rows [first_row, last_row). The rows above must be finished.
+static int CodeRowsMT(VP8EncWavefront* const wf, int first_row, int last_row) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  VP8Encoder* const enc = wf->enc_;
+  const int num_jobs = wf->num_jobs_;
+  const int num_chunks = wf->num_chunks_;
+  int next_row = first_row;   // next row to start
+  int ok = 1;
+
+  while (first_row < last_row) {
+    int y, n;
+    for (; next_row < last_row && next_row < first_row + num_jobs; ++next_row) {
+      StartRow(wf, &wf->jobs_[next_row % num_jobs], next_row);
+    }
+    // Bottom-up, so that the progress of the row above isn't updated yet.
+    for (y = next_row - 1; y >= first_row; --y) {
+      VP8EncRowJob* const job = &wf->jobs_[y % num_jobs];
+      const int chunk = job->num_done_;
+      const int num_done_above = (y == first_row) ? num_chunks
+                               : wf->jobs_[(y - 1) % num_jobs].num_done_;
+      if (chunk == num_chunks) continue;
+      if (num_done_above < chunk + 2 && num_done_above < num_chunks) continue;
+      job->first_x_ = chunk * wf->chunk_size_;
+      job->last_x_ = job->first_x_ + wf->chunk_size_;
+      if (job->last_x_ > enc->mb_w_) job->last_x_ = enc->mb_w_;
+      ++job->num_done_;
+      if (y > first_row) {
+        winterface->Launch(&wf->workers_[y % num_jobs]);
+      } else {
+        ok = CodeRowChunk(wf, job);
+      }
+    }
+    for (n = 0; n < num_jobs; ++n) {
+      if (n != first_row % num_jobs) ok &= winterface->Sync(&wf->workers_[n]);
+    }
+    if (!ok) {
+      return WebPEncodingSetError(enc->pic_, VP8_ENC_ERROR_OUT_OF_MEMORY);
+    }
+    // Rows are finished in order.
+    while (first_row < next_row &&
+           wf->jobs_[first_row % num_jobs].num_done_ == num_chunks) {
+      FinishRow(wf, &wf->jobs_[first_row % num_jobs]);
+      ++first_row;
+      if (wf->is_last_pass_ && enc->pic_->progress_hook != NULL) {
+        const int percent = wf->percent0_ + 20 * first_row / enc->mb_h_;
+        if (!WebPReportProgress(enc->pic_, percent, &enc->percent_)) return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// Collects the statistics of the jobs at the end of a pass: the side info
+// and max edge deltas are merged in the encoder, the bit counters in 'it'.
+static void FinishWavefrontPass(const VP8EncWavefront* const wf,
+                                VP8EncIterator* const it,
+                                uint64_t* const size_p0,
+                                uint64_t* const distortion) {
+  VP8Encoder* const enc = wf->enc_;
+  int n, i, s;
+  for (n = 0; n < wf->num_jobs_; ++n) {
+    const VP8EncRowJob* const job = &wf->jobs_[n];
+    *size_p0 += job->size_p0_;
+    *distortion += job->distortion_;
+    for (i = 0; i < 3; ++i) {
+      enc->sse_[i] += job->sse_[i];
+      enc->block_count_[i] += job->block_count_[i];
+      for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
+        it->bit_count_[s][i] += job->it_.bit_count_[s][i];
+      }
+    }
+    enc->sse_count_ += job->sse_count_;
+    for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
+      if (job->max_edge_[s] > enc->dqm_[s].max_edge_) {
+        enc->dqm_[s].max_edge_ = job->max_edge_[s];
+      }
+    }
+  }
+}
+
+#undef WAVEFRONT_CHUNK_SIZE
+
+// Returns the cost of the intra modes of the row 'y', which are only coded in
+// the first partition after the loop.
+static int RowModesCost(const VP8Encoder* const enc, int y) {
+  const int preds_w = enc->preds_w_;
+  const VP8MBInfo* const info = &enc->mb_info_[y * enc->mb_w_];
+  int cost = 0;
+  int x, i, j;
+  for (x = 0; x < enc->mb_w_; ++x) {
+    const uint8_t* preds = enc->preds_ + 4 * (y * preds_w + x);
+    cost += VP8FixedCostsUV[info[x].uv_mode_];
+    if (info[x].type_ == 1) {   // i16x16
+      cost += VP8FixedCostsI16[preds[0]];
+      continue;
+    }
+    for (j = 0; j < 4; ++j) {
+      for (i = 0; i < 4; ++i) {
+        cost += VP8FixedCostsI4[preds[i - preds_w]][preds[i - 1]][preds[i]];
+      }
+      preds += preds_w;
+    }
+  }
+  return cost;
+}
+
+// Returns the size of all the token partitions, in bits.
+static uint64_t PartitionsSize(const VP8Encoder* const enc) {
+  uint64_t size = 0;
+  int p;
+  for (p = 0; p < enc->num_parts_; ++p) {
+    size += VP8BitWriterPos(enc->parts_ + p);
+  }
+  return size;
+}
+
+// Returns the bits spent on the rows [0, num_rows).
+static double RowsBits(const VP8Encoder* const enc, int num_rows) {
+  uint64_t modes_cost = 0;
+  int y;
+  for (y = 0; y < num_rows; ++y) modes_cost += RowModesCost(enc, y);
+  return (double)PartitionsSize(enc) + modes_cost / 256.;
+}
+
+// Codes the frame in the partitions. With the rate control, the prediction
+// is checked after the rows [0, *check_rows), if any: if the quality is
+// predicted again, '*restart' is set and the coding stops there.
+static int CodeFrame(VP8Encoder* const enc, VP8EncIterator* const it,
+                     RateControl* const rc, PassStats* const stats,
+                     int* const check_rows, int* const restart) {
+  const int num_rows = *check_rows;
+  uint64_t last_size = 0;
+  int ok = 1;
+
+  *restart = 0;
+  VP8IteratorInit(enc, it);
+  VP8InitFilter(it);
+  if (enc->thread_level_ > 1 && enc->num_parts_ > 1) {
+    // Rows are coded directly in their partition: rows of different
+    // partitions can be coded in parallel. Since they share the quantization
+    // matrices, the rate can only be corrected when no row is in flight:
+    // once, after the rows checked.
+    VP8EncWavefront wf;
+    uint64_t size_p0 = 0, distortion = 0;   // unused
+    int y = 0;
+    ok = InitWavefront(enc, enc->num_parts_, 0, &wf);
+    if (!ok) return 0;
+    ResetWavefront(&wf, 1);
+    if (num_rows > 0) {
+      ok = CodeRowsMT(&wf, 0, num_rows);
+      if (ok) {
+        UpdateRateControlRows(enc, rc, num_rows, RowsBits(enc, num_rows));
+        *restart = CheckRatePrediction(enc, rc, stats, check_rows);
+      }
+      y = num_rows;
+    }
+    if (ok && !*restart) {
+      ok = CodeRowsMT(&wf, y, enc->mb_h_);
+      FinishWavefrontPass(&wf, it, &size_p0, &distortion);
+    }
+    DeleteWavefront(&wf);
+    return ok;
+  }
   do {
     VP8ModeScore info;
     const int dont_use_skip = !enc->proba_.use_skip_proba_;
     const VP8RDLevel rd_opt = enc->rd_opt_level_;
 
-    VP8IteratorImport(&it, NULL);
+    VP8IteratorImport(it, NULL);
     // Warning! order is important: first call VP8Decimate() and
     // *then* decide how to code the skip decision if there's one.
-    if (!VP8Decimate(&it, &info, rd_opt) || dont_use_skip) {
-      CodeResiduals(it.bw_, &it, &info);
+    if (!VP8Decimate(it, &info, rd_opt) || dont_use_skip) {
+      CodeResiduals(it->bw_, it, &info);
     } else {   // reset predictors after a skip
-      ResetAfterSkip(&it);
+      ResetAfterSkip(it);
     }
-    StoreSideInfo(&it);
-    VP8StoreFilterStats(&it);
-    VP8IteratorExport(&it);
-    ok = VP8IteratorProgress(&it, 20);
-    VP8IteratorSaveBoundary(&it);
-  } while (ok && VP8IteratorNext(&it));
+    StoreSideInfo(it, enc->sse_, &enc->sse_count_, enc->block_count_);
+    VP8StoreFilterStats(it);
+    VP8IteratorExport(it);
+    ok = VP8IteratorProgress(it, 20);
+    VP8IteratorSaveBoundary(it);
+    if (enc->rc_stats_ != NULL && it->x_ == enc->mb_w_ - 1) {
+      const uint64_t size = PartitionsSize(enc);
+      UpdateRateControl(enc, rc, it->y_, (double)(size - last_size) +
+                                         RowModesCost(enc, it->y_) / 256.);
+      last_size = size;
+      if (it->y_ + 1 == num_rows) {
+        *restart = CheckRatePrediction(enc, rc, stats, check_rows);
+        if (*restart) break;
+      }
+    }
+  } while (ok && VP8IteratorNext(it));
+  return ok;
+}
 
+int VP8EncLoop(VP8Encoder* const enc) {
+  VP8EncIterator it;
+  PassStats stats;
+  RateControl rc;
+  int check_rows = 0;
+  int restart;
+  int ok = PreLoopInitialize(enc);
+  if (!ok) return 0;
+
+  InitPassStats(enc, &stats);
+  StatLoop(enc, &stats, 20);  // stats-collection loop
+  if (enc->rc_stats_ != NULL) {
+    check_rows = GetCheckRows(enc);
+    InitRateControl(enc, &rc, 8. * (stats.target - HEADER_SIZE_ESTIMATE),
+                    check_rows);
+  }
+  ok = CodeFrame(enc, &it, &rc, &stats, &check_rows, &restart);
+  while (ok && restart) {
+    // Start over with the new quality, with statistics collected at it.
+    VP8EncFreeBitWriters(enc);
+    memset(enc->block_count_, 0, sizeof(enc->block_count_));
+    ok = PreLoopInitialize(enc);
+    if (!ok) break;
+    StatLoop(enc, &stats, 0);
+    InitRateControl(enc, &rc, 8. * (stats.target - HEADER_SIZE_ESTIMATE),
+                    check_rows);
+    ok = CodeFrame(enc, &it, &rc, &stats, &check_rows, &restart);
+  }
   return PostLoopFinalize(&it, ok);
 }
 
@@ -737,6 +1643,134 @@ int VP8EncLoop(VP8Encoder* const enc) {
 
 #define MIN_COUNT 96  // minimum number of macroblocks before updating stats
 
+// Returns the bits of the rows in the token buffers 'tokens[0, num_rows)',
+// with probabilities refreshed from the statistics collected so far.
+// 'size_p0' is the cost of their modes.
+static double TokensBits(VP8EncProba* const proba, VP8TBuffer* const tokens,
+                         int num_rows, uint64_t size_p0) {
+  uint64_t size = size_p0;
+  int y;
+  FinalizeTokenProbas(proba);
+  for (y = 0; y < num_rows; ++y) {
+    size += VP8EstimateTokenSize(&tokens[y], (const uint8_t*)proba->coeffs_);
+  }
+  return size / 256.;
+}
+
+// Same as the loop below, but the rows are coded as a wavefront, each in its
+// own token buffer. This also allows several partitions. Since the token
+// probabilities can only be refreshed when no row is in flight, this is done
+// every 'refresh_rows' rows.
+static int TokenLoopMT(VP8Encoder* const enc, int max_count) {
+  const int refresh_rows = (max_count + enc->mb_w_ - 1) / enc->mb_w_;
+  int num_pass_left = enc->config_->pass;
+  const int do_search = enc->do_search_;
+  VP8EncIterator it;
+  VP8EncProba* const proba = &enc->proba_;
+  const uint64_t pixel_count = enc->mb_w_ * enc->mb_h_ * 384;
+  VP8EncWavefront wf;
+  PassStats stats;
+  RateControl rc;
+  int check_rows = GetCheckRows(enc);   // cleared once checked
+  int ok;
+
+  InitPassStats(enc, &stats);
+  ok = PreLoopInitialize(enc);
+  if (!ok) return 0;
+  ok = InitWavefront(enc, enc->mb_h_, 1, &wf);
+  if (!ok) {
+    VP8EncFreeBitWriters(enc);
+    return 0;
+  }
+
+  while (ok && num_pass_left-- > 0) {
+    const int is_last_pass = (fabs(stats.dq) <= DQ_LIMIT) ||
+                             (num_pass_left == 0) ||
+                             (enc->max_i4_header_bits_ == 0);
+    uint64_t size_p0 = 0;
+    uint64_t distortion = 0;
+    int restart = 0;
+    int y, last_row;
+    VP8IteratorInit(enc, &it);
+    SetLoopParams(enc, stats.q);
+    if (is_last_pass) {
+      ResetTokenStats(enc);
+      VP8InitFilter(&it);  // don't collect stats until last pass (too costly)
+    }
+    if (enc->rc_stats_ != NULL) {
+      InitRateControl(enc, &rc, 8. * (stats.target - HEADER_SIZE_ESTIMATE),
+                      check_rows);
+    }
+    ResetWavefront(&wf, is_last_pass);
+    for (y = 0; ok && y < enc->mb_h_; y = last_row) {
+      last_row = (y + refresh_rows < enc->mb_h_) ? y + refresh_rows
+                                                 : enc->mb_h_;
+      if (y < check_rows && last_row > check_rows) last_row = check_rows;
+      if (y > 0) {
+        FinalizeTokenProbas(proba);
+        VP8CalculateLevelCosts(proba);  // refresh cost tables for rd-opt
+      }
+      ok = CodeRowsMT(&wf, y, last_row);
+      if (ok && last_row == check_rows) {
+        uint64_t modes_size = 0;
+        int n;
+        for (n = 0; n < wf.num_jobs_; ++n) modes_size += wf.jobs_[n].size_p0_;
+        UpdateRateControlRows(enc, &rc, check_rows,
+                              TokensBits(proba, wf.tokens_, check_rows,
+                                         modes_size));
+        restart = CheckRatePrediction(enc, &rc, &stats, &check_rows);
+        if (restart) break;
+      }
+    }
+    if (!ok) break;
+    if (restart) {   // start over, with the new quality
+      ++num_pass_left;
+      continue;
+    }
+    FinishWavefrontPass(&wf, &it, &size_p0, &distortion);
+
+    size_p0 += enc->segment_hdr_.size_;
+    if (stats.do_size_search) {
+      uint64_t size = FinalizeTokenProbas(&enc->proba_);
+      for (y = 0; y < enc->mb_h_; ++y) {
+        size += VP8EstimateTokenSize(&wf.tokens_[y],
+                                     (const uint8_t*)proba->coeffs_);
+      }
+      size = (size + size_p0 + 1024) >> 11;  // -> size in bytes
+      size += HEADER_SIZE_ESTIMATE;
+      stats.value = (double)size;
+    } else {  // compute and store PSNR
+      stats.value = GetPSNR(distortion, pixel_count);
+    }
+
+    if (enc->max_i4_header_bits_ > 0 && size_p0 > PARTITION0_SIZE_LIMIT) {
+      ++num_pass_left;
+      enc->max_i4_header_bits_ >>= 1;  // strengthen header bit limitation...
+      continue;                        // ...and start over
+    }
+    if (is_last_pass) {
+      break;   // done
+    }
+    if (do_search) {
+      ComputeNextQ(&stats);  // Adjust q
+    }
+  }
+  if (ok) {
+    int y;
+    if (!stats.do_size_search) {
+      FinalizeTokenProbas(&enc->proba_);
+    }
+    for (y = 0; ok && y < enc->mb_h_; ++y) {
+      ok = VP8EmitTokens(&wf.tokens_[y],
+                         enc->parts_ + (y & (enc->num_parts_ - 1)),
+                         (const uint8_t*)proba->coeffs_, 1);
+    }
+  }
+  DeleteWavefront(&wf);
+  ok = ok && WebPReportProgress(enc->pic_, enc->percent_ + 20, &enc->percent_);
+  return PostLoopFinalize(&it, ok);
+}
+
 int VP8EncTokenLoop(VP8Encoder* const enc) {
   // Roughly refresh the proba eight times per pass
   int max_count = (enc->mb_w_ * enc->mb_h_) >> 3;
@@ -747,14 +1781,17 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
   const VP8RDLevel rd_opt = enc->rd_opt_level_;
   const uint64_t pixel_count = enc->mb_w_ * enc->mb_h_ * 384;
   PassStats stats;
+  RateControl rc;
+  int check_rows = GetCheckRows(enc);   // cleared once checked
   int ok;
 
+  if (max_count < MIN_COUNT) max_count = MIN_COUNT;
+  if (enc->thread_level_ > 1) return TokenLoopMT(enc, max_count);
+
   InitPassStats(enc, &stats);
   ok = PreLoopInitialize(enc);
   if (!ok) return 0;
 
-  if (max_count < MIN_COUNT) max_count = MIN_COUNT;
-
   assert(enc->num_parts_ == 1);
   assert(enc->use_tokens_);
   assert(proba->use_skip_proba_ == 0);
@@ -767,6 +1804,8 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
                              (enc->max_i4_header_bits_ == 0);
     uint64_t size_p0 = 0;
     uint64_t distortion = 0;
+    uint64_t row_size = 0;
+    int restart = 0;
     int cnt = max_count;
     VP8IteratorInit(enc, &it);
     SetLoopParams(enc, stats.q);
@@ -774,6 +1813,11 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
       ResetTokenStats(enc);
       VP8InitFilter(&it);  // don't collect stats until last pass (too costly)
     }
+    if (enc->rc_stats_ != NULL) {
+      // Until the prediction is checked, the rows are coded without correction.
+      InitRateControl(enc, &rc, 8. * (stats.target - HEADER_SIZE_ESTIMATE),
+                      check_rows);
+    }
     VP8TBufferClear(&enc->tokens_);
     do {
       VP8ModeScore info;
@@ -792,14 +1836,36 @@ int VP8EncTokenLoop(VP8Encoder* const enc) {
       size_p0 += info.H;
       distortion += info.D;
       if (is_last_pass) {
-        StoreSideInfo(&it);
+        StoreSideInfo(&it, enc->sse_, &enc->sse_count_, enc->block_count_);
         VP8StoreFilterStats(&it);
         VP8IteratorExport(&it);
         ok = VP8IteratorProgress(&it, 20);
       }
       VP8IteratorSaveBoundary(&it);
+      if (enc->rc_stats_ != NULL) {
+        row_size += info.R + info.H;
+        if (it.x_ == enc->mb_w_ - 1 && it.y_ + 1 == check_rows) {
+          // The tokens are measured: the bits of the row are the rest.
+          const double bits =
+              TokensBits(proba, &enc->tokens_, 1, size_p0) - rc.spent;
+          UpdateRateControl(enc, &rc, it.y_, bits);
+          row_size = 0;
+          restart = CheckRatePrediction(enc, &rc, &stats, &check_rows);
+          if (restart) break;
+          VP8CalculateLevelCosts(proba);  // probas were refreshed
+          cnt = max_count;
+        } else if (it.x_ == enc->mb_w_ - 1) {
+          UpdateRateControl(enc, &rc, it.y_, row_size * RC_TOKEN_RATE / 256.);
+          row_size = 0;
+        }
+      }
     } while (ok && VP8IteratorNext(&it));
     if (!ok) break;
+    if (restart) {   // start over, with the new quality
+      memset(enc->block_count_, 0, sizeof(enc->block_count_));
+      ++num_pass_left;
+      continue;
+    }
 
     size_p0 += enc->segment_hdr_.size_;
     if (stats.do_size_search) {
@@ -19,6 +19,7 @@
 #include "./histogram_enc.h"
 #include "../dsp/lossless.h"
 #include "../dsp/lossless_common.h"
+#include "../utils/thread_utils.h"
 #include "../utils/utils.h"
 
 #define MAX_COST 1.e38
@@ -607,66 +608,275 @@ static uint32_t MyRand(uint32_t* const seed) {
 // -----------------------------------------------------------------------------
 // Histogram pairs priority queue
 
-// Pair of histograms. Negative idx1 value means that pair is out-of-date.
+// Pair of histograms. Negative idx1 value means that the slot is empty.
 typedef struct {
   int idx1;
   int idx2;
   double cost_diff;
   double cost_combo;
+  int stamp;    // number of merges done when the pair was evaluated
 } HistogramPair;
 
+// Priority queue of histogram pairs. The pairs are kept in slots, in the order
+// of a linear queue whose front is swapped with any cheaper pair: slot 0 holds
+// the front and new pairs are appended. A tournament tree over the slots gives
+// the first slot with the lowest cost_diff in O(log n), so that pairs with the
+// same cost are picked in the same order as with a linear scan. A pair becomes
+// out-of-date when one of its histograms is merged: such pairs are removed when
+// they are found, or all at once when no slot is left.
 typedef struct {
-  HistogramPair* queue;
-  int size;
-  int max_size;
+  HistogramPair* pairs;
+  int* tree;       // best slot below each node (or -1), leaves at 'num_slots'
+  int num_slots;   // a power of 2
+  int end;         // slots after 'end' have never been used
+  int size;        // number of pairs in the slots
 } HistoQueue;
 
 static int HistoQueueInit(HistoQueue* const histo_queue, const int max_index) {
+  // max_index*(max_index-1)/2 is the number of pairs pushed by the first two
+  // for loops of HistogramCombineGreedy, and the number of valid pairs can
+  // only be lower later on, so that a compaction always leaves a free slot.
+  const int max_size = (max_index > 1) ? max_index * (max_index - 1) / 2 : 1;
+  int i;
+  histo_queue->num_slots = 2;
+  while (histo_queue->num_slots <= max_size) histo_queue->num_slots <<= 1;
+  histo_queue->end = 1;
   histo_queue->size = 0;
-  // max_index^2 for the queue size is safe. If you look at
-  // HistogramCombineGreedy, and imagine that UpdateQueueFront always pushes
-  // data to the queue, you insert at most:
-  // - max_index*(max_index-1)/2 (the first two for loops)
-  // - max_index - 1 in the last for loop at the first iteration of the while
-  //   loop, max_index - 2 at the second iteration ... therefore
-  //   max_index*(max_index-1)/2 overall too
-  histo_queue->max_size = max_index * max_index;
-  // We allocate max_size + 1 because the last element at index "size" is
-  // used as temporary data (and it could be up to max_size).
-  histo_queue->queue = (HistogramPair*)WebPSafeMalloc(
-      histo_queue->max_size + 1, sizeof(*histo_queue->queue));
-  return histo_queue->queue != NULL;
+  histo_queue->pairs = (HistogramPair*)WebPSafeMalloc(
+      histo_queue->num_slots, sizeof(*histo_queue->pairs));
+  histo_queue->tree = (int*)WebPSafeMalloc(
+      2 * histo_queue->num_slots, sizeof(*histo_queue->tree));
+  if (histo_queue->pairs == NULL || histo_queue->tree == NULL) return 0;
+  for (i = 0; i < histo_queue->num_slots; ++i) histo_queue->pairs[i].idx1 = -1;
+  for (i = 0; i < 2 * histo_queue->num_slots; ++i) histo_queue->tree[i] = -1;
+  return 1;
 }
 
 static void HistoQueueClear(HistoQueue* const histo_queue) {
   assert(histo_queue != NULL);
-  WebPSafeFree(histo_queue->queue);
+  WebPSafeFree(histo_queue->pairs);
+  WebPSafeFree(histo_queue->tree);
 }
 
-static void SwapHistogramPairs(HistogramPair *p1,
-                               HistogramPair *p2) {
-  const HistogramPair tmp = *p1;
-  *p1 = *p2;
-  *p2 = tmp;
+// 'stamps' holds, for each histogram, the number of merges done when it was
+// last modified.
+static WEBP_INLINE int HistoPairIsValid(const HistogramPair* const p,
+                                        const int* const stamps) {
+  return (p->stamp >= stamps[p->idx1]) && (p->stamp >= stamps[p->idx2]);
 }
 
-// Given a valid priority queue in range [0, queue_size) this function checks
-// whether histo_queue[queue_size] should be accepted and swaps it with the
-// front if it is smaller. Otherwise, it leaves it as is.
-static void UpdateQueueFront(HistoQueue* const histo_queue) {
-  if (histo_queue->queue[histo_queue->size].cost_diff >= 0) return;
+// Returns the best of the slots 'a' and 'b' (a < b, or -1), 'a' on equality.
+static WEBP_INLINE int HistoQueueBest(const HistoQueue* const histo_queue,
+                                      int a, int b) {
+  if (a < 0) return b;
+  if (b < 0) return a;
+  return (histo_queue->pairs[b].cost_diff < histo_queue->pairs[a].cost_diff) ?
+         b : a;
+}
 
-  if (histo_queue->queue[histo_queue->size].cost_diff <
-      histo_queue->queue[0].cost_diff) {
-    SwapHistogramPairs(histo_queue->queue,
-                       histo_queue->queue + histo_queue->size);
+// Fills 'slot' with 'pair', or empties it if 'pair' is NULL.
+static void HistoQueueSet(HistoQueue* const histo_queue, int slot,
+                          const HistogramPair* const pair) {
+  HistogramPair* const dst = &histo_queue->pairs[slot];
+  int node = histo_queue->num_slots + slot;
+  histo_queue->size += (pair != NULL) - (dst->idx1 >= 0);
+  if (pair != NULL) {
+    *dst = *pair;
+  } else {
+    dst->idx1 = -1;
+  }
+  histo_queue->tree[node] = (pair != NULL) ? slot : -1;
+  for (node >>= 1; node > 0; node >>= 1) {
+    histo_queue->tree[node] = HistoQueueBest(histo_queue,
+        histo_queue->tree[2 * node], histo_queue->tree[2 * node + 1]);
   }
-  ++histo_queue->size;
+}
+
+// Returns the first slot in [1, last) with the lowest cost_diff, or -1.
+static int HistoQueueFirstBest(const HistoQueue* const histo_queue, int last) {
+  int lo = histo_queue->num_slots + 1;
+  int hi = histo_queue->num_slots + last;
+  int best = -1;
+  int right[32];   // nodes on the right side, visited last
+  int num_right = 0;
+  while (lo < hi) {
+    if (lo & 1) {
+      best = HistoQueueBest(histo_queue, best, histo_queue->tree[lo++]);
+    }
+    if (hi & 1) right[num_right++] = histo_queue->tree[--hi];
+    lo >>= 1;
+    hi >>= 1;
+  }
+  while (num_right > 0) {
+    best = HistoQueueBest(histo_queue, best, right[--num_right]);
+  }
+  return best;
+}
 
+// Moves the valid pairs to the first slots, in the same order.
+static void HistoQueueCompact(HistoQueue* const histo_queue,
+                              const int* const stamps) {
+  const int num_slots = histo_queue->num_slots;
+  int* const tree = histo_queue->tree;
+  int i, end = 0;
+  for (i = 0; i < histo_queue->end; ++i) {
+    const HistogramPair* const p = &histo_queue->pairs[i];
+    if (p->idx1 >= 0 && HistoPairIsValid(p, stamps)) {
+      histo_queue->pairs[end++] = *p;
+    }
+  }
+  histo_queue->size = end;
+  histo_queue->end = (end > 0) ? end : 1;
+  for (i = end; i < num_slots; ++i) histo_queue->pairs[i].idx1 = -1;
+  for (i = 0; i < num_slots; ++i) tree[num_slots + i] = (i < end) ? i : -1;
+  for (i = num_slots - 1; i > 0; --i) {
+    tree[i] = HistoQueueBest(histo_queue, tree[2 * i], tree[2 * i + 1]);
+  }
+}
+
+// Appends 'pair' to the queue, and makes it the front if it is cheaper.
+static void HistoQueuePush(HistoQueue* const histo_queue,
+                           const HistogramPair* const pair,
+                           const int* const stamps) {
+  int slot;
+  if (histo_queue->size == 0) {
+    HistoQueueSet(histo_queue, 0, pair);
+    return;
+  }
+  if (histo_queue->end == histo_queue->num_slots) {
+    HistoQueueCompact(histo_queue, stamps);
+  }
+  slot = histo_queue->end++;
   // We cannot add more elements than the capacity.
-  // The allocation adds an extra element to the official capacity so that
-  // histo_queue->queue[histo_queue->max_size] is read/written within bound.
-  assert(histo_queue->size <= histo_queue->max_size);
+  assert(slot < histo_queue->num_slots);
+  if (pair->cost_diff < histo_queue->pairs[0].cost_diff) {
+    HistoQueueSet(histo_queue, slot, &histo_queue->pairs[0]);
+    HistoQueueSet(histo_queue, 0, pair);
+  } else {
+    HistoQueueSet(histo_queue, slot, pair);
+  }
+}
+
+// Removes the front pair, and brings the first cheapest valid pair to slot 0.
+// As with a linear scan that keeps the cheapest pair so far at the front, each
+// pair that was the cheapest so far moves to the slot of the next cheaper one.
+// The out-of-date pairs found on the way are removed.
+static void HistoQueueUpdateFront(HistoQueue* const histo_queue,
+                                  const int* const stamps) {
+  int dst = 0;
+  int last = histo_queue->end;
+  HistoQueueSet(histo_queue, 0, NULL);
+  while (1) {
+    const int slot = HistoQueueFirstBest(histo_queue, last);
+    if (slot < 0) break;
+    if (!HistoPairIsValid(&histo_queue->pairs[slot], stamps)) {
+      HistoQueueSet(histo_queue, slot, NULL);
+      continue;
+    }
+    HistoQueueSet(histo_queue, dst, &histo_queue->pairs[slot]);
+    dst = last = slot;
+  }
+  if (dst != 0) HistoQueueSet(histo_queue, dst, NULL);
+}
+
+// -----------------------------------------------------------------------------
+// Multi-threaded evaluation of histogram pairs
+//
+// A batch of pairs (or of histograms to remap) is split into contiguous
+// ranges, one per job. The results are combined in order afterwards, so that
+// they don't depend on the number of jobs. The threads are started once for
+// the whole clustering.
+
+// Maximum number of jobs.
+#define MAX_HISTO_JOBS 16
+// Smaller batches are not worth the synchronization of the threads.
+#define MIN_HISTO_PAIRS_PER_JOB 16
+
+typedef struct {
+  WebPWorker worker_;
+  VP8LHistogram** histograms_;     // histograms referred to by the batch
+  HistogramPair* pairs_;           // batch of pairs
+  int first_, last_;               // range of the batch processed by the job
+  // Used by HistogramCombineStochastic():
+  VP8LHistogram* tmp_histo_;
+  VP8LHistogram* best_combo_;      // combination of the best pair
+  int best_;                       // best pair in pairs_[], or -1
+  double best_cost_diff_;
+  // Used by HistogramRemap():
+  VP8LHistogram** out_histo_;
+  int out_size_;
+  uint16_t* symbols_;
+} HistoJob;
+
+typedef struct {
+  HistoJob jobs_[MAX_HISTO_JOBS];
+  int num_jobs_;                   // number of jobs that can be launched
+  VP8LHistogramSet* scratch_;      // tmp_histo_ and best_combo_ of jobs 1+
+} HistoJobs;
+
+static void HistoJobsInit(HistoJobs* const jobs, int num_threads,
+                          int cache_bits) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  int n;
+  if (num_threads > MAX_HISTO_JOBS) num_threads = MAX_HISTO_JOBS;
+  jobs->scratch_ = NULL;
+  if (num_threads > 1) {
+    jobs->scratch_ =
+        VP8LAllocateHistogramSet(2 * (num_threads - 1), cache_bits);
+    // Without scratch histograms, all the work is done by the calling thread,
+    // with the same result.
+    if (jobs->scratch_ == NULL) num_threads = 1;
+  }
+  for (n = 0; n < num_threads; ++n) {
+    HistoJob* const job = &jobs->jobs_[n];
+    memset(job, 0, sizeof(*job));
+    worker_interface->Init(&job->worker_);
+    job->worker_.data1 = job;
+    if (n > 0) {
+      job->tmp_histo_ = jobs->scratch_->histograms[2 * n - 2];
+      job->best_combo_ = jobs->scratch_->histograms[2 * n - 1];
+      // The first job is run by the calling thread.
+      if (!worker_interface->Reset(&job->worker_)) break;
+    }
+  }
+  jobs->num_jobs_ = n;
+}
+
+static void HistoJobsEnd(HistoJobs* const jobs) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  int n;
+  for (n = 0; n < jobs->num_jobs_; ++n) {
+    worker_interface->End(&jobs->jobs_[n].worker_);
+  }
+  VP8LFreeHistogramSet(jobs->scratch_);
+}
+
+// Runs 'hook' on the 'num_items' elements of a batch. Returns the number of
+// jobs used, starting from the first one.
+static int RunHistoJobs(HistoJobs* const jobs, WebPWorkerHook hook,
+                        VP8LHistogram** const histograms,
+                        HistogramPair* const pairs, int num_items) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  int num_jobs = num_items / MIN_HISTO_PAIRS_PER_JOB;
+  int n;
+  if (num_jobs > jobs->num_jobs_) num_jobs = jobs->num_jobs_;
+  if (num_jobs < 1) num_jobs = 1;
+  for (n = 0; n < num_jobs; ++n) {
+    HistoJob* const job = &jobs->jobs_[n];
+    job->worker_.hook = hook;
+    job->histograms_ = histograms;
+    job->pairs_ = pairs;
+    job->first_ = (int)((int64_t)n * num_items / num_jobs);
+    job->last_ = (int)((int64_t)(n + 1) * num_items / num_jobs);
+  }
+  for (n = 1; n < num_jobs; ++n) {
+    worker_interface->Launch(&jobs->jobs_[n].worker_);
+  }
+  worker_interface->Execute(&jobs->jobs_[0].worker_);
+  for (n = 1; n < num_jobs; ++n) {
+    worker_interface->Sync(&jobs->jobs_[n].worker_);
+  }
+  return num_jobs;
 }
 
 // -----------------------------------------------------------------------------
@@ -692,74 +902,103 @@ static void PreparePair(VP8LHistogram** histograms, int idx1, int idx2,
   pair->cost_diff = pair->cost_combo - sum_cost;
 }
 
+static int PreparePairsHook(void* arg1, void* arg2) {
+  HistoJob* const job = (HistoJob*)arg1;
+  int i;
+  (void)arg2;
+  for (i = job->first_; i < job->last_; ++i) {
+    HistogramPair* const pair = &job->pairs_[i];
+    PreparePair(job->histograms_, pair->idx1, pair->idx2, pair);
+  }
+  return 1;
+}
+
+// Evaluates the 'num_pairs' pairs and pushes those that reduce the cost to the
+// queue, in order.
+static void PushPairs(HistoJobs* const jobs, VP8LHistogram** const histograms,
+                      HistogramPair* const pairs, int num_pairs,
+                      const int* const stamps, int num_merges,
+                      HistoQueue* const histo_queue) {
+  int i;
+  RunHistoJobs(jobs, PreparePairsHook, histograms, pairs, num_pairs);
+  for (i = 0; i < num_pairs; ++i) {
+    if (pairs[i].cost_diff < 0.) {
+      pairs[i].stamp = num_merges;
+      HistoQueuePush(histo_queue, &pairs[i], stamps);
+    }
+  }
+}
+
 // Combines histograms by continuously choosing the one with the highest cost
 // reduction.
-static int HistogramCombineGreedy(VP8LHistogramSet* const image_histo) {
+static int HistogramCombineGreedy(VP8LHistogramSet* const image_histo,
+                                  HistoJobs* const jobs) {
   int ok = 0;
   int image_histo_size = image_histo->size;
-  int i, j;
+  int i, j, num_pairs;
+  int num_merges = 0;
   VP8LHistogram** const histograms = image_histo->histograms;
   // Indexes of remaining histograms.
   int* const clusters =
       (int*)WebPSafeMalloc(image_histo_size, sizeof(*clusters));
+  // Number of merges done when each histogram was last modified.
+  int* const stamps = (int*)WebPSafeMalloc(image_histo_size, sizeof(*stamps));
   // Priority queue of histogram pairs.
   HistoQueue histo_queue;
+  // Pairs being evaluated, as many as in the first batch.
+  const int max_pairs = image_histo_size * (image_histo_size - 1) / 2;
+  HistogramPair* const pairs = (HistogramPair*)WebPSafeMalloc(
+      (max_pairs > 0) ? max_pairs : 1, sizeof(*pairs));
 
-  if (!HistoQueueInit(&histo_queue, image_histo_size) || clusters == NULL) {
+  if (!HistoQueueInit(&histo_queue, image_histo_size) ||
+      clusters == NULL || stamps == NULL || pairs == NULL) {
     goto End;
   }
 
+  num_pairs = 0;
   for (i = 0; i < image_histo_size; ++i) {
     // Initialize clusters indexes.
     clusters[i] = i;
+    stamps[i] = 0;
     for (j = i + 1; j < image_histo_size; ++j) {
-      // Initialize positions array.
-      PreparePair(histograms, i, j, &histo_queue.queue[histo_queue.size]);
-      UpdateQueueFront(&histo_queue);
+      pairs[num_pairs].idx1 = i;
+      pairs[num_pairs].idx2 = j;
+      ++num_pairs;
     }
   }
+  PushPairs(jobs, histograms, pairs, num_pairs, stamps, num_merges,
+            &histo_queue);
 
   while (image_histo_size > 1 && histo_queue.size > 0) {
-    HistogramPair* copy_to;
-    const int idx1 = histo_queue.queue[0].idx1;
-    const int idx2 = histo_queue.queue[0].idx2;
-    HistogramAdd(histograms[idx2], histograms[idx1], histograms[idx1]);
-    histograms[idx1]->bit_cost_ = histo_queue.queue[0].cost_combo;
+    const HistogramPair best = histo_queue.pairs[0];
+    HistogramAdd(histograms[best.idx2], histograms[best.idx1],
+                 histograms[best.idx1]);
+    histograms[best.idx1]->bit_cost_ = best.cost_combo;
     // Remove merged histogram.
     for (i = 0; i + 1 < image_histo_size; ++i) {
-      if (clusters[i] >= idx2) {
+      if (clusters[i] >= best.idx2) {
         clusters[i] = clusters[i + 1];
       }
     }
     --image_histo_size;
-
-    // Remove pairs intersecting the just combined best pair. This will
-    // therefore pop the head of the queue.
-    copy_to = histo_queue.queue;
-    for (i = 0; i < histo_queue.size; ++i) {
-      HistogramPair* const p = histo_queue.queue + i;
-      if (p->idx1 == idx1 || p->idx2 == idx1 ||
-          p->idx1 == idx2 || p->idx2 == idx2) {
-        // Do not copy the invalid pair.
-        continue;
-      }
-      if (p->cost_diff < histo_queue.queue[0].cost_diff) {
-        // Replace the top of the queue if we found better.
-        SwapHistogramPairs(histo_queue.queue, p);
-      }
-      SwapHistogramPairs(copy_to, p);
-      ++copy_to;
-    }
-    histo_queue.size = (int)(copy_to - histo_queue.queue);
+    // Invalidate the pairs intersecting the just combined best pair, and
+    // find the next front.
+    ++num_merges;
+    stamps[best.idx1] = num_merges;
+    stamps[best.idx2] = num_merges;
+    HistoQueueUpdateFront(&histo_queue, stamps);
 
     // Push new pairs formed with combined histogram to the queue.
+    num_pairs = 0;
     for (i = 0; i < image_histo_size; ++i) {
-      if (clusters[i] != idx1) {
-        PreparePair(histograms, idx1, clusters[i],
-                    &histo_queue.queue[histo_queue.size]);
-        UpdateQueueFront(&histo_queue);
+      if (clusters[i] != best.idx1) {
+        pairs[num_pairs].idx1 = best.idx1;
+        pairs[num_pairs].idx2 = clusters[i];
+        ++num_pairs;
       }
     }
+    PushPairs(jobs, histograms, pairs, num_pairs, stamps, num_merges,
+              &histo_queue);
   }
   // Move remaining histograms to the beginning of the array.
   for (i = 0; i < image_histo_size; ++i) {
@@ -773,14 +1012,40 @@ static int HistogramCombineGreedy(VP8LHistogramSet* const image_histo) {
 
  End:
   WebPSafeFree(clusters);
+  WebPSafeFree(stamps);
+  WebPSafeFree(pairs);
   HistoQueueClear(&histo_queue);
   return ok;
 }
 
-static void HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
-                                       VP8LHistogram* tmp_histo,
-                                       VP8LHistogram* best_combo,
-                                       int quality, int min_cluster_size) {
+// Keeps the first pair of the job's range with the lowest cost difference.
+static int CombineEvalHook(void* arg1, void* arg2) {
+  HistoJob* const job = (HistoJob*)arg1;
+  VP8LHistogram** const histograms = job->histograms_;
+  int i;
+  (void)arg2;
+  job->best_ = -1;
+  job->best_cost_diff_ = 0.;
+  for (i = job->first_; i < job->last_; ++i) {
+    const HistogramPair* const pair = &job->pairs_[i];
+    // Calculate cost reduction on combining.
+    const double curr_cost_diff =
+        HistogramAddEval(histograms[pair->idx1], histograms[pair->idx2],
+                         job->tmp_histo_, job->best_cost_diff_);
+    if (curr_cost_diff < job->best_cost_diff_) {  // found a better pair?
+      HistogramSwap(&job->best_combo_, &job->tmp_histo_);
+      job->best_cost_diff_ = curr_cost_diff;
+      job->best_ = i;
+    }
+  }
+  return 1;
+}
+
+static int HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
+                                      VP8LHistogram* tmp_histo,
+                                      VP8LHistogram* best_combo,
+                                      int quality, int min_cluster_size,
+                                      HistoJobs* const jobs) {
   int iter;
   uint32_t seed = 0;
   int tries_with_no_success = 0;
@@ -792,6 +1057,13 @@ static void HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
   int idx2_max = image_histo_size - 1;
   int do_brute_dorce = 0;
   VP8LHistogram** const histograms = image_histo->histograms;
+  // Pairs tried at each iteration, at most image_histo_size of them.
+  HistogramPair* const candidates = (HistogramPair*)WebPSafeMalloc(
+      image_histo_size, sizeof(*candidates));
+  if (candidates == NULL) return 0;
+
+  jobs->jobs_[0].tmp_histo_ = tmp_histo;
+  jobs->jobs_[0].best_combo_ = best_combo;
 
   // Collapse similar histograms in 'image_histo'.
   ++min_cluster_size;
@@ -799,8 +1071,9 @@ static void HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
        iter < outer_iters && image_histo_size >= min_cluster_size;
        ++iter) {
     double best_cost_diff = 0.;
-    int best_idx1 = -1, best_idx2 = 1;
-    int j;
+    int best_idx1 = -1, best_idx2 = 1, best_job = 0;
+    int j, n, num_jobs;
+    int num_candidates = 0;
     int num_tries =
         (num_pairs < image_histo_size) ? num_pairs : image_histo_size;
     // Use a brute force approach if:
@@ -815,7 +1088,6 @@ static void HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
 
     seed += iter;
     for (j = 0; j < num_tries; ++j) {
-      double curr_cost_diff;
       // Choose two histograms at random and try to combine them.
       uint32_t idx1, idx2;
       if (do_brute_dorce) {
@@ -832,21 +1104,34 @@ static void HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
           continue;
         }
       }
+      candidates[num_candidates].idx1 = (int)idx1;
+      candidates[num_candidates].idx2 = (int)idx2;
+      ++num_candidates;
+    }
 
-      // Calculate cost reduction on combining.
-      curr_cost_diff = HistogramAddEval(histograms[idx1], histograms[idx2],
-                                        tmp_histo, best_cost_diff);
-      if (curr_cost_diff < best_cost_diff) {  // found a better pair?
-        HistogramSwap(&best_combo, &tmp_histo);
-        best_cost_diff = curr_cost_diff;
-        best_idx1 = idx1;
-        best_idx2 = idx2;
+    // Same choice as trying the candidates one after the other: the first
+    // pair with the lowest cost difference.
+    num_jobs = RunHistoJobs(jobs, CombineEvalHook, histograms,
+                            candidates, num_candidates);
+    for (n = 0; n < num_jobs; ++n) {
+      const HistoJob* const job = &jobs->jobs_[n];
+      if (job->best_ >= 0 && job->best_cost_diff_ < best_cost_diff) {
+        best_cost_diff = job->best_cost_diff_;
+        best_idx1 = candidates[job->best_].idx1;
+        best_idx2 = candidates[job->best_].idx2;
+        best_job = n;
       }
     }
     if (do_brute_dorce) --idx2_max;
 
     if (best_idx1 >= 0) {
-      HistogramSwap(&best_combo, &histograms[best_idx1]);
+      if (best_job == 0) {
+        HistogramSwap(&jobs->jobs_[0].best_combo_, &histograms[best_idx1]);
+      } else {
+        // The histograms of the other jobs must stay in 'jobs->scratch_'.
+        HistogramCopy(jobs->jobs_[best_job].best_combo_,
+                      histograms[best_idx1]);
+      }
       // swap best_idx2 slot with last one (which is now unused)
       --image_histo_size;
       if (idx2_max >= image_histo_size) idx2_max = image_histo_size - 1;
@@ -861,36 +1146,54 @@ static void HistogramCombineStochastic(VP8LHistogramSet* const image_histo,
     }
   }
   image_histo->size = image_histo_size;
+  WebPSafeFree(candidates);
+  return 1;
 }
 
 // -----------------------------------------------------------------------------
 // Histogram refinement
 
+// Stores the best 'out' histogram of each 'in' histogram of the job's range.
+static int RemapHook(void* arg1, void* arg2) {
+  HistoJob* const job = (HistoJob*)arg1;
+  VP8LHistogram** const in_histo = job->histograms_;
+  VP8LHistogram** const out_histo = job->out_histo_;
+  int i;
+  (void)arg2;
+  for (i = job->first_; i < job->last_; ++i) {
+    int best_out = 0;
+    double best_bits = MAX_COST;
+    int k;
+    for (k = 0; k < job->out_size_; ++k) {
+      const double cur_bits =
+          HistogramAddThresh(out_histo[k], in_histo[i], best_bits);
+      if (k == 0 || cur_bits < best_bits) {
+        best_bits = cur_bits;
+        best_out = k;
+      }
+    }
+    job->symbols_[i] = best_out;
+  }
+  return 1;
+}
+
 // Find the best 'out' histogram for each of the 'in' histograms.
 // Note: we assume that out[]->bit_cost_ is already up-to-date.
 static void HistogramRemap(const VP8LHistogramSet* const in,
                            const VP8LHistogramSet* const out,
-                           uint16_t* const symbols) {
+                           uint16_t* const symbols, HistoJobs* const jobs) {
   int i;
   VP8LHistogram** const in_histo = in->histograms;
   VP8LHistogram** const out_histo = out->histograms;
   const int in_size = in->size;
   const int out_size = out->size;
   if (out_size > 1) {
-    for (i = 0; i < in_size; ++i) {
-      int best_out = 0;
-      double best_bits = MAX_COST;
-      int k;
-      for (k = 0; k < out_size; ++k) {
-        const double cur_bits =
-            HistogramAddThresh(out_histo[k], in_histo[i], best_bits);
-        if (k == 0 || cur_bits < best_bits) {
-          best_bits = cur_bits;
-          best_out = k;
-        }
-      }
-      symbols[i] = best_out;
+    for (i = 0; i < jobs->num_jobs_; ++i) {
+      jobs->jobs_[i].out_histo_ = out_histo;
+      jobs->jobs_[i].out_size_ = out_size;
+      jobs->jobs_[i].symbols_ = symbols;
     }
+    RunHistoJobs(jobs, RemapHook, in_histo, NULL, in_size);
   } else {
     assert(out_size == 1);
     for (i = 0; i < in_size; ++i) {
@@ -926,7 +1229,8 @@ int VP8LGetHistoImageSymbols(int xsize, int ysize,
                              int histo_bits, int cache_bits,
                              VP8LHistogramSet* const image_histo,
                              VP8LHistogramSet* const tmp_histos,
-                             uint16_t* const histogram_symbols) {
+                             uint16_t* const histogram_symbols,
+                             int num_threads) {
   int ok = 0;
   const int histo_xsize = histo_bits ? VP8LSubSampleSize(xsize, histo_bits) : 1;
   const int histo_ysize = histo_bits ? VP8LSubSampleSize(ysize, histo_bits) : 1;
@@ -940,7 +1244,9 @@ int VP8LGetHistoImageSymbols(int xsize, int ysize,
   const int entropy_combine_num_bins = low_effort ? NUM_PARTITIONS : BIN_SIZE;
   const int entropy_combine =
       (orig_histo->size > entropy_combine_num_bins * 2) && (quality < 100);
+  HistoJobs jobs;
 
+  HistoJobsInit(&jobs, num_threads, cache_bits);
   if (orig_histo == NULL) goto Error;
 
   // Construct the histograms from backward references.
@@ -970,21 +1276,25 @@ int VP8LGetHistoImageSymbols(int xsize, int ysize,
     const float x = quality / 100.f;
     // cubic ramp between 1 and MAX_HISTO_GREEDY:
     const int threshold_size = (int)(1 + (x * x * x) * (MAX_HISTO_GREEDY - 1));
-    HistogramCombineStochastic(image_histo, tmp_histos->histograms[0],
-                               cur_combo, quality, threshold_size);
+    if (!HistogramCombineStochastic(image_histo, tmp_histos->histograms[0],
+                                    cur_combo, quality, threshold_size,
+                                    &jobs)) {
+      goto Error;
+    }
     if ((image_histo->size <= threshold_size) &&
-        !HistogramCombineGreedy(image_histo)) {
+        !HistogramCombineGreedy(image_histo, &jobs)) {
       goto Error;
     }
   }
 
   // TODO(vikasa): Optimize HistogramRemap for low-effort compression mode also.
   // Find the optimal map from original histograms to the final ones.
-  HistogramRemap(orig_histo, image_histo, histogram_symbols);
+  HistogramRemap(orig_histo, image_histo, histogram_symbols, &jobs);
 
   ok = 1;
 
  Error:
+  HistoJobsEnd(&jobs);
   VP8LFreeHistogramSet(orig_histo);
   return ok;
 }
@@ -97,14 +97,16 @@ static WEBP_INLINE int VP8LHistogramNumCodes(int palette_code_bits) {
       ((palette_code_bits > 0) ? (1 << palette_code_bits) : 0);
 }
 
-// Builds the histogram image.
+// Builds the histogram image. Pairs of histograms are evaluated on up to
+// 'num_threads' threads, with a result that doesn't depend on 'num_threads'.
 int VP8LGetHistoImageSymbols(int xsize, int ysize,
                              const VP8LBackwardRefs* const refs,
                              int quality, int low_effort,
                              int histogram_bits, int cache_bits,
                              VP8LHistogramSet* const image_in,
                              VP8LHistogramSet* const tmp_histos,
-                             uint16_t* const histogram_symbols);
+                             uint16_t* const histogram_symbols,
+                             int num_threads);
 
 // Returns the entropy for the symbols in the input array.
 // Also sets trivial_symbol to the code value, if the array has only one code
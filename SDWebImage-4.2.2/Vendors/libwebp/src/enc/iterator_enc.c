@@ -72,6 +72,8 @@ void VP8IteratorInit(VP8Encoder* const enc, VP8EncIterator* const it) {
   it->yuv_out2_ = it->yuv_out_ + YUV_SIZE_ENC;
   it->yuv_p_    = it->yuv_out2_ + YUV_SIZE_ENC;
   it->lf_stats_ = enc->lf_stats_;
+  it->stats_ = enc->proba_.stats_;
+  it->max_edge_ = NULL;
   it->percent0_ = enc->percent_;
   it->y_left_ = (uint8_t*)WEBP_ALIGN(it->yuv_left_mem_ + 1);
   it->u_left_ = it->y_left_ + 16 + 16;
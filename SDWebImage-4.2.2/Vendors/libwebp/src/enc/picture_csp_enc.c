@@ -17,6 +17,7 @@
 
 #include "./vp8i_enc.h"
 #include "../utils/random_utils.h"
+#include "../utils/thread_utils.h"
 #include "../utils/utils.h"
 #include "../dsp/yuv.h"
 
@@ -386,18 +387,22 @@ static WEBP_INLINE uint8_t ConvertRGBToV(int r, int g, int b) {
   return clip_8b(128 + (v >> (YUV_FIX + SFIX)));
 }
 
-static int ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
-                            WebPPicture* const picture) {
+// Converts the rows [y_start, y_end) of the picture ('y_start' is even).
+static void ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
+                             int y_start, int y_end,
+                             WebPPicture* const picture) {
   int i, j;
-  uint8_t* dst_y = picture->y;
-  uint8_t* dst_u = picture->u;
-  uint8_t* dst_v = picture->v;
-  const fixed_t* const best_uv_base = best_uv;
   const int w = (picture->width + 1) & ~1;
-  const int h = (picture->height + 1) & ~1;
   const int uv_w = w >> 1;
-  const int uv_h = h >> 1;
-  for (best_uv = best_uv_base, j = 0; j < picture->height; ++j) {
+  const int uv_start = y_start >> 1;
+  const int uv_end = (y_end + 1) >> 1;
+  const fixed_t* const best_uv_base = best_uv + uv_start * 3 * uv_w;
+  uint8_t* dst_y = picture->y + y_start * picture->y_stride;
+  uint8_t* dst_u = picture->u + uv_start * picture->uv_stride;
+  uint8_t* dst_v = picture->v + uv_start * picture->uv_stride;
+  if (y_end > picture->height) y_end = picture->height;
+  best_y += y_start * w;
+  for (best_uv = best_uv_base, j = y_start; j < y_end; ++j) {
     for (i = 0; i < picture->width; ++i) {
       const int off = (i >> 1);
       const int W = best_y[i];
@@ -410,7 +415,7 @@ static int ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
     best_uv += (j & 1) * 3 * uv_w;
     dst_y += picture->y_stride;
   }
-  for (best_uv = best_uv_base, j = 0; j < uv_h; ++j) {
+  for (best_uv = best_uv_base, j = uv_start; j < uv_end; ++j) {
     for (i = 0; i < uv_w; ++i) {
       const int off = i;
       const int r = best_uv[off + 0 * uv_w];
@@ -423,11 +428,201 @@ static int ConvertWRGBToYUV(const fixed_y_t* best_y, const fixed_t* best_uv,
     dst_u += picture->uv_stride;
     dst_v += picture->uv_stride;
   }
-  return 1;
 }
 
 //------------------------------------------------------------------------------
 // Main function
+//
+// With several threads, the picture is split into bands of
+// SHARP_YUV_BAND_HEIGHT rows, which are processed in parallel. In each
+// iteration, the rows of a band only see the state of their neighbouring
+// bands at the start of the iteration, saved as 'halo' rows. The band layout
+// doesn't depend on the number of threads, so neither does the result.
+
+#define SHARP_YUV_BAND_HEIGHT 64    // must be even
+#define MAX_SHARP_YUV_JOBS 16
+
+typedef enum {
+  SHARP_YUV_IMPORT = 0,   // import the RGB samples to W/RGB
+  SHARP_YUV_UPDATE,       // one iteration
+  SHARP_YUV_CONVERT       // final reconstruction
+} SharpYUVStage;
+
+typedef struct {
+  const uint8_t* r_ptr_;
+  const uint8_t* g_ptr_;
+  const uint8_t* b_ptr_;
+  int step_, rgb_stride_;
+  WebPPicture* picture_;
+  int w_, h_, uv_w_;               // dimensions, expanded to even values
+  fixed_y_t* best_y_;
+  fixed_y_t* target_y_;
+  fixed_t* best_uv_;
+  fixed_t* target_uv_;
+  fixed_t* halo_uv_;               // uv rows above/below each band
+  int band_height_, num_bands_;
+  int num_jobs_;
+  SharpYUVStage stage_;
+} SharpYUVParams;
+
+typedef struct {
+  WebPWorker worker_;
+  const SharpYUVParams* params_;
+  int first_band_;                 // bands processed: first, first + num_jobs..
+  fixed_y_t* tmp_buffer_;          // scratch
+  fixed_y_t* best_rgb_y_;
+  fixed_t* best_rgb_uv_;
+  uint64_t diff_y_sum_;            // result of the SHARP_YUV_UPDATE stage
+} SharpYUVJob;
+
+// Imports the rows [y_start, y_end) ('y_start' and 'y_end' are even).
+static void ImportRows(const SharpYUVParams* const p, SharpYUVJob* const job,
+                       int y_start, int y_end) {
+  const int w = p->w_;
+  const int uv_w = p->uv_w_;
+  const int rgb_stride = p->rgb_stride_;
+  const uint8_t* r_ptr = p->r_ptr_ + y_start * rgb_stride;
+  const uint8_t* g_ptr = p->g_ptr_ + y_start * rgb_stride;
+  const uint8_t* b_ptr = p->b_ptr_ + y_start * rgb_stride;
+  fixed_y_t* best_y = p->best_y_ + y_start * w;
+  fixed_y_t* target_y = p->target_y_ + y_start * w;
+  fixed_t* best_uv = p->best_uv_ + (y_start >> 1) * 3 * uv_w;
+  fixed_t* target_uv = p->target_uv_ + (y_start >> 1) * 3 * uv_w;
+  int j;
+  for (j = y_start; j < y_end; j += 2) {
+    const int is_last_row = (j == p->picture_->height - 1);
+    fixed_y_t* const src1 = job->tmp_buffer_ + 0 * w;
+    fixed_y_t* const src2 = job->tmp_buffer_ + 3 * w;
+
+    // prepare two rows of input
+    ImportOneRow(r_ptr, g_ptr, b_ptr, p->step_, p->picture_->width, src1);
+    if (!is_last_row) {
+      ImportOneRow(r_ptr + rgb_stride, g_ptr + rgb_stride, b_ptr + rgb_stride,
+                   p->step_, p->picture_->width, src2);
+    } else {
+      memcpy(src2, src1, 3 * w * sizeof(*src2));
+    }
+    StoreGray(src1, best_y + 0, w);
+    StoreGray(src2, best_y + w, w);
+
+    UpdateW(src1, target_y, w);
+    UpdateW(src2, target_y + w, w);
+    UpdateChroma(src1, src2, target_uv, uv_w);
+    memcpy(best_uv, target_uv, 3 * uv_w * sizeof(*best_uv));
+    best_y += 2 * w;
+    best_uv += 3 * uv_w;
+    target_y += 2 * w;
+    target_uv += 3 * uv_w;
+    r_ptr += 2 * rgb_stride;
+    g_ptr += 2 * rgb_stride;
+    b_ptr += 2 * rgb_stride;
+  }
+}
+
+// Iterates once over the rows [y_start, y_end). 'top_uv' and 'bottom_uv' are
+// the uv rows just above and below, or NULL at the edges of the picture.
+// Returns the sum of the differences between the target and the current Y.
+static uint64_t UpdateRows(const SharpYUVParams* const p,
+                           SharpYUVJob* const job, int y_start, int y_end,
+                           const fixed_t* const top_uv,
+                           const fixed_t* const bottom_uv) {
+  const int w = p->w_;
+  const int uv_w = p->uv_w_;
+  fixed_y_t* best_y = p->best_y_ + y_start * w;
+  fixed_y_t* target_y = p->target_y_ + y_start * w;
+  fixed_t* best_uv = p->best_uv_ + (y_start >> 1) * 3 * uv_w;
+  fixed_t* target_uv = p->target_uv_ + (y_start >> 1) * 3 * uv_w;
+  const fixed_t* cur_uv = best_uv;
+  const fixed_t* prev_uv = (top_uv != NULL) ? top_uv : cur_uv;
+  uint64_t diff_y_sum = 0;
+  int j;
+  for (j = y_start; j < y_end; j += 2) {
+    fixed_y_t* const src1 = job->tmp_buffer_ + 0 * w;
+    fixed_y_t* const src2 = job->tmp_buffer_ + 3 * w;
+    {
+      const fixed_t* const next_uv =
+          (j < y_end - 2) ? cur_uv + 3 * uv_w :
+          (bottom_uv != NULL) ? bottom_uv : cur_uv;
+      InterpolateTwoRows(best_y, prev_uv, cur_uv, next_uv, w, src1, src2);
+      prev_uv = cur_uv;
+      cur_uv = next_uv;
+    }
+
+    UpdateW(src1, job->best_rgb_y_ + 0 * w, w);
+    UpdateW(src2, job->best_rgb_y_ + 1 * w, w);
+    UpdateChroma(src1, src2, job->best_rgb_uv_, uv_w);
+
+    // update two rows of Y and one row of RGB
+    diff_y_sum +=
+        WebPSharpYUVUpdateY(target_y, job->best_rgb_y_, best_y, 2 * w);
+    WebPSharpYUVUpdateRGB(target_uv, job->best_rgb_uv_, best_uv, 3 * uv_w);
+
+    best_y += 2 * w;
+    best_uv += 3 * uv_w;
+    target_y += 2 * w;
+    target_uv += 3 * uv_w;
+  }
+  return diff_y_sum;
+}
+
+static int DoSharpYUVJob(SharpYUVJob* const job, void* unused) {
+  const SharpYUVParams* const p = job->params_;
+  const int row_size = 3 * p->uv_w_;
+  int band;
+  (void)unused;
+  job->diff_y_sum_ = 0;
+  for (band = job->first_band_; band < p->num_bands_; band += p->num_jobs_) {
+    const int y_start = band * p->band_height_;
+    const int y_end = (y_start + p->band_height_ < p->h_) ?
+                      y_start + p->band_height_ : p->h_;
+    if (p->stage_ == SHARP_YUV_IMPORT) {
+      ImportRows(p, job, y_start, y_end);
+    } else if (p->stage_ == SHARP_YUV_UPDATE) {
+      const fixed_t* const halo = p->halo_uv_ + 2 * band * row_size;
+      job->diff_y_sum_ +=
+          UpdateRows(p, job, y_start, y_end,
+                     (band > 0) ? halo : NULL,
+                     (band < p->num_bands_ - 1) ? halo + row_size : NULL);
+    } else {
+      ConvertWRGBToYUV(p->best_y_, p->best_uv_, y_start, y_end, p->picture_);
+    }
+  }
+  return 1;
+}
+
+// Runs the 'stage' over all the bands. Returns the sum of the jobs' results.
+static uint64_t RunSharpYUVStage(SharpYUVParams* const p,
+                                 SharpYUVJob* const jobs,
+                                 SharpYUVStage stage) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  uint64_t diff_y_sum = 0;
+  int n;
+  p->stage_ = stage;
+  if (stage == SHARP_YUV_UPDATE && p->num_bands_ > 1) {
+    // Save the rows the bands share with their neighbours.
+    const int row_size = 3 * p->uv_w_;
+    const size_t row_bytes = row_size * sizeof(*p->halo_uv_);
+    int band;
+    for (band = 0; band < p->num_bands_; ++band) {
+      const int uv_start = (band * p->band_height_) >> 1;
+      const int uv_end = uv_start + (p->band_height_ >> 1);
+      fixed_t* const halo = p->halo_uv_ + 2 * band * row_size;
+      if (band > 0) {
+        memcpy(halo, p->best_uv_ + (uv_start - 1) * row_size, row_bytes);
+      }
+      if (band < p->num_bands_ - 1) {
+        memcpy(halo + row_size, p->best_uv_ + uv_end * row_size, row_bytes);
+      }
+    }
+  }
+  for (n = 1; n < p->num_jobs_; ++n) winterface->Launch(&jobs[n].worker_);
+  winterface->Execute(&jobs[0].worker_);
+  for (n = 0; n < p->num_jobs_; ++n) {
+    winterface->Sync(&jobs[n].worker_);
+    diff_y_sum += jobs[n].diff_y_sum_;
+  }
+  return diff_y_sum;
+}
 
 #define SAFE_ALLOC(W, H, T) ((T*)WebPSafeMalloc((W) * (H), sizeof(T)))
 
@@ -435,106 +630,97 @@ static int PreprocessARGB(const uint8_t* r_ptr,
                           const uint8_t* g_ptr,
                           const uint8_t* b_ptr,
                           int step, int rgb_stride,
+                          int num_threads,
                           WebPPicture* const picture) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
   // we expand the right/bottom border if needed
   const int w = (picture->width + 1) & ~1;
   const int h = (picture->height + 1) & ~1;
   const int uv_w = w >> 1;
   const int uv_h = h >> 1;
   uint64_t prev_diff_y_sum = ~0;
-  int j, iter;
+  int n, iter, num_jobs;
+  SharpYUVParams params;
+  SharpYUVJob jobs[MAX_SHARP_YUV_JOBS];
 
   // TODO(skal): allocate one big memory chunk. But for now, it's easier
   // for valgrind debugging to have several chunks.
-  fixed_y_t* const tmp_buffer = SAFE_ALLOC(w * 3, 2, fixed_y_t);   // scratch
   fixed_y_t* const best_y_base = SAFE_ALLOC(w, h, fixed_y_t);
   fixed_y_t* const target_y_base = SAFE_ALLOC(w, h, fixed_y_t);
-  fixed_y_t* const best_rgb_y = SAFE_ALLOC(w, 2, fixed_y_t);
   fixed_t* const best_uv_base = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
   fixed_t* const target_uv_base = SAFE_ALLOC(uv_w * 3, uv_h, fixed_t);
-  fixed_t* const best_rgb_uv = SAFE_ALLOC(uv_w * 3, 1, fixed_t);
-  fixed_y_t* best_y = best_y_base;
-  fixed_y_t* target_y = target_y_base;
-  fixed_t* best_uv = best_uv_base;
-  fixed_t* target_uv = target_uv_base;
   const uint64_t diff_y_threshold = (uint64_t)(3.0 * w * h);
-  int ok;
-
-  if (best_y_base == NULL || best_uv_base == NULL ||
-      target_y_base == NULL || target_uv_base == NULL ||
-      best_rgb_y == NULL || best_rgb_uv == NULL ||
-      tmp_buffer == NULL) {
+  int ok = 1;
+
+  memset(&params, 0, sizeof(params));
+  memset(jobs, 0, sizeof(jobs));
+  params.r_ptr_ = r_ptr;
+  params.g_ptr_ = g_ptr;
+  params.b_ptr_ = b_ptr;
+  params.step_ = step;
+  params.rgb_stride_ = rgb_stride;
+  params.picture_ = picture;
+  params.w_ = w;
+  params.h_ = h;
+  params.uv_w_ = uv_w;
+  params.best_y_ = best_y_base;
+  params.target_y_ = target_y_base;
+  params.best_uv_ = best_uv_base;
+  params.target_uv_ = target_uv_base;
+  if (num_threads > MAX_SHARP_YUV_JOBS) num_threads = MAX_SHARP_YUV_JOBS;
+  if (num_threads > 1 && h > SHARP_YUV_BAND_HEIGHT) {
+    params.band_height_ = SHARP_YUV_BAND_HEIGHT;
+    params.num_bands_ = (h + SHARP_YUV_BAND_HEIGHT - 1) / SHARP_YUV_BAND_HEIGHT;
+    params.halo_uv_ = SAFE_ALLOC(uv_w * 3, 2 * params.num_bands_, fixed_t);
+    if (params.halo_uv_ == NULL) ok = 0;
+  } else {
+    params.band_height_ = h;
+    params.num_bands_ = 1;
+  }
+  num_jobs = (num_threads < params.num_bands_) ? num_threads
+                                                : params.num_bands_;
+  params.num_jobs_ = num_jobs;
+
+  for (n = 0; n < num_jobs; ++n) {
+    SharpYUVJob* const job = &jobs[n];
+    winterface->Init(&job->worker_);
+    job->worker_.hook = (WebPWorkerHook)DoSharpYUVJob;
+    job->worker_.data1 = job;
+    job->worker_.data2 = NULL;
+    job->params_ = &params;
+    job->first_band_ = n;
+    job->tmp_buffer_ = SAFE_ALLOC(w * 3, 2, fixed_y_t);   // scratch
+    job->best_rgb_y_ = SAFE_ALLOC(w, 2, fixed_y_t);
+    job->best_rgb_uv_ = SAFE_ALLOC(uv_w * 3, 1, fixed_t);
+    if (job->tmp_buffer_ == NULL || job->best_rgb_y_ == NULL ||
+        job->best_rgb_uv_ == NULL) {
+      ok = 0;
+    }
+  }
+  if (!ok || best_y_base == NULL || best_uv_base == NULL ||
+      target_y_base == NULL || target_uv_base == NULL) {
     ok = WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
     goto End;
   }
+  for (n = 1; n < num_jobs; ++n) {
+    // Without enough threads, the other jobs take over the remaining bands.
+    if (!winterface->Reset(&jobs[n].worker_)) {
+      params.num_jobs_ = n;
+      break;
+    }
+  }
   assert(picture->width >= kMinDimensionIterativeConversion);
   assert(picture->height >= kMinDimensionIterativeConversion);
 
   WebPInitConvertARGBToYUV();
 
   // Import RGB samples to W/RGB representation.
-  for (j = 0; j < picture->height; j += 2) {
-    const int is_last_row = (j == picture->height - 1);
-    fixed_y_t* const src1 = tmp_buffer + 0 * w;
-    fixed_y_t* const src2 = tmp_buffer + 3 * w;
-
-    // prepare two rows of input
-    ImportOneRow(r_ptr, g_ptr, b_ptr, step, picture->width, src1);
-    if (!is_last_row) {
-      ImportOneRow(r_ptr + rgb_stride, g_ptr + rgb_stride, b_ptr + rgb_stride,
-                   step, picture->width, src2);
-    } else {
-      memcpy(src2, src1, 3 * w * sizeof(*src2));
-    }
-    StoreGray(src1, best_y + 0, w);
-    StoreGray(src2, best_y + w, w);
-
-    UpdateW(src1, target_y, w);
-    UpdateW(src2, target_y + w, w);
-    UpdateChroma(src1, src2, target_uv, uv_w);
-    memcpy(best_uv, target_uv, 3 * uv_w * sizeof(*best_uv));
-    best_y += 2 * w;
-    best_uv += 3 * uv_w;
-    target_y += 2 * w;
-    target_uv += 3 * uv_w;
-    r_ptr += 2 * rgb_stride;
-    g_ptr += 2 * rgb_stride;
-    b_ptr += 2 * rgb_stride;
-  }
+  RunSharpYUVStage(&params, jobs, SHARP_YUV_IMPORT);
 
   // Iterate and resolve clipping conflicts.
   for (iter = 0; iter < kNumIterations; ++iter) {
-    const fixed_t* cur_uv = best_uv_base;
-    const fixed_t* prev_uv = best_uv_base;
-    uint64_t diff_y_sum = 0;
-
-    best_y = best_y_base;
-    best_uv = best_uv_base;
-    target_y = target_y_base;
-    target_uv = target_uv_base;
-    for (j = 0; j < h; j += 2) {
-      fixed_y_t* const src1 = tmp_buffer + 0 * w;
-      fixed_y_t* const src2 = tmp_buffer + 3 * w;
-      {
-        const fixed_t* const next_uv = cur_uv + ((j < h - 2) ? 3 * uv_w : 0);
-        InterpolateTwoRows(best_y, prev_uv, cur_uv, next_uv, w, src1, src2);
-        prev_uv = cur_uv;
-        cur_uv = next_uv;
-      }
-
-      UpdateW(src1, best_rgb_y + 0 * w, w);
-      UpdateW(src2, best_rgb_y + 1 * w, w);
-      UpdateChroma(src1, src2, best_rgb_uv, uv_w);
-
-      // update two rows of Y and one row of RGB
-      diff_y_sum += WebPSharpYUVUpdateY(target_y, best_rgb_y, best_y, 2 * w);
-      WebPSharpYUVUpdateRGB(target_uv, best_rgb_uv, best_uv, 3 * uv_w);
-
-      best_y += 2 * w;
-      best_uv += 3 * uv_w;
-      target_y += 2 * w;
-      target_uv += 3 * uv_w;
-    }
+    const uint64_t diff_y_sum =
+        RunSharpYUVStage(&params, jobs, SHARP_YUV_UPDATE);
     // test exit condition
     if (iter > 0) {
       if (diff_y_sum < diff_y_threshold) break;
@@ -543,19 +729,25 @@ static int PreprocessARGB(const uint8_t* r_ptr,
     prev_diff_y_sum = diff_y_sum;
   }
   // final reconstruction
-  ok = ConvertWRGBToYUV(best_y_base, best_uv_base, picture);
+  RunSharpYUVStage(&params, jobs, SHARP_YUV_CONVERT);
 
  End:
+  for (n = 0; n < num_jobs; ++n) {
+    winterface->End(&jobs[n].worker_);
+    WebPSafeFree(jobs[n].tmp_buffer_);
+    WebPSafeFree(jobs[n].best_rgb_y_);
+    WebPSafeFree(jobs[n].best_rgb_uv_);
+  }
+  WebPSafeFree(params.halo_uv_);
   WebPSafeFree(best_y_base);
   WebPSafeFree(best_uv_base);
   WebPSafeFree(target_y_base);
   WebPSafeFree(target_uv_base);
-  WebPSafeFree(best_rgb_y);
-  WebPSafeFree(best_rgb_uv);
-  WebPSafeFree(tmp_buffer);
   return ok;
 }
 #undef SAFE_ALLOC
+#undef MAX_SHARP_YUV_JOBS
+#undef SHARP_YUV_BAND_HEIGHT
 
 //------------------------------------------------------------------------------
 // "Fast" regular RGB->YUV
@@ -828,6 +1020,208 @@ static WEBP_INLINE void ConvertRowsToUV(const uint16_t* rgb,
   }
 }
 
+// Parameters of the regular conversion, shared by the jobs.
+typedef struct {
+  const uint8_t* r_ptr_;
+  const uint8_t* g_ptr_;
+  const uint8_t* b_ptr_;
+  const uint8_t* a_ptr_;
+  int step_;             // bytes per pixel
+  int rgb_stride_;       // bytes per scanline
+  int has_alpha_;
+  int use_dsp_;          // use the dsp functions for the Y rows
+  VP8Random* rg_;        // dithering, if not NULL
+  WebPPicture* picture_;
+} ImportParams;
+
+typedef struct {
+  WebPWorker worker_;
+  const ImportParams* params_;
+  int first_row_, last_row_;   // pairs of rows to convert
+  uint16_t* tmp_rgb_;    // accumulated R/G/B values during conversion to U/V
+} ImportJob;
+
+#define MAX_IMPORT_JOBS 16
+#define MIN_IMPORT_ROWS_PER_JOB 16   // in pairs of rows
+
+static void ImportRowY(const ImportParams* const p,
+                       const uint8_t* const r_ptr,
+                       const uint8_t* const g_ptr,
+                       const uint8_t* const b_ptr,
+                       uint8_t* const dst_y) {
+  const int width = p->picture_->width;
+  if (p->use_dsp_) {
+    const int is_rgb = (r_ptr < b_ptr);  // otherwise it's bgr
+    if (p->step_ == 3) {
+      if (is_rgb) {
+        WebPConvertRGB24ToY(r_ptr, dst_y, width);
+      } else {
+        WebPConvertBGR24ToY(b_ptr, dst_y, width);
+      }
+    } else {
+      if (is_rgb) {
+        WebPConvertRGBAToY(r_ptr, dst_y, width);
+      } else {
+        WebPConvertBGRAToY(b_ptr, dst_y, width);
+      }
+    }
+  } else {
+    ConvertRowToY(r_ptr, g_ptr, b_ptr, p->step_, dst_y, width, p->rg_);
+  }
+}
+
+// Downsamples the pairs of rows [first_row, last_row) of the Y/U/V planes.
+static void ImportRowPairs(const ImportParams* const p,
+                           uint16_t* const tmp_rgb,
+                           int first_row, int last_row) {
+  WebPPicture* const picture = p->picture_;
+  const int width = picture->width;
+  const int uv_width = (width + 1) >> 1;
+  const int rgb_stride = p->rgb_stride_;
+  const int has_alpha = p->has_alpha_;
+  const size_t offset = (size_t)2 * first_row * rgb_stride;
+  const uint8_t* r_ptr = p->r_ptr_ + offset;
+  const uint8_t* g_ptr = p->g_ptr_ + offset;
+  const uint8_t* b_ptr = p->b_ptr_ + offset;
+  const uint8_t* a_ptr = has_alpha ? p->a_ptr_ + offset : NULL;
+  uint8_t* dst_y = picture->y + 2 * first_row * picture->y_stride;
+  uint8_t* dst_u = picture->u + first_row * picture->uv_stride;
+  uint8_t* dst_v = picture->v + first_row * picture->uv_stride;
+  uint8_t* dst_a =
+      has_alpha ? picture->a + 2 * first_row * picture->a_stride : NULL;
+  int y;
+
+  for (y = first_row; y < last_row; ++y) {
+    int rows_have_alpha = has_alpha;
+    ImportRowY(p, r_ptr, g_ptr, b_ptr, dst_y);
+    ImportRowY(p, r_ptr + rgb_stride, g_ptr + rgb_stride, b_ptr + rgb_stride,
+               dst_y + picture->y_stride);
+    dst_y += 2 * picture->y_stride;
+    if (has_alpha) {
+      rows_have_alpha &= !WebPExtractAlpha(a_ptr, rgb_stride, width, 2,
+                                           dst_a, picture->a_stride);
+      dst_a += 2 * picture->a_stride;
+    }
+    // Collect averaged R/G/B(/A)
+    if (!rows_have_alpha) {
+      AccumulateRGB(r_ptr, g_ptr, b_ptr, p->step_, rgb_stride, tmp_rgb, width);
+    } else {
+      AccumulateRGBA(r_ptr, g_ptr, b_ptr, a_ptr, rgb_stride, tmp_rgb, width);
+    }
+    // Convert to U/V
+    if (p->rg_ == NULL) {
+      WebPConvertRGBA32ToUV(tmp_rgb, dst_u, dst_v, uv_width);
+    } else {
+      ConvertRowsToUV(tmp_rgb, dst_u, dst_v, uv_width, p->rg_);
+    }
+    dst_u += picture->uv_stride;
+    dst_v += picture->uv_stride;
+    r_ptr += 2 * rgb_stride;
+    b_ptr += 2 * rgb_stride;
+    g_ptr += 2 * rgb_stride;
+    if (has_alpha) a_ptr += 2 * rgb_stride;
+  }
+}
+
+// Converts the extra last row of odd-height pictures.
+static void ImportLastRow(const ImportParams* const p,
+                          uint16_t* const tmp_rgb) {
+  WebPPicture* const picture = p->picture_;
+  const int width = picture->width;
+  const int uv_width = (width + 1) >> 1;
+  const int y = picture->height - 1;
+  const size_t offset = (size_t)y * p->rgb_stride_;
+  const uint8_t* const r_ptr = p->r_ptr_ + offset;
+  const uint8_t* const g_ptr = p->g_ptr_ + offset;
+  const uint8_t* const b_ptr = p->b_ptr_ + offset;
+  const uint8_t* const a_ptr = p->has_alpha_ ? p->a_ptr_ + offset : NULL;
+  uint8_t* const dst_u = picture->u + (y >> 1) * picture->uv_stride;
+  uint8_t* const dst_v = picture->v + (y >> 1) * picture->uv_stride;
+  int row_has_alpha = p->has_alpha_;
+
+  ImportRowY(p, r_ptr, g_ptr, b_ptr, picture->y + y * picture->y_stride);
+  if (row_has_alpha) {
+    row_has_alpha &= !WebPExtractAlpha(a_ptr, 0, width, 1,
+                                       picture->a + y * picture->a_stride, 0);
+  }
+  // Collect averaged R/G/B(/A)
+  if (!row_has_alpha) {
+    // Collect averaged R/G/B
+    AccumulateRGB(r_ptr, g_ptr, b_ptr, p->step_, /* rgb_stride = */ 0,
+                  tmp_rgb, width);
+  } else {
+    AccumulateRGBA(r_ptr, g_ptr, b_ptr, a_ptr, /* rgb_stride = */ 0,
+                   tmp_rgb, width);
+  }
+  if (p->rg_ == NULL) {
+    WebPConvertRGBA32ToUV(tmp_rgb, dst_u, dst_v, uv_width);
+  } else {
+    ConvertRowsToUV(tmp_rgb, dst_u, dst_v, uv_width, p->rg_);
+  }
+}
+
+static int DoImportJob(ImportJob* const job, void* unused) {
+  (void)unused;
+  ImportRowPairs(job->params_, job->tmp_rgb_, job->first_row_, job->last_row_);
+  return 1;
+}
+
+// Regular conversion. Without dithering, the pairs of rows are split into
+// bands converted by up to 'num_threads' jobs. The result is the same as with
+// a single job.
+static int ImportRegular(const ImportParams* const params, int num_threads) {
+  const WebPWorkerInterface* const winterface = WebPGetWorkerInterface();
+  const WebPPicture* const picture = params->picture_;
+  const int uv_width = (picture->width + 1) >> 1;
+  const int num_rows = picture->height >> 1;
+  ImportJob jobs[MAX_IMPORT_JOBS];
+  int num_jobs = 1;
+  int n, ok = 1;
+
+  if (params->rg_ == NULL) {   // the dithering is sequential
+    num_jobs = num_rows / MIN_IMPORT_ROWS_PER_JOB;
+    if (num_jobs > num_threads) num_jobs = num_threads;
+    if (num_jobs > MAX_IMPORT_JOBS) num_jobs = MAX_IMPORT_JOBS;
+    if (num_jobs < 1) num_jobs = 1;
+  }
+  for (n = 0; n < num_jobs; ++n) {
+    ImportJob* const job = &jobs[n];
+    winterface->Init(&job->worker_);
+    job->worker_.hook = (WebPWorkerHook)DoImportJob;
+    job->worker_.data1 = job;
+    job->worker_.data2 = NULL;
+    job->params_ = params;
+    job->first_row_ = n * num_rows / num_jobs;
+    job->last_row_ = (n + 1) * num_rows / num_jobs;
+    job->tmp_rgb_ =
+        (uint16_t*)WebPSafeMalloc(4 * uv_width, sizeof(*job->tmp_rgb_));
+    if (job->tmp_rgb_ == NULL) ok = 0;  // malloc error
+  }
+  if (ok) {
+    for (n = 1; n < num_jobs; ++n) {
+      // Without a thread, the job is run by the calling thread.
+      if (winterface->Reset(&jobs[n].worker_)) {
+        winterface->Launch(&jobs[n].worker_);
+      } else {
+        winterface->Execute(&jobs[n].worker_);
+      }
+    }
+    winterface->Execute(&jobs[0].worker_);
+    for (n = 0; n < num_jobs; ++n) winterface->Sync(&jobs[n].worker_);
+    if (picture->height & 1) {    // extra last row
+      ImportLastRow(params, jobs[0].tmp_rgb_);
+    }
+  }
+  for (n = 0; n < num_jobs; ++n) {
+    winterface->End(&jobs[n].worker_);
+    WebPSafeFree(jobs[n].tmp_rgb_);
+  }
+  return ok;
+}
+
+#undef MIN_IMPORT_ROWS_PER_JOB
+#undef MAX_IMPORT_JOBS
+
 static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
                               const uint8_t* g_ptr,
                               const uint8_t* b_ptr,
@@ -836,8 +1230,8 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
                               int rgb_stride,   // bytes per scanline
                               float dithering,
                               int use_iterative_conversion,
+                              int num_threads,
                               WebPPicture* const picture) {
-  int y;
   const int width = picture->width;
   const int height = picture->height;
   const int has_alpha = CheckNonOpaque(a_ptr, width, height, step, rgb_stride);
@@ -865,7 +1259,8 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
 
   if (use_iterative_conversion) {
     InitGammaTablesF();
-    if (!PreprocessARGB(r_ptr, g_ptr, b_ptr, step, rgb_stride, picture)) {
+    if (!PreprocessARGB(r_ptr, g_ptr, b_ptr, step, rgb_stride, num_threads,
+                        picture)) {
       return 0;
     }
     if (has_alpha) {
@@ -873,103 +1268,29 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
                        picture->a, picture->a_stride);
     }
   } else {
-    const int uv_width = (width + 1) >> 1;
-    int use_dsp = (step == 3);  // use special function in this case
-    // temporary storage for accumulated R/G/B values during conversion to U/V
-    uint16_t* const tmp_rgb =
-        (uint16_t*)WebPSafeMalloc(4 * uv_width, sizeof(*tmp_rgb));
-    uint8_t* dst_y = picture->y;
-    uint8_t* dst_u = picture->u;
-    uint8_t* dst_v = picture->v;
-    uint8_t* dst_a = picture->a;
-
+    ImportParams params;
     VP8Random base_rg;
-    VP8Random* rg = NULL;
+    params.r_ptr_ = r_ptr;
+    params.g_ptr_ = g_ptr;
+    params.b_ptr_ = b_ptr;
+    params.a_ptr_ = a_ptr;
+    params.step_ = step;
+    params.rgb_stride_ = rgb_stride;
+    params.has_alpha_ = has_alpha;
+    // Use special functions for the packed RGB / RGBA(X) / BGRA(X) layouts.
+    params.use_dsp_ =
+        (step == 3) ||
+        (step == 4 && (a_ptr == NULL || a_ptr == (is_rgb ? r_ptr : b_ptr) + 3));
+    params.rg_ = NULL;
+    params.picture_ = picture;
     if (dithering > 0.) {
       VP8InitRandom(&base_rg, dithering);
-      rg = &base_rg;
-      use_dsp = 0;   // can't use dsp in this case
+      params.rg_ = &base_rg;
+      params.use_dsp_ = 0;   // can't use dsp in this case
     }
     WebPInitConvertARGBToYUV();
     InitGammaTables();
-
-    if (tmp_rgb == NULL) return 0;  // malloc error
-
-    // Downsample Y/U/V planes, two rows at a time
-    for (y = 0; y < (height >> 1); ++y) {
-      int rows_have_alpha = has_alpha;
-      if (use_dsp) {
-        if (is_rgb) {
-          WebPConvertRGB24ToY(r_ptr, dst_y, width);
-          WebPConvertRGB24ToY(r_ptr + rgb_stride,
-                              dst_y + picture->y_stride, width);
-        } else {
-          WebPConvertBGR24ToY(b_ptr, dst_y, width);
-          WebPConvertBGR24ToY(b_ptr + rgb_stride,
-                              dst_y + picture->y_stride, width);
-        }
-      } else {
-        ConvertRowToY(r_ptr, g_ptr, b_ptr, step, dst_y, width, rg);
-        ConvertRowToY(r_ptr + rgb_stride,
-                      g_ptr + rgb_stride,
-                      b_ptr + rgb_stride, step,
-                      dst_y + picture->y_stride, width, rg);
-      }
-      dst_y += 2 * picture->y_stride;
-      if (has_alpha) {
-        rows_have_alpha &= !WebPExtractAlpha(a_ptr, rgb_stride, width, 2,
-                                             dst_a, picture->a_stride);
-        dst_a += 2 * picture->a_stride;
-      }
-      // Collect averaged R/G/B(/A)
-      if (!rows_have_alpha) {
-        AccumulateRGB(r_ptr, g_ptr, b_ptr, step, rgb_stride, tmp_rgb, width);
-      } else {
-        AccumulateRGBA(r_ptr, g_ptr, b_ptr, a_ptr, rgb_stride, tmp_rgb, width);
-      }
-      // Convert to U/V
-      if (rg == NULL) {
-        WebPConvertRGBA32ToUV(tmp_rgb, dst_u, dst_v, uv_width);
-      } else {
-        ConvertRowsToUV(tmp_rgb, dst_u, dst_v, uv_width, rg);
-      }
-      dst_u += picture->uv_stride;
-      dst_v += picture->uv_stride;
-      r_ptr += 2 * rgb_stride;
-      b_ptr += 2 * rgb_stride;
-      g_ptr += 2 * rgb_stride;
-      if (has_alpha) a_ptr += 2 * rgb_stride;
-    }
-    if (height & 1) {    // extra last row
-      int row_has_alpha = has_alpha;
-      if (use_dsp) {
-        if (r_ptr < b_ptr) {
-          WebPConvertRGB24ToY(r_ptr, dst_y, width);
-        } else {
-          WebPConvertBGR24ToY(b_ptr, dst_y, width);
-        }
-      } else {
-        ConvertRowToY(r_ptr, g_ptr, b_ptr, step, dst_y, width, rg);
-      }
-      if (row_has_alpha) {
-        row_has_alpha &= !WebPExtractAlpha(a_ptr, 0, width, 1, dst_a, 0);
-      }
-      // Collect averaged R/G/B(/A)
-      if (!row_has_alpha) {
-        // Collect averaged R/G/B
-        AccumulateRGB(r_ptr, g_ptr, b_ptr, step, /* rgb_stride = */ 0,
-                      tmp_rgb, width);
-      } else {
-        AccumulateRGBA(r_ptr, g_ptr, b_ptr, a_ptr, /* rgb_stride = */ 0,
-                       tmp_rgb, width);
-      }
-      if (rg == NULL) {
-        WebPConvertRGBA32ToUV(tmp_rgb, dst_u, dst_v, uv_width);
-      } else {
-        ConvertRowsToUV(tmp_rgb, dst_u, dst_v, uv_width, rg);
-      }
-    }
-    WebPSafeFree(tmp_rgb);
+    if (!ImportRegular(&params, num_threads)) return 0;
   }
   return 1;
 }
@@ -983,7 +1304,8 @@ static int ImportYUVAFromRGBA(const uint8_t* r_ptr,
 // call for ARGB->YUVA conversion
 
 static int PictureARGBToYUVA(WebPPicture* picture, WebPEncCSP colorspace,
-                             float dithering, int use_iterative_conversion) {
+                             float dithering, int use_iterative_conversion,
+                             int num_threads) {
   if (picture == NULL) return 0;
   if (picture->argb == NULL) {
     return WebPEncodingSetError(picture, VP8_ENC_ERROR_NULL_PARAMETER);
@@ -998,22 +1320,30 @@ static int PictureARGBToYUVA(WebPPicture* picture, WebPEncCSP colorspace,
 
     picture->colorspace = WEBP_YUV420;
     return ImportYUVAFromRGBA(r, g, b, a, 4, 4 * picture->argb_stride,
-                              dithering, use_iterative_conversion, picture);
+                              dithering, use_iterative_conversion,
+                              num_threads, picture);
   }
 }
 
 int WebPPictureARGBToYUVADithered(WebPPicture* picture, WebPEncCSP colorspace,
                                   float dithering) {
-  return PictureARGBToYUVA(picture, colorspace, dithering, 0);
+  return PictureARGBToYUVA(picture, colorspace, dithering, 0, 1);
 }
 
 int WebPPictureARGBToYUVA(WebPPicture* picture, WebPEncCSP colorspace) {
-  return PictureARGBToYUVA(picture, colorspace, 0.f, 0);
+  return PictureARGBToYUVA(picture, colorspace, 0.f, 0, 1);
 }
 
 int WebPPictureSharpARGBToYUVA(WebPPicture* picture) {
-  return PictureARGBToYUVA(picture, WEBP_YUV420, 0.f, 1);
+  return PictureARGBToYUVA(picture, WEBP_YUV420, 0.f, 1, 1);
 }
+
+int WebPPictureARGBToYUVAMT(WebPPicture* const picture, float dithering,
+                            int use_sharp_yuv, int num_threads) {
+  return PictureARGBToYUVA(picture, WEBP_YUV420, dithering, use_sharp_yuv,
+                           num_threads);
+}
+
 // for backward compatibility
 int WebPPictureSmartARGBToYUVA(WebPPicture* picture) {
   return WebPPictureSharpARGBToYUVA(picture);
@@ -1086,7 +1416,7 @@ int WebPPictureYUVAToARGB(WebPPicture* picture) {
 
 static int Import(WebPPicture* const picture,
                   const uint8_t* const rgb, int rgb_stride,
-                  int step, int swap_rb, int import_alpha) {
+                  int step, int swap_rb, int import_alpha, int num_threads) {
   int y;
   const uint8_t* r_ptr = rgb + (swap_rb ? 2 : 0);
   const uint8_t* g_ptr = rgb + 1;
@@ -1097,7 +1427,8 @@ static int Import(WebPPicture* const picture,
 
   if (!picture->use_argb) {
     return ImportYUVAFromRGBA(r_ptr, g_ptr, b_ptr, a_ptr, step, rgb_stride,
-                              0.f /* no dithering */, 0, picture);
+                              0.f /* no dithering */, 0, num_threads,
+                              picture);
   }
   if (!WebPPictureAlloc(picture)) return 0;
 
@@ -1133,42 +1464,58 @@ static int Import(WebPPicture* const picture,
 int WebPPictureImportRGB(WebPPicture* picture,
                          const uint8_t* rgb, int rgb_stride) {
   return (picture != NULL && rgb != NULL)
-             ? Import(picture, rgb, rgb_stride, 3, 0, 0)
+             ? Import(picture, rgb, rgb_stride, 3, 0, 0, 1)
+             : 0;
+}
+
+int WebPPictureImportRGBMT(WebPPicture* picture,
+                           const uint8_t* rgb, int rgb_stride,
+                           int num_threads) {
+  return (picture != NULL && rgb != NULL)
+             ? Import(picture, rgb, rgb_stride, 3, 0, 0, num_threads)
              : 0;
 }
 
 int WebPPictureImportBGR(WebPPicture* picture,
                          const uint8_t* rgb, int rgb_stride) {
   return (picture != NULL && rgb != NULL)
-             ? Import(picture, rgb, rgb_stride, 3, 1, 0)
+             ? Import(picture, rgb, rgb_stride, 3, 1, 0, 1)
              : 0;
 }
 
 int WebPPictureImportRGBA(WebPPicture* picture,
                           const uint8_t* rgba, int rgba_stride) {
   return (picture != NULL && rgba != NULL)
-             ? Import(picture, rgba, rgba_stride, 4, 0, 1)
+             ? Import(picture, rgba, rgba_stride, 4, 0, 1, 1)
+             : 0;
+}
+
+int WebPPictureImportRGBAMT(WebPPicture* picture,
+                            const uint8_t* rgba, int rgba_stride,
+                            int num_threads) {
+  return (picture != NULL && rgba != NULL)
+             ? Import(picture, rgba, rgba_stride, 4, 0, 1, num_threads)
              : 0;
 }
 
 int WebPPictureImportBGRA(WebPPicture* picture,
                           const uint8_t* rgba, int rgba_stride) {
   return (picture != NULL && rgba != NULL)
-             ? Import(picture, rgba, rgba_stride, 4, 1, 1)
+             ? Import(picture, rgba, rgba_stride, 4, 1, 1, 1)
              : 0;
 }
 
 int WebPPictureImportRGBX(WebPPicture* picture,
                           const uint8_t* rgba, int rgba_stride) {
   return (picture != NULL && rgba != NULL)
-             ? Import(picture, rgba, rgba_stride, 4, 0, 0)
+             ? Import(picture, rgba, rgba_stride, 4, 0, 0, 1)
              : 0;
 }
 
 int WebPPictureImportBGRX(WebPPicture* picture,
                           const uint8_t* rgba, int rgba_stride) {
   return (picture != NULL && rgba != NULL)
-             ? Import(picture, rgba, rgba_stride, 4, 1, 0)
+             ? Import(picture, rgba, rgba_stride, 4, 1, 0, 1)
              : 0;
 }
 
@@ -16,10 +16,17 @@
 
 #include "../dsp/lossless.h"
 #include "../dsp/lossless_common.h"
+#include "../utils/thread_utils.h"
+#include "../utils/utils.h"
 #include "./vp8li_enc.h"
 
 #define MAX_DIFF_COST (1e30f)
 
+// With multi-threading, the tiles are searched by bands of this many pixel
+// rows. The bands do not depend on the number of threads.
+#define TRANSFORM_BAND_HEIGHT 256
+#define MAX_TRANSFORM_JOBS 16
+
 static const float kSpatialPredictorBias = 15.f;
 static const int kPredLowEffort = 11;
 static const uint32_t kMaskAlpha = 0xff000000;
@@ -276,13 +283,14 @@ static WEBP_INLINE void GetResidual(
 }
 
 // Returns best predictor and updates the accumulated histogram.
+// The above tile is only used as context if its row is at least 'first_tile_y'.
 // If max_quantization > 1, assumes that near lossless processing will be
 // applied, quantizing residuals to multiples of quantization levels up to
 // max_quantization (the actual quantization level depends on smoothness near
 // the given pixel).
 static int GetBestPredictorForTile(int width, int height,
-                                   int tile_x, int tile_y, int bits,
-                                   int accumulated[4][256],
+                                   int tile_x, int tile_y, int first_tile_y,
+                                   int bits, int accumulated[4][256],
                                    uint32_t* const argb_scratch,
                                    const uint32_t* const argb,
                                    int max_quantization,
@@ -305,7 +313,7 @@ static int GetBestPredictorForTile(int width, int height,
   // Prediction modes of the left and above neighbor tiles.
   const int left_mode = (tile_x > 0) ?
       (modes[tile_y * tiles_per_row + tile_x - 1] >> 8) & 0xff : 0xff;
-  const int above_mode = (tile_y > 0) ?
+  const int above_mode = (tile_y > first_tile_y) ?
       (modes[(tile_y - 1) * tiles_per_row + tile_x] >> 8) & 0xff : 0xff;
   // The width of upper_row and current_row is one pixel larger than image width
   // to allow the top right pixel to point to the leftmost pixel of the next row
@@ -446,6 +454,112 @@ static void CopyImageWithPrediction(int width, int height,
   }
 }
 
+// Search of the best predictors for a band of tile rows.
+typedef struct {
+  WebPWorker worker_;
+  int width_, height_, bits_;
+  int first_band_, last_band_;  // range of bands, in units of 'band_rows_'
+  int band_rows_;               // number of tile rows per band
+  const uint32_t* argb_;
+  uint32_t* argb_scratch_;
+  uint32_t* image_;
+  int max_quantization_;
+  int exact_;
+  int used_subtract_green_;
+} PredictorJob;
+
+// Each band starts with an empty accumulated histogram and ignores the modes
+// of the band above it, so that the bands can be searched concurrently.
+static int PredictorSearchHook(PredictorJob* const job, void* unused) {
+  const int tiles_per_row = VP8LSubSampleSize(job->width_, job->bits_);
+  const int tiles_per_col = VP8LSubSampleSize(job->height_, job->bits_);
+  int histo[4][256];
+  int band;
+  (void)unused;
+  for (band = job->first_band_; band < job->last_band_; ++band) {
+    const int first_tile_y = band * job->band_rows_;
+    const int last_tile_y =
+        GetMin(first_tile_y + job->band_rows_, tiles_per_col);
+    int tile_y;
+    memset(histo, 0, sizeof(histo));
+    for (tile_y = first_tile_y; tile_y < last_tile_y; ++tile_y) {
+      int tile_x;
+      for (tile_x = 0; tile_x < tiles_per_row; ++tile_x) {
+        const int pred = GetBestPredictorForTile(job->width_, job->height_,
+            tile_x, tile_y, first_tile_y, job->bits_, histo,
+            job->argb_scratch_, job->argb_, job->max_quantization_,
+            job->exact_, job->used_subtract_green_, job->image_);
+        job->image_[tile_y * tiles_per_row + tile_x] = ARGB_BLACK | (pred << 8);
+      }
+    }
+  }
+  return 1;
+}
+
+// Searches the best predictors by bands of tile rows on up to 'num_threads'
+// threads. The jobs other than the first one need their own scratch rows: if
+// these cannot be allocated, fewer jobs are used, with the same result.
+static void ResidualImageBands(int width, int height, int bits,
+                               const uint32_t* const argb,
+                               uint32_t* const argb_scratch,
+                               uint32_t* const image, int max_quantization,
+                               int exact, int used_subtract_green,
+                               int num_threads) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  const int tiles_per_col = VP8LSubSampleSize(height, bits);
+  const int band_rows = GetMax(TRANSFORM_BAND_HEIGHT >> bits, 1);
+  const int num_bands = (tiles_per_col + band_rows - 1) / band_rows;
+  // Same size as the scratch buffer given to VP8LResidualImage().
+  const uint64_t scratch_size =
+      (width + 1) * 2 + (width * 2 + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  PredictorJob jobs[MAX_TRANSFORM_JOBS];
+  int num_jobs = GetMin(GetMin(num_threads, num_bands), MAX_TRANSFORM_JOBS);
+  int n;
+
+  for (n = 1; n < num_jobs; ++n) {
+    jobs[n].argb_scratch_ =
+        (uint32_t*)WebPSafeMalloc(scratch_size, sizeof(*argb_scratch));
+    if (jobs[n].argb_scratch_ == NULL) {
+      num_jobs = n;
+      break;
+    }
+  }
+  jobs[0].argb_scratch_ = argb_scratch;
+  for (n = 0; n < num_jobs; ++n) {
+    PredictorJob* const job = &jobs[n];
+    worker_interface->Init(&job->worker_);
+    job->worker_.hook = (WebPWorkerHook)PredictorSearchHook;
+    job->worker_.data1 = job;
+    job->worker_.data2 = NULL;
+    job->width_ = width;
+    job->height_ = height;
+    job->bits_ = bits;
+    job->first_band_ = n * num_bands / num_jobs;
+    job->last_band_ = (n + 1) * num_bands / num_jobs;
+    job->band_rows_ = band_rows;
+    job->argb_ = argb;
+    job->image_ = image;
+    job->max_quantization_ = max_quantization;
+    job->exact_ = exact;
+    job->used_subtract_green_ = used_subtract_green;
+  }
+
+  // Without a thread, the job is run by the calling thread.
+  for (n = 1; n < num_jobs; ++n) {
+    if (worker_interface->Reset(&jobs[n].worker_)) {
+      worker_interface->Launch(&jobs[n].worker_);
+    } else {
+      worker_interface->Execute(&jobs[n].worker_);
+    }
+  }
+  worker_interface->Execute(&jobs[0].worker_);
+  for (n = 0; n < num_jobs; ++n) worker_interface->Sync(&jobs[n].worker_);
+  for (n = 0; n < num_jobs; ++n) {
+    worker_interface->End(&jobs[n].worker_);
+    if (n > 0) WebPSafeFree(jobs[n].argb_scratch_);
+  }
+}
+
 // Finds the best predictor for each tile, and converts the image to residuals
 // with respect to predictions. If near_lossless_quality < 100, applies
 // near lossless processing, shaving off more bits of residuals for lower
@@ -453,7 +567,7 @@ static void CopyImageWithPrediction(int width, int height,
 void VP8LResidualImage(int width, int height, int bits, int low_effort,
                        uint32_t* const argb, uint32_t* const argb_scratch,
                        uint32_t* const image, int near_lossless_quality,
-                       int exact, int used_subtract_green) {
+                       int exact, int used_subtract_green, int num_threads) {
   const int tiles_per_row = VP8LSubSampleSize(width, bits);
   const int tiles_per_col = VP8LSubSampleSize(height, bits);
   int tile_y;
@@ -464,13 +578,17 @@ void VP8LResidualImage(int width, int height, int bits, int low_effort,
     for (i = 0; i < tiles_per_row * tiles_per_col; ++i) {
       image[i] = ARGB_BLACK | (kPredLowEffort << 8);
     }
+  } else if (num_threads > 1) {
+    ResidualImageBands(width, height, bits, argb, argb_scratch, image,
+                       max_quantization, exact, used_subtract_green,
+                       num_threads);
   } else {
     memset(histo, 0, sizeof(histo));
     for (tile_y = 0; tile_y < tiles_per_col; ++tile_y) {
       int tile_x;
       for (tile_x = 0; tile_x < tiles_per_row; ++tile_x) {
         const int pred = GetBestPredictorForTile(width, height, tile_x, tile_y,
-            bits, histo, argb_scratch, argb, max_quantization, exact,
+            0, bits, histo, argb_scratch, argb, max_quantization, exact,
             used_subtract_green, image);
         image[tile_y * tiles_per_row + tile_x] = ARGB_BLACK | (pred << 8);
       }
@@ -692,18 +810,24 @@ static void CopyTileWithColorTransform(int xsize, int ysize,
   }
 }
 
-void VP8LColorSpaceTransform(int width, int height, int bits, int quality,
-                             uint32_t* const argb, uint32_t* image) {
+// Searches the color transforms of the tile rows [first_tile_y, last_tile_y[
+// and applies them. The band starts with empty accumulated histograms and
+// only reads the pixels and the transforms of its own rows.
+static void ColorSpaceTransformBand(int width, int height, int bits,
+                                    int quality, int first_tile_y,
+                                    int last_tile_y, uint32_t* const argb,
+                                    uint32_t* const image) {
   const int max_tile_size = 1 << bits;
   const int tile_xsize = VP8LSubSampleSize(width, bits);
-  const int tile_ysize = VP8LSubSampleSize(height, bits);
+  // Index of the first pixel of the band.
+  const int band_start = first_tile_y * max_tile_size * width;
   int accumulated_red_histo[256] = { 0 };
   int accumulated_blue_histo[256] = { 0 };
   int tile_x, tile_y;
   VP8LMultipliers prev_x, prev_y;
   MultipliersClear(&prev_y);
   MultipliersClear(&prev_x);
-  for (tile_y = 0; tile_y < tile_ysize; ++tile_y) {
+  for (tile_y = first_tile_y; tile_y < last_tile_y; ++tile_y) {
     for (tile_x = 0; tile_x < tile_xsize; ++tile_x) {
       int y;
       const int tile_x_offset = tile_x * max_tile_size;
@@ -711,7 +835,7 @@ void VP8LColorSpaceTransform(int width, int height, int bits, int quality,
       const int all_x_max = GetMin(tile_x_offset + max_tile_size, width);
       const int all_y_max = GetMin(tile_y_offset + max_tile_size, height);
       const int offset = tile_y * tile_xsize + tile_x;
-      if (tile_y != 0) {
+      if (tile_y != first_tile_y) {
         ColorCodeToMultipliers(image[offset - tile_xsize], &prev_y);
       }
       prev_x = GetBestColorTransformForTile(tile_x, tile_y, bits,
@@ -730,12 +854,12 @@ void VP8LColorSpaceTransform(int width, int height, int bits, int quality,
         const int ix_end = ix + all_x_max - tile_x_offset;
         for (; ix < ix_end; ++ix) {
           const uint32_t pix = argb[ix];
-          if (ix >= 2 &&
+          if (ix >= band_start + 2 &&
               pix == argb[ix - 2] &&
               pix == argb[ix - 1]) {
             continue;  // repeated pixels are handled by backward references
           }
-          if (ix >= width + 2 &&
+          if (ix >= band_start + width + 2 &&
               argb[ix - 2] == argb[ix - width - 2] &&
               argb[ix - 1] == argb[ix - width - 1] &&
               pix == argb[ix - width]) {
@@ -748,3 +872,75 @@ void VP8LColorSpaceTransform(int width, int height, int bits, int quality,
     }
   }
 }
+
+// Color transform search for a range of bands of tile rows.
+typedef struct {
+  WebPWorker worker_;
+  int width_, height_, bits_, quality_;
+  int first_band_, last_band_;  // range of bands, in units of 'band_rows_'
+  int band_rows_;               // number of tile rows per band
+  uint32_t* argb_;
+  uint32_t* image_;
+} ColorSpaceTransformJob;
+
+static int ColorSpaceTransformHook(ColorSpaceTransformJob* const job,
+                                   void* unused) {
+  const int tile_ysize = VP8LSubSampleSize(job->height_, job->bits_);
+  int band;
+  (void)unused;
+  for (band = job->first_band_; band < job->last_band_; ++band) {
+    const int first_tile_y = band * job->band_rows_;
+    const int last_tile_y =
+        GetMin(first_tile_y + job->band_rows_, tile_ysize);
+    ColorSpaceTransformBand(job->width_, job->height_, job->bits_,
+                            job->quality_, first_tile_y, last_tile_y,
+                            job->argb_, job->image_);
+  }
+  return 1;
+}
+
+void VP8LColorSpaceTransform(int width, int height, int bits, int quality,
+                             uint32_t* const argb, uint32_t* image,
+                             int num_threads) {
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  const int tile_ysize = VP8LSubSampleSize(height, bits);
+  const int band_rows = GetMax(TRANSFORM_BAND_HEIGHT >> bits, 1);
+  const int num_bands = (tile_ysize + band_rows - 1) / band_rows;
+  ColorSpaceTransformJob jobs[MAX_TRANSFORM_JOBS];
+  int num_jobs = GetMin(GetMin(num_threads, num_bands), MAX_TRANSFORM_JOBS);
+  int n;
+
+  if (num_threads <= 1) {
+    ColorSpaceTransformBand(width, height, bits, quality, 0, tile_ysize,
+                            argb, image);
+    return;
+  }
+  for (n = 0; n < num_jobs; ++n) {
+    ColorSpaceTransformJob* const job = &jobs[n];
+    worker_interface->Init(&job->worker_);
+    job->worker_.hook = (WebPWorkerHook)ColorSpaceTransformHook;
+    job->worker_.data1 = job;
+    job->worker_.data2 = NULL;
+    job->width_ = width;
+    job->height_ = height;
+    job->bits_ = bits;
+    job->quality_ = quality;
+    job->first_band_ = n * num_bands / num_jobs;
+    job->last_band_ = (n + 1) * num_bands / num_jobs;
+    job->band_rows_ = band_rows;
+    job->argb_ = argb;
+    job->image_ = image;
+  }
+
+  // Without a thread, the job is run by the calling thread.
+  for (n = 1; n < num_jobs; ++n) {
+    if (worker_interface->Reset(&jobs[n].worker_)) {
+      worker_interface->Launch(&jobs[n].worker_);
+    } else {
+      worker_interface->Execute(&jobs[n].worker_);
+    }
+  }
+  worker_interface->Execute(&jobs[0].worker_);
+  for (n = 0; n < num_jobs; ++n) worker_interface->Sync(&jobs[n].worker_);
+  for (n = 0; n < num_jobs; ++n) worker_interface->End(&jobs[n].worker_);
+}
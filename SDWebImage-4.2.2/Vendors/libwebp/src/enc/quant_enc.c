@@ -236,6 +236,17 @@ static int ExpandMatrix(VP8Matrix* const m, int type) {
 
 static void CheckLambdaValue(int* const v) { if (*v < 1) *v = 1; }
 
+// Sets the lambdas of the trellis quantization, scaled by 'scale' / 16.
+static void SetTrellisLambdas(VP8SegmentInfo* const m,
+                              int q_i4, int q_i16, int q_uv, int scale) {
+  m->lambda_trellis_i4_  = (((7 * q_i4 * q_i4) >> 3) * scale) >> 4;
+  m->lambda_trellis_i16_ = (((q_i16 * q_i16) >> 2) * scale) >> 4;
+  m->lambda_trellis_uv_  = (((q_uv * q_uv) << 1) * scale) >> 4;
+  CheckLambdaValue(&m->lambda_trellis_i4_);
+  CheckLambdaValue(&m->lambda_trellis_i16_);
+  CheckLambdaValue(&m->lambda_trellis_uv_);
+}
+
 static void SetupMatrices(VP8Encoder* enc) {
   int i;
   const int tlambda_scale =
@@ -263,19 +274,14 @@ static void SetupMatrices(VP8Encoder* enc) {
     m->lambda_i16_         = (3 * q_i16 * q_i16);
     m->lambda_uv_          = (3 * q_uv * q_uv) >> 6;
     m->lambda_mode_        = (1 * q_i4 * q_i4) >> 7;
-    m->lambda_trellis_i4_  = (7 * q_i4 * q_i4) >> 3;
-    m->lambda_trellis_i16_ = (q_i16 * q_i16) >> 2;
-    m->lambda_trellis_uv_  = (q_uv * q_uv) << 1;
     m->tlambda_            = (tlambda_scale * q_i4) >> 5;
+    SetTrellisLambdas(m, q_i4, q_i16, q_uv, 16);
 
     // none of these constants should be < 1
     CheckLambdaValue(&m->lambda_i4_);
     CheckLambdaValue(&m->lambda_i16_);
     CheckLambdaValue(&m->lambda_uv_);
     CheckLambdaValue(&m->lambda_mode_);
-    CheckLambdaValue(&m->lambda_trellis_i4_);
-    CheckLambdaValue(&m->lambda_trellis_i16_);
-    CheckLambdaValue(&m->lambda_trellis_uv_);
     CheckLambdaValue(&m->tlambda_);
 
     m->min_disto_ = 20 * m->y1_.q_[0];   // quantization-aware min disto
@@ -398,9 +404,11 @@ static void SimplifySegments(VP8Encoder* const enc) {
   }
 }
 
-void VP8SetSegmentParams(VP8Encoder* const enc, float quality) {
+// Computes the quantizer of each segment for 'quality'. The unused segments
+// get the quantizer of the first one (required by the syntax).
+static void GetSegmentQuants(const VP8Encoder* const enc, float quality,
+                             int quants[NUM_MB_SEGMENTS]) {
   int i;
-  int dq_uv_ac, dq_uv_dc;
   const int num_segments = enc->segment_hdr_.num_segments_;
   const double amp = SNS_TO_DQ * enc->config_->sns_strength / 100. / 128.;
   const double Q = quality / 100.;
@@ -414,26 +422,39 @@ void VP8SetSegmentParams(VP8Encoder* const enc, float quality) {
     const double c = pow(c_base, expn);
     const int q = (int)(127. * (1. - c));
     assert(expn > 0.);
-    enc->dqm_[i].quant_ = clip(q, 0, 127);
+    quants[i] = clip(q, 0, 127);
   }
-
-  // purely indicative in the bitstream (except for the 1-segment case)
-  enc->base_quant_ = enc->dqm_[0].quant_;
-
-  // fill-in values for the unused segments (required by the syntax)
   for (i = num_segments; i < NUM_MB_SEGMENTS; ++i) {
-    enc->dqm_[i].quant_ = enc->base_quant_;
+    quants[i] = quants[0];
   }
+}
 
+static int GetDqUvAc(const VP8Encoder* const enc) {
   // uv_alpha_ is normally spread around ~60. The useful range is
   // typically ~30 (quite bad) to ~100 (ok to decimate UV more).
   // We map it to the safe maximal range of MAX/MIN_DQ_UV for dq_uv.
-  dq_uv_ac = (enc->uv_alpha_ - MID_ALPHA) * (MAX_DQ_UV - MIN_DQ_UV)
-                                          / (MAX_ALPHA - MIN_ALPHA);
+  int dq_uv_ac = (enc->uv_alpha_ - MID_ALPHA) * (MAX_DQ_UV - MIN_DQ_UV)
+                                              / (MAX_ALPHA - MIN_ALPHA);
   // we rescale by the user-defined strength of adaptation
   dq_uv_ac = dq_uv_ac * enc->config_->sns_strength / 100;
   // and make it safe.
-  dq_uv_ac = clip(dq_uv_ac, MIN_DQ_UV, MAX_DQ_UV);
+  return clip(dq_uv_ac, MIN_DQ_UV, MAX_DQ_UV);
+}
+
+void VP8SetSegmentParams(VP8Encoder* const enc, float quality) {
+  int i;
+  int dq_uv_ac, dq_uv_dc;
+  int quants[NUM_MB_SEGMENTS];
+  const int num_segments = enc->segment_hdr_.num_segments_;
+
+  GetSegmentQuants(enc, quality, quants);
+  for (i = 0; i < NUM_MB_SEGMENTS; ++i) {
+    enc->dqm_[i].quant_ = quants[i];
+  }
+  // purely indicative in the bitstream (except for the 1-segment case)
+  enc->base_quant_ = enc->dqm_[0].quant_;
+
+  dq_uv_ac = GetDqUvAc(enc);
   // We also boost the dc-uv-quant a little, based on sns-strength, since
   // U/V channels are quite more reactive to high quants (flat DC-blocks
   // tend to appear, and are unpleasant).
@@ -453,6 +474,135 @@ void VP8SetSegmentParams(VP8Encoder* const enc, float quality) {
   SetupMatrices(enc);         // finalize quantization matrices
 }
 
+//------------------------------------------------------------------------------
+// Single-pass rate control
+//
+// The bits of a row of macroblocks are predicted from the distributions of its
+// coefficients (see VP8RCRowStats). A coefficient of magnitude 'v', quantized
+// with a step 'Q', costs about a * log(1 + (v / (t * Q))^k) bits: almost
+// nothing below the threshold 't * Q', and then a logarithmic cost. A constant
+// cost per macroblock accounts for the modes.
+//
+// The constants were fitted by least squares on log(predicted / actual size),
+// over 490 encodings: 10 photos (from 80x60 to 5250x3450 pixels), at methods
+// 0 to 6 and qualities 10 to 95, with the default segments and sns_strength.
+// kRCMethodScale is the scale of each method relative to method 0. Content
+// unlike photos (flat areas, sharp edges, text) is predicted less accurately.
+
+typedef struct {
+  double a, t, k;
+} RCCoeffsModel;
+
+static const RCCoeffsModel kRCLuma = { 0.2426, 0.2919, 10.43 };
+static const RCCoeffsModel kRCChroma = { 0.4926, 0.5827, 10.47 };
+static const double kRCBitsPerMB = 6.24;
+static const double kRCHeaderBytes = 100.;
+static const double kRCMethodScale[7] = {
+  1., 0.9614, 0.7054, 0.6646, 0.6655, 0.6481, 0.6349
+};
+
+// Value of the coefficients in the bin 'i'. See VP8RCBin().
+static double BinCenter(int i) {
+  return (i < 48) ? 4. * i + 2. : 192. + 64. * (i - 48) + 32.;
+}
+
+// 'inv_q2' is the average of 1 / Q^2 over the macroblocks of the row.
+static double CoeffsBits(const uint32_t histo[NUM_RC_BINS], double inv_q2,
+                         const RCCoeffsModel* const model) {
+  const double scale = inv_q2 / (model->t * model->t);
+  double bits = 0.;
+  int i;
+  for (i = 0; i < NUM_RC_BINS; ++i) {
+    if (histo[i] != 0) {
+      const double v = BinCenter(i);
+      bits += histo[i] * log(1. + pow(v * v * scale, 0.5 * model->k));
+    }
+  }
+  return model->a * bits;
+}
+
+double VP8RCPredictSize(const VP8Encoder* const enc, float quality) {
+  const int dq_uv_ac = GetDqUvAc(enc);
+  const double scale = kRCMethodScale[enc->method_];
+  int quants[NUM_MB_SEGMENTS];
+  double inv_q2_y[NUM_MB_SEGMENTS], inv_q2_uv[NUM_MB_SEGMENTS];
+  double total = 0.;
+  int s, x, y;
+  assert(enc->rc_stats_ != NULL);
+  GetSegmentQuants(enc, quality, quants);
+  for (s = 0; s < NUM_MB_SEGMENTS; ++s) {
+    const double q_y = kAcTable[quants[s]];
+    const double q_uv = kAcTable[clip(quants[s] + dq_uv_ac, 0, 127)];
+    inv_q2_y[s] = 1. / (q_y * q_y);
+    inv_q2_uv[s] = 1. / (q_uv * q_uv);
+  }
+  for (y = 0; y < enc->mb_h_; ++y) {
+    VP8RCRowStats* const stats = &enc->rc_stats_[y];
+    const VP8MBInfo* const info = &enc->mb_info_[y * enc->mb_w_];
+    double sum_y = 0., sum_uv = 0.;
+    for (x = 0; x < enc->mb_w_; ++x) {
+      sum_y += inv_q2_y[info[x].segment_];
+      sum_uv += inv_q2_uv[info[x].segment_];
+    }
+    sum_y /= enc->mb_w_;
+    sum_uv /= enc->mb_w_;
+    stats->bits_ = scale * (CoeffsBits(stats->y_, sum_y, &kRCLuma) +
+                            CoeffsBits(stats->uv_, sum_uv, &kRCChroma) +
+                            kRCBitsPerMB * enc->mb_w_);
+    total += stats->bits_;
+  }
+  return total / 8. + kRCHeaderBytes;
+}
+
+float VP8RCPredictQuality(const VP8Encoder* const enc, double target_size) {
+  // The size decreases with the quality: bisect (100 / 2^12 < 0.03).
+  float lo = 0.f, hi = 100.f;
+  int n;
+  for (n = 0; n < 12; ++n) {
+    const float q = 0.5f * (lo + hi);
+    if (VP8RCPredictSize(enc, q) > target_size) {
+      hi = q;
+    } else {
+      lo = q;
+    }
+  }
+  VP8RCPredictSize(enc, lo);   // store the rows' bits for the final quality
+  return lo;
+}
+
+// Scales the rounding bias of the quantization by 'scale'.
+static void SetBias(VP8Matrix* const m, int type, double scale) {
+  int i;
+  for (i = 0; i < 16; ++i) {
+    const int bias = kBiasMatrices[type][i > 0];
+    m->bias_[i] = (uint32_t)(BIAS(bias) * scale);
+    m->zthresh_[i] = ((1 << QFIX) - 1 - m->bias_[i]) / m->iq_[i];
+  }
+}
+
+static int AverageQuant(const VP8Matrix* const m) {
+  int i, sum = 0;
+  for (i = 0; i < 16; ++i) sum += m->q_[i];
+  return (sum + 8) >> 4;
+}
+
+void VP8SetRateCorrection(VP8Encoder* const enc, float strength) {
+  // The rounding bias is lowered down to 0 (plain truncation), which zeroes
+  // more coefficients, and the trellis favors the rate up to 4x more.
+  const double bias_scale = 1. - strength;
+  const int lambda_scale = 16 + (int)(48.f * strength);
+  int i;
+  assert(strength >= 0.f && strength <= 1.f);
+  for (i = 0; i < enc->segment_hdr_.num_segments_; ++i) {
+    VP8SegmentInfo* const m = &enc->dqm_[i];
+    SetBias(&m->y1_, 0, bias_scale);
+    SetBias(&m->y2_, 1, bias_scale);
+    SetBias(&m->uv_, 2, bias_scale);
+    SetTrellisLambdas(m, AverageQuant(&m->y1_), AverageQuant(&m->y2_),
+                      AverageQuant(&m->uv_), lambda_scale);
+  }
+}
+
 //------------------------------------------------------------------------------
 // Form the predictions in cache
 
@@ -598,24 +748,17 @@ static int TrellisQuantizeBlock(const VP8Encoder* const enc,
   ScoreState* ss_cur = &SCORE_STATE(0, MIN_DELTA);
   ScoreState* ss_prev = &SCORE_STATE(1, MIN_DELTA);
   int best_path[3] = {-1, -1, -1};   // store best-last/best-level/best-previous
+  VP8TrellisCoeffs tc;
   score_t best_score;
   int n, m, p, last;
 
   {
     score_t cost;
-    const int thresh = mtx->q_[1] * mtx->q_[1] / 4;
     const int last_proba = probas[VP8EncBands[first]][ctx0][0];
 
-    // compute the position of the last interesting coefficient
-    last = first - 1;
-    for (n = 15; n >= first; --n) {
-      const int j = kZigzag[n];
-      const int err = in[j] * in[j];
-      if (err > thresh) {
-        last = n;
-        break;
-      }
-    }
+    // compute the position of the last interesting coefficient, together with
+    // the quantized levels and distortions of the coefficients to inspect.
+    last = VP8EncTrellisPrepare(in, first, mtx, kWeightTrellis, &tc);
     // we don't need to go inspect up to n = 16 coeffs. We can just go up
     // to last + 1 (inclusive) without losing much.
     if (last < 15) ++last;
@@ -635,17 +778,11 @@ static int TrellisQuantizeBlock(const VP8Encoder* const enc,
   // traverse trellis.
   for (n = first; n <= last; ++n) {
     const int j = kZigzag[n];
-    const uint32_t Q  = mtx->q_[j];
-    const uint32_t iQ = mtx->iq_[j];
-    const uint32_t B = BIAS(0x00);     // neutral bias
     // note: it's important to take sign of the _original_ coeff,
     // so we don't have to consider level < 0 afterward.
     const int sign = (in[j] < 0);
-    const uint32_t coeff0 = (sign ? -in[j] : in[j]) + mtx->sharpen_[j];
-    int level0 = QUANTDIV(coeff0, iQ, B);
-    int thresh_level = QUANTDIV(coeff0, iQ, BIAS(0x80));
-    if (thresh_level > MAX_LEVEL) thresh_level = MAX_LEVEL;
-    if (level0 > MAX_LEVEL) level0 = MAX_LEVEL;
+    const int level0 = tc.level[j];
+    const int thresh_level = tc.max_level[j];
 
     {   // Swap current and previous score states
       ScoreState* const tmp = ss_cur;
@@ -656,43 +793,43 @@ static int TrellisQuantizeBlock(const VP8Encoder* const enc,
     // test all alternate level values around level0.
     for (m = -MIN_DELTA; m <= MAX_DELTA; ++m) {
       Node* const cur = &NODE(n, m);
-      int level = level0 + m;
+      const int level = level0 + m;
       const int ctx = (level > 2) ? 2 : level;
       const int band = VP8EncBands[n + 1];
-      score_t base_score;
-      score_t best_cur_score = MAX_COST;
-      int best_prev = 0;   // default, in case
+      const int var_level =
+          (level > MAX_VARIABLE_LEVEL) ? MAX_VARIABLE_LEVEL : level;
+      score_t best_cur_score;
+      int best_prev;
 
-      ss_cur[m].score = MAX_COST;
       ss_cur[m].costs = costs[n + 1][ctx];
       if (level < 0 || level > thresh_level) {
         // Node is dead.
+        ss_cur[m].score = MAX_COST;
         continue;
       }
 
-      {
-        // Compute delta_error = how much coding this level will
-        // subtract to max_error as distortion.
-        // Here, distortion = sum of (|coeff_i| - level_i * Q_i)^2
-        const int new_error = coeff0 - level * Q;
-        const int delta_error =
-            kWeightTrellis[j] * (new_error * new_error - coeff0 * coeff0);
-        base_score = RDScoreTrellis(lambda, 0, delta_error);
-      }
-
       // Inspect all possible non-dead predecessors. Retain only the best one.
-      for (p = -MIN_DELTA; p <= MAX_DELTA; ++p) {
-        // Dead nodes (with ss_prev[p].score >= MAX_COST) are automatically
-        // eliminated since their score can't be better than the current best.
-        const score_t cost = VP8LevelCost(ss_prev[p].costs, level);
+      // Dead nodes (with ss_prev[p].score >= MAX_COST) are automatically
+      // eliminated since their score can't be better than the current best.
+      // The part of the score that doesn't depend on the predecessor is
+      // added afterward.
+      best_cur_score = ss_prev[-MIN_DELTA].score +
+          RDScoreTrellis(lambda, ss_prev[-MIN_DELTA].costs[var_level], 0);
+      best_prev = -MIN_DELTA;
+      for (p = -MIN_DELTA + 1; p <= MAX_DELTA; ++p) {
         // Examine node assuming it's a non-terminal one.
-        const score_t score =
-            base_score + ss_prev[p].score + RDScoreTrellis(lambda, cost, 0);
+        const score_t score = ss_prev[p].score +
+            RDScoreTrellis(lambda, ss_prev[p].costs[var_level], 0);
         if (score < best_cur_score) {
           best_cur_score = score;
           best_prev = p;
         }
       }
+      // Add delta_error = how much coding this level will subtract to
+      // max_error as distortion, and the fixed part of the level's cost.
+      // Here, distortion = sum of (|coeff_i| - level_i * Q_i)^2
+      best_cur_score += RDScoreTrellis(lambda, VP8LevelFixedCosts[level],
+                                       tc.error[m + MIN_DELTA][j]);
       // Store best finding in current node.
       cur->sign = sign;
       cur->level = level;
@@ -869,7 +1006,7 @@ static int ReconstructUV(VP8EncIterator* const it, VP8ModeScore* const rd,
 // RD-opt decision. Reconstruct each modes, evalue distortion and bit-cost.
 // Pick the mode is lower RD-cost = Rate + lambda * Distortion.
 
-static void StoreMaxDelta(VP8SegmentInfo* const dqm, const int16_t DCs[16]) {
+static void StoreMaxDelta(int* const max_edge, const int16_t DCs[16]) {
   // We look at the first three AC coefficients to determine what is the average
   // delta between each sub-4x4 block.
   const int v0 = abs(DCs[1]);
@@ -877,7 +1014,7 @@ static void StoreMaxDelta(VP8SegmentInfo* const dqm, const int16_t DCs[16]) {
   const int v2 = abs(DCs[4]);
   int max_v = (v1 > v0) ? v1 : v0;
   max_v = (v2 > max_v) ? v2 : max_v;
-  if (max_v > dqm->max_edge_) dqm->max_edge_ = max_v;
+  if (max_v > *max_edge) *max_edge = max_v;
 }
 
 static void SwapModeScore(VP8ModeScore** a, VP8ModeScore** b) {
@@ -957,7 +1094,9 @@ static void PickBestIntra16(VP8EncIterator* const it, VP8ModeScore* rd) {
   // distortion, record max delta so we can later adjust the minimal filtering
   // strength needed to smooth these blocks out.
   if ((rd->nz & 0x100ffff) == 0x1000000 && rd->D > dqm->min_disto_) {
-    StoreMaxDelta(dqm, rd->y_dc_levels);
+    int* const max_edge = (it->max_edge_ != NULL)
+                        ? &it->max_edge_[it->mb_->segment_] : &dqm->max_edge_;
+    StoreMaxDelta(max_edge, rd->y_dc_levels);
   }
 }
 
@@ -1281,3 +1420,4 @@ int VP8Decimate(VP8EncIterator* const it, VP8ModeScore* const rd,
   VP8SetSkip(it, is_skipped);
   return is_skipped;
 }
+
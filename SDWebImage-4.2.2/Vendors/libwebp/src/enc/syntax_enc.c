@@ -261,6 +261,13 @@ static int EmitPartitionsSize(const VP8Encoder* const enc,
   return p ? pic->writer(buf, 3 * p, pic) : 1;
 }
 
+// VP8BitWriterEmitFunc forwarding token partition data to the picture's writer.
+static int EmitPartitionData(const uint8_t* data, size_t size,
+                             void* const opaque) {
+  WebPPicture* const pic = (WebPPicture*)opaque;
+  return pic->writer(data, size, pic);
+}
+
 //------------------------------------------------------------------------------
 
 static int GeneratePartition0(VP8Encoder* const enc) {
@@ -358,12 +365,13 @@ int VP8EncWrite(VP8Encoder* const enc) {
     VP8BitWriterWipeOut(bw);    // will free the internal buffer.
   }
 
-  // Token partitions
+  // Token partitions. Each chunk is released as soon as it has been written.
   for (p = 0; p < enc->num_parts_; ++p) {
-    const uint8_t* const buf = VP8BitWriterBuf(enc->parts_ + p);
-    const size_t size = VP8BitWriterSize(enc->parts_ + p);
-    if (size) ok = ok && pic->writer(buf, size, pic);
-    VP8BitWriterWipeOut(enc->parts_ + p);    // will free the internal buffer.
+    if (ok) {
+      ok = VP8BitWriterDrain(enc->parts_ + p, EmitPartitionData, pic);
+    } else {
+      VP8BitWriterWipeOut(enc->parts_ + p);
+    }
     ok = ok && WebPReportProgress(pic, enc->percent_ + percent_per_part,
                                   &enc->percent_);
   }
@@ -148,6 +148,8 @@ typedef struct {
   ProbaArray coeffs_[NUM_TYPES][NUM_BANDS];      // 1056 bytes
   StatsArray stats_[NUM_TYPES][NUM_BANDS];       // 4224 bytes
   CostArray level_cost_[NUM_TYPES][NUM_BANDS];   // 13056 bytes
+  // coeffs_ from which each of the level_cost_ tables was last computed
+  ProbaArray level_cost_probas_[NUM_TYPES][NUM_BANDS];  // 1056 bytes
   CostArrayMap remapped_costs_[NUM_TYPES];       // 1536 bytes
   int dirty_;               // if true, need to call VP8CalculateLevelCosts()
   int use_skip_proba_;      // Note: we always use skip_proba for now.
@@ -215,6 +217,23 @@ typedef struct {
   uint32_t nz;                // non-zero blocks
 } VP8ModeScore;
 
+// Statistics of a row of macroblocks, for the single-pass rate control
+// (config->use_rate_model, with target_size and pass = 1). The distributions
+// are those of the transformed residuals of the intra modes picked by the
+// analysis.
+#define NUM_RC_BINS 64
+typedef struct {
+  uint32_t y_[NUM_RC_BINS];    // luma coefficients, by VP8RCBin()
+  uint32_t uv_[NUM_RC_BINS];   // chroma coefficients
+  double bits_;                // bits predicted by the rate model
+} VP8RCRowStats;
+
+// Bin of a coefficient of magnitude 'v': steps of 4 up to 192, then of 64.
+static WEBP_INLINE int VP8RCBin(int v) {
+  v >>= 2;
+  return (v < 48) ? v : (v < 304) ? 48 + ((v - 48) >> 4) : NUM_RC_BINS - 1;
+}
+
 // Iterator structure to iterate through macroblocks, pointing to the
 // right neighbouring data (samples, predictions, contexts, ...)
 typedef struct {
@@ -237,6 +256,9 @@ typedef struct {
   uint64_t      luma_bits_;        // macroblock bit-cost for luma
   uint64_t      uv_bits_;          // macroblock bit-cost for chroma
   LFStats*      lf_stats_;         // filter stats (borrowed from enc_)
+  StatsArray  (*stats_)[NUM_BANDS];  // token stats (borrowed from enc_)
+  int*          max_edge_;         // per-segment max edge deltas, or NULL
+                                   // to store them in enc_->dqm_[]
   int           do_trellis_;       // if true, perform extra level optimisation
   int           count_down_;       // number of mb still to be processed
   int           count_down0_;      // starting counter value (for progress)
@@ -392,7 +414,8 @@ struct VP8Encoder {
   VP8RDLevel rd_opt_level_;  // Deduced from method_.
   int max_i4_header_bits_;   // partition #0 safeness factor
   int mb_header_limit_;      // rough limit for header bits per MB
-  int thread_level_;         // derived from config->thread_level
+  int thread_level_;         // derived from config->thread_level. Above 1,
+                             // rows are coded as a wavefront (frame_enc.c)
   int do_search_;            // derived from config->target_XXX
   int use_tokens_;           // if true, use token buffer
 
@@ -404,6 +427,7 @@ struct VP8Encoder {
   uint8_t*   uv_top_;    // top u/v samples.
                          // U and V are packed into 16 bytes (8 U + 8 V)
   LFStats*   lf_stats_;  // autofilter stats (if NULL, autofilter is off)
+  VP8RCRowStats* rc_stats_;  // per-row stats (if NULL, no rate control)
 };
 
 //------------------------------------------------------------------------------
@@ -463,6 +487,16 @@ int VP8EncAnalyze(VP8Encoder* const enc);
   // in quant.c
 // Sets up segment's quantization values, base_quant_ and filter strengths.
 void VP8SetSegmentParams(VP8Encoder* const enc, float quality);
+// Single-pass rate control: returns the size, in bytes, predicted by the rate
+// model for 'quality'. The bits predicted for each row are stored in
+// rc_stats_[].bits_.
+double VP8RCPredictSize(const VP8Encoder* const enc, float quality);
+// Returns the quality for which the predicted size is 'target_size'.
+float VP8RCPredictQuality(const VP8Encoder* const enc, double target_size);
+// Quantizes more coarsely than the segment parameters, so as to lower the
+// bit-rate of the next macroblocks. 'strength' is in [0, 1], 0 meaning no
+// correction. Must be called after VP8SetSegmentParams().
+void VP8SetRateCorrection(VP8Encoder* const enc, float strength);
 // Pick best modes and fills the levels. Returns true if skipped.
 int VP8Decimate(VP8EncIterator* const it, VP8ModeScore* const rd,
                 VP8RDLevel rd_opt);
@@ -502,6 +536,14 @@ int WebPPictureAllocYUVA(WebPPicture* const picture, int width, int height);
 // compressibility (no guarantee, though). Assumes that pic->use_argb is true.
 void WebPCleanupTransparentAreaLossless(WebPPicture* const pic);
 
+// Converts picture->argb to YUVA420 (sharp conversion if 'use_sharp_yuv') with
+// up to 'num_threads' threads. The regular conversion gives the same result
+// for any number of threads, and is done on a single one when dithering.
+// Above one thread, the sharp conversion processes the picture by bands of
+// rows and the result differs slightly from the single-threaded one.
+int WebPPictureARGBToYUVAMT(WebPPicture* const picture, float dithering,
+                            int use_sharp_yuv, int num_threads);
+
   // in near_lossless.c
 // Near lossless preprocessing in RGB color-space.
 int VP8ApplyNearLossless(int xsize, int ysize, uint32_t* argb, int quality);
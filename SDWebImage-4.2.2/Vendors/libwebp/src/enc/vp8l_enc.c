@@ -23,6 +23,7 @@
 #include "../dsp/lossless_common.h"
 #include "../utils/bit_writer_utils.h"
 #include "../utils/huffman_encode_utils.h"
+#include "../utils/thread_utils.h"
 #include "../utils/utils.h"
 #include "../webp/format_constants.h"
 
@@ -164,6 +165,12 @@ typedef enum {
   kHistoTotal  // Must be last.
 } HistoIx;
 
+// Candidate configuration for the encoding of the main image stream.
+typedef struct {
+  EntropyIx entropy_idx_;
+  int red_and_blue_always_zero_;  // if true, the cross-color is skipped
+} CrunchConfig;
+
 static void AddSingleSubGreen(int p, uint32_t* const r, uint32_t* const b) {
   const int green = p >> 8;  // The upper bits are masked away later.
   ++r[((p >> 16) - green) & 0xff];
@@ -185,11 +192,16 @@ static WEBP_INLINE uint32_t HashPix(uint32_t pix) {
   return ((((uint64_t)pix + (pix >> 19)) * 0x39c5fba7ull) & 0xffffffffu) >> 24;
 }
 
+// Maximum ratio between the entropy of a candidate mode and the best one.
+#define CRUNCH_ENTROPY_RATIO 1.15
+
+// Fills 'crunch_configs' with the (at most 'max_configs') entropy modes of
+// lowest estimated entropy, in increasing order.
 static int AnalyzeEntropy(const uint32_t* argb,
                           int width, int height, int argb_stride,
-                          int use_palette,
-                          EntropyIx* const min_entropy_ix,
-                          int* const red_and_blue_always_zero) {
+                          int use_palette, int max_configs,
+                          CrunchConfig crunch_configs[],
+                          int* const num_crunch_configs) {
   // Allocate histogram set with cache_bits = 0.
   uint32_t* const histo =
       (uint32_t*)WebPSafeCalloc(kHistoTotal, sizeof(*histo) * 256);
@@ -267,17 +279,33 @@ static int AnalyzeEntropy(const uint32_t* argb,
       // Palette mode seems more efficient in a breakeven case. Bias with 1.0.
       entropy[kPalette] = entropy_comp[kHistoPalette] - 1.0;
 
-      *min_entropy_ix = kDirect;
-      for (k = kDirect + 1; k <= last_mode_to_analyze; ++k) {
-        if (entropy[*min_entropy_ix] > entropy[k]) {
-          *min_entropy_ix = (EntropyIx)k;
+      // Sort the modes by increasing entropy. In case of equality, the
+      // smallest index comes first.
+      *num_crunch_configs = 0;
+      for (k = kDirect; k <= last_mode_to_analyze; ++k) {
+        int n = *num_crunch_configs;
+        while (n > 0 &&
+               entropy[crunch_configs[n - 1].entropy_idx_] > entropy[k]) {
+          if (n < max_configs) crunch_configs[n] = crunch_configs[n - 1];
+          --n;
         }
+        if (n < max_configs) {
+          crunch_configs[n].entropy_idx_ = (EntropyIx)k;
+          if (*num_crunch_configs < max_configs) ++*num_crunch_configs;
+        }
+      }
+      // Only keep the modes which are close to the best one: the others are
+      // unlikely to win and can be much slower to encode.
+      while (*num_crunch_configs > 1 &&
+             entropy[crunch_configs[*num_crunch_configs - 1].entropy_idx_] >
+                 entropy[crunch_configs[0].entropy_idx_] *
+                     CRUNCH_ENTROPY_RATIO) {
+        --*num_crunch_configs;
       }
-      *red_and_blue_always_zero = 1;
-      // Let's check if the histogram of the chosen entropy mode has
+      // Let's check if the histogram of each chosen entropy mode has
       // non-zero red and blue values. If all are zero, we can later skip
       // the cross color optimization.
-      {
+      for (k = 0; k < *num_crunch_configs; ++k) {
         static const uint8_t kHistoPairs[5][2] = {
           { kHistoRed, kHistoBlue },
           { kHistoRedPred, kHistoBluePred },
@@ -285,13 +313,13 @@ static int AnalyzeEntropy(const uint32_t* argb,
           { kHistoRedPredSubGreen, kHistoBluePredSubGreen },
           { kHistoRed, kHistoBlue }
         };
-        const uint32_t* const red_histo =
-            &histo[256 * kHistoPairs[*min_entropy_ix][0]];
-        const uint32_t* const blue_histo =
-            &histo[256 * kHistoPairs[*min_entropy_ix][1]];
+        const EntropyIx ix = crunch_configs[k].entropy_idx_;
+        const uint32_t* const red_histo = &histo[256 * kHistoPairs[ix][0]];
+        const uint32_t* const blue_histo = &histo[256 * kHistoPairs[ix][1]];
+        crunch_configs[k].red_and_blue_always_zero_ = 1;
         for (i = 1; i < 256; ++i) {
           if ((red_histo[i] | blue_histo[i]) != 0) {
-            *red_and_blue_always_zero = 0;
+            crunch_configs[k].red_and_blue_always_zero_ = 0;
             break;
           }
         }
@@ -325,7 +353,11 @@ static int GetTransformBits(int method, int histo_bits) {
   return res;
 }
 
-static int AnalyzeAndInit(VP8LEncoder* const enc) {
+// Analyzes the picture and fills 'crunch_configs' with up to 'max_configs'
+// candidate configurations, the most promising one first.
+static int AnalyzeAndInit(VP8LEncoder* const enc, int max_configs,
+                          CrunchConfig crunch_configs[],
+                          int* const num_crunch_configs) {
   const WebPPicture* const pic = enc->pic_;
   const int width = pic->width;
   const int height = pic->height;
@@ -333,10 +365,8 @@ static int AnalyzeAndInit(VP8LEncoder* const enc) {
   const WebPConfig* const config = enc->config_;
   const int method = config->method;
   const int low_effort = (config->method == 0);
-  // we round the block size up, so we're guaranteed to have
-  // at max MAX_REFS_BLOCK_PER_IMAGE blocks used:
-  int refs_block_size = (pix_cnt - 1) / MAX_REFS_BLOCK_PER_IMAGE + 1;
   assert(pic != NULL && pic->argb != NULL);
+  assert(max_configs >= 1 && max_configs <= kNumEntropyIx);
 
   enc->use_cross_color_ = 0;
   enc->use_predict_ = 0;
@@ -353,34 +383,30 @@ static int AnalyzeAndInit(VP8LEncoder* const enc) {
 
   if (low_effort) {
     // AnalyzeEntropy is somewhat slow.
-    enc->use_predict_ = !enc->use_palette_;
-    enc->use_subtract_green_ = !enc->use_palette_;
-    enc->use_cross_color_ = 0;
+    crunch_configs[0].entropy_idx_ =
+        enc->use_palette_ ? kPalette : kSpatialSubGreen;
+    crunch_configs[0].red_and_blue_always_zero_ = 1;   // no cross-color
+    *num_crunch_configs = 1;
   } else {
-    int red_and_blue_always_zero;
-    EntropyIx min_entropy_ix;
     if (!AnalyzeEntropy(pic->argb, width, height, pic->argb_stride,
-                        enc->use_palette_, &min_entropy_ix,
-                        &red_and_blue_always_zero)) {
+                        enc->use_palette_, max_configs, crunch_configs,
+                        num_crunch_configs)) {
       return 0;
     }
-    enc->use_palette_ = (min_entropy_ix == kPalette);
-    enc->use_subtract_green_ =
-        (min_entropy_ix == kSubGreen) || (min_entropy_ix == kSpatialSubGreen);
-    enc->use_predict_ =
-        (min_entropy_ix == kSpatial) || (min_entropy_ix == kSpatialSubGreen);
-    enc->use_cross_color_ = red_and_blue_always_zero ? 0 : enc->use_predict_;
   }
 
-  if (!VP8LHashChainInit(&enc->hash_chain_, pix_cnt)) return 0;
-
-  // palette-friendly input typically uses less literals
-  //  -> reduce block size a bit
-  if (enc->use_palette_) refs_block_size /= 2;
-  VP8LBackwardRefsInit(&enc->refs_[0], refs_block_size);
-  VP8LBackwardRefsInit(&enc->refs_[1], refs_block_size);
+  return VP8LHashChainInit(&enc->hash_chain_, pix_cnt);
+}
 
-  return 1;
+// Sets the transforms used by 'enc' from 'crunch_config'.
+static void ApplyCrunchConfig(VP8LEncoder* const enc,
+                              const CrunchConfig* const crunch_config) {
+  const EntropyIx ix = crunch_config->entropy_idx_;
+  enc->use_palette_ = (ix == kPalette);
+  enc->use_subtract_green_ = (ix == kSubGreen) || (ix == kSpatialSubGreen);
+  enc->use_predict_ = (ix == kSpatial) || (ix == kSpatialSubGreen);
+  enc->use_cross_color_ =
+      crunch_config->red_and_blue_always_zero_ ? 0 : enc->use_predict_;
 }
 
 // Returns false in case of memory error.
@@ -708,6 +734,8 @@ static WebPEncodingError EncodeImageNoHuffman(VP8LBitWriter* const bw,
                                               VP8LBackwardRefs refs_array[2],
                                               int width, int height,
                                               int quality, int low_effort) {
+  // The images encoded here are small: a single thread is used.
+  const int num_threads = 1;
   int i;
   int max_tokens = 0;
   WebPEncodingError err = VP8_ENC_OK;
@@ -726,7 +754,7 @@ static WebPEncodingError EncodeImageNoHuffman(VP8LBitWriter* const bw,
 
   // Calculate backward references from ARGB image.
   if (!VP8LHashChainFill(hash_chain, quality, argb, width, height,
-                         low_effort)) {
+                         low_effort, num_threads)) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
     goto Error;
   }
@@ -793,7 +821,7 @@ static WebPEncodingError EncodeImageInternal(VP8LBitWriter* const bw,
                                              VP8LHashChain* const hash_chain,
                                              VP8LBackwardRefs refs_array[2],
                                              int width, int height, int quality,
-                                             int low_effort,
+                                             int low_effort, int num_threads,
                                              int use_cache, int* cache_bits,
                                              int histogram_bits,
                                              size_t init_byte_position,
@@ -837,7 +865,7 @@ static WebPEncodingError EncodeImageInternal(VP8LBitWriter* const bw,
   // of refs_array[0] or refs_array[1].
   // Calculate backward references from ARGB image.
   if (!VP8LHashChainFill(hash_chain, quality, argb, width, height,
-                         low_effort)) {
+                         low_effort, num_threads)) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
     goto Error;
   }
@@ -859,7 +887,8 @@ static WebPEncodingError EncodeImageInternal(VP8LBitWriter* const bw,
   // Build histogram image and symbols from backward references.
   if (!VP8LGetHistoImageSymbols(width, height, &refs, quality, low_effort,
                                 histogram_bits, *cache_bits, histogram_image,
-                                tmp_histos, histogram_symbols)) {
+                                tmp_histos, histogram_symbols,
+                                num_threads)) {
     err = VP8_ENC_ERROR_OUT_OF_MEMORY;
     goto Error;
   }
@@ -985,6 +1014,19 @@ static void ApplySubtractGreen(VP8LEncoder* const enc, int width, int height,
   VP8LSubtractGreenFromBlueAndRed(enc->argb_, width * height);
 }
 
+// Number of threads for the search of the transforms and of the backward
+// references.
+static int GetNumThreads(const VP8LEncoder* const enc) {
+  const int thread_level = enc->config_->thread_level;
+  return (thread_level > 1) ? thread_level : (thread_level > 0) ? 2 : 1;
+}
+
+// Searching the predictor and cross-color transforms by bands changes the
+// output, so it is only done when explicitly requested.
+static int GetNumTransformThreads(const VP8LEncoder* const enc) {
+  return enc->config_->use_tile_bands ? GetNumThreads(enc) : 1;
+}
+
 static WebPEncodingError ApplyPredictFilter(const VP8LEncoder* const enc,
                                             int width, int height,
                                             int quality, int low_effort,
@@ -1000,7 +1042,7 @@ static WebPEncodingError ApplyPredictFilter(const VP8LEncoder* const enc,
   VP8LResidualImage(width, height, pred_bits, low_effort, enc->argb_,
                     enc->argb_scratch_, enc->transform_data_,
                     near_lossless_strength, enc->config_->exact,
-                    used_subtract_green);
+                    used_subtract_green, GetNumTransformThreads(enc));
   VP8LPutBits(bw, TRANSFORM_PRESENT, 1);
   VP8LPutBits(bw, PREDICTOR_TRANSFORM, 2);
   assert(pred_bits >= 2);
@@ -1021,7 +1063,8 @@ static WebPEncodingError ApplyCrossColorFilter(const VP8LEncoder* const enc,
   const int transform_height = VP8LSubSampleSize(height, ccolor_transform_bits);
 
   VP8LColorSpaceTransform(width, height, ccolor_transform_bits, quality,
-                          enc->argb_, enc->transform_data_);
+                          enc->argb_, enc->transform_data_,
+                          GetNumTransformThreads(enc));
   VP8LPutBits(bw, TRANSFORM_PRESENT, 1);
   VP8LPutBits(bw, CROSS_COLOR_TRANSFORM, 2);
   assert(ccolor_transform_bits >= 2);
@@ -1441,33 +1484,36 @@ static void VP8LEncoderDelete(VP8LEncoder* enc) {
 // -----------------------------------------------------------------------------
 // Main call
 
-WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
-                                   const WebPPicture* const picture,
-                                   VP8LBitWriter* const bw, int use_cache) {
+// Encodes the main image stream of 'enc' with the transforms and entropy mode
+// of 'crunch_config'.
+static WebPEncodingError EncodeStreamConfig(
+    VP8LEncoder* const enc, const CrunchConfig* const crunch_config,
+    VP8LBitWriter* const bw, int use_cache, size_t byte_position,
+    int* const hdr_size, int* const data_size) {
   WebPEncodingError err = VP8_ENC_OK;
+  const WebPConfig* const config = enc->config_;
+  const WebPPicture* const picture = enc->pic_;
   const int quality = (int)config->quality;
   const int low_effort = (config->method == 0);
   const int width = picture->width;
   const int height = picture->height;
-  VP8LEncoder* const enc = VP8LEncoderNew(config, picture);
-  const size_t byte_position = VP8LBitWriterNumBytes(bw);
+  // we round the block size up, so we're guaranteed to have
+  // at max MAX_REFS_BLOCK_PER_IMAGE blocks used:
+  int refs_block_size = (width * height - 1) / MAX_REFS_BLOCK_PER_IMAGE + 1;
   int use_near_lossless = 0;
-  int hdr_size = 0;
-  int data_size = 0;
   int use_delta_palette = 0;
 
-  if (enc == NULL) {
-    err = VP8_ENC_ERROR_OUT_OF_MEMORY;
-    goto Error;
-  }
+  ApplyCrunchConfig(enc, crunch_config);
+  enc->argb_ = NULL;
+  enc->cache_bits_ = 0;
 
-  // ---------------------------------------------------------------------------
-  // Analyze image (entropy, num_palettes etc)
-
-  if (!AnalyzeAndInit(enc)) {
-    err = VP8_ENC_ERROR_OUT_OF_MEMORY;
-    goto Error;
-  }
+  // palette-friendly input typically uses less literals
+  //  -> reduce block size a bit
+  if (enc->use_palette_) refs_block_size /= 2;
+  VP8LBackwardRefsClear(&enc->refs_[0]);
+  VP8LBackwardRefsClear(&enc->refs_[1]);
+  VP8LBackwardRefsInit(&enc->refs_[0], refs_block_size);
+  VP8LBackwardRefsInit(&enc->refs_[1], refs_block_size);
 
   // Apply near-lossless preprocessing.
   use_near_lossless =
@@ -1475,8 +1521,7 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
   if (use_near_lossless) {
     if (!VP8ApplyNearLossless(width, height, picture->argb,
                               config->near_lossless)) {
-      err = VP8_ENC_ERROR_OUT_OF_MEMORY;
-      goto Error;
+      return VP8_ENC_ERROR_OUT_OF_MEMORY;
     }
   }
 
@@ -1487,14 +1532,14 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
     enc->use_subtract_green_ = 0;
     enc->use_palette_ = 1;
     err = MakeInputImageCopy(enc);
-    if (err != VP8_ENC_OK) goto Error;
+    if (err != VP8_ENC_OK) return err;
     err = WebPSearchOptimalDeltaPalette(enc);
-    if (err != VP8_ENC_OK) goto Error;
+    if (err != VP8_ENC_OK) return err;
     if (enc->use_palette_) {
       err = AllocateTransformBuffer(enc, width, height);
-      if (err != VP8_ENC_OK) goto Error;
+      if (err != VP8_ENC_OK) return err;
       err = EncodeDeltaPalettePredictorImage(bw, enc, quality, low_effort);
-      if (err != VP8_ENC_OK) goto Error;
+      if (err != VP8_ENC_OK) return err;
       use_delta_palette = 1;
     }
   }
@@ -1503,9 +1548,9 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
   // Encode palette
   if (enc->use_palette_) {
     err = EncodePalette(bw, low_effort, enc);
-    if (err != VP8_ENC_OK) goto Error;
+    if (err != VP8_ENC_OK) return err;
     err = MapImageFromPalette(enc, use_delta_palette);
-    if (err != VP8_ENC_OK) goto Error;
+    if (err != VP8_ENC_OK) return err;
     // If using a color cache, do not have it bigger than the number of colors.
     if (use_cache && enc->palette_size_ < (1 << MAX_COLOR_CACHE_BITS)) {
       enc->cache_bits_ = BitsLog2Floor(enc->palette_size_) + 1;
@@ -1515,7 +1560,7 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
     // In case image is not packed.
     if (enc->argb_ == NULL) {
       err = MakeInputImageCopy(enc);
-      if (err != VP8_ENC_OK) goto Error;
+      if (err != VP8_ENC_OK) return err;
     }
 
     // -------------------------------------------------------------------------
@@ -1528,13 +1573,13 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
     if (enc->use_predict_) {
       err = ApplyPredictFilter(enc, enc->current_width_, height, quality,
                                low_effort, enc->use_subtract_green_, bw);
-      if (err != VP8_ENC_OK) goto Error;
+      if (err != VP8_ENC_OK) return err;
     }
 
     if (enc->use_cross_color_) {
       err = ApplyCrossColorFilter(enc, enc->current_width_,
                                   height, quality, low_effort, bw);
-      if (err != VP8_ENC_OK) goto Error;
+      if (err != VP8_ENC_OK) return err;
     }
   }
 
@@ -1544,12 +1589,190 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
   // Encode and write the transformed image.
   err = EncodeImageInternal(bw, enc->argb_, &enc->hash_chain_, enc->refs_,
                             enc->current_width_, height, quality, low_effort,
-                            use_cache, &enc->cache_bits_, enc->histo_bits_,
-                            byte_position, &hdr_size, &data_size);
-  if (err != VP8_ENC_OK) goto Error;
+                            GetNumThreads(enc), use_cache, &enc->cache_bits_,
+                            enc->histo_bits_, byte_position, hdr_size,
+                            data_size);
+  if (err == VP8_ENC_OK && bw->error_) err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+  return err;
+}
+
+// Encoding of a subset of the candidate configurations, by one worker.
+typedef struct {
+  WebPWorker worker_;
+  VP8LEncoder* enc_;
+  VP8LBitWriter* bw_;           // holds the smallest stream upon return
+  const CrunchConfig* crunch_configs_;
+  int num_crunch_configs_;
+  int use_cache_;
+  size_t byte_position_;        // position of the stream in 'bw_'
+  // Result, for the smallest stream:
+  int best_config_;             // index in crunch_configs_[]
+  int best_cache_bits_;
+  int hdr_size_;
+  int data_size_;
+  WebPEncodingError err_;
+} StreamEncodeJob;
+
+static int EncodeStreamHook(StreamEncodeJob* const job, void* unused) {
+  VP8LBitWriter* const bw = job->bw_;
+  const VP8LBitWriter bw_init = *bw;
+  VP8LBitWriter bw_best;
+  WebPEncodingError err = VP8_ENC_OK;
+  int idx;
+  (void)unused;
+
+  memset(&bw_best, 0, sizeof(bw_best));
+  // Both 'bw' and 'bw_best' start with the bits written so far, so that they
+  // can be swapped and rewound.
+  if (job->num_crunch_configs_ > 1 && !VP8LBitWriterClone(bw, &bw_best)) {
+    err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+  }
+  for (idx = 0; err == VP8_ENC_OK && idx < job->num_crunch_configs_; ++idx) {
+    int hdr_size = 0;
+    int data_size = 0;
+    err = EncodeStreamConfig(job->enc_, &job->crunch_configs_[idx], bw,
+                             job->use_cache_, job->byte_position_,
+                             &hdr_size, &data_size);
+    if (err != VP8_ENC_OK) break;
+    if (idx == 0 ||
+        VP8LBitWriterNumBytes(bw) < VP8LBitWriterNumBytes(&bw_best)) {
+      job->best_config_ = idx;
+      job->best_cache_bits_ = job->enc_->cache_bits_;
+      job->hdr_size_ = hdr_size;
+      job->data_size_ = data_size;
+      if (job->num_crunch_configs_ > 1) VP8LBitWriterSwap(bw, &bw_best);
+    }
+    if (job->num_crunch_configs_ > 1) VP8LBitWriterReset(&bw_init, bw);
+  }
+  if (err == VP8_ENC_OK && job->num_crunch_configs_ > 1) {
+    VP8LBitWriterSwap(bw, &bw_best);
+  }
+  VP8LBitWriterWipeOut(&bw_best);
+  job->err_ = err;
+  return (err == VP8_ENC_OK);
+}
+
+// Initializes a side encoder with the analysis done by 'enc_main'.
+static int CopyAnalysis(const VP8LEncoder* const enc_main,
+                        VP8LEncoder* const enc) {
+  const WebPPicture* const pic = enc_main->pic_;
+  enc->histo_bits_ = enc_main->histo_bits_;
+  enc->transform_bits_ = enc_main->transform_bits_;
+  enc->palette_size_ = enc_main->palette_size_;
+  memcpy(enc->palette_, enc_main->palette_, sizeof(enc->palette_));
+  return VP8LHashChainInit(&enc->hash_chain_, pic->width * pic->height);
+}
+
+WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
+                                   const WebPPicture* const picture,
+                                   VP8LBitWriter* const bw, int use_cache) {
+  WebPEncodingError err = VP8_ENC_OK;
+  const WebPWorkerInterface* const worker_interface = WebPGetWorkerInterface();
+  VP8LEncoder* const enc_main = VP8LEncoderNew(config, picture);
+  const size_t byte_position = VP8LBitWriterNumBytes(bw);
+  CrunchConfig crunch_configs[kNumEntropyIx];
+  int num_crunch_configs = 0;
+  // With multi-threading, the best entropy modes are all encoded and the
+  // smallest stream is kept: each job encodes its share of the modes with
+  // its own encoder and bit writer.
+  StreamEncodeJob jobs[kNumEntropyIx];
+  VP8LBitWriter bw_side[kNumEntropyIx];
+  int max_configs = 1;
+  int num_jobs = 0;
+  int best, n;
+
+  if (enc_main == NULL) {
+    err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+    goto Error;
+  }
+  // The extra configurations cost one encoder per job and may change the
+  // output, so they are only tried with an explicit thread count (>= 2).
+  // Near-lossless modifies the picture in place: keep a single configuration.
+  if (config->thread_level > 1 && config->method >= 5 &&
+      config->near_lossless == 100) {
+    max_configs = (config->method == 6) ? kNumEntropyIx : 2;
+  }
+#ifdef WEBP_EXPERIMENTAL_FEATURES
+  if (config->use_delta_palette) max_configs = 1;
+#endif
+
+  // ---------------------------------------------------------------------------
+  // Analyze image (entropy, num_palettes etc)
+
+  if (!AnalyzeAndInit(enc_main, max_configs, crunch_configs,
+                      &num_crunch_configs)) {
+    err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+    goto Error;
+  }
+  assert(num_crunch_configs >= 1 && num_crunch_configs <= max_configs);
+  num_jobs = num_crunch_configs;
+  if (num_jobs > 1 && num_jobs > config->thread_level) {
+    num_jobs = config->thread_level;
+  }
+
+  for (n = 0; n < num_jobs; ++n) {
+    StreamEncodeJob* const job = &jobs[n];
+    const int first = n * num_crunch_configs / num_jobs;
+    const int last = (n + 1) * num_crunch_configs / num_jobs;
+    memset(job, 0, sizeof(*job));
+    worker_interface->Init(&job->worker_);
+    job->worker_.hook = (WebPWorkerHook)EncodeStreamHook;
+    job->worker_.data1 = job;
+    job->worker_.data2 = NULL;
+    job->crunch_configs_ = crunch_configs + first;
+    job->num_crunch_configs_ = last - first;
+    job->use_cache_ = use_cache;
+    job->byte_position_ = byte_position;
+    if (n == 0) {
+      job->enc_ = enc_main;
+      job->bw_ = bw;
+    } else {
+      job->bw_ = &bw_side[n];
+      if (!VP8LBitWriterInit(job->bw_, 0)) {
+        num_jobs = n + 1;
+        err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+        goto Error;
+      }
+      job->enc_ = VP8LEncoderNew(config, picture);
+      if (job->enc_ == NULL || !CopyAnalysis(enc_main, job->enc_) ||
+          !VP8LBitWriterClone(bw, job->bw_)) {
+        num_jobs = n + 1;
+        err = VP8_ENC_ERROR_OUT_OF_MEMORY;
+        goto Error;
+      }
+    }
+  }
+
+  // Without a thread, the job is run by the calling thread.
+  for (n = 1; n < num_jobs; ++n) {
+    if (worker_interface->Reset(&jobs[n].worker_)) {
+      worker_interface->Launch(&jobs[n].worker_);
+    } else {
+      worker_interface->Execute(&jobs[n].worker_);
+    }
+  }
+  worker_interface->Execute(&jobs[0].worker_);
+  for (n = 0; n < num_jobs; ++n) worker_interface->Sync(&jobs[n].worker_);
+
+  // Keep the smallest stream. In case of equality, the first one wins.
+  best = 0;
+  for (n = 0; n < num_jobs; ++n) {
+    if (jobs[n].err_ != VP8_ENC_OK) {
+      err = jobs[n].err_;
+      goto Error;
+    }
+    if (VP8LBitWriterNumBytes(jobs[n].bw_) <
+        VP8LBitWriterNumBytes(jobs[best].bw_)) {
+      best = n;
+    }
+  }
+  if (best != 0) VP8LBitWriterSwap(jobs[best].bw_, bw);
 
   if (picture->stats != NULL) {
+    const StreamEncodeJob* const job = &jobs[best];
+    VP8LEncoder* const enc = job->enc_;
     WebPAuxStats* const stats = picture->stats;
+    ApplyCrunchConfig(enc, &job->crunch_configs_[job->best_config_]);
     stats->lossless_features = 0;
     if (enc->use_predict_) stats->lossless_features |= 1;
     if (enc->use_cross_color_) stats->lossless_features |= 2;
@@ -1557,15 +1780,22 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
     if (enc->use_palette_) stats->lossless_features |= 8;
     stats->histogram_bits = enc->histo_bits_;
     stats->transform_bits = enc->transform_bits_;
-    stats->cache_bits = enc->cache_bits_;
+    stats->cache_bits = job->best_cache_bits_;
     stats->palette_size = enc->palette_size_;
     stats->lossless_size = (int)(VP8LBitWriterNumBytes(bw) - byte_position);
-    stats->lossless_hdr_size = hdr_size;
-    stats->lossless_data_size = data_size;
+    stats->lossless_hdr_size = job->hdr_size_;
+    stats->lossless_data_size = job->data_size_;
   }
 
  Error:
-  VP8LEncoderDelete(enc);
+  for (n = 0; n < num_jobs; ++n) {
+    worker_interface->End(&jobs[n].worker_);
+    if (n > 0) {
+      VP8LBitWriterWipeOut(&bw_side[n]);
+      VP8LEncoderDelete(jobs[n].enc_);
+    }
+  }
+  VP8LEncoderDelete(enc_main);
   return err;
 }
 
@@ -78,13 +78,21 @@ WebPEncodingError VP8LEncodeStream(const WebPConfig* const config,
 //------------------------------------------------------------------------------
 // Image transforms in predictor.c.
 
+// If 'num_threads' > 1, the predictors are searched by bands of tile rows,
+// each with its own accumulated histogram and without the modes of the band
+// above, on up to 'num_threads' threads. The result does not depend on the
+// actual number of threads, but differs from the single-threaded search and
+// can be much larger (by up to 30% on pictures with repeating content).
 void VP8LResidualImage(int width, int height, int bits, int low_effort,
                        uint32_t* const argb, uint32_t* const argb_scratch,
                        uint32_t* const image, int near_lossless, int exact,
-                       int used_subtract_green);
+                       int used_subtract_green, int num_threads);
 
+// If 'num_threads' > 1, the color transforms are searched by bands of tile
+// rows, with the same consequences as for VP8LResidualImage().
 void VP8LColorSpaceTransform(int width, int height, int bits, int quality,
-                             uint32_t* const argb, uint32_t* image);
+                             uint32_t* const argb, uint32_t* image,
+                             int num_threads);
 
 //------------------------------------------------------------------------------
 
@@ -116,8 +116,10 @@ static void MapConfigToTools(VP8Encoder* const enc) {
 #if !defined(DISABLE_TOKEN_BUFFER)
     enc->use_tokens_ = (enc->rd_opt_level_ >= RD_OPT_BASIC);  // need rd stats
 #endif
-    if (enc->use_tokens_) {
-      enc->num_parts_ = 1;   // doesn't work with multi-partition
+    if (enc->use_tokens_ && enc->thread_level_ <= 1) {
+      // doesn't work with multi-partition, unless each row has its own token
+      // buffer (see TokenLoopMT()).
+      enc->num_parts_ = 1;
     }
   }
 }
@@ -141,8 +143,17 @@ static void MapConfigToTools(VP8Encoder* const enc) {
 //              LFStats: 2048
 // Picture size (yuv): 419328
 
+struct WebPEncoderContext {
+  uint8_t* mem_;          // memory of the last VP8Encoder and its arrays
+  size_t mem_size_;
+  int has_costs_;         // true if the level cost tables below are set
+  ProbaArray level_cost_probas_[NUM_TYPES][NUM_BANDS];  // see VP8EncProba
+  CostArray level_cost_[NUM_TYPES][NUM_BANDS];
+};
+
 static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
-                                  WebPPicture* const picture) {
+                                  WebPPicture* const picture,
+                                  WebPEncoderContext* const ctx) {
   VP8Encoder* enc;
   const int use_filter =
       (config->filter_strength > 0) || (config->autofilter > 0);
@@ -159,6 +170,12 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
       + WEBP_ALIGN_CST;                      // align all
   const size_t lf_stats_size =
       config->autofilter ? sizeof(*enc->lf_stats_) + WEBP_ALIGN_CST : 0;
+  const int use_rate_control = (config->use_rate_model &&
+                                config->target_size > 0 &&
+                                config->target_PSNR == 0. &&
+                                config->pass == 1);
+  const size_t rc_stats_size =
+      use_rate_control ? mb_h * sizeof(*enc->rc_stats_) + WEBP_ALIGN_CST : 0;
   uint8_t* mem;
   const uint64_t size = (uint64_t)sizeof(*enc)   // main struct
                       + WEBP_ALIGN_CST           // cache alignment
@@ -166,7 +183,8 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
                       + preds_size               // prediction modes
                       + samples_size             // top/left samples
                       + nz_size                  // coeff context bits
-                      + lf_stats_size;           // autofilter stats
+                      + lf_stats_size            // autofilter stats
+                      + rc_stats_size;           // rate control stats
 
 #ifdef PRINT_MEMORY_INFO
   printf("===================================\n");
@@ -177,9 +195,11 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
          "         top samples: %ld\n"
          "            non-zero: %ld\n"
          "            lf-stats: %ld\n"
+         "            rc-stats: %ld\n"
          "               total: %ld\n",
          sizeof(*enc) + WEBP_ALIGN_CST, info_size,
-         preds_size, samples_size, nz_size, lf_stats_size, size);
+         preds_size, samples_size, nz_size, lf_stats_size, rc_stats_size,
+         size);
   printf("Transient object sizes:\n"
          "      VP8EncIterator: %ld\n"
          "        VP8ModeScore: %ld\n"
@@ -193,10 +213,19 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
          mb_w * mb_h * 384 * sizeof(uint8_t));
   printf("===================================\n");
 #endif
-  mem = (uint8_t*)WebPSafeMalloc(size, sizeof(*mem));
-  if (mem == NULL) {
-    WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
-    return NULL;
+  if (ctx != NULL && ctx->mem_ != NULL && size <= ctx->mem_size_) {
+    mem = ctx->mem_;
+  } else {
+    mem = (uint8_t*)WebPSafeMalloc(size, sizeof(*mem));
+    if (mem == NULL) {
+      WebPEncodingSetError(picture, VP8_ENC_ERROR_OUT_OF_MEMORY);
+      return NULL;
+    }
+    if (ctx != NULL) {
+      WebPSafeFree(ctx->mem_);
+      ctx->mem_ = mem;
+      ctx->mem_size_ = (size_t)size;
+    }
   }
   enc = (VP8Encoder*)mem;
   mem = (uint8_t*)WEBP_ALIGN(mem + sizeof(*enc));
@@ -213,6 +242,11 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
   mem += nz_size;
   enc->lf_stats_ = lf_stats_size ? (LFStats*)WEBP_ALIGN(mem) : NULL;
   mem += lf_stats_size;
+  enc->rc_stats_ = rc_stats_size ? (VP8RCRowStats*)WEBP_ALIGN(mem) : NULL;
+  if (enc->rc_stats_ != NULL) {
+    memset(enc->rc_stats_, 0, mb_h * sizeof(*enc->rc_stats_));
+  }
+  mem += rc_stats_size;
 
   // top samples (all 16-aligned)
   mem = (uint8_t*)WEBP_ALIGN(mem);
@@ -229,6 +263,14 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
   MapConfigToTools(enc);
   VP8EncDspInit();
   VP8DefaultProbas(enc);
+  if (ctx != NULL && ctx->has_costs_) {
+    // Only the tables whose probabilities differ will be re-computed by
+    // VP8CalculateLevelCosts().
+    memcpy(enc->proba_.level_cost_probas_, ctx->level_cost_probas_,
+           sizeof(ctx->level_cost_probas_));
+    memcpy(enc->proba_.level_cost_, ctx->level_cost_,
+           sizeof(ctx->level_cost_));
+  }
   ResetSegmentHeader(enc);
   ResetFilterHeader(enc);
   ResetBoundaryPredictions(enc);
@@ -244,12 +286,23 @@ static VP8Encoder* InitVP8Encoder(const WebPConfig* const config,
   return enc;
 }
 
-static int DeleteVP8Encoder(VP8Encoder* enc) {
+// The memory of 'enc' is kept in 'ctx', if not NULL, along with the level
+// cost tables.
+static int DeleteVP8Encoder(VP8Encoder* enc, WebPEncoderContext* const ctx) {
   int ok = 1;
   if (enc != NULL) {
     ok = VP8EncDeleteAlpha(enc);
     VP8TBufferClear(&enc->tokens_);
-    WebPSafeFree(enc);
+    if (ctx != NULL) {
+      assert((uint8_t*)enc == ctx->mem_);
+      memcpy(ctx->level_cost_probas_, enc->proba_.level_cost_probas_,
+             sizeof(ctx->level_cost_probas_));
+      memcpy(ctx->level_cost_, enc->proba_.level_cost_,
+             sizeof(ctx->level_cost_));
+      ctx->has_costs_ = 1;
+    } else {
+      WebPSafeFree(enc);
+    }
   }
   return ok;
 }
@@ -313,7 +366,24 @@ int WebPReportProgress(const WebPPicture* const pic,
 }
 //------------------------------------------------------------------------------
 
+WebPEncoderContext* WebPEncoderContextNew(void) {
+  return (WebPEncoderContext*)WebPSafeCalloc(1ULL,
+                                             sizeof(WebPEncoderContext));
+}
+
+void WebPEncoderContextDelete(WebPEncoderContext* context) {
+  if (context != NULL) {
+    WebPSafeFree(context->mem_);
+    WebPSafeFree(context);
+  }
+}
+
 int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
+  return WebPEncodeWithContext(NULL, config, pic);
+}
+
+int WebPEncodeWithContext(WebPEncoderContext* context,
+                          const WebPConfig* config, WebPPicture* pic) {
   int ok = 0;
   if (pic == NULL) return 0;
 
@@ -342,26 +412,27 @@ int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
 
     if (pic->use_argb || pic->y == NULL || pic->u == NULL || pic->v == NULL) {
       // Make sure we have YUVA samples.
-      if (config->use_sharp_yuv || (config->preprocessing & 4)) {
-        if (!WebPPictureSharpARGBToYUVA(pic)) {
-          return 0;
-        }
-      } else {
-        float dithering = 0.f;
-        if (config->preprocessing & 2) {
-          const float x = config->quality / 100.f;
-          const float x2 = x * x;
-          // slowly decreasing from max dithering at low quality (q->0)
-          // to 0.5 dithering amplitude at high quality (q->100)
-          dithering = 1.0f + (0.5f - 1.0f) * x2 * x2;
-        }
-        if (!WebPPictureARGBToYUVADithered(pic, WEBP_YUV420, dithering)) {
-          return 0;
-        }
+      // With thread_level, the bands of rows are processed in parallel.
+      const int num_threads = (config->thread_level > 1) ?
+                              config->thread_level :
+                              (config->thread_level > 0) ? 2 : 1;
+      const int use_sharp_yuv =
+          config->use_sharp_yuv || (config->preprocessing & 4);
+      float dithering = 0.f;
+      if (!use_sharp_yuv && (config->preprocessing & 2)) {
+        const float x = config->quality / 100.f;
+        const float x2 = x * x;
+        // slowly decreasing from max dithering at low quality (q->0)
+        // to 0.5 dithering amplitude at high quality (q->100)
+        dithering = 1.0f + (0.5f - 1.0f) * x2 * x2;
+      }
+      if (!WebPPictureARGBToYUVAMT(pic, dithering, use_sharp_yuv,
+                                   num_threads)) {
+        return 0;
       }
     }
 
-    enc = InitVP8Encoder(config, pic);
+    enc = InitVP8Encoder(config, pic, context);
     if (enc == NULL) return 0;  // pic->error is already set.
     // Note: each of the tasks below account for 20% in the progress report.
     ok = VP8EncAnalyze(enc);
@@ -380,7 +451,7 @@ int WebPEncode(const WebPConfig* config, WebPPicture* pic) {
     if (!ok) {
       VP8EncFreeBitWriters(enc);
     }
-    ok &= DeleteVP8Encoder(enc);  // must always be called, even if !ok
+    ok &= DeleteVP8Encoder(enc, context);  // must always be called
   } else {
     // Make sure we have ARGB samples.
     if (pic->argb == NULL && !WebPPictureYUVAToARGB(pic)) {
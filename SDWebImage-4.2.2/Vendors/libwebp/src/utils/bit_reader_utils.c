@@ -18,6 +18,38 @@
 #include "./bit_reader_inl_utils.h"
 #include "../utils/utils.h"
 
+//------------------------------------------------------------------------------
+// VP8InputSegment
+
+const VP8InputSegment* VP8FindSegment(const VP8InputSegment* seg, size_t pos) {
+  assert(seg != NULL && pos >= seg->offset_);
+  while (pos >= seg->offset_ + seg->size_ && seg->next_ != NULL) {
+    seg = seg->next_;
+  }
+  return seg;
+}
+
+int VP8CopySegmentBytes(const VP8InputSegment* seg, size_t pos,
+                        uint8_t* dst, size_t size) {
+  seg = VP8FindSegment(seg, pos);
+  while (size > 0) {
+    const size_t skip = pos - seg->offset_;
+    size_t n;
+    if (skip >= seg->size_) return 0;
+    n = seg->size_ - skip;
+    if (n > size) n = size;
+    memcpy(dst, seg->data_ + skip, n);
+    dst += n;
+    pos += n;
+    size -= n;
+    if (size > 0) {
+      if (seg->next_ == NULL) return 0;
+      seg = seg->next_;
+    }
+  }
+  return 1;
+}
+
 //------------------------------------------------------------------------------
 // VP8BitReader
 
@@ -40,10 +72,46 @@ void VP8InitBitReader(VP8BitReader* const br,
   br->value_   = 0;
   br->bits_    = -8;   // to load the very first 8bits
   br->eof_     = 0;
+  br->seg_     = NULL;
+  br->end_pos_ = 0;
   VP8BitReaderSetBuffer(br, start, size);
   VP8LoadNewBytes(br);
 }
 
+// Points the read buffer to the part of 'seg' starting at 'pos'.
+static void SetSegmentBuffer(VP8BitReader* const br,
+                             const VP8InputSegment* const seg, size_t pos) {
+  const size_t seg_end = seg->offset_ + seg->size_;
+  const size_t end = (seg_end < br->end_pos_) ? seg_end : br->end_pos_;
+  assert(pos >= seg->offset_ && pos <= seg_end);
+  br->seg_ = seg;
+  VP8BitReaderSetBuffer(br, seg->data_ + (pos - seg->offset_),
+                        (end > pos) ? end - pos : 0);
+}
+
+void VP8InitSegmentBitReader(VP8BitReader* const br,
+                             const VP8InputSegment* const seg,
+                             size_t start_pos, size_t end_pos) {
+  assert(br != NULL);
+  assert(seg != NULL);
+  assert(start_pos <= end_pos);
+  br->range_   = 255 - 1;
+  br->value_   = 0;
+  br->bits_    = -8;   // to load the very first 8bits
+  br->eof_     = 0;
+  br->end_pos_ = end_pos;
+  SetSegmentBuffer(br, VP8FindSegment(seg, start_pos), start_pos);
+  VP8LoadNewBytes(br);
+}
+
+// Moves to the next segment, if it's available and still has data to read.
+static int NextSegment(VP8BitReader* const br) {
+  const VP8InputSegment* const next = br->seg_->next_;
+  if (next == NULL || next->offset_ >= br->end_pos_) return 0;
+  SetSegmentBuffer(br, next, next->offset_);
+  return 1;
+}
+
 void VP8RemapBitReader(VP8BitReader* const br, ptrdiff_t offset) {
   if (br->buf_ != NULL) {
     br->buf_ += offset;
@@ -86,6 +154,10 @@ const uint8_t kVP8NewRange[128] = {
 
 void VP8LoadFinalBytes(VP8BitReader* const br) {
   assert(br != NULL && br->buf_ != NULL);
+  if (br->buf_ == br->buf_end_ && br->seg_ != NULL && NextSegment(br)) {
+    VP8LoadNewBytes(br);
+    return;
+  }
   // Only read 8bits at a time
   if (br->buf_ < br->buf_end_) {
     br->bits_ += 8;
@@ -148,6 +220,7 @@ void VP8LInitBitReader(VP8LBitReader* const br, const uint8_t* const start,
   br->val_ = 0;
   br->bit_pos_ = 0;
   br->eos_ = 0;
+  br->seg_ = NULL;
 
   if (length > sizeof(br->val_)) {
     length = sizeof(br->val_);
@@ -176,6 +249,17 @@ static void VP8LSetEndOfStream(VP8LBitReader* const br) {
   br->bit_pos_ = 0;  // To avoid undefined behaviour with shifts.
 }
 
+// Moves to the next segment, if available.
+static int NextLSegment(VP8LBitReader* const br) {
+  const VP8InputSegment* const next = br->seg_->next_;
+  if (next == NULL) return 0;
+  br->seg_ = next;
+  br->buf_ = next->data_;
+  br->len_ = next->size_;
+  br->pos_ = 0;
+  return 1;
+}
+
 // If not at EOS, reload up to VP8L_LBITS byte-by-byte
 static void ShiftBytes(VP8LBitReader* const br) {
   while (br->bit_pos_ >= 8 && br->pos_ < br->len_) {
@@ -184,11 +268,31 @@ static void ShiftBytes(VP8LBitReader* const br) {
     ++br->pos_;
     br->bit_pos_ -= 8;
   }
+  if (br->bit_pos_ >= 8 && br->seg_ != NULL && NextLSegment(br)) {
+    ShiftBytes(br);
+    return;
+  }
   if (VP8LIsEndOfStream(br)) {
     VP8LSetEndOfStream(br);
   }
 }
 
+void VP8LInitSegmentBitReader(VP8LBitReader* const br,
+                              const VP8InputSegment* const seg,
+                              size_t start_pos) {
+  assert(br != NULL);
+  assert(seg != NULL);
+  br->seg_ = VP8FindSegment(seg, start_pos);
+  br->buf_ = br->seg_->data_;
+  br->len_ = br->seg_->size_;
+  br->pos_ = start_pos - br->seg_->offset_;
+  assert(br->pos_ <= br->len_);
+  br->val_ = 0;
+  br->bit_pos_ = VP8L_LBITS;   // empty window, filled below
+  br->eos_ = 0;
+  ShiftBytes(br);
+}
+
 void VP8LDoFillBitWindow(VP8LBitReader* const br) {
   assert(br->bit_pos_ >= VP8L_WBITS);
 #if defined(VP8L_USE_FAST_LOAD)
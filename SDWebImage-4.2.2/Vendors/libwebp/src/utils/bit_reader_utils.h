@@ -64,6 +64,30 @@ typedef uint32_t bit_t;
 
 typedef uint32_t range_t;
 
+//------------------------------------------------------------------------------
+// Input segments
+
+// Input that is not contiguous in memory can be described as a chain of
+// segments. Bit readers initialized with VP8InitSegmentBitReader() or
+// VP8LInitSegmentBitReader() move on to the next segment when reaching the
+// end of the current one, including segments linked after initialization.
+typedef struct VP8InputSegment VP8InputSegment;
+struct VP8InputSegment {
+  const uint8_t* data_;        // segment bytes
+  size_t size_;                // number of bytes in data_ (non-zero)
+  size_t offset_;              // position of data_[0] in the whole input
+  VP8InputSegment* next_;      // next segment, or NULL if not available yet
+};
+
+// Returns the segment holding the byte at position 'pos', searching forward
+// from 'seg'. If 'pos' is past the last segment, the last one is returned.
+const VP8InputSegment* VP8FindSegment(const VP8InputSegment* seg, size_t pos);
+
+// Copies 'size' bytes starting at position 'pos' into 'dst'. Returns false
+// if the segments following 'seg' don't hold that many bytes.
+int VP8CopySegmentBytes(const VP8InputSegment* seg, size_t pos,
+                        uint8_t* dst, size_t size);
+
 //------------------------------------------------------------------------------
 // Bitreader
 
@@ -78,11 +102,19 @@ struct VP8BitReader {
   const uint8_t* buf_end_;    // end of read buffer
   const uint8_t* buf_max_;    // max packed-read position on buffer
   int eof_;                   // true if input is exhausted
+  // segmented input (seg_ is NULL for a flat buffer)
+  const VP8InputSegment* seg_;  // segment holding buf_
+  size_t end_pos_;            // input position where the data to read ends
 };
 
 // Initialize the bit reader and the boolean decoder.
 void VP8InitBitReader(VP8BitReader* const br,
                       const uint8_t* const start, size_t size);
+// Same as VP8InitBitReader(), but reads the data in [start_pos, end_pos) from
+// the chain of segments starting at 'seg'.
+void VP8InitSegmentBitReader(VP8BitReader* const br,
+                             const VP8InputSegment* const seg,
+                             size_t start_pos, size_t end_pos);
 // Sets the working read buffer.
 void VP8BitReaderSetBuffer(VP8BitReader* const br,
                            const uint8_t* const start, size_t size);
@@ -125,12 +157,19 @@ typedef struct {
   size_t         pos_;        // byte position in buf_
   int            bit_pos_;    // current bit-reading position in val_
   int            eos_;        // true if a bit was read past the end of buffer
+  const VP8InputSegment* seg_;  // segment holding buf_, or NULL
 } VP8LBitReader;
 
 void VP8LInitBitReader(VP8LBitReader* const br,
                        const uint8_t* const start,
                        size_t length);
 
+// Same as VP8LInitBitReader(), but reads from the chain of segments starting
+// at 'seg', from position 'start_pos' on.
+void VP8LInitSegmentBitReader(VP8LBitReader* const br,
+                              const VP8InputSegment* const seg,
+                              size_t start_pos);
+
 //  Sets a new data buffer.
 void VP8LBitReaderSetBuffer(VP8LBitReader* const br,
                             const uint8_t* const buffer, size_t length);
@@ -23,6 +23,39 @@
 //------------------------------------------------------------------------------
 // VP8BitWriter
 
+// Chunked mode: seals all the bytes of buf_ but the last one, which may still
+// receive a carry (see Flush()), and moves on to a new chunk. No data is copied
+// apart from this last byte.
+static int BitWriterSeal(VP8BitWriter* const bw, size_t extra_size) {
+  VP8BitWriterChunk* const chunk =
+      (VP8BitWriterChunk*)WebPSafeMalloc(1ULL, sizeof(*chunk));
+  size_t new_size = bw->chunk_size_;
+  uint8_t* new_buf;
+  if (new_size <= extra_size) new_size = extra_size + 1;
+  new_buf = (uint8_t*)WebPSafeMalloc(1ULL, new_size);
+  if (chunk == NULL || new_buf == NULL) {
+    WebPSafeFree(chunk);
+    WebPSafeFree(new_buf);
+    bw->error_ = 1;
+    return 0;
+  }
+  chunk->next_ = NULL;
+  chunk->buf_ = bw->buf_;
+  chunk->size_ = bw->pos_ - 1;
+  if (bw->last_chunk_ != NULL) {
+    bw->last_chunk_->next_ = chunk;
+  } else {
+    bw->chunks_ = chunk;
+  }
+  bw->last_chunk_ = chunk;
+  bw->sealed_size_ += chunk->size_;
+  new_buf[0] = bw->buf_[bw->pos_ - 1];
+  bw->buf_ = new_buf;
+  bw->pos_ = 1;
+  bw->max_pos_ = new_size;
+  return 1;
+}
+
 static int BitWriterResize(VP8BitWriter* const bw, size_t extra_size) {
   uint8_t* new_buf;
   size_t new_size;
@@ -33,6 +66,7 @@ static int BitWriterResize(VP8BitWriter* const bw, size_t extra_size) {
     return 0;
   }
   if (needed_size <= bw->max_pos_) return 1;
+  if (bw->chunk_size_ > 0 && bw->pos_ > 1) return BitWriterSeal(bw, extra_size);
   // If the following line wraps over 32bit, the test just after will catch it.
   new_size = 2 * bw->max_pos_;
   if (new_size < needed_size) new_size = needed_size;
@@ -59,10 +93,11 @@ static void Flush(VP8BitWriter* const bw) {
   bw->value_ -= bits << s;
   bw->nb_bits_ -= 8;
   if ((bits & 0xff) != 0xff) {
-    size_t pos = bw->pos_;
+    size_t pos;
     if (!BitWriterResize(bw, bw->run_ + 1)) {
       return;
     }
+    pos = bw->pos_;   // read after the resize, which may have sealed a chunk
     if (bits & 0x100) {  // overflow -> propagate carry over pending 0xff's
       if (pos > 0) bw->buf_[pos - 1]++;
     }
@@ -168,9 +203,20 @@ int VP8BitWriterInit(VP8BitWriter* const bw, size_t expected_size) {
   bw->max_pos_ = 0;
   bw->error_   = 0;
   bw->buf_     = NULL;
+  bw->chunk_size_  = 0;
+  bw->sealed_size_ = 0;
+  bw->chunks_      = NULL;
+  bw->last_chunk_  = NULL;
   return (expected_size > 0) ? BitWriterResize(bw, expected_size) : 1;
 }
 
+int VP8BitWriterInitChunked(VP8BitWriter* const bw, size_t chunk_size) {
+  assert(chunk_size > 1);
+  if (!VP8BitWriterInit(bw, chunk_size)) return 0;
+  bw->chunk_size_ = chunk_size;
+  return 1;
+}
+
 uint8_t* VP8BitWriterFinish(VP8BitWriter* const bw) {
   VP8PutBits(bw, 0, 9 - bw->nb_bits_);
   bw->nb_bits_ = 0;   // pad with zeroes
@@ -190,11 +236,33 @@ int VP8BitWriterAppend(VP8BitWriter* const bw,
 
 void VP8BitWriterWipeOut(VP8BitWriter* const bw) {
   if (bw != NULL) {
+    while (bw->chunks_ != NULL) {
+      VP8BitWriterChunk* const chunk = bw->chunks_;
+      bw->chunks_ = chunk->next_;
+      WebPSafeFree(chunk->buf_);
+      WebPSafeFree(chunk);
+    }
     WebPSafeFree(bw->buf_);
     memset(bw, 0, sizeof(*bw));
   }
 }
 
+int VP8BitWriterDrain(VP8BitWriter* const bw,
+                      VP8BitWriterEmitFunc emit, void* const opaque) {
+  int ok = 1;
+  while (bw->chunks_ != NULL) {
+    VP8BitWriterChunk* const chunk = bw->chunks_;
+    ok = ok && emit(chunk->buf_, chunk->size_, opaque);
+    bw->chunks_ = chunk->next_;
+    WebPSafeFree(chunk->buf_);
+    WebPSafeFree(chunk);
+  }
+  bw->last_chunk_ = NULL;
+  if (bw->pos_ > 0) ok = ok && emit(bw->buf_, bw->pos_, opaque);
+  VP8BitWriterWipeOut(bw);
+  return ok;
+}
+
 //------------------------------------------------------------------------------
 // VP8LBitWriter
 
@@ -246,6 +314,35 @@ void VP8LBitWriterWipeOut(VP8LBitWriter* const bw) {
   }
 }
 
+int VP8LBitWriterClone(const VP8LBitWriter* const src,
+                       VP8LBitWriter* const dst) {
+  const size_t current_size = src->cur_ - src->buf_;
+  assert(src->cur_ >= src->buf_ && src->cur_ <= src->end_);
+  dst->cur_ = dst->buf_;
+  if (!VP8LBitWriterResize(dst, current_size)) return 0;
+  if (current_size > 0) memcpy(dst->buf_, src->buf_, current_size);
+  dst->bits_ = src->bits_;
+  dst->used_ = src->used_;
+  dst->error_ = src->error_;
+  dst->cur_ = dst->buf_ + current_size;
+  return 1;
+}
+
+void VP8LBitWriterReset(const VP8LBitWriter* const bw_init,
+                        VP8LBitWriter* const bw) {
+  bw->bits_ = bw_init->bits_;
+  bw->used_ = bw_init->used_;
+  bw->cur_ = bw->buf_ + (bw_init->cur_ - bw_init->buf_);
+  assert(bw->cur_ <= bw->end_);
+  bw->error_ = bw_init->error_;
+}
+
+void VP8LBitWriterSwap(VP8LBitWriter* const src, VP8LBitWriter* const dst) {
+  const VP8LBitWriter tmp = *src;
+  *src = *dst;
+  *dst = tmp;
+}
+
 void VP8LPutBitsFlushBits(VP8LBitWriter* const bw) {
   // If needed, make some room by flushing some bits out.
   if (bw->cur_ + VP8L_WRITER_BYTES > bw->end_) {
@@ -23,6 +23,14 @@ extern "C" {
 //------------------------------------------------------------------------------
 // Bit-writing
 
+// Bytes already coded, sealed in chunked mode (see VP8BitWriterInitChunked).
+typedef struct VP8BitWriterChunk VP8BitWriterChunk;
+struct VP8BitWriterChunk {
+  VP8BitWriterChunk* next_;
+  uint8_t* buf_;
+  size_t size_;
+};
+
 typedef struct VP8BitWriter VP8BitWriter;
 struct VP8BitWriter {
   int32_t  range_;      // range-1
@@ -33,12 +41,30 @@ struct VP8BitWriter {
   size_t   pos_;
   size_t   max_pos_;
   int      error_;      // true in case of error
+  // chunked mode only:
+  size_t   chunk_size_;           // size of the new chunks (0 = not chunked)
+  size_t   sealed_size_;          // total size of the sealed chunks
+  VP8BitWriterChunk* chunks_;     // sealed chunks, oldest first
+  VP8BitWriterChunk* last_chunk_;
 };
 
 // Initialize the object. Allocates some initial memory based on expected_size.
 int VP8BitWriterInit(VP8BitWriter* const bw, size_t expected_size);
+// Same, but the output is kept as a list of chunks of about 'chunk_size'
+// bytes instead of being re-allocated (and copied) as it grows. The bytes
+// that can no longer be modified are sealed in 'chunks_', and buf_ only holds
+// the most recent ones. VP8BitWriterBuf() is then not the whole bitstream:
+// use VP8BitWriterDrain() to get it.
+int VP8BitWriterInitChunked(VP8BitWriter* const bw, size_t chunk_size);
 // Finalize the bitstream coding. Returns a pointer to the internal buffer.
 uint8_t* VP8BitWriterFinish(VP8BitWriter* const bw);
+// Passes the whole bitstream to 'emit', in order, releasing each chunk as
+// soon as it has been handed over. Stops at the first failing call. The object
+// is wiped out in all cases. Returns false if a call to 'emit' failed.
+typedef int (*VP8BitWriterEmitFunc)(const uint8_t* data, size_t size,
+                                    void* const opaque);
+int VP8BitWriterDrain(VP8BitWriter* const bw,
+                      VP8BitWriterEmitFunc emit, void* const opaque);
 // Release any pending memory and zeroes the object. Not a mandatory call.
 // Only useful in case of error, when the internal buffer hasn't been grabbed!
 void VP8BitWriterWipeOut(VP8BitWriter* const bw);
@@ -55,16 +81,16 @@ int VP8BitWriterAppend(VP8BitWriter* const bw,
 // return approximate write position (in bits)
 static WEBP_INLINE uint64_t VP8BitWriterPos(const VP8BitWriter* const bw) {
   const uint64_t nb_bits = 8 + bw->nb_bits_;   // bw->nb_bits_ is <= 0, note
-  return (bw->pos_ + bw->run_) * 8 + nb_bits;
+  return (bw->sealed_size_ + bw->pos_ + bw->run_) * 8 + nb_bits;
 }
 
 // Returns a pointer to the internal buffer.
 static WEBP_INLINE uint8_t* VP8BitWriterBuf(const VP8BitWriter* const bw) {
   return bw->buf_;
 }
-// Returns the size of the internal buffer.
+// Returns the size of the bitstream (including the sealed chunks, if any).
 static WEBP_INLINE size_t VP8BitWriterSize(const VP8BitWriter* const bw) {
-  return bw->pos_;
+  return bw->sealed_size_ + bw->pos_;
 }
 
 //------------------------------------------------------------------------------
@@ -110,6 +136,16 @@ int VP8LBitWriterInit(VP8LBitWriter* const bw, size_t expected_size);
 uint8_t* VP8LBitWriterFinish(VP8LBitWriter* const bw);
 // Release any pending memory and zeroes the object.
 void VP8LBitWriterWipeOut(VP8LBitWriter* const bw);
+// Copies the written bits of 'src' into 'dst', which must be initialized.
+// Returns false in case of memory allocation error.
+int VP8LBitWriterClone(const VP8LBitWriter* const src,
+                       VP8LBitWriter* const dst);
+// Rewinds 'bw' to the position 'bw_init' was at. The bytes written up to this
+// position must be present in 'bw' too, e.g. because 'bw' is a clone.
+void VP8LBitWriterReset(const VP8LBitWriter* const bw_init,
+                        VP8LBitWriter* const bw);
+// Swaps the memory and state of two bit writers.
+void VP8LBitWriterSwap(VP8LBitWriter* const src, VP8LBitWriter* const dst);
 
 // Internal function for VP8LPutBits flushing 32 bits from the written state.
 void VP8LPutBitsFlushBits(VP8LBitWriter* const bw);
@@ -47,6 +47,7 @@ typedef struct {
 #else  // !_WIN32
 
 #include <pthread.h>
+#include <sys/time.h>   // for gettimeofday()
 
 #endif  // _WIN32
 
@@ -354,3 +355,328 @@ const WebPWorkerInterface* WebPGetWorkerInterface(void) {
 }
 
 //------------------------------------------------------------------------------
+// Pooled worker interface
+//
+// Pending jobs are stored in a bounded FIFO, shared by all the threads of the
+// pool. For such workers, impl_ is only used to signal the end of the job to
+// the thread waiting in Sync(). Its thread_ field is unused.
+
+#define POOL_MAX_THREADS 64
+#define POOL_DEFAULT_QUEUE_SIZE 256
+
+#ifdef WEBP_USE_THREAD
+
+typedef struct {
+  WebPWorker* worker_;
+  uint64_t launch_time_;   // in microseconds
+} WebPPoolJob;
+
+typedef struct {
+  pthread_mutex_t mutex_;
+  pthread_cond_t  condition_;   // signaled when a job is queued or at exit
+  pthread_t       threads_[POOL_MAX_THREADS];
+  int             num_threads_;
+  int             work_stealing_;
+  int             done_;         // true when the threads should exit
+  WebPPoolJob*    jobs_;         // circular buffer of pending jobs
+  int             queue_size_;
+  int             first_job_;
+  int             num_pending_;
+  WebPWorkerPoolStats stats_;
+} WebPWorkerPool;
+
+static WebPWorkerPool* g_pool = NULL;
+
+static uint64_t GetTimeUs(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+         (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+// Removes the job at position 'n' in the queue. Must be called with the pool
+// mutex held.
+static WebPWorker* PoolRemoveJob(WebPWorkerPool* const pool, int n) {
+  const int size = pool->queue_size_;
+  const int pos = (pool->first_job_ + n) % size;
+  const WebPPoolJob job = pool->jobs_[pos];
+  const uint64_t latency = GetTimeUs() - job.launch_time_;
+  if (n == 0) {
+    pool->first_job_ = (pool->first_job_ + 1) % size;
+  } else {   // shift the following jobs
+    int i;
+    for (i = n; i + 1 < pool->num_pending_; ++i) {
+      pool->jobs_[(pool->first_job_ + i) % size] =
+          pool->jobs_[(pool->first_job_ + i + 1) % size];
+    }
+  }
+  --pool->num_pending_;
+  pool->stats_.total_latency_us += latency;
+  if (latency > pool->stats_.max_latency_us) {
+    pool->stats_.max_latency_us = latency;
+  }
+  return job.worker_;
+}
+
+// Runs the job and signals its completion to the thread waiting in Sync().
+static void PoolRunJob(WebPWorker* const worker) {
+  Execute(worker);
+  pthread_mutex_lock(&worker->impl_->mutex_);
+  worker->status_ = OK;
+  pthread_cond_signal(&worker->impl_->condition_);
+  pthread_mutex_unlock(&worker->impl_->mutex_);
+}
+
+static THREADFN PoolThreadLoop(void* ptr) {
+  WebPWorkerPool* const pool = (WebPWorkerPool*)ptr;
+  while (1) {
+    WebPWorker* worker;
+    pthread_mutex_lock(&pool->mutex_);
+    while (pool->num_pending_ == 0 && !pool->done_) {
+      pthread_cond_wait(&pool->condition_, &pool->mutex_);
+    }
+    if (pool->num_pending_ == 0) {   // done, and no more pending jobs
+      pthread_mutex_unlock(&pool->mutex_);
+      break;
+    }
+    worker = PoolRemoveJob(pool, 0);
+    pthread_mutex_unlock(&pool->mutex_);
+    PoolRunJob(worker);
+  }
+  return THREAD_RETURN(NULL);    // Thread is finished
+}
+
+// Removes 'worker' from the queue if it's still pending (or the first pending
+// job if 'worker' is NULL) and runs it in the calling thread. Returns false if
+// no job was found.
+static int PoolRunPendingJob(WebPWorkerPool* const pool,
+                             const WebPWorker* const worker) {
+  WebPWorker* job = NULL;
+  pthread_mutex_lock(&pool->mutex_);
+  if (worker == NULL) {
+    if (pool->num_pending_ > 0) job = PoolRemoveJob(pool, 0);
+  } else {
+    int n;
+    for (n = 0; n < pool->num_pending_; ++n) {
+      const int pos = (pool->first_job_ + n) % pool->queue_size_;
+      if (pool->jobs_[pos].worker_ == worker) {
+        job = PoolRemoveJob(pool, n);
+        break;
+      }
+    }
+  }
+  if (job != NULL) ++pool->stats_.num_stolen;
+  pthread_mutex_unlock(&pool->mutex_);
+  if (job == NULL) return 0;
+  PoolRunJob(job);
+  return 1;
+}
+
+static int PoolIsWorking(WebPWorker* const worker) {
+  int working;
+  pthread_mutex_lock(&worker->impl_->mutex_);
+  working = (worker->status_ == WORK);
+  pthread_mutex_unlock(&worker->impl_->mutex_);
+  return working;
+}
+
+#endif  // WEBP_USE_THREAD
+
+static int PoolSync(WebPWorker* const worker) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerPool* const pool = g_pool;
+  if (worker->impl_ != NULL && pool != NULL) {
+    // If the job is still pending, it's faster to run it right away. This also
+    // guarantees progress when all the threads of the pool are waiting.
+    if (!PoolRunPendingJob(pool, worker) && pool->work_stealing_) {
+      while (PoolIsWorking(worker) && PoolRunPendingJob(pool, NULL)) {}
+    }
+    pthread_mutex_lock(&worker->impl_->mutex_);
+    while (worker->status_ == WORK) {
+      pthread_cond_wait(&worker->impl_->condition_, &worker->impl_->mutex_);
+    }
+    pthread_mutex_unlock(&worker->impl_->mutex_);
+  }
+#endif
+  assert(worker->status_ <= OK);
+  return !worker->had_error;
+}
+
+static int PoolReset(WebPWorker* const worker) {
+  int ok = 1;
+  worker->had_error = 0;
+  if (worker->status_ < OK) {
+#ifdef WEBP_USE_THREAD
+    worker->impl_ = (WebPWorkerImpl*)WebPSafeCalloc(1, sizeof(*worker->impl_));
+    if (worker->impl_ == NULL) {
+      return 0;
+    }
+    if (pthread_mutex_init(&worker->impl_->mutex_, NULL)) {
+      goto Error;
+    }
+    if (pthread_cond_init(&worker->impl_->condition_, NULL)) {
+      pthread_mutex_destroy(&worker->impl_->mutex_);
+ Error:
+      WebPSafeFree(worker->impl_);
+      worker->impl_ = NULL;
+      return 0;
+    }
+#endif
+    worker->status_ = OK;
+  } else if (worker->status_ > OK) {
+    ok = PoolSync(worker);
+  }
+  assert(!ok || (worker->status_ == OK));
+  return ok;
+}
+
+static void PoolLaunch(WebPWorker* const worker) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerPool* const pool = g_pool;
+  int queued = 0;
+  if (worker->impl_ != NULL && pool != NULL) {
+    pthread_mutex_lock(&worker->impl_->mutex_);
+    worker->status_ = WORK;
+    pthread_mutex_unlock(&worker->impl_->mutex_);
+    pthread_mutex_lock(&pool->mutex_);
+    ++pool->stats_.num_jobs;
+    if (pool->num_pending_ < pool->queue_size_) {
+      const int pos = (pool->first_job_ + pool->num_pending_) % pool->queue_size_;
+      pool->jobs_[pos].worker_ = worker;
+      pool->jobs_[pos].launch_time_ = GetTimeUs();
+      ++pool->num_pending_;
+      if (pool->num_pending_ > pool->stats_.max_queue_depth) {
+        pool->stats_.max_queue_depth = pool->num_pending_;
+      }
+      pthread_cond_signal(&pool->condition_);
+      queued = 1;
+    } else {
+      ++pool->stats_.num_inlined;
+    }
+    pthread_mutex_unlock(&pool->mutex_);
+    if (!queued) PoolRunJob(worker);
+    return;
+  }
+#endif
+  Execute(worker);
+}
+
+static void PoolEnd(WebPWorker* const worker) {
+  if (worker->status_ >= OK) {
+    PoolSync(worker);
+#ifdef WEBP_USE_THREAD
+    if (worker->impl_ != NULL) {
+      pthread_mutex_destroy(&worker->impl_->mutex_);
+      pthread_cond_destroy(&worker->impl_->condition_);
+      WebPSafeFree(worker->impl_);
+      worker->impl_ = NULL;
+    }
+#endif
+    worker->status_ = NOT_OK;
+  }
+  assert(worker->impl_ == NULL);
+}
+
+static const WebPWorkerInterface g_pool_interface = {
+  Init, PoolReset, PoolSync, PoolLaunch, Execute, PoolEnd
+};
+
+const WebPWorkerInterface* WebPGetWorkerPoolInterface(void) {
+  return &g_pool_interface;
+}
+
+int WebPWorkerPoolInit(const WebPWorkerPoolOptions* const options) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerPool* pool;
+  int n;
+  if (options == NULL || g_pool != NULL) return 0;
+  if (options->num_threads < 1 || options->num_threads > POOL_MAX_THREADS) {
+    return 0;
+  }
+  if (options->queue_size < 0) return 0;
+
+  pool = (WebPWorkerPool*)WebPSafeCalloc(1ULL, sizeof(*pool));
+  if (pool == NULL) return 0;
+  pool->queue_size_ = (options->queue_size > 0) ? options->queue_size
+                                                : POOL_DEFAULT_QUEUE_SIZE;
+  pool->jobs_ = (WebPPoolJob*)WebPSafeMalloc(pool->queue_size_,
+                                             sizeof(*pool->jobs_));
+  if (pool->jobs_ == NULL) goto Error;
+  if (pthread_mutex_init(&pool->mutex_, NULL)) goto Error;
+  if (pthread_cond_init(&pool->condition_, NULL)) {
+    pthread_mutex_destroy(&pool->mutex_);
+    goto Error;
+  }
+  pool->work_stealing_ = options->work_stealing;
+  for (n = 0; n < options->num_threads; ++n) {
+    if (pthread_create(&pool->threads_[n], NULL, PoolThreadLoop, pool)) break;
+    ++pool->num_threads_;
+  }
+  pool->stats_.num_threads = pool->num_threads_;
+  g_pool = pool;
+  if (pool->num_threads_ != options->num_threads) {
+    WebPWorkerPoolEnd();
+    return 0;
+  }
+  return 1;
+
+ Error:
+  WebPSafeFree(pool->jobs_);
+  WebPSafeFree(pool);
+  return 0;
+#else
+  (void)options;
+  return 0;
+#endif
+}
+
+void WebPWorkerPoolEnd(void) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerPool* const pool = g_pool;
+  int n;
+  if (pool == NULL) return;
+  pthread_mutex_lock(&pool->mutex_);
+  pool->done_ = 1;
+  pthread_mutex_unlock(&pool->mutex_);
+  for (n = 0; n < pool->num_threads_; ++n) {
+    pthread_mutex_lock(&pool->mutex_);
+    pthread_cond_signal(&pool->condition_);
+    pthread_mutex_unlock(&pool->mutex_);
+  }
+  for (n = 0; n < pool->num_threads_; ++n) {
+    pthread_join(pool->threads_[n], NULL);
+  }
+  pthread_mutex_destroy(&pool->mutex_);
+  pthread_cond_destroy(&pool->condition_);
+  WebPSafeFree(pool->jobs_);
+  WebPSafeFree(pool);
+  g_pool = NULL;
+#endif
+}
+
+int WebPWorkerPoolGetStats(WebPWorkerPoolStats* const stats) {
+#ifdef WEBP_USE_THREAD
+  WebPWorkerPool* const pool = g_pool;
+  if (stats == NULL || pool == NULL) return 0;
+  pthread_mutex_lock(&pool->mutex_);
+  *stats = pool->stats_;
+  stats->queue_depth = pool->num_pending_;
+  pthread_mutex_unlock(&pool->mutex_);
+  return 1;
+#else
+  (void)stats;
+  return 0;
+#endif
+}
+
+#undef POOL_MAX_THREADS
+#undef POOL_DEFAULT_QUEUE_SIZE
+
+//------------------------------------------------------------------------------
@@ -84,6 +84,53 @@ WEBP_EXTERN(int) WebPSetWorkerInterface(
 // Retrieve the currently set thread worker interface.
 WEBP_EXTERN(const WebPWorkerInterface*) WebPGetWorkerInterface(void);
 
+//------------------------------------------------------------------------------
+// Pooled worker interface
+//
+// Instead of spawning one thread per WebPWorker, the workers using this
+// interface share a process-wide fixed set of threads. Launch() only queues
+// the job, and the first idle thread of the pool picks it up. Typical use:
+//   WebPWorkerPoolOptions options = { 4, 64, 0 };
+//   if (WebPWorkerPoolInit(&options)) {
+//     WebPSetWorkerInterface(WebPGetWorkerPoolInterface());
+//   }
+
+typedef struct {
+  int num_threads;    // number of threads in the pool, in [1..64]
+  int queue_size;     // maximum number of pending jobs (0 = default). When the
+                      // queue is full, Launch() runs the job in the caller.
+  int work_stealing;  // if true, a thread waiting in Sync() for a job which is
+                      // already running executes pending jobs meanwhile.
+} WebPWorkerPoolOptions;
+
+typedef struct {
+  int num_threads;            // number of threads in the pool
+  int queue_depth;            // number of jobs currently pending
+  int max_queue_depth;        // maximum number of pending jobs observed
+  uint64_t num_jobs;          // total number of jobs launched
+  uint64_t num_inlined;       // jobs run by Launch() because queue was full
+  uint64_t num_stolen;        // jobs run by a thread waiting in Sync()
+  uint64_t total_latency_us;  // cumulated time spent by jobs in the queue
+  uint64_t max_latency_us;    // maximum time spent by a job in the queue
+} WebPWorkerPoolStats;
+
+// Spawns the threads of the pool. Returns false in case of error, of invalid
+// options, if the pool is already running or if threads are not available.
+// This function is not thread-safe.
+WEBP_EXTERN(int) WebPWorkerPoolInit(const WebPWorkerPoolOptions* const options);
+
+// Finishes the pending jobs and terminates the threads of the pool. It must not
+// be called while a worker is still using the pool interface.
+WEBP_EXTERN(void) WebPWorkerPoolEnd(void);
+
+// Retrieve the pooled interface, to be installed with WebPSetWorkerInterface().
+// Until WebPWorkerPoolInit() is called, jobs are executed by Launch() itself.
+WEBP_EXTERN(const WebPWorkerInterface*) WebPGetWorkerPoolInterface(void);
+
+// Copies a snapshot of the pool statistics into 'stats'. Returns false if the
+// pool is not running or 'stats' is NULL.
+WEBP_EXTERN(int) WebPWorkerPoolGetStats(WebPWorkerPoolStats* const stats);
+
 //------------------------------------------------------------------------------
 
 #ifdef __cplusplus
@@ -20,7 +20,7 @@
 extern "C" {
 #endif
 
-#define WEBP_DECODER_ABI_VERSION 0x0208    // MAJOR(8b) + MINOR(8b)
+#define WEBP_DECODER_ABI_VERSION 0x0209    // MAJOR(8b) + MINOR(8b)
 
 // Note: forward declaring enumerations is not allowed in (strict) C and C++,
 // the types are left here for reference.
@@ -33,6 +33,7 @@ typedef struct WebPIDecoder WebPIDecoder;
 typedef struct WebPBitstreamFeatures WebPBitstreamFeatures;
 typedef struct WebPDecoderOptions WebPDecoderOptions;
 typedef struct WebPDecoderConfig WebPDecoderConfig;
+typedef struct WebPDecoderContext WebPDecoderContext;
 
 // Return the decoder's version number, packed in hexadecimal using 8bits for
 // each of major/minor/revision. E.g: v2.5.7 is 0x020507.
@@ -335,6 +336,25 @@ WEBP_EXTERN(VP8StatusCode) WebPIAppend(
 WEBP_EXTERN(VP8StatusCode) WebPIUpdate(
     WebPIDecoder* idec, const uint8_t* data, size_t data_size);
 
+// Called by the incremental decoder when it no longer needs a chunk of data
+// passed to WebPIAppendChunk().
+typedef void (*WebPIReleaseChunkFunc)(const uint8_t* data, size_t data_size,
+                                      void* user_data);
+
+// A variant of WebPIAppend() that doesn't copy 'data': the chunks are kept in
+// a list and read in place. Only the headers and partition #0 of a lossy
+// image are gathered into internal memory, and only if they span several
+// chunks. If 'release' is not NULL, the decoder takes ownership of 'data' and
+// calls 'release(data, data_size, user_data)' exactly once, as soon as the
+// chunk has been consumed and at the latest in WebPIDelete(). This also
+// happens before returning if the chunk could not be added. Otherwise, 'data'
+// must remain valid until the decoding is finished or WebPIDelete() is called.
+// Calls to WebPIAppendChunk() can't be mixed with WebPIAppend() or
+// WebPIUpdate() on the same decoder.
+WEBP_EXTERN(VP8StatusCode) WebPIAppendChunk(
+    WebPIDecoder* idec, const uint8_t* data, size_t data_size,
+    WebPIReleaseChunkFunc release, void* user_data);
+
 // Returns the RGB/A image decoded so far. Returns NULL if output params
 // are not initialized yet. The RGB/A output type corresponds to the colorspace
 // specified during call to WebPINewDecoder() or WebPINewRGB().
@@ -432,6 +452,12 @@ static WEBP_INLINE VP8StatusCode WebPGetFeatures(
 }
 
 // Decoding options
+// Note: for thumbnails, the fastest path is 'use_scaling' to the final size,
+// together with 'bypass_filtering' (and 'no_fancy_upsampling' for lossy).
+// Lossy pictures are still reconstructed at full size, since the intra
+// predictors need the exact neighboring samples, but the in-loop filter is
+// skipped and each row is rescaled as soon as it is decoded, without any
+// full-size output buffer.
 struct WebPDecoderOptions {
   int bypass_filtering;               // if true, skip the in-loop filtering
   int no_fancy_upsampling;            // if true, use faster pointwise upsampler
@@ -486,6 +512,37 @@ WEBP_EXTERN(WebPIDecoder*) WebPIDecode(const uint8_t* data, size_t data_size,
 WEBP_EXTERN(VP8StatusCode) WebPDecode(const uint8_t* data, size_t data_size,
                                       WebPDecoderConfig* config);
 
+//------------------------------------------------------------------------------
+// Reusable decoding context
+//
+// A WebPDecoderContext keeps the decoders' internal memory and worker threads
+// between calls, so that decoding many pictures in a row doesn't allocate
+// them again each time. The memory grows to fit the largest picture decoded
+// so far. A context must not be used by several threads at the same time.
+// Typical use:
+//
+//   WebPDecoderContext* const ctx = WebPDecoderNew();
+//   for (each picture) {
+//     WebPDecoderConfig config;
+//     WebPInitDecoderConfig(&config);
+//     ... set config.options and config.output as for WebPDecode() ...
+//     status = WebPDecodeWith(ctx, data, data_size, &config);
+//     ... use and free config.output ...
+//   }
+//   WebPDecoderDelete(ctx);
+
+// Creates a new, empty, decoding context. Returns NULL in case of memory error.
+WEBP_EXTERN(WebPDecoderContext*) WebPDecoderNew(void);
+
+// Same as WebPDecode(), using the memory kept in 'ctx'. If 'ctx' is NULL, this
+// is exactly WebPDecode().
+WEBP_EXTERN(VP8StatusCode) WebPDecodeWith(WebPDecoderContext* ctx,
+                                          const uint8_t* data, size_t data_size,
+                                          WebPDecoderConfig* config);
+
+// Releases the context and all its memory.
+WEBP_EXTERN(void) WebPDecoderDelete(WebPDecoderContext* ctx);
+
 #ifdef __cplusplus
 }    // extern "C"
 #endif
@@ -55,7 +55,7 @@
 extern "C" {
 #endif
 
-#define WEBP_DEMUX_ABI_VERSION 0x0107    // MAJOR(8b) + MINOR(8b)
+#define WEBP_DEMUX_ABI_VERSION 0x0108    // MAJOR(8b) + MINOR(8b)
 
 // Note: forward declaring enumerations is not allowed in (strict) C and C++,
 // the types are left here for reference.
@@ -248,7 +248,11 @@ struct WebPAnimDecoderOptions {
   // MODE_RGBA, MODE_BGRA, MODE_rgbA and MODE_bgrA.
   WEBP_CSP_MODE color_mode;
   int use_threads;           // If true, use multi-threaded decoding.
-  uint32_t padding[7];       // Padding for later use.
+  // Number of upcoming frames to decode ahead of time on background workers
+  // (0 = disabled, at most 16). Each look-ahead frame needs a buffer of the
+  // canvas size. Blending onto the canvas still happens in frame order.
+  int lookahead_frames;
+  uint32_t padding[6];       // Padding for later use.
 };
 
 // Internal, version-checked, entry point.
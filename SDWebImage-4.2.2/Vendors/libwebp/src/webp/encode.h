@@ -20,7 +20,7 @@
 extern "C" {
 #endif
 
-#define WEBP_ENCODER_ABI_VERSION 0x020e    // MAJOR(8b) + MINOR(8b)
+#define WEBP_ENCODER_ABI_VERSION 0x020f    // MAJOR(8b) + MINOR(8b)
 
 // Note: forward declaring enumerations is not allowed in (strict) C and C++,
 // the types are left here for reference.
@@ -32,6 +32,7 @@ typedef struct WebPConfig WebPConfig;
 typedef struct WebPPicture WebPPicture;   // main structure for I/O
 typedef struct WebPAuxStats WebPAuxStats;
 typedef struct WebPMemoryWriter WebPMemoryWriter;
+typedef struct WebPEncoderContext WebPEncoderContext;
 
 // Return the encoder's version number, packed in hexadecimal using 8bits for
 // each of major/minor/revision. E.g: v2.5.7 is 0x020507.
@@ -132,7 +133,24 @@ struct WebPConfig {
                           // JPEG compression. Generally, the output size will
                           // be similar but the degradation will be lower.
   int thread_level;       // If non-zero, try and use multi-threaded encoding.
+                          // Values in [2..16] also code the macroblock rows
+                          // of lossy pictures as a wavefront, with up to
+                          // 'thread_level' threads (rows are then spread
+                          // over the 'partitions' even with method >= 3).
+                          // With 'target_size' or 'target_PSNR' and 'pass' >
+                          // 1, they make each pass evaluate 4 qualities, on up
+                          // to 4 threads: the result does not depend on the
+                          // value in [2..16], but can differ from 0 or 1.
+                          // For lossless with method >= 5, they also make the
+                          // promising transform sets (2, or up to 5 with
+                          // method 6) be encoded on up to 'thread_level'
+                          // threads and the smallest bitstream be kept: the
+                          // output can then be smaller than with 0 or 1, and
+                          // each extra thread needs its own encoder, about
+                          // as much memory as a single-threaded encoding.
   int low_memory;         // If set, reduce memory usage (but increase CPU use).
+                          // For lossy, the bitstream is then also kept in
+                          // small chunks, released as they are written out.
 
   int near_lossless;      // Near lossless encoding [0 = max loss .. 100 = off
                           // (default)].
@@ -143,8 +161,24 @@ struct WebPConfig {
 
   int use_delta_palette;  // reserved for future lossless feature
   int use_sharp_yuv;      // if needed, use sharp (and slow) RGB->YUV conversion
-
-  uint32_t pad[2];        // padding for later use
+  int use_rate_model;     // if non-zero, with 'target_size' and 'pass' = 1,
+                          // the quality is predicted by a rate model instead
+                          // of being searched. The size of the first quarter
+                          // of the rows is measured and, if it is off by more
+                          // than 10%, the frame is coded again (at most
+                          // twice) at a corrected quality. This takes up to
+                          // 2x the time of a plain encode, much less than
+                          // 'pass' > 1, but the size is only approximate:
+                          // within 8% of the target on average, and up to 25%
+                          // below or 20% above it. Default is 0.
+  int use_tile_bands;     // if non-zero and 'thread_level' is set, the
+                          // lossless predictor and cross-color transforms are
+                          // searched by independent bands of 256 rows on
+                          // several threads. This is faster, but each band
+                          // ignores the tiles above it, so the output differs
+                          // and can be much larger (by up to 30% on pictures
+                          // with repeating content).
+                          // Default is 0: exact, sequential search.
 };
 
 // Enumerate some predefined settings for WebPConfig, depending on the type
@@ -470,6 +504,15 @@ WEBP_EXTERN(int) WebPPictureImportBGRA(
 WEBP_EXTERN(int) WebPPictureImportBGRX(
     WebPPicture* picture, const uint8_t* bgrx, int bgrx_stride);
 
+// Variants of WebPPictureImportRGB() and WebPPictureImportRGBA() converting
+// the picture to YUVA by bands of rows, using up to 'num_threads' threads.
+// The result is the same as with the single-threaded functions.
+WEBP_EXTERN(int) WebPPictureImportRGBMT(
+    WebPPicture* picture, const uint8_t* rgb, int rgb_stride, int num_threads);
+WEBP_EXTERN(int) WebPPictureImportRGBAMT(
+    WebPPicture* picture, const uint8_t* rgba, int rgba_stride,
+    int num_threads);
+
 // Converts picture->argb data to the YUV420A format. The 'colorspace'
 // parameter is deprecated and should be equal to WEBP_YUV420.
 // Upon return, picture->use_argb is set to false. The presence of real
@@ -533,6 +576,23 @@ WEBP_EXTERN(void) WebPBlendAlpha(WebPPicture* pic, uint32_t background_rgb);
 // another is provided but they both incur some loss.
 WEBP_EXTERN(int) WebPEncode(const WebPConfig* config, WebPPicture* picture);
 
+// Encoding context, that can be re-used across calls to WebPEncodeWithContext()
+// in order to save the set-up cost of the lossy encoder (memory allocation and
+// cost tables), which dominates the encoding time of small pictures.
+// A context must not be used by several encoding calls at the same time.
+
+// Returns a new context, or NULL in case of memory error.
+WEBP_EXTERN(WebPEncoderContext*) WebPEncoderContextNew(void);
+// Releases the context and all the memory it holds.
+WEBP_EXTERN(void) WebPEncoderContextDelete(WebPEncoderContext* context);
+// Same as WebPEncode(), but re-using the memory and cost tables held by
+// 'context' (which can be NULL) for lossy encoding. The output is identical.
+// The memory is kept until the context is deleted: it is only re-allocated
+// when a larger picture is encoded.
+WEBP_EXTERN(int) WebPEncodeWithContext(WebPEncoderContext* context,
+                                       const WebPConfig* config,
+                                       WebPPicture* picture);
+
 //------------------------------------------------------------------------------
 
 #ifdef __cplusplus